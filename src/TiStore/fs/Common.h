@@ -16,6 +16,16 @@
 #define CACHE_LINE_SIZE     64
 #endif
 
+// Prefetch the cache line of addr for a read, to hide the latency of a miss.
+#if defined(_MSC_VER)
+#include <xmmintrin.h>
+#define TISTORE_PREFETCH(addr)  _mm_prefetch((const char *)(addr), _MM_HINT_T0)
+#elif defined(__GNUC__) || defined(__clang__)
+#define TISTORE_PREFETCH(addr)  __builtin_prefetch((const void *)(addr), 0, 3)
+#else
+#define TISTORE_PREFETCH(addr)  ((void)(addr))
+#endif
+
 #ifndef MAX_PATH
 #ifndef PATH_MAX
 #define MAX_PATH    260
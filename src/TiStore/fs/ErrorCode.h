@@ -6,6 +6,10 @@ class error_code {
 public:
     enum {
         error_first,
+        err_not_supported = -6,
+        err_not_found = -5,
+        err_corruption = -4,
+        err_io_error = -3,
         out_of_memory = -2,
         err_failed = -1,
         no_error = 0,
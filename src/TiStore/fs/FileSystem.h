@@ -1,9 +1,21 @@
 #pragma once
 
 #include "TiStore/basic/cstdint"
+#include "TiStore/basic/cstdssize"
 #include "TiStore/fs/Common.h"
 #include "TiStore/fs/MetaData.h"
 
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#if !(defined(_WIN32) || defined(WIN32) || defined(OS_WINDOWS) || defined(__WINDOWS__))
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#endif
+
 namespace TiStore {
 namespace fs {
 
@@ -39,6 +51,12 @@ enum fs_stat_t {
 
 typedef Inode * tsfs_fd;
 
+//
+// A file: the metadata is kept by MetaData, the data is stored in a native
+// file of the same name, until TiFS has its own block storage.
+//
+// read() and write() are not thread safe, the owner serializes them.
+//
 class File {
 private:
     native_fd native_fd_;
@@ -63,7 +81,6 @@ public:
     }
 
     File(const char * filename, int mode = FS_MARK_DEFAULT) : File() {
-        std_strcpy(filename_, filename);
         open(filename, mode);
     }
 
@@ -71,22 +88,136 @@ public:
         close();
     }
 
-    bool is_open() {
-        return ((flag_ | FS_STAT_OPEN) != 0);
+    bool is_open() const {
+        return ((flag_ & FS_STAT_OPEN) != 0);
     }
 
+    //
+    // FS_MARK_WRITE creates the file if it doesn't exist, FS_MARK_TRUNC empties it,
+    // and with FS_MARK_APPENDTOEND every write() goes to the end of the file.
+    //
     bool open(const char * filename, int mode = FS_MARK_DEFAULT) {
+        assert(filename != nullptr);
+        if (is_open())
+            close();
+        if (::strlen(filename) >= sizeof(filename_))
+            return false;
+        std_strcpy(filename_, filename);
+        mode_ = (uint32_t)mode;
+
         int err_code;
-        if (fd_ == null_fd)
+        if (fd_ == nullptr)
             fd_ = MetaData::get().open_file(this, filename, err_code);
+        if (fd_ == nullptr)
+            return false;
+
+        if (!open_native(filename, mode))
+            return false;
+
+        size_ = (size_t)size_native();
+        offset_ = ((mode & FS_MARK_APPENDTOEND) != 0) ? size_ : 0;
+        flag_ = FS_ADD_MASK(flag_, FS_STAT_OPEN, uint32_t, uint32_t);
         return true;
     }
 
     bool close() {
-        flag_ = FS_REMOVE_MASK(flag_, FS_STAT_OPEN, uint32_t, uint32_t);
+        if (is_open()) {
+            close_native();
+            flag_ = FS_REMOVE_MASK(flag_, FS_STAT_OPEN, uint32_t, uint32_t);
+        }
         return true;
     }
 
+    //
+    // Read up to len bytes from the current position, returns the bytes read,
+    // 0 at the end of the file, or -1 on error.
+    //
+    std::ssize_t read(char * buf, std::size_t len) {
+        assert(buf != nullptr);
+        if (!is_open())
+            return -1;
+        std::ssize_t total = 0;
+        while (len > 0) {
+            std::ssize_t n = read_native(buf, len);
+            if (n < 0)
+                return -1;
+            else if (n == 0)
+                break;
+            buf += n;
+            len -= (std::size_t)n;
+            total += n;
+        }
+        offset_ += (std::size_t)total;
+        return total;
+    }
+
+    //
+    // Read up to len bytes at offset, without moving the current position.
+    // Returns the bytes read, or -1 on error. Can be called by many threads
+    // at the same time.
+    //
+    std::ssize_t read_at(std::uint64_t offset, char * buf, std::size_t len) const {
+        assert(buf != nullptr);
+        if (!is_open())
+            return -1;
+        std::ssize_t total = 0;
+        while (len > 0) {
+            std::ssize_t n = pread_native(offset, buf, len);
+            if (n < 0)
+                return -1;
+            else if (n == 0)
+                break;
+            buf += n;
+            len -= (std::size_t)n;
+            offset += (std::uint64_t)n;
+            total += n;
+        }
+        return total;
+    }
+
+    //
+    // Write all the len bytes, returns len, or -1 on error.
+    //
+    std::ssize_t write(const char * buf, std::size_t len) {
+        assert(buf != nullptr);
+        if (!is_open())
+            return -1;
+        std::size_t remain = len;
+        while (remain > 0) {
+            std::ssize_t n = write_native(buf, remain);
+            if (n <= 0)
+                return -1;
+            buf += n;
+            remain -= (std::size_t)n;
+        }
+        offset_ += len;
+        if (offset_ > size_)
+            size_ = offset_;
+        return (std::ssize_t)len;
+    }
+
+    //
+    // Flush the data of the file (not necessarily its metadata) to the device.
+    //
+    bool sync() {
+        if (!is_open())
+            return false;
+#if defined(_WIN32) || defined(WIN32) || defined(OS_WINDOWS) || defined(__WINDOWS__)
+        return (::FlushFileBuffers(native_fd_) != FALSE);
+#elif defined(__APPLE__)
+        return (::fcntl(native_fd_, F_FULLFSYNC) == 0);
+#elif defined(_POSIX_SYNCHRONIZED_IO) && (_POSIX_SYNCHRONIZED_IO > 0)
+        return (::fdatasync(native_fd_) == 0);
+#else
+        return (::fsync(native_fd_) == 0);
+#endif
+    }
+
+    const char * filename() const { return filename_; }
+
+    // The size of the file when it was opened, plus the bytes written since.
+    std::uint64_t size() const { return (std::uint64_t)size_; }
+
     bool is_file() const {
         return ((flag_ & FS_MARK_DIRECTORY) == 0);
     }
@@ -94,6 +225,146 @@ public:
     bool is_directory() const {
         return ((flag_ & FS_MARK_DIRECTORY) != 0);
     }
+
+    static bool exists(const char * filename) {
+        FILE * fp = ::fopen(filename, "rb");
+        if (fp != nullptr) {
+            ::fclose(fp);
+            return true;
+        }
+        return false;
+    }
+
+    static bool remove(const char * filename) {
+        return (::remove(filename) == 0);
+    }
+
+private:
+    File(const File &) = delete;
+    File & operator = (const File &) = delete;
+
+#if defined(_WIN32) || defined(WIN32) || defined(OS_WINDOWS) || defined(__WINDOWS__)
+    bool open_native(const char * filename, int mode) {
+        DWORD access = 0;
+        if ((mode & FS_MARK_READ) != 0)
+            access |= GENERIC_READ;
+        if ((mode & FS_MARK_WRITE) != 0)
+            access |= ((mode & FS_MARK_APPENDTOEND) != 0) ? FILE_APPEND_DATA : GENERIC_WRITE;
+        DWORD creation;
+        if ((mode & FS_MARK_WRITE) != 0)
+            creation = ((mode & FS_MARK_TRUNC) != 0) ? CREATE_ALWAYS : OPEN_ALWAYS;
+        else
+            creation = OPEN_EXISTING;
+        HANDLE handle = ::CreateFileA(filename, access, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                      NULL, creation, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (handle == INVALID_HANDLE_VALUE)
+            return false;
+        native_fd_ = handle;
+        return true;
+    }
+
+    void close_native() {
+        if (native_fd_ != null_fd) {
+            ::CloseHandle(native_fd_);
+            native_fd_ = null_fd;
+        }
+    }
+
+    std::ssize_t read_native(char * buf, std::size_t len) {
+        DWORD bytes_read = 0;
+        if (::ReadFile(native_fd_, buf, (DWORD)len, &bytes_read, NULL) == FALSE)
+            return -1;
+        return (std::ssize_t)bytes_read;
+    }
+
+    std::ssize_t pread_native(std::uint64_t offset, char * buf, std::size_t len) const {
+        OVERLAPPED overlapped;
+        ::memset(&overlapped, 0, sizeof(overlapped));
+        overlapped.Offset = (DWORD)(offset & 0xFFFFFFFFULL);
+        overlapped.OffsetHigh = (DWORD)(offset >> 32);
+        DWORD bytes_read = 0;
+        if (::ReadFile(native_fd_, buf, (DWORD)len, &bytes_read, &overlapped) == FALSE) {
+            return (::GetLastError() == ERROR_HANDLE_EOF) ? 0 : -1;
+        }
+        return (std::ssize_t)bytes_read;
+    }
+
+    std::uint64_t size_native() const {
+        LARGE_INTEGER file_size;
+        if (::GetFileSizeEx(native_fd_, &file_size) == FALSE)
+            return 0;
+        return (std::uint64_t)file_size.QuadPart;
+    }
+
+    std::ssize_t write_native(const char * buf, std::size_t len) {
+        DWORD bytes_written = 0;
+        if (::WriteFile(native_fd_, buf, (DWORD)len, &bytes_written, NULL) == FALSE)
+            return -1;
+        return (std::ssize_t)bytes_written;
+    }
+#else
+    bool open_native(const char * filename, int mode) {
+        int flags;
+        if ((mode & FS_MARK_READ_WRITE) == FS_MARK_READ_WRITE)
+            flags = O_RDWR;
+        else if ((mode & FS_MARK_WRITE) != 0)
+            flags = O_WRONLY;
+        else
+            flags = O_RDONLY;
+        if ((mode & FS_MARK_WRITE) != 0)
+            flags |= O_CREAT;
+        if ((mode & FS_MARK_TRUNC) != 0)
+            flags |= O_TRUNC;
+        if ((mode & FS_MARK_APPENDTOEND) != 0)
+            flags |= O_APPEND;
+#ifdef O_CLOEXEC
+        flags |= O_CLOEXEC;
+#endif
+        int fd = ::open(filename, flags, 0644);
+        if (fd < 0)
+            return false;
+        native_fd_ = fd;
+        return true;
+    }
+
+    void close_native() {
+        if (native_fd_ != null_fd) {
+            ::close(native_fd_);
+            native_fd_ = null_fd;
+        }
+    }
+
+    std::ssize_t read_native(char * buf, std::size_t len) {
+        std::ssize_t n;
+        do {
+            n = ::read(native_fd_, buf, len);
+        } while (n < 0 && errno == EINTR);
+        return n;
+    }
+
+    std::ssize_t pread_native(std::uint64_t offset, char * buf, std::size_t len) const {
+        std::ssize_t n;
+        do {
+            n = ::pread(native_fd_, buf, len, (off_t)offset);
+        } while (n < 0 && errno == EINTR);
+        return n;
+    }
+
+    std::uint64_t size_native() const {
+        struct stat st;
+        if (::fstat(native_fd_, &st) != 0)
+            return 0;
+        return (std::uint64_t)st.st_size;
+    }
+
+    std::ssize_t write_native(const char * buf, std::size_t len) {
+        std::ssize_t n;
+        do {
+            n = ::write(native_fd_, buf, len);
+        } while (n < 0 && errno == EINTR);
+        return n;
+    }
+#endif // _WIN32
 };
 
 struct Directory {
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "TiStore/basic/cstdint"
+#include "TiStore/fs/Common.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <vector>
+#include <atomic>
+
+namespace TiStore {
+
+//
+// A bump-pointer allocator. The memory is carved out of big blocks,
+// and all of it is freed together when the arena is destroyed.
+//
+// Allocation is not thread safe, it's expected to be done by the single
+// writer of the owner (e.g. the SkipList). memoryUsage() can be called
+// from any thread.
+//
+// See: https://github.com/google/leveldb/blob/master/util/arena.h
+//
+class Arena {
+public:
+    static const std::size_t kDefaultBlockSize = 4096;
+    static const std::size_t kDefaultAlignment = (sizeof(void *) > 8) ? sizeof(void *) : 8;
+
+private:
+    // Allocation state
+    char * alloc_ptr_;
+    std::size_t alloc_bytes_remaining_;
+    std::size_t block_size_;
+
+    // Array of new[] allocated memory blocks
+    std::vector<char *> blocks_;
+
+    // Total memory usage of the arena.
+    std::atomic<std::size_t> memory_usage_;
+
+public:
+    explicit Arena(std::size_t block_size = kDefaultBlockSize)
+        : alloc_ptr_(nullptr), alloc_bytes_remaining_(0),
+          block_size_((block_size >= CACHE_LINE_SIZE) ? block_size : kDefaultBlockSize),
+          memory_usage_(0) {
+    }
+
+    ~Arena() {
+        for (std::size_t i = 0; i < blocks_.size(); i++) {
+            delete[] blocks_[i];
+        }
+    }
+
+    // Return a pointer to a newly allocated memory block of "bytes" bytes.
+    char * allocate(std::size_t bytes) {
+        // The semantics of what to return are a bit messy if we allow
+        // 0-byte allocations, so we disallow them here (we don't need
+        // them for our internal use).
+        assert(bytes > 0);
+        if (bytes <= alloc_bytes_remaining_) {
+            char * result = alloc_ptr_;
+            alloc_ptr_ += bytes;
+            alloc_bytes_remaining_ -= bytes;
+            return result;
+        }
+        return allocateFallback(bytes);
+    }
+
+    // Allocate memory with the normal alignment guarantees provided by malloc,
+    // or with a bigger power of 2 alignment, for example CACHE_LINE_SIZE.
+    char * allocateAligned(std::size_t bytes, std::size_t alignment = kDefaultAlignment) {
+        assert((alignment & (alignment - 1)) == 0);     // Pointer size should be a power of 2
+        assert(alignment <= CACHE_LINE_SIZE);
+        std::size_t current_mod = reinterpret_cast<std::uintptr_t>(alloc_ptr_) & (alignment - 1);
+        std::size_t slop = (current_mod == 0) ? 0 : (alignment - current_mod);
+        std::size_t needed = bytes + slop;
+        char * result;
+        if (needed <= alloc_bytes_remaining_) {
+            result = alloc_ptr_ + slop;
+            alloc_ptr_ += needed;
+            alloc_bytes_remaining_ -= needed;
+        }
+        else {
+            // allocateFallback() always returns cache line aligned memory.
+            result = allocateFallback(bytes);
+        }
+        assert((reinterpret_cast<std::uintptr_t>(result) & (alignment - 1)) == 0);
+        return result;
+    }
+
+    // Returns an estimate of the total memory usage of data allocated
+    // by the arena, including the unused tail of the blocks.
+    std::size_t memoryUsage() const {
+        return memory_usage_.load(std::memory_order_relaxed);
+    }
+
+    std::size_t getBlockSize() const { return block_size_; }
+
+private:
+    Arena(const Arena &) = delete;
+    Arena & operator = (const Arena &) = delete;
+
+    char * allocateFallback(std::size_t bytes) {
+        if (bytes > block_size_ / 4) {
+            // Object is more than a quarter of our block size. Allocate it separately
+            // to avoid wasting too much space in leftover bytes.
+            char * result = allocateNewBlock(bytes);
+            return result;
+        }
+
+        // We waste the remaining space in the current block.
+        alloc_ptr_ = allocateNewBlock(block_size_);
+        alloc_bytes_remaining_ = block_size_;
+
+        char * result = alloc_ptr_;
+        alloc_ptr_ += bytes;
+        alloc_bytes_remaining_ -= bytes;
+        return result;
+    }
+
+    // The returned block is aligned to CACHE_LINE_SIZE bytes.
+    char * allocateNewBlock(std::size_t block_bytes) {
+        char * block = new char[block_bytes + CACHE_LINE_SIZE];
+        blocks_.push_back(block);
+        memory_usage_.fetch_add(block_bytes + CACHE_LINE_SIZE + sizeof(char *),
+                                std::memory_order_relaxed);
+        std::size_t current_mod = reinterpret_cast<std::uintptr_t>(block) & (CACHE_LINE_SIZE - 1);
+        std::size_t slop = (current_mod == 0) ? 0 : (CACHE_LINE_SIZE - current_mod);
+        return (block + slop);
+    }
+};
+
+} // namespace TiStore
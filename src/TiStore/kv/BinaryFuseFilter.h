@@ -0,0 +1,603 @@
+#pragma once
+
+#include "TiStore/basic/cstdint"
+#include "TiStore/fs/Common.h"
+#include "TiStore/fs/ErrorCode.h"
+#include "TiStore/kv/BloomFilter.h"
+#include "TiStore/kv/BloomFilterFormat.h"
+#include "TiStore/kv/Coding.h"
+#include "TiStore/kv/Hash.h"
+#include "TiStore/kv/HashBatch.h"
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_AMD64))
+#include <intrin.h>
+#endif
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+#include <stdio.h>
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+namespace TiStore {
+
+namespace detail {
+
+// The high 64 bits of a * b.
+static inline
+std::uint64_t mulhi64(std::uint64_t a, std::uint64_t b)
+{
+#if defined(__SIZEOF_INT128__)
+    return (std::uint64_t)(((unsigned __int128)a * b) >> 64);
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_AMD64))
+    return __umulh(a, b);
+#else
+    std::uint64_t a_lo = (std::uint32_t)a, a_hi = a >> 32;
+    std::uint64_t b_lo = (std::uint32_t)b, b_hi = b >> 32;
+    std::uint64_t lo_lo = a_lo * b_lo;
+    std::uint64_t hi_lo = a_hi * b_lo;
+    std::uint64_t lo_hi = a_lo * b_hi;
+    std::uint64_t cross = (lo_lo >> 32) + (std::uint32_t)hi_lo + lo_hi;
+    return a_hi * b_hi + (hi_lo >> 32) + (cross >> 32);
+#endif
+}
+
+static inline
+std::uint64_t murmur_mix64(std::uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static inline
+std::uint64_t splitmix64(std::uint64_t & state)
+{
+    std::uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+} // namespace detail
+
+//
+// A binary fuse filter (3-wise, 8 bits fingerprints): a static filter built
+// from the whole key set, as a table builder has it, which takes about
+// 9 bits per key (1.125 x 8, less for the big sets) for a false positive
+// rate of 2^-8 (0.39%), where a FullBloomFilter takes 10 bits per key for
+// about 1%.
+//
+// Each key maps to three slots, one in each of three consecutive segments,
+// and the slots are solved (by peeling the 3-hypergraph) so that the xor of
+// the three fingerprints in them is the fingerprint of the key. A lookup
+// reads the three slots, all within 3 segments, so they are often on
+// nearby cache lines, and has no early exit.
+//
+// addKey() only remembers the 64 bits hash of the key, build() makes the
+// filter from all of them, and maybeMatch() can only be used after it.
+// The bits_per_key of the constructor is not used, the fingerprints are
+// always 8 bits.
+//
+// See: "Binary Fuse Filters: Fast and Smaller Than Xor Filters", Graf and Lemire.
+// See: https://github.com/FastFilter/xor_singleheader
+//
+class BinaryFuseFilter {
+public:
+    static const std::size_t kNumProbes = 3;
+    static const std::size_t kMaxSegmentLength = 262144;
+    static const int kMaxIterations = 100;
+    // The parameters before the fingerprints in the encoding:
+    // seed fixed64, segment_length fixed32, segment_count fixed32.
+    static const std::size_t kParamsSize = 16;
+
+    typedef std::uint8_t fingerprint_type;
+
+private:
+    HashUtils<> hashUtils_;
+    // The hashes of the keys, until build().
+    std::vector<std::uint64_t> hashes_;
+    std::unique_ptr<fingerprint_type[]> buffer_;
+    const fingerprint_type * fingerprints_;
+
+    std::uint64_t seed_;
+    std::uint32_t segment_length_;
+    std::uint32_t segment_length_mask_;
+    std::uint32_t segment_count_;
+    std::uint32_t segment_count_length_;
+    std::uint32_t array_length_;
+
+    std::size_t num_total_keys_;
+    std::size_t bits_per_key_;
+    bool built_;
+
+    bool verbose_;
+
+public:
+    BinaryFuseFilter() :
+        fingerprints_(nullptr), seed_(0), segment_length_(0), segment_length_mask_(0),
+        segment_count_(0), segment_count_length_(0), array_length_(0),
+        num_total_keys_(0), bits_per_key_(0), built_(false), verbose_(false) {
+    }
+
+    BinaryFuseFilter(std::size_t num_total_keys, std::size_t bits_per_key, bool verbose = true)
+        : hashUtils_(), fingerprints_(nullptr), seed_(0), segment_length_(0), segment_length_mask_(0),
+          segment_count_(0), segment_count_length_(0), array_length_(0),
+          num_total_keys_(num_total_keys), bits_per_key_(bits_per_key), built_(false),
+          verbose_(verbose) {
+        initFilter(num_total_keys, bits_per_key);
+    }
+
+    ~BinaryFuseFilter() {}
+
+private:
+    void initFilter(std::size_t num_total_keys, std::size_t bits_per_key) noexcept {
+        num_total_keys_ = num_total_keys;
+        bits_per_key_ = bits_per_key;
+        hashes_.clear();
+        hashes_.reserve(num_total_keys);
+        buffer_.reset(nullptr);
+        fingerprints_ = nullptr;
+        array_length_ = 0;
+        built_ = false;
+
+        if (getVerbose()) {
+            printf("num_total_keys      = %zu keys\n"
+                   "num_probes          = %zu\n"
+                   "fingerprint_bits    = %zu\n\n",
+                    num_total_keys_, kNumProbes, sizeof(fingerprint_type) * 8);
+        }
+    }
+
+    // Sets the geometry for num_keys keys.
+    void initGeometry(std::size_t num_keys) {
+        const std::uint32_t arity = (std::uint32_t)kNumProbes;
+        std::uint32_t size = (std::uint32_t)num_keys;
+        std::uint32_t segment_length = 4;
+        if (size > 0) {
+            double bits = ::floor(::log((double)size) / ::log(3.33) + 2.25);
+            segment_length = (bits > 18.0) ? (std::uint32_t)kMaxSegmentLength
+                                           : ((std::uint32_t)1 << (int)bits);
+        }
+        std::uint32_t capacity = 0;
+        if (size > 1) {
+            double size_factor = 0.875 + 0.25 * ::log(1000000.0) / ::log((double)size);
+            if (size_factor < 1.125)
+                size_factor = 1.125;
+            capacity = (std::uint32_t)::floor((double)size * size_factor + 0.5);
+        }
+        std::uint32_t segment_count = (capacity + segment_length - 1) / segment_length;
+        if (segment_count <= arity - 1)
+            segment_count = 1;
+        else
+            segment_count -= (arity - 1);
+        setGeometry(segment_length, segment_count);
+    }
+
+    void setGeometry(std::uint32_t segment_length, std::uint32_t segment_count) {
+        segment_length_ = segment_length;
+        segment_length_mask_ = segment_length - 1;
+        segment_count_ = segment_count;
+        segment_count_length_ = segment_count * segment_length;
+        array_length_ = (segment_count + (std::uint32_t)kNumProbes - 1) * segment_length;
+    }
+
+    inline std::uint64_t getKeyHash(const Slice & key) const {
+        std::uint32_t primary_hash = hashUtils_.primaryHash(key.data(), key.size(), kDefaultHashSeed);
+        std::uint32_t secondary_hash = hashUtils_.secondaryHash(key.data(), key.size());
+        return (((std::uint64_t)primary_hash << 32) | secondary_hash);
+    }
+
+    inline std::uint64_t mixHash(std::uint64_t key_hash) const {
+        return detail::murmur_mix64(key_hash + seed_);
+    }
+
+    static inline fingerprint_type getFingerprint(std::uint64_t hash) {
+        return (fingerprint_type)(hash ^ (hash >> 32));
+    }
+
+    // The slot of the hash in the index-th (0, 1 or 2) of its segments.
+    inline std::uint32_t getSlot(std::size_t index, std::uint64_t hash) const {
+        std::uint64_t h = detail::mulhi64(hash, segment_count_length_);
+        h += index * segment_length_;
+        std::uint64_t hh = hash & ((1ULL << 36) - 1);
+        h ^= (std::size_t)((hh >> (36 - 18 * index)) & segment_length_mask_);
+        return (std::uint32_t)h;
+    }
+
+    inline void getSlots(std::uint64_t hash, std::uint32_t & h0,
+                         std::uint32_t & h1, std::uint32_t & h2) const {
+        h0 = (std::uint32_t)detail::mulhi64(hash, segment_count_length_);
+        h1 = h0 + segment_length_;
+        h2 = h1 + segment_length_;
+        h1 ^= (std::uint32_t)(hash >> 18) & segment_length_mask_;
+        h2 ^= (std::uint32_t)hash & segment_length_mask_;
+    }
+
+    inline bool matchHash(std::uint64_t hash) const {
+        std::uint32_t h0, h1, h2;
+        getSlots(hash, h0, h1, h2);
+        fingerprint_type f = getFingerprint(hash);
+        f ^= fingerprints_[h0] ^ fingerprints_[h1] ^ fingerprints_[h2];
+        return (f == 0);
+    }
+
+    bool checkGeometry() const {
+        return (segment_length_ != 0 && (segment_length_ & segment_length_mask_) == 0
+                && segment_length_ <= kMaxSegmentLength && segment_count_ != 0
+                && (std::uint64_t)(segment_count_ + kNumProbes - 1) * segment_length_ <= 0xFFFFFFFFULL);
+    }
+
+    int decodeParams(const Slice & input, bool verify_checksum, const char ** fingerprints) {
+        BloomFilterHeader header;
+        const char * bitmap;
+        int status = header.decodeFrom(input, kBinaryFuseFilter, &bitmap, verify_checksum);
+        if (status != error_code::no_error)
+            return status;
+        if (header.num_probes != kNumProbes || header.bitmap_bytes < kParamsSize)
+            return error_code::err_corruption;
+        seed_ = decodeFixed64(bitmap);
+        std::uint32_t segment_length = decodeFixed32(bitmap + 8);
+        std::uint32_t segment_count = decodeFixed32(bitmap + 12);
+        setGeometry(segment_length, segment_count);
+        if (!checkGeometry() || header.bitmap_bytes != kParamsSize + array_length_) {
+            array_length_ = 0;
+            return error_code::err_corruption;
+        }
+        bits_per_key_ = header.bits_per_key;
+        hashes_.clear();
+        built_ = true;
+        *fingerprints = bitmap + kParamsSize;
+        return error_code::no_error;
+    }
+
+public:
+    bool getVerbose() const { return verbose_; }
+    void setVerbose(bool verbose) { verbose_ = verbose; }
+
+    // The bytes of the fingerprints, valid after build().
+    std::size_t getFilterSize() const { return array_length_ * sizeof(fingerprint_type); }
+    std::size_t getNumProbes() const { return kNumProbes; }
+
+    bool isBuilt() const { return built_; }
+
+    // A filter attached to an encoding can't be changed.
+    bool isReadOnly() const { return (fingerprints_ != nullptr && buffer_.get() == nullptr); }
+
+    // BinaryFuseFilter: appends the encoding of the filter, see BloomFilterFormat.h,
+    // the bitmap is the kParamsSize bytes of the parameters and the fingerprints.
+    void encodeTo(std::string * dst) const {
+        assert(isBuilt());
+        std::string bitmap;
+        putFixed64(&bitmap, seed_);
+        putFixed32(&bitmap, segment_length_);
+        putFixed32(&bitmap, segment_count_);
+        bitmap.append(reinterpret_cast<const char *>(fingerprints_), getFilterSize());
+        bitmap.resize(BloomFilterHeader::paddedSize(bitmap.size()), '\0');
+        BloomFilterHeader header(kBinaryFuseFilter, kNumProbes, 0, bits_per_key_,
+                                 kParamsSize + getFilterSize());
+        header.encodeTo(dst, bitmap.data());
+    }
+
+    // BinaryFuseFilter: restores the filter from a copy of the encoding.
+    int decodeFrom(const Slice & input, bool verify_checksum = true) {
+        const char * fingerprints;
+        int status = decodeParams(input, verify_checksum, &fingerprints);
+        if (status != error_code::no_error)
+            return status;
+        fingerprint_type * new_fingerprints = new (std::nothrow) fingerprint_type[array_length_];
+        if (new_fingerprints == nullptr) {
+            array_length_ = 0;
+            built_ = false;
+            return error_code::out_of_memory;
+        }
+        ::memcpy((void *)new_fingerprints, fingerprints, getFilterSize());
+        buffer_.reset(new_fingerprints);
+        fingerprints_ = new_fingerprints;
+        return error_code::no_error;
+    }
+
+    // BinaryFuseFilter: makes the filter a read-only view of the encoding,
+    // without a copy, the encoding must outlive the filter.
+    int attach(const Slice & input, bool verify_checksum = true) {
+        const char * fingerprints;
+        int status = decodeParams(input, verify_checksum, &fingerprints);
+        if (status != error_code::no_error)
+            return status;
+        buffer_.reset(nullptr);
+        fingerprints_ = reinterpret_cast<const fingerprint_type *>(fingerprints);
+        return error_code::no_error;
+    }
+
+    // BinaryFuseFilter
+    void setOption(std::size_t num_total_keys, std::size_t bits_per_key, bool verbose = true) {
+        setVerbose(verbose);
+        initFilter(num_total_keys, bits_per_key);
+    }
+
+    // BinaryFuseFilter: drops the keys and the fingerprints.
+    void reset() {
+        initFilter(num_total_keys_, bits_per_key_);
+    }
+
+    std::size_t getUsedBits() const {
+        std::size_t total_used = 0;
+        const unsigned char * cur = reinterpret_cast<const unsigned char *>(fingerprints_);
+        for (std::size_t n = 0; n < getFilterSize(); n++) {
+            total_used += BitsSetTable256[*cur];
+            cur++;
+        }
+        return total_used;
+    }
+
+    // BinaryFuseFilter
+    void addKey(const Slice & key) {
+        assert(!isBuilt());
+        hashes_.push_back(getKeyHash(key));
+        if (getVerbose())
+            printf("addKey(): %s\n", key.data());
+    }
+
+    // BinaryFuseFilter: makes the fingerprints from the keys added, and frees
+    // the hashes of the keys. A few rounds (with a new seed each) may be
+    // needed, returns err_failed if it doesn't converge, e.g. if the hashes
+    // of too many keys collide.
+    int build() {
+        assert(!isReadOnly());
+        std::size_t size = hashes_.size();
+        if (size > 0xFFFFFFFFULL / 2)
+            return error_code::err_failed;
+        initGeometry(size);
+        std::uint32_t capacity = array_length_;
+
+        fingerprint_type * new_fingerprints = new (std::nothrow) fingerprint_type[capacity];
+        if (new_fingerprints == nullptr) {
+            array_length_ = 0;
+            return error_code::out_of_memory;
+        }
+        ::memset((void *)new_fingerprints, 0, capacity * sizeof(fingerprint_type));
+        buffer_.reset(new_fingerprints);
+        fingerprints_ = new_fingerprints;
+
+        int status = error_code::no_error;
+        if (size > 0) {
+            status = solve(new_fingerprints);
+            if (status != error_code::no_error) {
+                buffer_.reset(nullptr);
+                fingerprints_ = nullptr;
+                array_length_ = 0;
+                return status;
+            }
+        }
+        std::vector<std::uint64_t>().swap(hashes_);
+        built_ = true;
+
+        if (getVerbose()) {
+            printf("segment_length      = %u\n"
+                   "segment_count       = %u\n"
+                   "size_of_fingerprints = %zu bytes\n"
+                   "bits_per_key        = %0.3f\n\n",
+                    segment_length_, segment_count_, getFilterSize(),
+                    (size != 0) ? (double)getFilterSize() * 8.0 / (double)size : 0.0);
+        }
+        return status;
+    }
+
+    // BinaryFuseFilter
+    bool maybeMatch(const Slice & key) const {
+        assert(isBuilt());
+        if (fingerprints_ == nullptr)
+            return false;
+        return matchHash(mixHash(getKeyHash(key)));
+    }
+
+    // BinaryFuseFilter: out[i] = maybeMatch(keys[i]). The kBatchSize keys are
+    // hashed by BatchHash, and their slots prefetched before any of them is
+    // tested.
+    static const std::size_t kBatchSize = 16;
+
+    void maybeMatchBatch(const Slice * keys, std::size_t n, bool * out) const {
+        assert(isBuilt());
+        if (fingerprints_ == nullptr) {
+            for (std::size_t i = 0; i < n; i++)
+                out[i] = false;
+            return;
+        }
+        std::uint64_t hashes[kBatchSize];
+        std::uint32_t primary_hashes[kBatchSize], secondary_hashes[kBatchSize];
+        for (std::size_t start = 0; start < n; start += kBatchSize) {
+            std::size_t count = ((n - start) < kBatchSize) ? (n - start) : kBatchSize;
+            BatchHash::hashPair(keys + start, count, kDefaultHashSeed, primary_hashes, secondary_hashes);
+            for (std::size_t i = 0; i < count; i++) {
+                std::uint64_t key_hash = ((std::uint64_t)primary_hashes[i] << 32) | secondary_hashes[i];
+                std::uint64_t hash = mixHash(key_hash);
+                hashes[i] = hash;
+                std::uint32_t h0, h1, h2;
+                getSlots(hash, h0, h1, h2);
+                TISTORE_PREFETCH(fingerprints_ + h0);
+                TISTORE_PREFETCH(fingerprints_ + h1);
+                TISTORE_PREFETCH(fingerprints_ + h2);
+            }
+            for (std::size_t i = 0; i < count; i++) {
+                out[start + i] = matchHash(hashes[i]);
+            }
+        }
+    }
+
+private:
+    BinaryFuseFilter(const BinaryFuseFilter &) = delete;
+    BinaryFuseFilter & operator = (const BinaryFuseFilter &) = delete;
+
+    //
+    // Peels the 3-hypergraph of the keys: a slot with only one key left
+    // decides the fingerprint of that key, which is then removed from its
+    // other two slots. The keys are first sorted by segment, so the
+    // counters being updated are close to each other.
+    //
+    int solve(fingerprint_type * fingerprints) {
+        std::uint32_t size = (std::uint32_t)hashes_.size();
+        std::uint32_t capacity = array_length_;
+
+        std::unique_ptr<std::uint64_t[]> reverse_order(new (std::nothrow) std::uint64_t[size + 1]);
+        std::unique_ptr<std::uint32_t[]> alone(new (std::nothrow) std::uint32_t[capacity]);
+        std::unique_ptr<std::uint8_t[]> t2count(new (std::nothrow) std::uint8_t[capacity]);
+        std::unique_ptr<std::uint8_t[]> reverse_h(new (std::nothrow) std::uint8_t[size]);
+        std::unique_ptr<std::uint64_t[]> t2hash(new (std::nothrow) std::uint64_t[capacity]);
+
+        std::uint32_t block_bits = 1;
+        while (((std::uint32_t)1 << block_bits) < segment_count_)
+            block_bits++;
+        std::uint32_t block = (std::uint32_t)1 << block_bits;
+        std::unique_ptr<std::uint32_t[]> start_pos(new (std::nothrow) std::uint32_t[block]);
+
+        if (!reverse_order || !alone || !t2count || !reverse_h || !t2hash || !start_pos)
+            return error_code::out_of_memory;
+
+        ::memset((void *)reverse_order.get(), 0, sizeof(std::uint64_t) * size);
+        ::memset((void *)t2count.get(), 0, sizeof(std::uint8_t) * capacity);
+        ::memset((void *)t2hash.get(), 0, sizeof(std::uint64_t) * capacity);
+        // The end marker of the partition below.
+        reverse_order[size] = 1;
+
+        std::uint64_t rng_state = 0x726B2B9D438B9D4DULL;
+        seed_ = detail::splitmix64(rng_state);
+
+        std::uint32_t h012[5];
+        int iteration = 0;
+        while (true) {
+            if (++iteration > kMaxIterations)
+                return error_code::err_failed;
+
+            // Partition the hashes by their segment.
+            for (std::uint32_t i = 0; i < block; i++)
+                start_pos[i] = (std::uint32_t)(((std::uint64_t)i * size) >> block_bits);
+            std::uint64_t mask_block = block - 1;
+            for (std::uint32_t i = 0; i < size; i++) {
+                std::uint64_t hash = mixHash(hashes_[i]);
+                std::uint64_t segment_index = hash >> (64 - block_bits);
+                while (reverse_order[start_pos[segment_index]] != 0) {
+                    segment_index++;
+                    segment_index &= mask_block;
+                }
+                reverse_order[start_pos[segment_index]] = hash;
+                start_pos[segment_index]++;
+            }
+
+            // t2count: the number of keys in the slot (<< 2) and the xor of
+            // their indexes (0, 1, 2) in it, t2hash: the xor of their hashes.
+            bool error = false;
+            std::uint32_t duplicates = 0;
+            for (std::uint32_t i = 0; i < size; i++) {
+                std::uint64_t hash = reverse_order[i];
+                std::uint32_t h0 = getSlot(0, hash);
+                t2count[h0] += 4;
+                t2hash[h0] ^= hash;
+                std::uint32_t h1 = getSlot(1, hash);
+                t2count[h1] += 4;
+                t2count[h1] ^= 1;
+                t2hash[h1] ^= hash;
+                std::uint32_t h2 = getSlot(2, hash);
+                t2count[h2] += 4;
+                t2count[h2] ^= 2;
+                t2hash[h2] ^= hash;
+                // The same hash twice, drop the second one.
+                if ((t2hash[h0] & t2hash[h1] & t2hash[h2]) == 0) {
+                    if (((t2hash[h0] == 0) && (t2count[h0] == 8))
+                        || ((t2hash[h1] == 0) && (t2count[h1] == 8))
+                        || ((t2hash[h2] == 0) && (t2count[h2] == 8))) {
+                        duplicates++;
+                        t2count[h0] -= 4;
+                        t2hash[h0] ^= hash;
+                        t2count[h1] -= 4;
+                        t2count[h1] ^= 1;
+                        t2hash[h1] ^= hash;
+                        t2count[h2] -= 4;
+                        t2count[h2] ^= 2;
+                        t2hash[h2] ^= hash;
+                    }
+                }
+                // The 6 bits counter overflowed.
+                if (t2count[h0] < 4 || t2count[h1] < 4 || t2count[h2] < 4)
+                    error = true;
+            }
+
+            if (!error) {
+                // The slots with one key.
+                std::uint32_t queue_size = 0;
+                for (std::uint32_t i = 0; i < capacity; i++) {
+                    alone[queue_size] = i;
+                    queue_size += ((t2count[i] >> 2) == 1) ? 1 : 0;
+                }
+                std::uint32_t stack_size = 0;
+                while (queue_size > 0) {
+                    queue_size--;
+                    std::uint32_t index = alone[queue_size];
+                    if ((t2count[index] >> 2) == 1) {
+                        std::uint64_t hash = t2hash[index];
+                        h012[1] = getSlot(1, hash);
+                        h012[2] = getSlot(2, hash);
+                        h012[3] = getSlot(0, hash);
+                        h012[4] = h012[1];
+                        std::uint8_t found = t2count[index] & 3;
+                        reverse_h[stack_size] = found;
+                        reverse_order[stack_size] = hash;
+                        stack_size++;
+
+                        std::uint32_t other_index1 = h012[found + 1];
+                        alone[queue_size] = other_index1;
+                        queue_size += ((t2count[other_index1] >> 2) == 2) ? 1 : 0;
+                        t2count[other_index1] -= 4;
+                        t2count[other_index1] ^= (std::uint8_t)((found + 1) % 3);
+                        t2hash[other_index1] ^= hash;
+
+                        std::uint32_t other_index2 = h012[found + 2];
+                        alone[queue_size] = other_index2;
+                        queue_size += ((t2count[other_index2] >> 2) == 2) ? 1 : 0;
+                        t2count[other_index2] -= 4;
+                        t2count[other_index2] ^= (std::uint8_t)((found + 2) % 3);
+                        t2hash[other_index2] ^= hash;
+                    }
+                }
+                if (stack_size + duplicates == size) {
+                    size = stack_size;
+                    break;
+                }
+                if (duplicates > 0) {
+                    // The keys added twice, drop them for good.
+                    std::sort(hashes_.begin(), hashes_.end());
+                    hashes_.erase(std::unique(hashes_.begin(), hashes_.end()), hashes_.end());
+                    size = (std::uint32_t)hashes_.size();
+                    reverse_order[size] = 1;
+                }
+            }
+
+            // Try again with a new seed.
+            ::memset((void *)reverse_order.get(), 0, sizeof(std::uint64_t) * size);
+            ::memset((void *)t2count.get(), 0, sizeof(std::uint8_t) * capacity);
+            ::memset((void *)t2hash.get(), 0, sizeof(std::uint64_t) * capacity);
+            seed_ = detail::splitmix64(rng_state);
+        }
+
+        // Assign the fingerprints in the reverse order of the peeling.
+        for (std::uint32_t i = size - 1; i < size; i--) {
+            std::uint64_t hash = reverse_order[i];
+            fingerprint_type xor2 = getFingerprint(hash);
+            std::uint8_t found = reverse_h[i];
+            h012[0] = getSlot(0, hash);
+            h012[1] = getSlot(1, hash);
+            h012[2] = getSlot(2, hash);
+            h012[3] = h012[0];
+            h012[4] = h012[1];
+            fingerprints[h012[found]] = xor2 ^ fingerprints[h012[found + 1]]
+                                             ^ fingerprints[h012[found + 2]];
+        }
+        return error_code::no_error;
+    }
+};
+
+} // namespace TiStore
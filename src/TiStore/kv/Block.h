@@ -0,0 +1,344 @@
+#pragma once
+
+#include "TiStore/basic/cstdint"
+#include "TiStore/kv/Coding.h"
+#include "TiStore/kv/Slice.h"
+
+#include <assert.h>
+#include <string>
+#include <vector>
+
+//
+// The format of a block of a table:
+//
+// When we store a key, we drop the prefix shared with the previous
+// string. This helps reduce the space requirement significantly.
+// Furthermore, once every K keys, we do not apply the prefix
+// compression and store the entire key. We call this a "restart
+// point". The tail end of the block stores the offsets of all of the
+// restart points, and can be used to do a binary search when looking
+// for a particular key. Values are stored as-is (without compression)
+// immediately following the corresponding key.
+//
+// An entry for a particular key-value pair has the form:
+//     shared_bytes: varint32
+//     unshared_bytes: varint32
+//     value_length: varint32
+//     key_delta: char[unshared_bytes]
+//     value: char[value_length]
+// shared_bytes == 0 for restart points.
+//
+// The trailer of the block has the form:
+//     restarts: uint32[num_restarts]
+//     num_restarts: uint32
+// restarts[i] contains the offset within the block of the ith restart point.
+//
+// See: https://github.com/google/leveldb/blob/master/table/block_builder.cc
+//
+
+namespace TiStore {
+
+class BlockBuilder {
+private:
+    int restart_interval_;
+    std::string buffer_;                    // Destination buffer
+    std::vector<std::uint32_t> restarts_;   // Restart points
+    int counter_;                           // Number of entries emitted since restart
+    bool finished_;                         // Has finish() been called?
+    std::string last_key_;
+
+public:
+    explicit BlockBuilder(int restart_interval = 16)
+        : restart_interval_(restart_interval), counter_(0), finished_(false) {
+        assert(restart_interval_ >= 1);
+        restarts_.push_back(0);     // First restart point is at offset 0
+    }
+
+    // Reset the contents as if the BlockBuilder was just constructed.
+    void reset() {
+        buffer_.clear();
+        restarts_.clear();
+        restarts_.push_back(0);     // First restart point is at offset 0
+        counter_ = 0;
+        finished_ = false;
+        last_key_.clear();
+    }
+
+    // REQUIRES: finish() has not been called since the last call to reset().
+    // REQUIRES: key is larger than any previously added key
+    void add(const Slice & key, const Slice & value) {
+        assert(!finished_);
+        assert(counter_ <= restart_interval_);
+        assert(buffer_.empty() || Slice(last_key_).compare(key) < 0);
+        std::size_t shared = 0;
+        if (counter_ < restart_interval_) {
+            // See how much sharing to do with previous string
+            const std::size_t min_length = (last_key_.size() < key.size()) ? last_key_.size() : key.size();
+            while ((shared < min_length) && (last_key_[shared] == key[shared])) {
+                shared++;
+            }
+        }
+        else {
+            // Restart compression
+            restarts_.push_back((std::uint32_t)buffer_.size());
+            counter_ = 0;
+        }
+        const std::size_t non_shared = key.size() - shared;
+
+        // Add "<shared><non_shared><value_size>" to buffer_
+        putVarint32(&buffer_, (std::uint32_t)shared);
+        putVarint32(&buffer_, (std::uint32_t)non_shared);
+        putVarint32(&buffer_, (std::uint32_t)value.size());
+
+        // Add string delta to buffer_ followed by value
+        buffer_.append(key.data() + shared, non_shared);
+        buffer_.append(value.data(), value.size());
+
+        // Update state
+        last_key_.resize(shared);
+        last_key_.append(key.data() + shared, non_shared);
+        assert(Slice(last_key_) == key);
+        counter_++;
+    }
+
+    // Finish building the block and return a slice that refers to the
+    // block contents. The returned slice will remain valid for the
+    // lifetime of this builder or until reset() is called.
+    Slice finish() {
+        // Append restart array
+        for (std::size_t i = 0; i < restarts_.size(); i++) {
+            putFixed32(&buffer_, restarts_[i]);
+        }
+        putFixed32(&buffer_, (std::uint32_t)restarts_.size());
+        finished_ = true;
+        return Slice(buffer_);
+    }
+
+    // Returns an estimate of the current (uncompressed) size of the block
+    // we are building.
+    std::size_t currentSizeEstimate() const {
+        return (buffer_.size() +                            // Raw data buffer
+                restarts_.size() * sizeof(std::uint32_t) +  // Restart array
+                sizeof(std::uint32_t));                     // Restart array length
+    }
+
+    // Return true iff no entries have been added since the last reset()
+    bool empty() const { return buffer_.empty(); }
+
+    const std::string & lastKey() const { return last_key_; }
+
+private:
+    BlockBuilder(const BlockBuilder &) = delete;
+    BlockBuilder & operator = (const BlockBuilder &) = delete;
+};
+
+//
+// A read-only view of the contents of a block, the contents must outlive it.
+//
+class Block {
+private:
+    const char * data_;
+    std::size_t size_;
+    std::uint32_t restart_offset_;  // Offset in data_ of restart array
+    std::uint32_t num_restarts_;
+
+public:
+    explicit Block(const Slice & contents)
+        : data_(contents.data()), size_(contents.size()), restart_offset_(0), num_restarts_(0) {
+        if (size_ < sizeof(std::uint32_t)) {
+            size_ = 0;  // Error marker
+        }
+        else {
+            std::size_t max_restarts_allowed = (size_ - sizeof(std::uint32_t)) / sizeof(std::uint32_t);
+            num_restarts_ = decodeFixed32(data_ + size_ - sizeof(std::uint32_t));
+            if (num_restarts_ > max_restarts_allowed) {
+                // The size is too small for num_restarts()
+                size_ = 0;
+            }
+            else {
+                restart_offset_ = (std::uint32_t)(size_ - (1 + num_restarts_) * sizeof(std::uint32_t));
+            }
+        }
+    }
+
+    bool isValid() const { return (size_ != 0); }
+    std::size_t size() const { return size_; }
+
+    class Iterator {
+    private:
+        const char * const data_;           // underlying block contents
+        std::uint32_t const restarts_;      // Offset of restart array (list of fixed32)
+        std::uint32_t const num_restarts_;  // Number of uint32_t entries in restart array
+
+        // current_ is offset in data_ of current entry.  >= restarts_ if !isValid
+        std::uint32_t current_;
+        std::uint32_t restart_index_;       // Index of restart block in which current_ falls
+        std::string key_;
+        Slice value_;
+        bool corrupted_;
+
+    public:
+        Iterator(const Block * block)
+            : data_(block->data_), restarts_(block->restart_offset_),
+              num_restarts_(block->num_restarts_), current_(block->restart_offset_),
+              restart_index_(block->num_restarts_), corrupted_(!block->isValid()) {
+        }
+
+        bool isValid() const { return (current_ < restarts_); }
+        bool isCorrupted() const { return corrupted_; }
+
+        Slice key() const {
+            assert(isValid());
+            return Slice(key_);
+        }
+
+        Slice value() const {
+            assert(isValid());
+            return value_;
+        }
+
+        void next() {
+            assert(isValid());
+            parseNextKey();
+        }
+
+        // Advance to the first entry with a key >= target
+        void seek(const Slice & target) {
+            if (corrupted_ || num_restarts_ == 0)
+                return;
+            // Binary search in restart array to find the last restart point
+            // with a key < target
+            std::uint32_t left = 0;
+            std::uint32_t right = num_restarts_ - 1;
+            while (left < right) {
+                std::uint32_t mid = (left + right + 1) / 2;
+                std::uint32_t region_offset = getRestartPoint(mid);
+                std::uint32_t shared, non_shared, value_length;
+                const char * key_ptr = decodeEntry(data_ + region_offset, data_ + restarts_,
+                                                   &shared, &non_shared, &value_length);
+                if (key_ptr == nullptr || (shared != 0)) {
+                    corruptionError();
+                    return;
+                }
+                Slice mid_key(key_ptr, non_shared);
+                if (mid_key.compare(target) < 0) {
+                    // Key at "mid" is smaller than "target".  Therefore all
+                    // blocks before "mid" are uninteresting.
+                    left = mid;
+                }
+                else {
+                    // Key at "mid" is >= "target".  Therefore all blocks at or
+                    // after "mid" are uninteresting.
+                    right = mid - 1;
+                }
+            }
+
+            // Linear search (within restart block) for first key >= target
+            seekToRestartPoint(left);
+            while (true) {
+                if (!parseNextKey())
+                    return;
+                if (Slice(key_).compare(target) >= 0)
+                    return;
+            }
+        }
+
+        void seekToFirst() {
+            if (corrupted_ || num_restarts_ == 0)
+                return;
+            seekToRestartPoint(0);
+            parseNextKey();
+        }
+
+    private:
+        // Return the offset in data_ just past the end of the current entry.
+        std::uint32_t nextEntryOffset() const {
+            return (std::uint32_t)((value_.data() + value_.size()) - data_);
+        }
+
+        std::uint32_t getRestartPoint(std::uint32_t index) const {
+            assert(index < num_restarts_);
+            return decodeFixed32(data_ + restarts_ + index * sizeof(std::uint32_t));
+        }
+
+        void seekToRestartPoint(std::uint32_t index) {
+            key_.clear();
+            restart_index_ = index;
+            // current_ will be fixed by parseNextKey();
+
+            // parseNextKey() starts at the end of value_, so set value_ accordingly
+            std::uint32_t offset = getRestartPoint(index);
+            value_ = Slice(data_ + offset, 0);
+        }
+
+        void corruptionError() {
+            current_ = restarts_;
+            restart_index_ = num_restarts_;
+            corrupted_ = true;
+            key_.clear();
+            value_.clear();
+        }
+
+        // Helper routine: decode the next block entry starting at "p",
+        // storing the number of shared key bytes, non_shared key bytes,
+        // and the length of the value in "*shared", "*non_shared", and
+        // "*value_length", respectively.  Will not dereference past "limit".
+        //
+        // If any errors are detected, returns nullptr.  Otherwise, returns a
+        // pointer to the key delta (just past the three decoded values).
+        static const char * decodeEntry(const char * p, const char * limit,
+                                        std::uint32_t * shared, std::uint32_t * non_shared,
+                                        std::uint32_t * value_length) {
+            if (limit - p < 3)
+                return nullptr;
+            *shared = reinterpret_cast<const unsigned char *>(p)[0];
+            *non_shared = reinterpret_cast<const unsigned char *>(p)[1];
+            *value_length = reinterpret_cast<const unsigned char *>(p)[2];
+            if ((*shared | *non_shared | *value_length) < 128) {
+                // Fast path: all three values are encoded in one byte each
+                p += 3;
+            }
+            else {
+                if ((p = getVarint32Ptr(p, limit, shared)) == nullptr) return nullptr;
+                if ((p = getVarint32Ptr(p, limit, non_shared)) == nullptr) return nullptr;
+                if ((p = getVarint32Ptr(p, limit, value_length)) == nullptr) return nullptr;
+            }
+
+            if ((std::uint32_t)(limit - p) < (*non_shared + *value_length))
+                return nullptr;
+            return p;
+        }
+
+        bool parseNextKey() {
+            current_ = nextEntryOffset();
+            const char * p = data_ + current_;
+            const char * limit = data_ + restarts_;  // Restarts come right after data
+            if (p >= limit) {
+                // No more entries to return.  Mark as invalid.
+                current_ = restarts_;
+                restart_index_ = num_restarts_;
+                return false;
+            }
+
+            // Decode next entry
+            std::uint32_t shared, non_shared, value_length;
+            p = decodeEntry(p, limit, &shared, &non_shared, &value_length);
+            if (p == nullptr || key_.size() < shared) {
+                corruptionError();
+                return false;
+            }
+            else {
+                key_.resize(shared);
+                key_.append(p, non_shared);
+                value_ = Slice(p + non_shared, value_length);
+                while (restart_index_ + 1 < num_restarts_ &&
+                       getRestartPoint(restart_index_ + 1) < current_) {
+                    ++restart_index_;
+                }
+                return true;
+            }
+        }
+    };
+};
+
+} // namespace TiStore
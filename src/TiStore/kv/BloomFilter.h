@@ -2,9 +2,17 @@
 
 #include "TiStore/basic/cstdint"
 #include "TiStore/fs/Common.h"
+#include "TiStore/fs/ErrorCode.h"
+#include "TiStore/kv/BloomFilterFormat.h"
 #include "TiStore/kv/Hash.h"
+#include "TiStore/kv/HashBatch.h"
 #include "TiStore/lang/TypeInfo.h"
 
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#include <assert.h>
 #include <string.h>
 #include <stdio.h>
 #include <string>
@@ -61,6 +69,83 @@ void get_posinfo(std::uint32_t bit_pos,
 #endif
 }
 
+//
+// The bits of the bitmaps of the bloom filters, which are read and written
+// by words of std::size_t, so the bitmaps are padded to 8 bytes.
+//
+static inline
+void set_bit(unsigned char * bitmap, std::uint32_t bit_pos)
+{
+    assert(bitmap != nullptr);
+    std::uint32_t index, offset;
+    get_posinfo(bit_pos, index, offset);
+    std::size_t * bits = reinterpret_cast<std::size_t *>(bitmap) + index;
+    *bits |= std::size_t(1) << offset;
+}
+
+static inline
+void clear_bit(unsigned char * bitmap, std::uint32_t bit_pos)
+{
+    assert(bitmap != nullptr);
+    std::uint32_t index, offset;
+    get_posinfo(bit_pos, index, offset);
+    std::size_t * bits = reinterpret_cast<std::size_t *>(bitmap) + index;
+    *bits &= ~(std::size_t(1) << offset);
+}
+
+static inline
+bool test_bit(const unsigned char * bitmap, std::uint32_t bit_pos)
+{
+    assert(bitmap != nullptr);
+    std::uint32_t index, offset;
+    get_posinfo(bit_pos, index, offset);
+    const std::size_t * bits = reinterpret_cast<const std::size_t *>(bitmap) + index;
+    return (((*bits) >> offset) & 1) != 0;
+}
+
+//
+// set_bit() for the bitmaps being built by many threads at a time, see
+// FilterPolicy::Builder::finishParallel(), a word of the bitmap can have
+// the bits of the keys of different threads.
+//
+static inline
+void set_bit_atomic(unsigned char * bitmap, std::uint32_t bit_pos)
+{
+    assert(bitmap != nullptr);
+    std::uint32_t index, offset;
+    get_posinfo(bit_pos, index, offset);
+    std::size_t * bits = reinterpret_cast<std::size_t *>(bitmap) + index;
+    std::size_t mask = std::size_t(1) << offset;
+#if defined(_MSC_VER)
+#if defined(_WIN64)
+    _InterlockedOr64(reinterpret_cast<volatile __int64 *>(bits), (__int64)mask);
+#else
+    _InterlockedOr(reinterpret_cast<volatile long *>(bits), (long)mask);
+#endif
+#else
+    __atomic_fetch_or(bits, mask, __ATOMIC_RELAXED);
+#endif
+}
+
+//
+// set_bit_atomic() by a byte, for the bitmaps which aren't made of aligned
+// words: the regions of the probes of StandardBloomFilter are 8n + 13 bytes
+// long, an atomic on a misaligned word would be undefined (and a split lock
+// on x86). The bits are little endian, so it's the same bit as set_bit().
+//
+static inline
+void set_bit_atomic_byte(unsigned char * bitmap, std::uint32_t bit_pos)
+{
+    assert(bitmap != nullptr);
+    unsigned char * bits = bitmap + (bit_pos >> 3);
+    unsigned char mask = (unsigned char)(1U << (bit_pos & 7));
+#if defined(_MSC_VER)
+    _InterlockedOr8(reinterpret_cast<volatile char *>(bits), (char)mask);
+#else
+    __atomic_fetch_or(bits, mask, __ATOMIC_RELAXED);
+#endif
+}
+
 } // namesoace detail
 
 //
@@ -73,7 +158,9 @@ void get_posinfo(std::uint32_t bit_pos,
 class StandardBloomFilter {
 private:
     HashUtils<> hashUtils_;
-    std::unique_ptr<unsigned char> bitmap_;
+    std::unique_ptr<unsigned char[]> buffer_;
+    // The bitmap, in buffer_, or in the encoding the filter is attached to.
+    unsigned char * bitmap_;
 
     std::size_t bytes_per_probe_;
     std::size_t bits_per_probe_;
@@ -87,13 +174,13 @@ private:
 
 public:
     StandardBloomFilter() :
-        bytes_per_probe_(0), bits_per_probe_(0), num_probes_(0), bytes_total_(0),
+        bitmap_(nullptr), bytes_per_probe_(0), bits_per_probe_(0), num_probes_(0), bytes_total_(0),
         num_total_keys_(0), bits_per_key_(0), verbose_(false) {
     }
 
     StandardBloomFilter(std::size_t num_total_keys, std::size_t bits_per_key, bool verbose = true)
-        : hashUtils_(), bytes_per_probe_(0), bits_per_probe_(0), num_probes_(0), bytes_total_(0),
-          num_total_keys_(num_total_keys), bits_per_key_(bits_per_key), verbose_(verbose) {
+        : hashUtils_(), bitmap_(nullptr), bytes_per_probe_(0), bits_per_probe_(0), num_probes_(0),
+          bytes_total_(0), num_total_keys_(num_total_keys), bits_per_key_(bits_per_key), verbose_(verbose) {
         initFilter(num_total_keys, bits_per_key);
     }
 
@@ -140,10 +227,12 @@ private:
         alignas(8) unsigned char * new_bitmap = new (std::nothrow) unsigned char [bytes_total_];
         if (new_bitmap) {
             ::memset((void *)new_bitmap, 0, bytes_total_ * sizeof(unsigned char));
-            bitmap_.reset(new_bitmap);
+            buffer_.reset(new_bitmap);
+            bitmap_ = new_bitmap;
         }
         else {
-            bitmap_.reset(nullptr);
+            buffer_.reset(nullptr);
+            bitmap_ = nullptr;
         }
         if (getVerbose())
             printf("\n");
@@ -154,7 +243,64 @@ public:
     void setVerbose(bool verbose) { verbose_ = verbose; }
 
     std::size_t getFilterSize() const { return bytes_total_; }
+    std::size_t getNumProbes() const { return num_probes_; }
+
+    const char * getBitmap() const { return reinterpret_cast<const char *>(bitmap_); }
+
+    // A filter attached to an encoding can't be changed.
+    bool isReadOnly() const { return (bitmap_ != nullptr && buffer_.get() == nullptr); }
+
+    // StandardBloomFilter: appends the encoding of the filter, see BloomFilterFormat.h.
+    void encodeTo(std::string * dst) const {
+        BloomFilterHeader header(kStandardBloomFilter, num_probes_, bytes_per_probe_,
+                                 bits_per_key_, bytes_total_);
+        header.encodeTo(dst, getBitmap());
+    }
+
+    // StandardBloomFilter: restores the filter from a copy of the encoding.
+    int decodeFrom(const Slice & input, bool verify_checksum = true) {
+        return decodeFilter(input, verify_checksum, true);
+    }
+
+    // StandardBloomFilter: makes the filter a read-only view of the encoding,
+    // without a copy, the encoding must outlive the filter.
+    int attach(const Slice & input, bool verify_checksum = true) {
+        return decodeFilter(input, verify_checksum, false);
+    }
 
+private:
+    int decodeFilter(const Slice & input, bool verify_checksum, bool copy) {
+        BloomFilterHeader header;
+        const char * bitmap;
+        int status = header.decodeFrom(input, kStandardBloomFilter, &bitmap, verify_checksum);
+        if (status != error_code::no_error)
+            return status;
+        if (header.num_probes < 1 || header.num_probes > 30 || header.bytes_per_probe < 8
+            || (std::uint64_t)header.bytes_per_probe * header.num_probes > header.bitmap_bytes)
+            return error_code::err_corruption;
+
+        std::size_t bytes = BloomFilterHeader::paddedSize(header.bitmap_bytes);
+        if (copy) {
+            unsigned char * new_bitmap = new (std::nothrow) unsigned char[bytes];
+            if (new_bitmap == nullptr)
+                return error_code::out_of_memory;
+            ::memcpy((void *)new_bitmap, bitmap, bytes);
+            buffer_.reset(new_bitmap);
+            bitmap_ = new_bitmap;
+        }
+        else {
+            buffer_.reset(nullptr);
+            bitmap_ = reinterpret_cast<unsigned char *>(const_cast<char *>(bitmap));
+        }
+        num_probes_ = header.num_probes;
+        bytes_per_probe_ = header.bytes_per_probe;
+        bits_per_probe_ = bytes_per_probe_ * 8;
+        bits_per_key_ = header.bits_per_key;
+        bytes_total_ = (std::size_t)header.bitmap_bytes;
+        return error_code::no_error;
+    }
+
+public:
     // StandardBloomFilter
     void setOption(std::size_t num_total_keys, std::size_t bits_per_key, bool verbose = true) {
         setVerbose(verbose);
@@ -163,7 +309,7 @@ public:
 
     // StandardBloomFilter
     void reset() {
-        unsigned char * bitmap = bitmap_.get();
+        unsigned char * bitmap = bitmap_;
         assert(bitmap != nullptr);
         if (bitmap) {
             assert(bytes_total_ != 0);
@@ -174,7 +320,7 @@ public:
     std::size_t getUsedBits() const {
         std::size_t total_used = 0;
         std::size_t probe_used;
-        unsigned char * bitmap = bitmap_.get();
+        unsigned char * bitmap = bitmap_;
         unsigned char * cur;
         //printf("| ");
         for (int k = 0; k < (int)num_probes_; k++) {
@@ -196,59 +342,56 @@ public:
     // StandardBloomFilter
     inline void setBit(std::uint32_t probes, std::uint32_t bit_pos) {
         assert(probes < num_probes_);
-        std::uint32_t index, offset;
-        detail::get_posinfo(bit_pos, index, offset);
-        register std::size_t bit_mask = std::size_t(1) << offset;
-        std::size_t * probe_bits = (std::size_t *)(bitmap_.get() + probes * bytes_per_probe_) + index;
-        assert(probe_bits != nullptr);
-        register std::size_t bits_val = (*probe_bits);
-        bits_val |= bit_mask;
-        *probe_bits = bits_val;
+        detail::set_bit(bitmap_ + probes * bytes_per_probe_, bit_pos);
     }
 
     // StandardBloomFilter
     inline void clearBit(std::uint32_t probes, std::uint32_t bit_pos) {
         assert(probes < num_probes_);
-        std::uint32_t index, offset;
-        detail::get_posinfo(bit_pos, index, offset);
-        register std::size_t bit_mask = ~(std::size_t(1) << offset);
-        std::size_t * probe_bits = (std::size_t *)(bitmap_.get() + probes * bytes_per_probe_) + index;
-        assert(probe_bits != nullptr);
-        register std::size_t bits_val = (*probe_bits);
-        bits_val &= bit_mask;
-        *probe_bits = bits_val;
+        detail::clear_bit(bitmap_ + probes * bytes_per_probe_, bit_pos);
     }
 
     // StandardBloomFilter
     inline bool insideBitmap(std::uint32_t probes, std::uint32_t bit_pos) const {
         assert(probes < num_probes_);
-        std::uint32_t index, offset;
-        detail::get_posinfo(bit_pos, index, offset);
-        register std::size_t bit_mask = std::size_t(1) << offset;
-        std::size_t * probe_bits = (std::size_t *)(bitmap_.get() + probes * bytes_per_probe_) + index;
-        assert(probe_bits != nullptr);
-        register std::size_t bits_val = (*probe_bits);
-        return ((bits_val & bit_mask) != 0);
+        return detail::test_bit(bitmap_ + probes * bytes_per_probe_, bit_pos);
     }
 
     // StandardBloomFilter
     void addKey(const Slice & key) {
         std::uint32_t primary_hash = hashUtils_.primaryHash(key.data(), key.size(), kDefaultHashSeed);
+        std::uint32_t secondary_hash = hashUtils_.secondaryHash(key.data(), key.size());
+        addHash(primary_hash, secondary_hash);
+        if (getVerbose())
+            printf("addKey(): %s\n", key.data());
+    }
+
+    // StandardBloomFilter: adds a key by its primary and secondary hashes.
+    void addHash(std::uint32_t primary_hash, std::uint32_t secondary_hash) {
+        assert(!isReadOnly());
         std::uint32_t bit_pos = primary_hash % ((std::uint32_t)bits_per_probe_ - 1);
         // Note: 0 is first probe index, it's primary_hash function.
         setBit(0, bit_pos);
-        if (num_probes_ > 1) {
-            std::uint32_t secondary_hash, hash;
-            secondary_hash = hashUtils_.secondaryHash(key.data(), key.size());
-            hash = secondary_hash;
-            for (int i = 1; i < (int)num_probes_; ++i) {
-                bit_pos = hash % ((std::uint32_t)bits_per_probe_ - 1);
-                setBit(i, bit_pos);
-                hash += secondary_hash;
-            }
+        std::uint32_t hash = secondary_hash;
+        for (int i = 1; i < (int)num_probes_; ++i) {
+            bit_pos = hash % ((std::uint32_t)bits_per_probe_ - 1);
+            setBit(i, bit_pos);
+            hash += secondary_hash;
+        }
+    }
+
+    // StandardBloomFilter: addHash(), the other threads may add keys at the same time.
+    void addHashConcurrently(std::uint32_t primary_hash, std::uint32_t secondary_hash) {
+        assert(!isReadOnly());
+        std::uint32_t bit_pos = primary_hash % ((std::uint32_t)bits_per_probe_ - 1);
+        detail::set_bit_atomic_byte(bitmap_, bit_pos);
+        std::uint32_t hash = secondary_hash;
+        for (int i = 1; i < (int)num_probes_; ++i) {
+            bit_pos = hash % ((std::uint32_t)bits_per_probe_ - 1);
+            // The regions of the probes after the first one are not aligned to words.
+            detail::set_bit_atomic_byte(bitmap_ + i * bytes_per_probe_, bit_pos);
+            hash += secondary_hash;
         }
-        if (getVerbose())
-            printf("addKey(): %s\n", key.data());
     }
 
     // StandardBloomFilter
@@ -310,7 +453,9 @@ public:
 class FullBloomFilter {
 private:
     HashUtils<> hashUtils_;
-    std::unique_ptr<unsigned char> bitmap_;
+    std::unique_ptr<unsigned char[]> buffer_;
+    // The bitmap, in buffer_, or in the encoding the filter is attached to.
+    unsigned char * bitmap_;
 
     std::size_t bits_total_;
     std::size_t num_probes_;
@@ -323,14 +468,18 @@ private:
     bool verbose_;
 
 public:
+    // The probes are the 32-bit hashes modulo the bits of the bitmap, so a
+    // bitmap has less than 2^32 bits, the bigger ones are refused.
+    static const std::size_t kMaxBytesTotal = 0xFFFFFFFFUL / 8;
+
     FullBloomFilter() :
-        bits_total_(0), num_probes_(0), bytes_per_probe_(0), 
+        bitmap_(nullptr), bits_total_(0), num_probes_(0), bytes_per_probe_(0), 
         bytes_total_(0), num_total_keys_(0), bits_per_key_(0),
         verbose_(false) {
     }
 
     FullBloomFilter(std::size_t num_total_keys, std::size_t bits_per_key, bool verbose = true)
-        : hashUtils_(), bits_total_(0), num_probes_(0), bytes_per_probe_(0), 
+        : hashUtils_(), bitmap_(nullptr), bits_total_(0), num_probes_(0), bytes_per_probe_(0),
           bytes_total_(0), num_total_keys_(num_total_keys), bits_per_key_(bits_per_key),
           verbose_(verbose) {
         initFilter(num_total_keys, bits_per_key);
@@ -350,6 +499,15 @@ private:
         std::size_t bytes = (num_total_keys * bits_per_key + 7) / 8 + 1;
         //bytes_total_ = ALIGNED_TO(bytes, CACHE_LINE_SIZE);
         bytes_total_ = ALIGNED_TO(bytes, 8) + 13;
+        if (bytes_total_ > kMaxBytesTotal) {
+            if (getVerbose())
+                printf("FullBloomFilter: %zu bytes is more than %zu bytes.\n\n", bytes_total_, kMaxBytesTotal);
+            buffer_.reset(nullptr);
+            bitmap_ = nullptr;
+            bytes_total_ = 0;
+            bits_total_ = 0;
+            return;
+        }
         bits_total_ = bytes_total_ * 8;
 
         bytes_per_probe_ = (bytes_total_ / num_probes_) + 1;
@@ -372,13 +530,17 @@ private:
                    (std::size_t)((double)(bits_total_) * 0.69 / (double)(num_probes_)),
                    (double)(bits_total_) / (double)(num_total_keys));
         }
-        alignas(8) unsigned char * new_bitmap = new (std::nothrow) unsigned char[bytes_total_];
+        // The bits are read 8 bytes at a time, round up the allocation.
+        std::size_t alloc_bytes = ALIGNED_TO(bytes_total_, 8);
+        alignas(8) unsigned char * new_bitmap = new (std::nothrow) unsigned char[alloc_bytes];
         if (new_bitmap) {
-            ::memset((void *)new_bitmap, 0, bytes_total_ * sizeof(unsigned char));
-            bitmap_.reset(new_bitmap);
+            ::memset((void *)new_bitmap, 0, alloc_bytes * sizeof(unsigned char));
+            buffer_.reset(new_bitmap);
+            bitmap_ = new_bitmap;
         }
         else {
-            bitmap_.reset(nullptr);
+            buffer_.reset(nullptr);
+            bitmap_ = nullptr;
         }
         if (getVerbose())
             printf("\n");
@@ -389,6 +551,72 @@ public:
     void setVerbose(bool verbose) { verbose_ = verbose; }
 
     std::size_t getFilterSize() const { return bytes_total_; }
+    std::size_t getNumProbes() const { return num_probes_; }
+
+    // The raw bitmap, getFilterSize() bytes, e.g. to store it in a table file.
+    const char * getBitmap() const { return reinterpret_cast<const char *>(bitmap_); }
+
+    // A filter attached to an encoding can't be changed.
+    bool isReadOnly() const { return (bitmap_ != nullptr && buffer_.get() == nullptr); }
+
+    // FullBloomFilter: appends the encoding of the filter, see BloomFilterFormat.h.
+    void encodeTo(std::string * dst) const {
+        BloomFilterHeader header(kFullBloomFilter, num_probes_, 0, bits_per_key_, bytes_total_);
+        header.encodeTo(dst, getBitmap());
+    }
+
+    // FullBloomFilter: restores the filter from a copy of the encoding.
+    int decodeFrom(const Slice & input, bool verify_checksum = true) {
+        BloomFilterHeader header;
+        const char * bitmap;
+        int status = header.decodeFrom(input, kFullBloomFilter, &bitmap, verify_checksum);
+        if (status != error_code::no_error)
+            return status;
+        if (!loadFilter(bitmap, (std::size_t)header.bitmap_bytes, header.num_probes))
+            return error_code::err_corruption;
+        bits_per_key_ = header.bits_per_key;
+        return error_code::no_error;
+    }
+
+    // FullBloomFilter: makes the filter a read-only view of the encoding,
+    // without a copy, the encoding must outlive the filter.
+    int attach(const Slice & input, bool verify_checksum = true) {
+        BloomFilterHeader header;
+        const char * bitmap;
+        int status = header.decodeFrom(input, kFullBloomFilter, &bitmap, verify_checksum);
+        if (status != error_code::no_error)
+            return status;
+        if (header.num_probes < 1 || header.num_probes > 30 || header.bitmap_bytes > kMaxBytesTotal)
+            return error_code::err_corruption;
+        buffer_.reset(nullptr);
+        bitmap_ = reinterpret_cast<unsigned char *>(const_cast<char *>(bitmap));
+        bytes_total_ = (std::size_t)header.bitmap_bytes;
+        bits_total_ = bytes_total_ * 8;
+        num_probes_ = header.num_probes;
+        bytes_per_probe_ = (bytes_total_ / num_probes_) + 1;
+        bits_per_key_ = header.bits_per_key;
+        return error_code::no_error;
+    }
+
+    // FullBloomFilter: restore a filter from its raw bitmap and probes.
+    bool loadFilter(const char * bitmap, std::size_t bytes, std::size_t num_probes) {
+        if (bitmap == nullptr || bytes == 0 || bytes > kMaxBytesTotal || num_probes < 1 || num_probes > 30)
+            return false;
+        // The bits are read 8 bytes at a time.
+        std::size_t alloc_bytes = ALIGNED_TO(bytes, 8);
+        unsigned char * new_bitmap = new (std::nothrow) unsigned char[alloc_bytes];
+        if (new_bitmap == nullptr)
+            return false;
+        ::memcpy((void *)new_bitmap, bitmap, bytes);
+        ::memset((void *)(new_bitmap + bytes), 0, alloc_bytes - bytes);
+        buffer_.reset(new_bitmap);
+        bitmap_ = new_bitmap;
+        bytes_total_ = bytes;
+        bits_total_ = bytes * 8;
+        num_probes_ = num_probes;
+        bytes_per_probe_ = (bytes_total_ / num_probes_) + 1;
+        return true;
+    }
 
     // FullBloomFilter
     void setOption(std::size_t num_total_keys, std::size_t bits_per_key, bool verbose = true) {
@@ -398,7 +626,7 @@ public:
 
     // FullBloomFilter
     void reset() {
-        unsigned char * bitmap = bitmap_.get();
+        unsigned char * bitmap = bitmap_;
         assert(bitmap != nullptr);
         if (bitmap) {
             assert(bytes_total_ != 0);
@@ -408,7 +636,7 @@ public:
 
     std::size_t getUsedBits() const {
         std::size_t total_used = 0;
-        unsigned char * cur = bitmap_.get();
+        unsigned char * cur = bitmap_;
         for (int n = 0; n < (int)bytes_total_; n++) {
             std::size_t bits = BitsSetTable256[*cur];
             total_used += bits;
@@ -419,59 +647,65 @@ public:
 
     // FullBloomFilter
     inline void setBit(std::uint32_t bit_pos) {
-        std::uint32_t index, offset;
-        detail::get_posinfo(bit_pos, index, offset);
-        register std::size_t bit_mask = std::size_t(1) << offset;
-        std::size_t * probe_bits = (std::size_t *)(bitmap_.get()) + index;
-        assert(probe_bits != nullptr);
-        register std::size_t bits_val = (*probe_bits);
-        bits_val |= bit_mask;
-        *probe_bits = bits_val;
+        detail::set_bit(bitmap_, bit_pos);
     }
 
     // FullBloomFilter
     inline void clearBit(std::uint32_t bit_pos) {
-        std::uint32_t index, offset;
-        detail::get_posinfo(bit_pos, index, offset);
-        register std::size_t bit_mask = ~(std::size_t(1) << offset);
-        std::size_t * probe_bits = (std::size_t *)(bitmap_.get()) + index;
-        assert(probe_bits != nullptr);
-        register std::size_t bits_val = (*probe_bits);
-        bits_val &= bit_mask;
-        *probe_bits = bits_val;
+        detail::clear_bit(bitmap_, bit_pos);
     }
 
     // FullBloomFilter
     inline bool insideBitmap(std::uint32_t bit_pos) const {
-        std::uint32_t index, offset;
-        detail::get_posinfo(bit_pos, index, offset);
-        register std::size_t bit_mask = std::size_t(1) << offset;
-        std::size_t * probe_bits = (std::size_t *)(bitmap_.get()) + index;
-        assert(probe_bits != nullptr);
-        register std::size_t bits_val = (*probe_bits);
-        return ((bits_val & bit_mask) != 0);
+        return detail::test_bit(bitmap_, bit_pos);
     }
 
     // FullBloomFilter
     void addKey(const Slice & key) {
         std::uint32_t primary_hash = hashUtils_.primaryHash(key.data(), key.size(), kDefaultHashSeed);
-        std::uint32_t bit_pos = primary_hash % ((std::uint32_t)bits_total_ - 0);
-        // Note: 0 is first probe index, it's primary_hash function.
-        setBit(bit_pos);
-        if (num_probes_ > 1) {
-            std::uint32_t secondary_hash, hash;
-            secondary_hash = hashUtils_.secondaryHash(key.data(), key.size());
-            hash = secondary_hash;
-            for (int i = 1; i < (int)num_probes_; ++i) {
-                bit_pos = hash % ((std::uint32_t)bits_total_ - 0);
-                setBit(bit_pos);
-                hash += secondary_hash;
-            }
-        }
+        std::uint32_t secondary_hash = hashUtils_.secondaryHash(key.data(), key.size());
+        addHash(primary_hash, secondary_hash);
         if (getVerbose())
             printf("addKey(): %s\n", key.data());
     }
 
+    // FullBloomFilter: adds a key by its primary and secondary hashes, e.g.
+    // to hash a key once for many filters. The i-th probe is
+    // primary_hash + i * secondary_hash (double hashing), so the probes of
+    // two keys only collide together if both of their hashes do.
+    void addHash(std::uint32_t primary_hash, std::uint32_t secondary_hash) {
+        assert(!isReadOnly());
+        std::uint32_t hash = primary_hash;
+        for (int i = 0; i < (int)num_probes_; ++i) {
+            std::uint32_t bit_pos = hash % ((std::uint32_t)bits_total_ - 0);
+            setBit(bit_pos);
+            hash += secondary_hash;
+        }
+    }
+
+    // FullBloomFilter: addHash(), the other threads may add keys at the same time.
+    void addHashConcurrently(std::uint32_t primary_hash, std::uint32_t secondary_hash) {
+        assert(!isReadOnly());
+        std::uint32_t hash = primary_hash;
+        for (int i = 0; i < (int)num_probes_; ++i) {
+            std::uint32_t bit_pos = hash % ((std::uint32_t)bits_total_ - 0);
+            detail::set_bit_atomic(bitmap_, bit_pos);
+            hash += secondary_hash;
+        }
+    }
+
+    // FullBloomFilter: maybeMatch() of a key added by addHash().
+    bool matchHash(std::uint32_t primary_hash, std::uint32_t secondary_hash) const {
+        std::uint32_t hash = primary_hash;
+        for (int i = 0; i < (int)num_probes_; ++i) {
+            std::uint32_t bit_pos = hash % ((std::uint32_t)bits_total_ - 0);
+            if (!insideBitmap(bit_pos))
+                return false;
+            hash += secondary_hash;
+        }
+        return true;
+    }
+
     // FullBloomFilter
     bool maybeMatch(const Slice & key) const {
         std::uint32_t primary_hash = hashUtils_.primaryHash(key.data(), key.size(), kDefaultHashSeed);
@@ -483,7 +717,7 @@ public:
         if (num_probes_ > 1) {
             std::uint32_t secondary_hash, hash;
             secondary_hash = hashUtils_.secondaryHash(key.data(), key.size());
-            hash = secondary_hash;
+            hash = primary_hash + secondary_hash;
             for (int i = 1; i < (int)num_probes_; ++i) {
                 bit_pos = hash % ((std::uint32_t)bits_total_ - 0);
                 isMatch = insideBitmap(bit_pos);
@@ -494,24 +728,319 @@ public:
         }
         return true;
     }
+
+    //
+    // FullBloomFilter: out[i] = maybeMatch(keys[i]). The keys are hashed (by
+    // BatchHash) and the words of their probes prefetched kBatchSize at a
+    // time, before any of them is tested, so the cache misses of the keys
+    // overlap. All the
+    // probes are computed, without the early exit, so it only pays off when
+    // the filter doesn't fit in the caches.
+    //
+    void maybeMatchBatch(const Slice * keys, std::size_t n, bool * out) const {
+        static const std::size_t kBatchSize = 16;
+        static const std::size_t kMaxNumProbes = 30;
+        // The bit positions of the probes, the modulo is computed only once.
+        std::uint32_t bit_positions[kBatchSize][kMaxNumProbes];
+        std::uint32_t primary_hashes[kBatchSize], secondary_hashes[kBatchSize];
+        const std::uint32_t bits_total = (std::uint32_t)bits_total_;
+        const std::size_t num_probes = num_probes_;
+        const std::size_t * bitmap = reinterpret_cast<const std::size_t *>(bitmap_);
+
+        for (std::size_t start = 0; start < n; start += kBatchSize) {
+            std::size_t count = ((n - start) < kBatchSize) ? (n - start) : kBatchSize;
+            BatchHash::hashPair(keys + start, count, kDefaultHashSeed, primary_hashes, secondary_hashes);
+            for (std::size_t i = 0; i < count; i++) {
+                std::uint32_t secondary_hash = secondary_hashes[i];
+                std::uint32_t hash = primary_hashes[i];
+                for (std::size_t k = 0; k < num_probes; ++k) {
+                    bit_positions[i][k] = hash % bits_total;
+                    hash += secondary_hash;
+                }
+                for (std::size_t k = 0; k < num_probes; ++k) {
+                    std::uint32_t index, offset;
+                    detail::get_posinfo(bit_positions[i][k], index, offset);
+                    TISTORE_PREFETCH(bitmap + index);
+                }
+            }
+            for (std::size_t i = 0; i < count; i++) {
+                bool isMatch = true;
+                for (std::size_t k = 0; isMatch && k < num_probes; ++k) {
+                    isMatch = insideBitmap(bit_positions[i][k]);
+                }
+                out[start + i] = isMatch;
+            }
+        }
+    }
 };
 
-class BloomFilter {
+//
+// A cache-line-blocked bloom filter: the primary hash picks one line of
+// CACHE_LINE_SIZE bytes, and all the probes of the key land in that line,
+// so a lookup costs one cache miss instead of up to num_probes_.
+//
+// The probes come from the secondary hash: each one takes the top 9 bits
+// (a bit of the 512 bits line) and multiplies the hash by the golden ratio
+// for the next one. The false positive rate is a little higher than the
+// one of FullBloomFilter with the same bits per key, because the lines
+// are not evenly loaded.
+//
+// See: "Cache-, Hash- and Space-Efficient Bloom Filters", Putze, Sanders, Singler.
+// See: https://github.com/facebook/rocksdb/blob/master/util/bloom_impl.h (FastLocalBloomImpl)
+//
+class BlockedBloomFilter {
+public:
+    static const std::size_t kBytesPerLine = CACHE_LINE_SIZE;
+    static const std::size_t kBitsPerLine = kBytesPerLine * 8;
+    static const std::size_t kMaxNumProbes = 16;
+
 private:
-    std::string name_;
-    std::string root_;
-    std::size_t capacity_;
-    std::size_t block_size_;
+    HashUtils<> hashUtils_;
+    std::unique_ptr<unsigned char[]> buffer_;
+    // bitmap_ is buffer_ aligned to kBytesPerLine.
+    unsigned char * bitmap_;
+
+    std::size_t num_lines_;
+    std::size_t num_probes_;
+
+    std::size_t bytes_total_;
+    std::size_t num_total_keys_;
+    std::size_t bits_per_key_;
+
+    bool verbose_;
 
 public:
-    BloomFilter() {};
-    BloomFilter(const char * name) : name_(name), root_(""),
-        capacity_(0), block_size_(0) {}
-    virtual ~BloomFilter() {}
+    BlockedBloomFilter() :
+        bitmap_(nullptr), num_lines_(0), num_probes_(0),
+        bytes_total_(0), num_total_keys_(0), bits_per_key_(0),
+        verbose_(false) {
+    }
+
+    BlockedBloomFilter(std::size_t num_total_keys, std::size_t bits_per_key, bool verbose = true)
+        : hashUtils_(), bitmap_(nullptr), num_lines_(0), num_probes_(0),
+          bytes_total_(0), num_total_keys_(num_total_keys), bits_per_key_(bits_per_key),
+          verbose_(verbose) {
+        initFilter(num_total_keys, bits_per_key);
+    }
 
-    bool build() {
+    ~BlockedBloomFilter() {}
+
+private:
+    bool allocBitmap(std::size_t num_lines) noexcept {
+        std::size_t bytes = num_lines * kBytesPerLine;
+        unsigned char * new_buffer = new (std::nothrow) unsigned char[bytes + kBytesPerLine - 1];
+        buffer_.reset(new_buffer);
+        if (new_buffer == nullptr) {
+            bitmap_ = nullptr;
+            num_lines_ = 0;
+            bytes_total_ = 0;
+            return false;
+        }
+        bitmap_ = reinterpret_cast<unsigned char *>(
+            ALIGNED_TO((std::size_t)new_buffer, kBytesPerLine));
+        ::memset((void *)bitmap_, 0, bytes);
+        num_lines_ = num_lines;
+        bytes_total_ = bytes;
         return true;
     }
+
+    void initFilter(std::size_t num_total_keys, std::size_t bits_per_key) noexcept {
+        num_total_keys_ = num_total_keys;
+        bits_per_key_ = bits_per_key;
+        num_probes_ = static_cast<std::size_t>((double)bits_per_key * 0.69);
+        if (num_probes_ < 1)
+            num_probes_ = 1;
+        if (num_probes_ > kMaxNumProbes)
+            num_probes_ = kMaxNumProbes;
+
+        std::size_t bits = num_total_keys * bits_per_key;
+        std::size_t num_lines = (bits + kBitsPerLine - 1) / kBitsPerLine;
+        if (num_lines < 1)
+            num_lines = 1;
+        allocBitmap(num_lines);
+
+        if (getVerbose()) {
+            printf("num_total_keys      = %zu keys\n"
+                   "bits_per_key        = %zu\n"
+                   "num_lines           = %zu lines\n"
+                   "num_probes          = %zu\n\n",
+                    num_total_keys_, bits_per_key_, num_lines_, num_probes_);
+            printf("size_of_bitmap_     = %zu bytes\n\n", bytes_total_);
+        }
+    }
+
+    // Picks the line by the high bits of (hash * num_lines_), see:
+    // http://lemire.me/blog/2016/06/27/a-fast-alternative-to-the-modulo-reduction/
+    inline const std::uint64_t * getLine(std::uint32_t primary_hash) const {
+        std::size_t line = (std::size_t)(((std::uint64_t)primary_hash * num_lines_) >> 32);
+        return reinterpret_cast<const std::uint64_t *>(bitmap_ + line * kBytesPerLine);
+    }
+
+public:
+    bool getVerbose() const { return verbose_; }
+    void setVerbose(bool verbose) { verbose_ = verbose; }
+
+    std::size_t getFilterSize() const { return bytes_total_; }
+    std::size_t getNumProbes() const { return num_probes_; }
+    std::size_t getNumLines() const { return num_lines_; }
+
+    const char * getBitmap() const { return reinterpret_cast<const char *>(bitmap_); }
+
+    // A filter attached to an encoding can't be changed.
+    bool isReadOnly() const { return (bitmap_ != nullptr && buffer_.get() == nullptr); }
+
+    // BlockedBloomFilter: appends the encoding of the filter, see BloomFilterFormat.h.
+    void encodeTo(std::string * dst) const {
+        BloomFilterHeader header(kBlockedBloomFilter, num_probes_, 0, bits_per_key_, bytes_total_);
+        header.encodeTo(dst, getBitmap());
+    }
+
+    // BlockedBloomFilter: restores the filter from a copy of the encoding.
+    int decodeFrom(const Slice & input, bool verify_checksum = true) {
+        BloomFilterHeader header;
+        const char * bitmap;
+        int status = header.decodeFrom(input, kBlockedBloomFilter, &bitmap, verify_checksum);
+        if (status != error_code::no_error)
+            return status;
+        if (!loadFilter(bitmap, (std::size_t)header.bitmap_bytes, header.num_probes))
+            return error_code::err_corruption;
+        bits_per_key_ = header.bits_per_key;
+        return error_code::no_error;
+    }
+
+    // BlockedBloomFilter: makes the filter a read-only view of the encoding,
+    // without a copy, the encoding must outlive the filter. The lines of
+    // the view are not aligned to the cache lines unless the encoding is.
+    int attach(const Slice & input, bool verify_checksum = true) {
+        BloomFilterHeader header;
+        const char * bitmap;
+        int status = header.decodeFrom(input, kBlockedBloomFilter, &bitmap, verify_checksum);
+        if (status != error_code::no_error)
+            return status;
+        if (header.num_probes < 1 || header.num_probes > kMaxNumProbes
+            || (header.bitmap_bytes % kBytesPerLine) != 0)
+            return error_code::err_corruption;
+        buffer_.reset(nullptr);
+        bitmap_ = reinterpret_cast<unsigned char *>(const_cast<char *>(bitmap));
+        bytes_total_ = (std::size_t)header.bitmap_bytes;
+        num_lines_ = bytes_total_ / kBytesPerLine;
+        num_probes_ = header.num_probes;
+        bits_per_key_ = header.bits_per_key;
+        return error_code::no_error;
+    }
+
+    // BlockedBloomFilter: restore a filter from its raw bitmap and probes.
+    bool loadFilter(const char * bitmap, std::size_t bytes, std::size_t num_probes) {
+        if (bitmap == nullptr || bytes == 0 || (bytes % kBytesPerLine) != 0
+            || num_probes < 1 || num_probes > kMaxNumProbes)
+            return false;
+        if (!allocBitmap(bytes / kBytesPerLine))
+            return false;
+        ::memcpy((void *)bitmap_, bitmap, bytes);
+        num_probes_ = num_probes;
+        return true;
+    }
+
+    // BlockedBloomFilter
+    void setOption(std::size_t num_total_keys, std::size_t bits_per_key, bool verbose = true) {
+        setVerbose(verbose);
+        initFilter(num_total_keys, bits_per_key);
+    }
+
+    // BlockedBloomFilter
+    void reset() {
+        assert(bitmap_ != nullptr);
+        if (bitmap_) {
+            ::memset((void *)bitmap_, 0, bytes_total_ * sizeof(unsigned char));
+        }
+    }
+
+    std::size_t getUsedBits() const {
+        std::size_t total_used = 0;
+        const unsigned char * cur = bitmap_;
+        for (std::size_t n = 0; n < bytes_total_; n++) {
+            total_used += BitsSetTable256[*cur];
+            cur++;
+        }
+        return total_used;
+    }
+
+    // BlockedBloomFilter
+    void addKey(const Slice & key) {
+        std::uint32_t primary_hash = hashUtils_.primaryHash(key.data(), key.size(), kDefaultHashSeed);
+        std::uint32_t secondary_hash = hashUtils_.secondaryHash(key.data(), key.size());
+        addHash(primary_hash, secondary_hash);
+        if (getVerbose())
+            printf("addKey(): %s\n", key.data());
+    }
+
+    // BlockedBloomFilter: adds a key by its primary and secondary hashes.
+    void addHash(std::uint32_t primary_hash, std::uint32_t secondary_hash) {
+        assert(!isReadOnly());
+        std::uint64_t * line = const_cast<std::uint64_t *>(getLine(primary_hash));
+        std::uint32_t hash = secondary_hash;
+        for (int i = 0; i < (int)num_probes_; ++i) {
+            // The top 9 bits of the hash are the bit position in the line.
+            std::uint32_t bit_pos = hash >> (32 - 9);
+            line[bit_pos >> 6] |= std::uint64_t(1) << (bit_pos & 63);
+            hash *= 0x9E3779B9U;
+        }
+    }
+
+    // BlockedBloomFilter: addHash(), the other threads may add keys at the same time.
+    void addHashConcurrently(std::uint32_t primary_hash, std::uint32_t secondary_hash) {
+        assert(!isReadOnly());
+        unsigned char * line = reinterpret_cast<unsigned char *>(
+            const_cast<std::uint64_t *>(getLine(primary_hash)));
+        std::uint32_t hash = secondary_hash;
+        for (int i = 0; i < (int)num_probes_; ++i) {
+            detail::set_bit_atomic(line, hash >> (32 - 9));
+            hash *= 0x9E3779B9U;
+        }
+    }
+
+    // BlockedBloomFilter
+    bool maybeMatch(const Slice & key) const {
+        std::uint32_t primary_hash = hashUtils_.primaryHash(key.data(), key.size(), kDefaultHashSeed);
+        const std::uint64_t * line = getLine(primary_hash);
+        return matchLine(line, hashUtils_.secondaryHash(key.data(), key.size()));
+    }
+
+    //
+    // BlockedBloomFilter: out[i] = maybeMatch(keys[i]). The keys are hashed
+    // (by BatchHash) and their lines prefetched kBatchSize at a time, before
+    // any of them is tested, so the cache misses of the keys overlap.
+    //
+    void maybeMatchBatch(const Slice * keys, std::size_t n, bool * out) const {
+        static const std::size_t kBatchSize = 16;
+        const std::uint64_t * lines[kBatchSize];
+        std::uint32_t primary_hashes[kBatchSize], hashes[kBatchSize];
+
+        for (std::size_t start = 0; start < n; start += kBatchSize) {
+            std::size_t count = ((n - start) < kBatchSize) ? (n - start) : kBatchSize;
+            BatchHash::hashPair(keys + start, count, kDefaultHashSeed, primary_hashes, hashes);
+            for (std::size_t i = 0; i < count; i++) {
+                lines[i] = getLine(primary_hashes[i]);
+                TISTORE_PREFETCH(lines[i]);
+            }
+            for (std::size_t i = 0; i < count; i++) {
+                out[start + i] = matchLine(lines[i], hashes[i]);
+            }
+        }
+    }
+
+private:
+    inline bool matchLine(const std::uint64_t * line, std::uint32_t hash) const {
+        // All the probes are in one line, checking them all without a branch
+        // is cheaper than a mispredicted early exit.
+        std::uint64_t isMatch = 1;
+        for (int i = 0; i < (int)num_probes_; ++i) {
+            std::uint32_t bit_pos = hash >> (32 - 9);
+            isMatch &= (line[bit_pos >> 6] >> (bit_pos & 63));
+            hash *= 0x9E3779B9U;
+        }
+        return (isMatch != 0);
+    }
 };
 
 } // namespace TiStore
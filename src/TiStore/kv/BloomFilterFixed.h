@@ -2,6 +2,9 @@
 
 #include "TiStore/basic/cstdint"
 #include "TiStore/fs/Common.h"
+#include "TiStore/fs/ErrorCode.h"
+#include "TiStore/kv/BloomFilter.h"
+#include "TiStore/kv/BloomFilterFormat.h"
 #include "TiStore/kv/Hash.h"
 #include "TiStore/lang/TypeInfo.h"
 
@@ -57,7 +60,10 @@ private:
     // The size of total keys.
     static const std::size_t kSizeOfTotalKeys = (std::size_t)((double)(kBitsOfPerProbe) * 0.69);
 
-    std::unique_ptr<unsigned char> bitmap_;
+    HashUtils<> hashUtils_;
+    std::unique_ptr<unsigned char[]> buffer_;
+    // The bitmap, in buffer_, or in the encoding the filter is attached to.
+    unsigned char * bitmap_;
 
     std::size_t bytes_per_probe_;
     std::size_t bits_per_probe_;
@@ -69,7 +75,7 @@ private:
 
 public:
     StandardBloomFilterFixed(bool verbose = true)
-        : bytes_per_probe_((kBitsOfPerProbe + 7) / 8), bits_per_probe_((kBitsOfPerProbe + 7) / 8 * 8),
+        : bitmap_(nullptr), bytes_per_probe_((kBitsOfPerProbe + 7) / 8), bits_per_probe_((kBitsOfPerProbe + 7) / 8 * 8),
           num_probes_(kNumProbes), size_of_bitmap_(0), bits_per_key_(kBitsPerKey), verbose_(verbose) {
         initBloomFilter();
     }
@@ -80,6 +86,61 @@ public:
 
     std::size_t getFilterSize() const { return size_of_bitmap_; }
 
+    const char * getBitmap() const { return reinterpret_cast<const char *>(bitmap_); }
+
+    // A filter attached to an encoding can't be changed.
+    bool isReadOnly() const { return (bitmap_ != nullptr && buffer_.get() == nullptr); }
+
+    // StandardBloomFilterFixed: appends the encoding of the filter, see BloomFilterFormat.h.
+    void encodeTo(std::string * dst) const {
+        BloomFilterHeader header(kStandardBloomFilterFixed, num_probes_, bytes_per_probe_, bits_per_key_, size_of_bitmap_);
+        header.encodeTo(dst, getBitmap());
+    }
+
+    // StandardBloomFilterFixed: restores the bits from a copy of an encoding of a filter
+    // with the same template arguments.
+    int decodeFrom(const Slice & input, bool verify_checksum = true) {
+        const char * bitmap;
+        int status = decodeHeader(input, verify_checksum, &bitmap);
+        if (status != error_code::no_error)
+            return status;
+        if (buffer_.get() == nullptr) {
+            unsigned char * new_bitmap = new (std::nothrow) unsigned char[size_of_bitmap_];
+            if (new_bitmap == nullptr)
+                return error_code::out_of_memory;
+            buffer_.reset(new_bitmap);
+        }
+        bitmap_ = buffer_.get();
+        ::memcpy((void *)bitmap_, bitmap, size_of_bitmap_);
+        return error_code::no_error;
+    }
+
+    // StandardBloomFilterFixed: makes the filter a read-only view of the encoding, without
+    // a copy, the encoding must outlive the filter.
+    int attach(const Slice & input, bool verify_checksum = true) {
+        const char * bitmap;
+        int status = decodeHeader(input, verify_checksum, &bitmap);
+        if (status != error_code::no_error)
+            return status;
+        buffer_.reset(nullptr);
+        bitmap_ = reinterpret_cast<unsigned char *>(const_cast<char *>(bitmap));
+        return error_code::no_error;
+    }
+
+private:
+    int decodeHeader(const Slice & input, bool verify_checksum, const char ** bitmap) const {
+        BloomFilterHeader header;
+        int status = header.decodeFrom(input, kStandardBloomFilterFixed, bitmap, verify_checksum);
+        if (status != error_code::no_error)
+            return status;
+        // The geometry of the filter is fixed by the template arguments.
+        if (header.num_probes != num_probes_ || header.bytes_per_probe != bytes_per_probe_
+            || header.bitmap_bytes != size_of_bitmap_)
+            return error_code::err_failed;
+        return error_code::no_error;
+    }
+
+public:
     void initBloomFilter() noexcept {
 #if 1
         bytes_per_probe_ = BITS_ALIGNED_TO(kBitsOfPerProbe, CACHE_LINE_SIZE);
@@ -116,17 +177,19 @@ public:
         alignas(8) unsigned char * new_bitmap = new (std::nothrow) unsigned char [size_of_bitmap_];
         if (new_bitmap) {
             ::memset((void *)new_bitmap, 0, size_of_bitmap_ * sizeof(unsigned char));
-            bitmap_.reset(new_bitmap);
+            buffer_.reset(new_bitmap);
+            bitmap_ = new_bitmap;
         }
         else {
-            bitmap_.reset(nullptr);
+            buffer_.reset(nullptr);
+            bitmap_ = nullptr;
         }
         if (getVerbose())
             printf("\n");
     }
 
     void reset() {
-        unsigned char * bitmap = bitmap_.get();
+        unsigned char * bitmap = bitmap_;
         assert(bitmap != nullptr);
         if (bitmap) {
             assert(size_of_bitmap_ != 0);
@@ -137,64 +200,47 @@ public:
     // StandardBloomFilter
     inline void setBit(std::uint32_t probes, std::uint32_t bit_pos) {
         assert(probes < num_probes_);
-        std::uint32_t index, offset;
-        detail::get_posinfo(bit_pos, index, offset);
-        register std::size_t bit_mask = std::size_t(1) << offset;
-        std::size_t * probe_bits = (std::size_t *)(bitmap_.get() + probes * bytes_per_probe_) + index;
-        assert(probe_bits != nullptr);
-        register std::size_t bits_val = (*probe_bits);
-        bits_val |= bit_mask;
-        *probe_bits = bits_val;
+        detail::set_bit(bitmap_ + probes * bytes_per_probe_, bit_pos);
     }
 
     // StandardBloomFilter
     inline void clearBit(std::uint32_t probes, std::uint32_t bit_pos) {
         assert(probes < num_probes_);
-        std::uint32_t index, offset;
-        detail::get_posinfo(bit_pos, index, offset);
-        register std::size_t bit_mask = ~(std::size_t(1) << offset);
-        std::size_t * probe_bits = (std::size_t *)(bitmap_.get() + probes * bytes_per_probe_) + index;
-        assert(probe_bits != nullptr);
-        register std::size_t bits_val = (*probe_bits);
-        bits_val &= bit_mask;
-        *probe_bits = bits_val;
+        detail::clear_bit(bitmap_ + probes * bytes_per_probe_, bit_pos);
     }
 
     // StandardBloomFilter
     inline bool insideBitmap(std::uint32_t probes, std::uint32_t bit_pos) const {
         assert(probes < num_probes_);
-        std::uint32_t index, offset;
-        detail::get_posinfo(bit_pos, index, offset);
-        register std::size_t bit_mask = std::size_t(1) << offset;
-        std::size_t * probe_bits = (std::size_t *)(bitmap_.get() + probes * bytes_per_probe_) + index;
-        assert(probe_bits != nullptr);
-        register std::size_t bits_val = (*probe_bits);
-        return ((bits_val & bit_mask) != 0);
+        return detail::test_bit(bitmap_ + probes * bytes_per_probe_, bit_pos);
     }
 
     // StandardBloomFilter
     void addKey(const Slice & key) {
-        std::uint32_t primary_hash = HashUtils<std::uint32_t>::primaryHash(key.data(), key.size(), kDefaultHashSeed);
+        std::uint32_t primary_hash = hashUtils_.primaryHash(key.data(), key.size(), kDefaultHashSeed);
+        std::uint32_t secondary_hash = hashUtils_.secondaryHash(key.data(), key.size());
+        addHash(primary_hash, secondary_hash);
+        if (getVerbose())
+            printf("addKey(): %s\n", key.data());
+    }
+
+    // StandardBloomFilter: adds a key by its primary and secondary hashes.
+    void addHash(std::uint32_t primary_hash, std::uint32_t secondary_hash) {
+        assert(!isReadOnly());
         std::uint32_t bit_pos = primary_hash % ((std::uint32_t)bits_per_probe_ - 0);
         // Note: 0 is first probe index, it's primary_hash function.
         setBit(0, bit_pos);
-        if (num_probes_ > 1) {
-            std::uint32_t secondary_hash, hash;
-            secondary_hash = HashUtils<std::uint32_t>::secondaryHash(key.data(), key.size());
-            hash = secondary_hash;
-            for (int i = 1; i < (int)num_probes_; ++i) {
-                bit_pos = hash % ((std::uint32_t)bits_per_probe_ - 0);
-                setBit(i, bit_pos);
-                hash += secondary_hash;
-            }
+        std::uint32_t hash = secondary_hash;
+        for (int i = 1; i < (int)num_probes_; ++i) {
+            bit_pos = hash % ((std::uint32_t)bits_per_probe_ - 0);
+            setBit(i, bit_pos);
+            hash += secondary_hash;
         }
-        if (getVerbose())
-            printf("addKey(): %s\n", key.data());
     }
 
     // StandardBloomFilter
     bool maybeMatch(const Slice & key) const {
-        std::uint32_t primary_hash = HashUtils<std::uint32_t>::primaryHash(key.data(), key.size(), kDefaultHashSeed);
+        std::uint32_t primary_hash = hashUtils_.primaryHash(key.data(), key.size(), kDefaultHashSeed);
         std::uint32_t bit_pos = primary_hash % ((std::uint32_t)bits_per_probe_ - 0);
         // Note: 0 is first probe index, it's primary_hash function.
         bool isMatch = insideBitmap(0, bit_pos);
@@ -202,7 +248,7 @@ public:
             return false;
         if (num_probes_ > 1) {
             std::uint32_t secondary_hash, hash;
-            secondary_hash = HashUtils<std::uint32_t>::secondaryHash(key.data(), key.size());
+            secondary_hash = hashUtils_.secondaryHash(key.data(), key.size());
             hash = secondary_hash;
             for (int i = 1; i < (int)num_probes_; ++i) {
                 bit_pos = hash % ((std::uint32_t)bits_per_probe_ - 0);
@@ -236,7 +282,10 @@ private:
     // The size of total keys.
     static const std::size_t kSizeOfTotalKeys = (std::size_t)((double)(kBitsOfPerProbe) * 0.69);
 
-    std::unique_ptr<unsigned char> bitmap_;
+    HashUtils<> hashUtils_;
+    std::unique_ptr<unsigned char[]> buffer_;
+    // The bitmap, in buffer_, or in the encoding the filter is attached to.
+    unsigned char * bitmap_;
 
     std::size_t bits_total_;
     std::size_t num_probes_;
@@ -248,7 +297,7 @@ private:
 
 public:
     FullBloomFilterFixed(bool verbose = true)
-        : bits_total_((((kBitsOfPerProbe + 7) / 8) * kNumProbes) * 8),
+        : bitmap_(nullptr), bits_total_((((kBitsOfPerProbe + 7) / 8) * kNumProbes) * 8),
           num_probes_(kNumProbes), bytes_per_probe_((kBitsOfPerProbe + 7) / 8), 
           size_of_bitmap_(((kBitsOfPerProbe + 7) / 8) * kNumProbes), 
           bits_per_key_(kBitsPerKey), verbose_(verbose) {
@@ -262,6 +311,61 @@ public:
 
     std::size_t getFilterSize() const { return size_of_bitmap_; }
 
+    const char * getBitmap() const { return reinterpret_cast<const char *>(bitmap_); }
+
+    // A filter attached to an encoding can't be changed.
+    bool isReadOnly() const { return (bitmap_ != nullptr && buffer_.get() == nullptr); }
+
+    // FullBloomFilterFixed: appends the encoding of the filter, see BloomFilterFormat.h.
+    void encodeTo(std::string * dst) const {
+        BloomFilterHeader header(kFullBloomFilterFixed, num_probes_, 0, bits_per_key_, size_of_bitmap_);
+        header.encodeTo(dst, getBitmap());
+    }
+
+    // FullBloomFilterFixed: restores the bits from a copy of an encoding of a filter
+    // with the same template arguments.
+    int decodeFrom(const Slice & input, bool verify_checksum = true) {
+        const char * bitmap;
+        int status = decodeHeader(input, verify_checksum, &bitmap);
+        if (status != error_code::no_error)
+            return status;
+        if (buffer_.get() == nullptr) {
+            unsigned char * new_bitmap = new (std::nothrow) unsigned char[size_of_bitmap_];
+            if (new_bitmap == nullptr)
+                return error_code::out_of_memory;
+            buffer_.reset(new_bitmap);
+        }
+        bitmap_ = buffer_.get();
+        ::memcpy((void *)bitmap_, bitmap, size_of_bitmap_);
+        return error_code::no_error;
+    }
+
+    // FullBloomFilterFixed: makes the filter a read-only view of the encoding, without
+    // a copy, the encoding must outlive the filter.
+    int attach(const Slice & input, bool verify_checksum = true) {
+        const char * bitmap;
+        int status = decodeHeader(input, verify_checksum, &bitmap);
+        if (status != error_code::no_error)
+            return status;
+        buffer_.reset(nullptr);
+        bitmap_ = reinterpret_cast<unsigned char *>(const_cast<char *>(bitmap));
+        return error_code::no_error;
+    }
+
+private:
+    int decodeHeader(const Slice & input, bool verify_checksum, const char ** bitmap) const {
+        BloomFilterHeader header;
+        int status = header.decodeFrom(input, kFullBloomFilterFixed, bitmap, verify_checksum);
+        if (status != error_code::no_error)
+            return status;
+        // The geometry of the filter is fixed by the template arguments.
+        if (header.num_probes != num_probes_ || header.bytes_per_probe != 0
+            || header.bitmap_bytes != size_of_bitmap_)
+            return error_code::err_failed;
+        return error_code::no_error;
+    }
+
+public:
     void initBloomFilter() noexcept {
 #if 1
         num_probes_ = static_cast<std::size_t>(kBitsPerKey * 0.69);
@@ -297,17 +401,19 @@ public:
         alignas(8) unsigned char * new_bitmap = new (std::nothrow) unsigned char[size_of_bitmap_];
         if (new_bitmap) {
             ::memset((void *)new_bitmap, 0, size_of_bitmap_ * sizeof(unsigned char));
-            bitmap_.reset(new_bitmap);
+            buffer_.reset(new_bitmap);
+            bitmap_ = new_bitmap;
         }
         else {
-            bitmap_.reset(nullptr);
+            buffer_.reset(nullptr);
+            bitmap_ = nullptr;
         }
         if (getVerbose())
             printf("\n");
     }
 
     void reset() {
-        unsigned char * bitmap = bitmap_.get();
+        unsigned char * bitmap = bitmap_;
         assert(bitmap != nullptr);
         if (bitmap) {
             assert(size_of_bitmap_ != 0);
@@ -317,62 +423,45 @@ public:
 
     // FullBloomFilter
     inline void setBit(std::uint32_t bit_pos) {
-        std::uint32_t index, offset;
-        detail::get_posinfo(bit_pos, index, offset);
-        register std::size_t bit_mask = std::size_t(1) << offset;
-        std::size_t * probe_bits = (std::size_t *)(bitmap_.get()) + index;
-        assert(probe_bits != nullptr);
-        register std::size_t bits_val = (*probe_bits);
-        bits_val |= bit_mask;
-        *probe_bits = bits_val;
+        detail::set_bit(bitmap_, bit_pos);
     }
 
     // FullBloomFilter
     inline void clearBit(std::uint32_t bit_pos) {
-        std::uint32_t index, offset;
-        detail::get_posinfo(bit_pos, index, offset);
-        register std::size_t bit_mask = ~(std::size_t(1) << offset);
-        std::size_t * probe_bits = (std::size_t *)(bitmap_.get()) + index;
-        assert(probe_bits != nullptr);
-        register std::size_t bits_val = (*probe_bits);
-        bits_val &= bit_mask;
-        *probe_bits = bits_val;
+        detail::clear_bit(bitmap_, bit_pos);
     }
 
     // FullBloomFilter
     inline bool insideBitmap(std::uint32_t bit_pos) const {
-        std::uint32_t index, offset;
-        detail::get_posinfo(bit_pos, index, offset);
-        register std::size_t bit_mask = std::size_t(1) << offset;
-        std::size_t * probe_bits = (std::size_t *)(bitmap_.get()) + index;
-        assert(probe_bits != nullptr);
-        register std::size_t bits_val = (*probe_bits);
-        return ((bits_val & bit_mask) != 0);
+        return detail::test_bit(bitmap_, bit_pos);
     }
 
     // FullBloomFilter
     void addKey(const Slice & key) {
-        std::uint32_t primary_hash = HashUtils<std::uint32_t>::primaryHash(key.data(), key.size(), kDefaultHashSeed);
+        std::uint32_t primary_hash = hashUtils_.primaryHash(key.data(), key.size(), kDefaultHashSeed);
+        std::uint32_t secondary_hash = hashUtils_.secondaryHash(key.data(), key.size());
+        addHash(primary_hash, secondary_hash);
+        if (getVerbose())
+            printf("addKey(): %s\n", key.data());
+    }
+
+    // FullBloomFilter: adds a key by its primary and secondary hashes.
+    void addHash(std::uint32_t primary_hash, std::uint32_t secondary_hash) {
+        assert(!isReadOnly());
         std::uint32_t bit_pos = primary_hash % ((std::uint32_t)bits_total_ - 1);
         // Note: 0 is first probe index, it's primary_hash function.
         setBit(bit_pos);
-        if (num_probes_ > 1) {
-            std::uint32_t secondary_hash, hash;
-            secondary_hash = HashUtils<std::uint32_t>::secondaryHash(key.data(), key.size());
-            hash = secondary_hash;
-            for (int i = 1; i < (int)num_probes_; ++i) {
-                bit_pos = hash % ((std::uint32_t)bits_total_ - 0);
-                setBit(bit_pos);
-                hash += secondary_hash;
-            }
+        std::uint32_t hash = secondary_hash;
+        for (int i = 1; i < (int)num_probes_; ++i) {
+            bit_pos = hash % ((std::uint32_t)bits_total_ - 0);
+            setBit(bit_pos);
+            hash += secondary_hash;
         }
-        if (getVerbose())
-            printf("addKey(): %s\n", key.data());
     }
 
     // FullBloomFilter
     bool maybeMatch(const Slice & key) const {
-        std::uint32_t primary_hash = HashUtils<std::uint32_t>::primaryHash(key.data(), key.size(), kDefaultHashSeed);
+        std::uint32_t primary_hash = hashUtils_.primaryHash(key.data(), key.size(), kDefaultHashSeed);
         std::uint32_t bit_pos = primary_hash % ((std::uint32_t)bits_total_ - 1);
         // Note: 0 is first probe index, it's primary_hash function.
         bool isMatch = insideBitmap(bit_pos);
@@ -380,7 +469,7 @@ public:
             return false;
         if (num_probes_ > 1) {
             std::uint32_t secondary_hash, hash;
-            secondary_hash = HashUtils<std::uint32_t>::secondaryHash(key.data(), key.size());
+            secondary_hash = hashUtils_.secondaryHash(key.data(), key.size());
             hash = secondary_hash;
             for (int i = 1; i < (int)num_probes_; ++i) {
                 bit_pos = hash % ((std::uint32_t)bits_total_ - 0);
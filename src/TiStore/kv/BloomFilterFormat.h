@@ -0,0 +1,145 @@
+#pragma once
+
+#include "TiStore/basic/cstdint"
+#include "TiStore/fs/ErrorCode.h"
+#include "TiStore/kv/Coding.h"
+#include "TiStore/kv/Crc32c.h"
+#include "TiStore/kv/Slice.h"
+
+#include <string>
+
+//
+// The on-disk format of a bloom filter:
+//
+//   magic:           fixed32  "TiBF"
+//   format version:  uint8
+//   filter type:     uint8    (BloomFilterType)
+//   hash version:    uint8    (the hash functions the bits were made with)
+//   reserved:        uint8
+//   num_probes:      fixed32
+//   bytes_per_probe: fixed32  (StandardBloomFilter only, 0 for the others)
+//   bits_per_key:    fixed32
+//   bitmap bytes:    fixed64
+//   reserved:        fixed64
+//   checksum:        fixed32  (masked crc32c of the header before it and the bitmap)
+//   [bitmap]                  (the bitmap bytes, zero padded to a multiple of 8)
+//
+// The header is kHeaderSize bytes, so a bitmap following a header at an
+// 8 bytes aligned address is 8 bytes aligned too. A filter can be decoded
+// from the encoding (a copy of the bitmap), or attached to it, as a read
+// only view of the bitmap, e.g. of a mmapped file or a cached block,
+// which must outlive the filter.
+//
+
+namespace TiStore {
+
+enum BloomFilterType {
+    kStandardBloomFilter = 1,
+    kFullBloomFilter = 2,
+    kBlockedBloomFilter = 3,
+    kSplitBlockBloomFilter = 4,
+    kStandardBloomFilterFixed = 5,
+    kFullBloomFilterFixed = 6,
+    kBinaryFuseFilter = 7
+};
+
+struct BloomFilterHeader {
+    static const std::uint32_t kMagic = 0x46426954U;    // "TiBF"
+    static const std::uint32_t kFormatVersion = 1;
+    // The version of HashUtils::primaryHash() and secondaryHash(), and of
+    // the probes derived from them, a filter is useless if the hashes change,
+    // so it must be bumped if they do.
+    // 2: FullBloomFilter probes primary + i * secondary.
+    static const std::uint32_t kHashVersion = 2;
+    static const std::size_t kHeaderSize = 40;
+
+    std::uint32_t type;
+    std::uint32_t hash_version;
+    std::uint32_t num_probes;
+    std::uint32_t bytes_per_probe;
+    std::uint32_t bits_per_key;
+    std::uint64_t bitmap_bytes;
+
+    BloomFilterHeader()
+        : type(0), hash_version(kHashVersion), num_probes(0), bytes_per_probe(0),
+          bits_per_key(0), bitmap_bytes(0) {}
+
+    BloomFilterHeader(std::uint32_t _type, std::size_t _num_probes, std::size_t _bytes_per_probe,
+                      std::size_t _bits_per_key, std::size_t _bitmap_bytes)
+        : type(_type), hash_version(kHashVersion), num_probes((std::uint32_t)_num_probes),
+          bytes_per_probe((std::uint32_t)_bytes_per_probe), bits_per_key((std::uint32_t)_bits_per_key),
+          bitmap_bytes(_bitmap_bytes) {}
+
+    // The size of the bitmap in the encoding.
+    static std::size_t paddedSize(std::uint64_t bitmap_bytes) {
+        return (std::size_t)((bitmap_bytes + 7) / 8 * 8);
+    }
+
+    std::size_t encodedSize() const {
+        return kHeaderSize + paddedSize(bitmap_bytes);
+    }
+
+    //
+    // Appends the header and the bitmap to *dst, bitmap must have
+    // paddedSize(bitmap_bytes) bytes, the bytes past bitmap_bytes are zero.
+    //
+    void encodeTo(std::string * dst, const char * bitmap) const {
+        std::size_t start = dst->size();
+        putFixed32(dst, kMagic);
+        dst->push_back((char)kFormatVersion);
+        dst->push_back((char)type);
+        dst->push_back((char)hash_version);
+        dst->push_back((char)0);
+        putFixed32(dst, num_probes);
+        putFixed32(dst, bytes_per_probe);
+        putFixed32(dst, bits_per_key);
+        putFixed64(dst, bitmap_bytes);
+        putFixed64(dst, 0);
+
+        std::size_t padded_size = paddedSize(bitmap_bytes);
+        std::uint32_t crc = crc32c_value(dst->data() + start, dst->size() - start);
+        crc = crc32c_extend(crc, bitmap, padded_size);
+        putFixed32(dst, crc32c_mask(crc));
+        dst->append(bitmap, padded_size);
+    }
+
+    //
+    // Parses the header of a filter of the type, and stores a pointer to its
+    // bitmap (in input) in *bitmap. The checksum of a big filter takes a
+    // pass over all of its bitmap, so it can be skipped, e.g. if the
+    // encoding is in a block that is already checked.
+    //
+    int decodeFrom(const Slice & input, std::uint32_t expected_type,
+                   const char ** bitmap, bool verify_checksum = true) {
+        if (input.size() < kHeaderSize)
+            return error_code::err_corruption;
+        const char * p = input.data();
+        if (decodeFixed32(p) != kMagic)
+            return error_code::err_corruption;
+        if ((unsigned char)p[4] != kFormatVersion)
+            return error_code::err_not_supported;
+        type = (unsigned char)p[5];
+        hash_version = (unsigned char)p[6];
+        num_probes = decodeFixed32(p + 8);
+        bytes_per_probe = decodeFixed32(p + 12);
+        bits_per_key = decodeFixed32(p + 16);
+        bitmap_bytes = decodeFixed64(p + 20);
+        if (type != expected_type)
+            return error_code::err_failed;
+        if (hash_version != kHashVersion)
+            return error_code::err_not_supported;
+        if (bitmap_bytes == 0 || bitmap_bytes > (std::uint64_t)(input.size() - kHeaderSize)
+            || paddedSize(bitmap_bytes) > input.size() - kHeaderSize)
+            return error_code::err_corruption;
+        if (verify_checksum) {
+            std::uint32_t crc = crc32c_value(p, kHeaderSize - sizeof(std::uint32_t));
+            crc = crc32c_extend(crc, p + kHeaderSize, paddedSize(bitmap_bytes));
+            if (crc32c_unmask(decodeFixed32(p + kHeaderSize - sizeof(std::uint32_t))) != crc)
+                return error_code::err_corruption;
+        }
+        *bitmap = p + kHeaderSize;
+        return error_code::no_error;
+    }
+};
+
+} // namespace TiStore
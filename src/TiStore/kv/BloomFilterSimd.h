@@ -0,0 +1,370 @@
+#pragma once
+
+#include "TiStore/basic/cstdint"
+#include "TiStore/fs/ErrorCode.h"
+#include "TiStore/kv/BloomFilter.h"
+#include "TiStore/kv/BloomFilterFormat.h"
+#include "TiStore/kv/CpuFeatures.h"
+#include "TiStore/kv/Hash.h"
+#include "TiStore/kv/HashBatch.h"
+
+#include <assert.h>
+#include <string.h>
+#include <stdio.h>
+#include <memory>
+
+namespace TiStore {
+
+namespace detail {
+
+// The odd salts of the split block bloom filter, one per 32-bit word.
+static const std::uint32_t kSplitBlockSalts[8] = {
+    0x47B6137BU, 0x44974D91U, 0x8824AD5BU, 0xA2B7289DU,
+    0x705495C7U, 0x2DF1424BU, 0x9EFC4947U, 0x5C6BFB31U
+};
+
+} // namespace detail
+
+//
+// A split block bloom filter: the primary hash picks one block of 256 bits
+// (8 words of 32 bits), and each word gets exactly one bit of the key, at
+// (hash * salt[i]) >> 27 of the secondary hash. So the 8 probes are
+// independent of each other, and with AVX2 all of them are made by one
+// vpmulld, one vpsrld and one vpsllvd, and tested by one vptest.
+//
+// The implementation (AVX2, SSE4.1 or scalar) is chosen at run time by
+// CpuFeatures, the bitmap is the same for all of them.
+//
+// See: "Cache Efficient Bloom Filters for Shared Memory Machines", Schlegel et al.
+// See: https://github.com/apache/parquet-format/blob/master/BloomFilter.md
+//
+class SplitBlockBloomFilter {
+public:
+    static const std::size_t kBytesPerBlock = 32;
+    static const std::size_t kNumProbes = 8;
+
+    enum SimdLevel {
+        kScalar,
+        kSSE41,
+        kAVX2
+    };
+
+private:
+    HashUtils<> hashUtils_;
+    std::unique_ptr<unsigned char[]> buffer_;
+    // bitmap_ is buffer_ aligned to kBytesPerBlock.
+    std::uint32_t * bitmap_;
+
+    std::size_t num_blocks_;
+    std::size_t bytes_total_;
+    std::size_t num_total_keys_;
+    std::size_t bits_per_key_;
+    SimdLevel simd_level_;
+
+    bool verbose_;
+
+public:
+    SplitBlockBloomFilter() :
+        bitmap_(nullptr), num_blocks_(0), bytes_total_(0), num_total_keys_(0),
+        bits_per_key_(0), simd_level_(getBestSimdLevel()), verbose_(false) {
+    }
+
+    SplitBlockBloomFilter(std::size_t num_total_keys, std::size_t bits_per_key, bool verbose = true)
+        : hashUtils_(), bitmap_(nullptr), num_blocks_(0), bytes_total_(0),
+          num_total_keys_(num_total_keys), bits_per_key_(bits_per_key),
+          simd_level_(getBestSimdLevel()), verbose_(verbose) {
+        initFilter(num_total_keys, bits_per_key);
+    }
+
+    ~SplitBlockBloomFilter() {}
+
+    // The best implementation the CPU supports.
+    static SimdLevel getBestSimdLevel() {
+        if (CpuFeatures::hasAVX2())
+            return kAVX2;
+        else if (CpuFeatures::hasSSE41())
+            return kSSE41;
+        else
+            return kScalar;
+    }
+
+    static const char * getSimdLevelName(SimdLevel level) {
+        switch (level) {
+        case kAVX2:  return "AVX2";
+        case kSSE41: return "SSE4.1";
+        default:     return "Scalar";
+        }
+    }
+
+private:
+    bool allocBitmap(std::size_t num_blocks) noexcept {
+        std::size_t bytes = num_blocks * kBytesPerBlock;
+        unsigned char * new_buffer = new (std::nothrow) unsigned char[bytes + kBytesPerBlock - 1];
+        buffer_.reset(new_buffer);
+        if (new_buffer == nullptr) {
+            bitmap_ = nullptr;
+            num_blocks_ = 0;
+            bytes_total_ = 0;
+            return false;
+        }
+        bitmap_ = reinterpret_cast<std::uint32_t *>(
+            ALIGNED_TO((std::size_t)new_buffer, kBytesPerBlock));
+        ::memset((void *)bitmap_, 0, bytes);
+        num_blocks_ = num_blocks;
+        bytes_total_ = bytes;
+        return true;
+    }
+
+    void initFilter(std::size_t num_total_keys, std::size_t bits_per_key) noexcept {
+        num_total_keys_ = num_total_keys;
+        bits_per_key_ = bits_per_key;
+        std::size_t bits = num_total_keys * bits_per_key;
+        std::size_t num_blocks = (bits + kBytesPerBlock * 8 - 1) / (kBytesPerBlock * 8);
+        if (num_blocks < 1)
+            num_blocks = 1;
+        allocBitmap(num_blocks);
+
+        if (getVerbose()) {
+            printf("num_total_keys      = %zu keys\n"
+                   "bits_per_key        = %zu\n"
+                   "num_blocks          = %zu blocks\n"
+                   "num_probes          = %zu\n"
+                   "simd_level          = %s\n\n",
+                    num_total_keys_, bits_per_key_, num_blocks_, kNumProbes,
+                    getSimdLevelName(simd_level_));
+            printf("size_of_bitmap_     = %zu bytes\n\n", bytes_total_);
+        }
+    }
+
+    inline std::uint32_t * getBlock(std::uint32_t primary_hash) const {
+        std::size_t block = (std::size_t)(((std::uint64_t)primary_hash * num_blocks_) >> 32);
+        return bitmap_ + block * (kBytesPerBlock / sizeof(std::uint32_t));
+    }
+
+public:
+    bool getVerbose() const { return verbose_; }
+    void setVerbose(bool verbose) { verbose_ = verbose; }
+
+    std::size_t getFilterSize() const { return bytes_total_; }
+    std::size_t getNumProbes() const { return kNumProbes; }
+
+    SimdLevel getSimdLevel() const { return simd_level_; }
+
+    // Forces an implementation, e.g. to compare them, a level the CPU
+    // doesn't support falls back to the best one it does.
+    void setSimdLevel(SimdLevel level) {
+        SimdLevel best = getBestSimdLevel();
+        simd_level_ = (level <= best) ? level : best;
+    }
+
+    const char * getBitmap() const { return reinterpret_cast<const char *>(bitmap_); }
+
+    // A filter attached to an encoding can't be changed.
+    bool isReadOnly() const { return (bitmap_ != nullptr && buffer_.get() == nullptr); }
+
+    // SplitBlockBloomFilter: appends the encoding of the filter, see BloomFilterFormat.h.
+    void encodeTo(std::string * dst) const {
+        BloomFilterHeader header(kSplitBlockBloomFilter, kNumProbes, 0, bits_per_key_, bytes_total_);
+        header.encodeTo(dst, getBitmap());
+    }
+
+    // SplitBlockBloomFilter: restores the filter from a copy of the encoding.
+    int decodeFrom(const Slice & input, bool verify_checksum = true) {
+        BloomFilterHeader header;
+        const char * bitmap;
+        int status = header.decodeFrom(input, kSplitBlockBloomFilter, &bitmap, verify_checksum);
+        if (status != error_code::no_error)
+            return status;
+        if (header.num_probes != kNumProbes
+            || !loadFilter(bitmap, (std::size_t)header.bitmap_bytes))
+            return error_code::err_corruption;
+        bits_per_key_ = header.bits_per_key;
+        return error_code::no_error;
+    }
+
+    // SplitBlockBloomFilter: makes the filter a read-only view of the
+    // encoding, without a copy, the encoding must outlive the filter.
+    int attach(const Slice & input, bool verify_checksum = true) {
+        BloomFilterHeader header;
+        const char * bitmap;
+        int status = header.decodeFrom(input, kSplitBlockBloomFilter, &bitmap, verify_checksum);
+        if (status != error_code::no_error)
+            return status;
+        if (header.num_probes != kNumProbes || (header.bitmap_bytes % kBytesPerBlock) != 0)
+            return error_code::err_corruption;
+        buffer_.reset(nullptr);
+        bitmap_ = reinterpret_cast<std::uint32_t *>(const_cast<char *>(bitmap));
+        bytes_total_ = (std::size_t)header.bitmap_bytes;
+        num_blocks_ = bytes_total_ / kBytesPerBlock;
+        bits_per_key_ = header.bits_per_key;
+        return error_code::no_error;
+    }
+
+    // SplitBlockBloomFilter: restore a filter from its raw bitmap.
+    bool loadFilter(const char * bitmap, std::size_t bytes) {
+        if (bitmap == nullptr || bytes == 0 || (bytes % kBytesPerBlock) != 0)
+            return false;
+        if (!allocBitmap(bytes / kBytesPerBlock))
+            return false;
+        ::memcpy((void *)bitmap_, bitmap, bytes);
+        return true;
+    }
+
+    // SplitBlockBloomFilter
+    void setOption(std::size_t num_total_keys, std::size_t bits_per_key, bool verbose = true) {
+        setVerbose(verbose);
+        initFilter(num_total_keys, bits_per_key);
+    }
+
+    // SplitBlockBloomFilter
+    void reset() {
+        assert(bitmap_ != nullptr);
+        if (bitmap_) {
+            ::memset((void *)bitmap_, 0, bytes_total_ * sizeof(unsigned char));
+        }
+    }
+
+    std::size_t getUsedBits() const {
+        std::size_t total_used = 0;
+        const unsigned char * cur = reinterpret_cast<const unsigned char *>(bitmap_);
+        for (std::size_t n = 0; n < bytes_total_; n++) {
+            total_used += BitsSetTable256[*cur];
+            cur++;
+        }
+        return total_used;
+    }
+
+    // SplitBlockBloomFilter
+    void addKey(const Slice & key) {
+        assert(!isReadOnly());
+        std::uint32_t primary_hash = hashUtils_.primaryHash(key.data(), key.size(), kDefaultHashSeed);
+        std::uint32_t secondary_hash = hashUtils_.secondaryHash(key.data(), key.size());
+        std::uint32_t * block = getBlock(primary_hash);
+#if TISTORE_ARCH_X86
+        if (simd_level_ == kAVX2)
+            addHashAVX2(block, secondary_hash);
+        else if (simd_level_ == kSSE41)
+            addHashSSE41(block, secondary_hash);
+        else
+#endif
+            addHashScalar(block, secondary_hash);
+        if (getVerbose())
+            printf("addKey(): %s\n", key.data());
+    }
+
+    // SplitBlockBloomFilter
+    bool maybeMatch(const Slice & key) const {
+        std::uint32_t primary_hash = hashUtils_.primaryHash(key.data(), key.size(), kDefaultHashSeed);
+        std::uint32_t secondary_hash = hashUtils_.secondaryHash(key.data(), key.size());
+        const std::uint32_t * block = getBlock(primary_hash);
+        return matchHash(block, secondary_hash);
+    }
+
+    //
+    // SplitBlockBloomFilter: out[i] = maybeMatch(keys[i]). The keys are
+    // hashed (by BatchHash) and their blocks prefetched kBatchSize at a
+    // time, before any of them is tested, so the cache misses of the keys
+    // overlap.
+    //
+    void maybeMatchBatch(const Slice * keys, std::size_t n, bool * out) const {
+        static const std::size_t kBatchSize = 16;
+        const std::uint32_t * blocks[kBatchSize];
+        std::uint32_t primary_hashes[kBatchSize], hashes[kBatchSize];
+
+        for (std::size_t start = 0; start < n; start += kBatchSize) {
+            std::size_t count = ((n - start) < kBatchSize) ? (n - start) : kBatchSize;
+            BatchHash::hashPair(keys + start, count, kDefaultHashSeed, primary_hashes, hashes);
+            for (std::size_t i = 0; i < count; i++) {
+                blocks[i] = getBlock(primary_hashes[i]);
+                TISTORE_PREFETCH(blocks[i]);
+            }
+            for (std::size_t i = 0; i < count; i++) {
+                out[start + i] = matchHash(blocks[i], hashes[i]);
+            }
+        }
+    }
+
+    inline bool matchHash(const std::uint32_t * block, std::uint32_t hash) const {
+#if TISTORE_ARCH_X86
+        if (simd_level_ == kAVX2)
+            return matchHashAVX2(block, hash);
+        else if (simd_level_ == kSSE41)
+            return matchHashSSE41(block, hash);
+#endif
+        return matchHashScalar(block, hash);
+    }
+
+    static void addHashScalar(std::uint32_t * block, std::uint32_t hash) {
+        for (std::size_t i = 0; i < kNumProbes; i++) {
+            block[i] |= std::uint32_t(1) << ((hash * detail::kSplitBlockSalts[i]) >> 27);
+        }
+    }
+
+    static bool matchHashScalar(const std::uint32_t * block, std::uint32_t hash) {
+        std::uint32_t isMatch = 1;
+        for (std::size_t i = 0; i < kNumProbes; i++) {
+            isMatch &= (block[i] >> ((hash * detail::kSplitBlockSalts[i]) >> 27));
+        }
+        return (isMatch != 0);
+    }
+
+#if TISTORE_ARCH_X86
+    // The 8 masks of one bit in a word each, of the hash.
+    TISTORE_TARGET("avx2")
+    static __m256i makeMaskAVX2(std::uint32_t hash) {
+        const __m256i salts = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i *>(detail::kSplitBlockSalts));
+        __m256i bits = _mm256_mullo_epi32(_mm256_set1_epi32((int)hash), salts);
+        bits = _mm256_srli_epi32(bits, 27);
+        return _mm256_sllv_epi32(_mm256_set1_epi32(1), bits);
+    }
+
+    TISTORE_TARGET("avx2")
+    static void addHashAVX2(std::uint32_t * block, std::uint32_t hash) {
+        __m256i * ptr = reinterpret_cast<__m256i *>(block);
+        _mm256_store_si256(ptr, _mm256_or_si256(_mm256_load_si256(ptr), makeMaskAVX2(hash)));
+    }
+
+    TISTORE_TARGET("avx2")
+    static bool matchHashAVX2(const std::uint32_t * block, std::uint32_t hash) {
+        // A view of an encoding may not be aligned.
+        __m256i bits = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(block));
+        // vptest: CF = ((~bits & mask) == 0).
+        return (_mm256_testc_si256(bits, makeMaskAVX2(hash)) != 0);
+    }
+
+    //
+    // SSE4.1 has no variable shift, 1 << n is made of the float 2^n: the
+    // exponent n + 127 shifted to its place, converted back to an int.
+    // 2^31 converts to 0x80000000 (the "integer indefinite"), which is
+    // still 1 << 31.
+    //
+    TISTORE_TARGET("sse4.1")
+    static __m128i makeMaskSSE41(__m128i hash, const std::uint32_t * salts) {
+        __m128i bits = _mm_mullo_epi32(hash, _mm_loadu_si128(reinterpret_cast<const __m128i *>(salts)));
+        bits = _mm_srli_epi32(bits, 27);
+        bits = _mm_add_epi32(_mm_slli_epi32(bits, 23), _mm_set1_epi32(0x3F800000));
+        return _mm_cvttps_epi32(_mm_castsi128_ps(bits));
+    }
+
+    TISTORE_TARGET("sse4.1")
+    static void addHashSSE41(std::uint32_t * block, std::uint32_t hash) {
+        __m128i h = _mm_set1_epi32((int)hash);
+        __m128i * ptr = reinterpret_cast<__m128i *>(block);
+        _mm_store_si128(ptr, _mm_or_si128(_mm_load_si128(ptr),
+                                          makeMaskSSE41(h, detail::kSplitBlockSalts)));
+        _mm_store_si128(ptr + 1, _mm_or_si128(_mm_load_si128(ptr + 1),
+                                              makeMaskSSE41(h, detail::kSplitBlockSalts + 4)));
+    }
+
+    TISTORE_TARGET("sse4.1")
+    static bool matchHashSSE41(const std::uint32_t * block, std::uint32_t hash) {
+        __m128i h = _mm_set1_epi32((int)hash);
+        const __m128i * ptr = reinterpret_cast<const __m128i *>(block);
+        return ((_mm_testc_si128(_mm_loadu_si128(ptr), makeMaskSSE41(h, detail::kSplitBlockSalts)) &
+                 _mm_testc_si128(_mm_loadu_si128(ptr + 1), makeMaskSSE41(h, detail::kSplitBlockSalts + 4))) != 0);
+    }
+#endif // TISTORE_ARCH_X86
+};
+
+} // namespace TiStore
@@ -0,0 +1,367 @@
+#pragma once
+
+#include "TiStore/basic/cstdint"
+
+#include <assert.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace TiStore {
+
+//
+// The key of a cached block: the id of the table (BlockCache::newId())
+// and the offset of the block in the table file.
+//
+struct BlockCacheKey {
+    std::uint64_t file_id;
+    std::uint64_t offset;
+
+    BlockCacheKey() : file_id(0), offset(0) {}
+    BlockCacheKey(std::uint64_t _file_id, std::uint64_t _offset)
+        : file_id(_file_id), offset(_offset) {}
+
+    bool operator == (const BlockCacheKey & rhs) const {
+        return (file_id == rhs.file_id && offset == rhs.offset);
+    }
+};
+
+enum CachePolicy {
+    kCacheLRU,
+    kCacheCLOCK
+};
+
+struct CacheStats {
+    std::uint64_t hits;
+    std::uint64_t misses;
+    std::uint64_t inserts;
+    std::uint64_t evictions;
+    std::size_t charge;
+    std::size_t entries;
+
+    CacheStats() : hits(0), misses(0), inserts(0), evictions(0), charge(0), entries(0) {}
+};
+
+namespace detail {
+
+//
+// The hash of a BlockCacheKey, made of its two words (not of its bytes, the
+// struct isn't a char array): the file id and the offset mixed, then folded
+// by a multiply, so the high bits depend on all the bits of both words.
+// BlockCache picks the shard by the high bits, a shard its bucket by all.
+//
+static inline
+std::uint64_t hash_block_cache_key(const BlockCacheKey & key)
+{
+    std::uint64_t h = (key.file_id * 0x9E3779B97F4A7C15ULL) ^ key.offset;
+    h ^= h >> 29;
+    h *= 0xBF58476D1CE4E5B9ULL;
+    return (h ^ (h >> 32));
+}
+
+//
+// One shard of the BlockCache: a hash table and a circular list of the
+// entries, guarded by one mutex.
+//
+// LRU:   a hit moves the entry to the head of the list, the tail is evicted.
+// CLOCK: a hit only sets the referenced bit of the entry; the hand walks the
+//        list, clears the bits it passes and evicts the first entry without
+//        the bit, so a hit does not touch the list.
+//
+class BlockCacheShard {
+public:
+    typedef std::shared_ptr<const std::string> value_type;
+
+private:
+    struct Entry {
+        BlockCacheKey key;
+        value_type value;
+        std::size_t charge;
+        Entry * prev;
+        Entry * next;
+        bool referenced;
+    };
+
+    struct KeyHash {
+        std::size_t operator () (const BlockCacheKey & key) const {
+            return (std::size_t)hash_block_cache_key(key);
+        }
+    };
+
+    typedef std::unordered_map<BlockCacheKey, Entry *, KeyHash> table_type;
+
+    std::mutex mutex_;
+    table_type table_;
+    // The dummy head of the circular list, head_.next is the most recently
+    // inserted (or used, for LRU) entry, head_.prev the eviction candidate.
+    Entry head_;
+    Entry * hand_;          // The hand of CLOCK, &head_ if the list is empty
+    CachePolicy policy_;
+    std::size_t capacity_;
+    std::size_t charge_;
+
+    std::uint64_t hits_;
+    std::uint64_t misses_;
+    std::uint64_t inserts_;
+    std::uint64_t evictions_;
+
+    // Keep the mutexes of the neighboring shards on different cache lines.
+    char padding_[64];
+
+public:
+    BlockCacheShard() : hand_(&head_), policy_(kCacheLRU), capacity_(0), charge_(0),
+                        hits_(0), misses_(0), inserts_(0), evictions_(0) {
+        head_.prev = head_.next = &head_;
+        head_.charge = 0;
+        head_.referenced = false;
+        (void)padding_;
+    }
+
+    ~BlockCacheShard() {
+        Entry * entry = head_.next;
+        while (entry != &head_) {
+            Entry * next = entry->next;
+            delete entry;
+            entry = next;
+        }
+    }
+
+    void setup(std::size_t capacity, CachePolicy policy) {
+        capacity_ = capacity;
+        policy_ = policy;
+    }
+
+    value_type lookup(const BlockCacheKey & key) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        table_type::const_iterator iter = table_.find(key);
+        if (iter == table_.end()) {
+            misses_++;
+            return value_type();
+        }
+        hits_++;
+        Entry * entry = iter->second;
+        if (policy_ == kCacheLRU) {
+            listRemove(entry);
+            listInsertFront(entry);
+        }
+        else {
+            entry->referenced = true;
+        }
+        return entry->value;
+    }
+
+    void insert(const BlockCacheKey & key, const value_type & value, std::size_t charge) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        inserts_++;
+        std::pair<table_type::iterator, bool> result = table_.insert(
+            table_type::value_type(key, nullptr));
+        Entry * entry;
+        if (result.second) {
+            entry = new Entry;
+            entry->key = key;
+            entry->charge = 0;
+            entry->referenced = false;
+            result.first->second = entry;
+            listInsertFront(entry);
+        }
+        else {
+            entry = result.first->second;
+            listRemove(entry);
+            listInsertFront(entry);
+        }
+        entry->value = value;
+        charge_ = charge_ - entry->charge + charge;
+        entry->charge = charge;
+
+        while (charge_ > capacity_ && head_.next != &head_) {
+            Entry * victim = selectVictim();
+            if (victim == entry && table_.size() > 1) {
+                // Don't evict what we have just inserted while there are others.
+                victim->referenced = true;
+                continue;
+            }
+            evict(victim);
+        }
+    }
+
+    bool erase(const BlockCacheKey & key) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        table_type::iterator iter = table_.find(key);
+        if (iter == table_.end())
+            return false;
+        Entry * entry = iter->second;
+        table_.erase(iter);
+        removeEntry(entry);
+        return true;
+    }
+
+    void getStats(CacheStats & stats) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats.hits += hits_;
+        stats.misses += misses_;
+        stats.inserts += inserts_;
+        stats.evictions += evictions_;
+        stats.charge += charge_;
+        stats.entries += table_.size();
+    }
+
+    void resetStats() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        hits_ = misses_ = inserts_ = evictions_ = 0;
+    }
+
+private:
+    BlockCacheShard(const BlockCacheShard &) = delete;
+    BlockCacheShard & operator = (const BlockCacheShard &) = delete;
+
+    void listRemove(Entry * entry) {
+        if (hand_ == entry)
+            hand_ = entry->prev;
+        entry->next->prev = entry->prev;
+        entry->prev->next = entry->next;
+    }
+
+    void listInsertFront(Entry * entry) {
+        entry->next = head_.next;
+        entry->prev = &head_;
+        head_.next->prev = entry;
+        head_.next = entry;
+    }
+
+    Entry * selectVictim() {
+        if (policy_ == kCacheLRU)
+            return head_.prev;
+
+        // CLOCK, the hand moves from the oldest entry towards the newest.
+        while (true) {
+            if (hand_ == &head_)
+                hand_ = head_.prev;
+            if (!hand_->referenced)
+                return hand_;
+            hand_->referenced = false;
+            hand_ = hand_->prev;
+        }
+    }
+
+    void evict(Entry * entry) {
+        table_.erase(entry->key);
+        removeEntry(entry);
+        evictions_++;
+    }
+
+    void removeEntry(Entry * entry) {
+        listRemove(entry);
+        charge_ -= entry->charge;
+        // The readers holding the value keep it alive.
+        delete entry;
+    }
+};
+
+} // namespace detail
+
+//
+// A cache of the uncompressed table blocks, shared by all the readers.
+//
+// The cache is split into 2^num_shard_bits shards, picked by the high bits
+// of the hash of the key (detail::hash_block_cache_key), each one has its
+// own mutex, eviction list and 1/N of the capacity, so the readers of
+// different blocks rarely wait for each other. The capacity is charged by the byte size of
+// the blocks (plus the key and the entry overhead).
+//
+// A value returned by lookup() stays valid after it's evicted, it's freed
+// when the last reader drops it, so the memory in use can exceed the
+// capacity by the blocks being read.
+//
+class BlockCache {
+public:
+    typedef detail::BlockCacheShard::value_type value_type;
+
+    static const std::size_t kEntryOverhead = 64;
+
+private:
+    std::vector<std::unique_ptr<detail::BlockCacheShard>> shards_;
+    // The shard is (hash >> 32) >> shard_shift_, the high num_shard_bits bits.
+    int shard_shift_;
+    std::size_t capacity_;
+    CachePolicy policy_;
+    std::atomic<std::uint64_t> last_id_;
+
+public:
+    BlockCache(std::size_t capacity, int num_shard_bits = 4, CachePolicy policy = kCacheLRU)
+        : shard_shift_(32 - num_shard_bits), capacity_(capacity),
+          policy_(policy), last_id_(0) {
+        assert(num_shard_bits >= 0 && num_shard_bits < 20);
+        std::size_t num_shards = (std::size_t)1 << num_shard_bits;
+        std::size_t per_shard = (capacity + num_shards - 1) / num_shards;
+        shards_.reserve(num_shards);
+        for (std::size_t i = 0; i < num_shards; i++) {
+            shards_.push_back(std::unique_ptr<detail::BlockCacheShard>(new detail::BlockCacheShard()));
+            shards_.back()->setup(per_shard, policy);
+        }
+    }
+
+    ~BlockCache() {}
+
+    // Returns a new id for a client (e.g. a table) to partition the key space.
+    std::uint64_t newId() {
+        return last_id_.fetch_add(1) + 1;
+    }
+
+    // Returns an empty pointer on a miss.
+    value_type lookup(const BlockCacheKey & key) {
+        return shard(key)->lookup(key);
+    }
+
+    // values[i] = lookup(keys[i]).
+    void lookupBatch(const BlockCacheKey * keys, std::size_t n, value_type * values) {
+        for (std::size_t i = 0; i < n; i++) {
+            values[i] = shard(keys[i])->lookup(keys[i]);
+        }
+    }
+
+    void insert(const BlockCacheKey & key, const value_type & value) {
+        assert(value);
+        std::size_t charge = value->size() + sizeof(BlockCacheKey) + kEntryOverhead;
+        shard(key)->insert(key, value, charge);
+    }
+
+    bool erase(const BlockCacheKey & key) {
+        return shard(key)->erase(key);
+    }
+
+    CacheStats getStats() const {
+        CacheStats stats;
+        for (std::size_t i = 0; i < shards_.size(); i++) {
+            shards_[i]->getStats(stats);
+        }
+        return stats;
+    }
+
+    void resetStats() {
+        for (std::size_t i = 0; i < shards_.size(); i++) {
+            shards_[i]->resetStats();
+        }
+    }
+
+    std::size_t capacity() const { return capacity_; }
+    std::size_t numShards() const { return shards_.size(); }
+
+    // The shard of the key, in [0, numShards()).
+    std::size_t shardIndex(const BlockCacheKey & key) const {
+        return (std::size_t)((detail::hash_block_cache_key(key) >> 32) >> shard_shift_);
+    }
+    CachePolicy policy() const { return policy_; }
+
+private:
+    BlockCache(const BlockCache &) = delete;
+    BlockCache & operator = (const BlockCache &) = delete;
+
+    detail::BlockCacheShard * shard(const BlockCacheKey & key) const {
+        return shards_[shardIndex(key)].get();
+    }
+};
+
+} // namespace TiStore
@@ -0,0 +1,194 @@
+#pragma once
+
+#include "TiStore/basic/cstdint"
+#include "TiStore/kv/Slice.h"
+
+#include <string.h>
+#include <string>
+
+//
+// Endian-neutral encoding:
+//
+// * Fixed-length numbers are encoded with least-significant byte first.
+// * In addition we support variable length "varint" encoding.
+// * Strings are encoded prefixed by their length in varint format.
+//
+// See: https://github.com/google/leveldb/blob/master/util/coding.h
+//
+
+namespace TiStore {
+
+static inline void encodeFixed32(char * dst, std::uint32_t value)
+{
+    unsigned char * buf = reinterpret_cast<unsigned char *>(dst);
+    buf[0] = (unsigned char)(value);
+    buf[1] = (unsigned char)(value >> 8);
+    buf[2] = (unsigned char)(value >> 16);
+    buf[3] = (unsigned char)(value >> 24);
+}
+
+static inline void encodeFixed64(char * dst, std::uint64_t value)
+{
+    encodeFixed32(dst, (std::uint32_t)value);
+    encodeFixed32(dst + 4, (std::uint32_t)(value >> 32));
+}
+
+static inline std::uint32_t decodeFixed32(const char * ptr)
+{
+    const unsigned char * buf = reinterpret_cast<const unsigned char *>(ptr);
+    return ((std::uint32_t)buf[0])
+         | ((std::uint32_t)buf[1] << 8)
+         | ((std::uint32_t)buf[2] << 16)
+         | ((std::uint32_t)buf[3] << 24);
+}
+
+static inline std::uint64_t decodeFixed64(const char * ptr)
+{
+    return ((std::uint64_t)decodeFixed32(ptr))
+         | ((std::uint64_t)decodeFixed32(ptr + 4) << 32);
+}
+
+static inline void putFixed32(std::string * dst, std::uint32_t value)
+{
+    char buf[sizeof(value)];
+    encodeFixed32(buf, value);
+    dst->append(buf, sizeof(buf));
+}
+
+static inline void putFixed64(std::string * dst, std::uint64_t value)
+{
+    char buf[sizeof(value)];
+    encodeFixed64(buf, value);
+    dst->append(buf, sizeof(buf));
+}
+
+// Returns a pointer just past the last written byte, writes at most 5 bytes.
+static inline char * encodeVarint32(char * dst, std::uint32_t value)
+{
+    unsigned char * ptr = reinterpret_cast<unsigned char *>(dst);
+    while (value >= 0x80) {
+        *(ptr++) = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    *(ptr++) = (unsigned char)value;
+    return reinterpret_cast<char *>(ptr);
+}
+
+static inline void putVarint32(std::string * dst, std::uint32_t value)
+{
+    char buf[5];
+    char * ptr = encodeVarint32(buf, value);
+    dst->append(buf, ptr - buf);
+}
+
+// Returns a pointer just past the last written byte, writes at most 10 bytes.
+static inline char * encodeVarint64(char * dst, std::uint64_t value)
+{
+    unsigned char * ptr = reinterpret_cast<unsigned char *>(dst);
+    while (value >= 0x80) {
+        *(ptr++) = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    *(ptr++) = (unsigned char)value;
+    return reinterpret_cast<char *>(ptr);
+}
+
+static inline void putVarint64(std::string * dst, std::uint64_t value)
+{
+    char buf[10];
+    char * ptr = encodeVarint64(buf, value);
+    dst->append(buf, ptr - buf);
+}
+
+// Returns the number of bytes of the varint encoding of value.
+static inline int varintLength(std::uint64_t value)
+{
+    int len = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        len++;
+    }
+    return len;
+}
+
+//
+// Decode a varint32 from [p, limit), returns a pointer just past the parsed
+// value, or nullptr on error.
+//
+static inline const char * getVarint32Ptr(const char * p, const char * limit, std::uint32_t * value)
+{
+    std::uint32_t result = 0;
+    for (std::uint32_t shift = 0; shift <= 28 && p < limit; shift += 7) {
+        std::uint32_t byte = *(reinterpret_cast<const unsigned char *>(p));
+        p++;
+        if ((byte & 0x80) != 0) {
+            result |= ((byte & 0x7F) << shift);
+        }
+        else {
+            result |= (byte << shift);
+            *value = result;
+            return p;
+        }
+    }
+    return nullptr;
+}
+
+// Parse a varint32 from the front of input, and advance the slice past it.
+static inline bool getVarint32(Slice * input, std::uint32_t * value)
+{
+    const char * p = input->data();
+    const char * limit = p + input->size();
+    const char * q = getVarint32Ptr(p, limit, value);
+    if (q == nullptr)
+        return false;
+    *input = Slice(q, limit - q);
+    return true;
+}
+
+static inline const char * getVarint64Ptr(const char * p, const char * limit, std::uint64_t * value)
+{
+    std::uint64_t result = 0;
+    for (std::uint32_t shift = 0; shift <= 63 && p < limit; shift += 7) {
+        std::uint64_t byte = *(reinterpret_cast<const unsigned char *>(p));
+        p++;
+        if ((byte & 0x80) != 0) {
+            result |= ((byte & 0x7F) << shift);
+        }
+        else {
+            result |= (byte << shift);
+            *value = result;
+            return p;
+        }
+    }
+    return nullptr;
+}
+
+static inline bool getVarint64(Slice * input, std::uint64_t * value)
+{
+    const char * p = input->data();
+    const char * limit = p + input->size();
+    const char * q = getVarint64Ptr(p, limit, value);
+    if (q == nullptr)
+        return false;
+    *input = Slice(q, limit - q);
+    return true;
+}
+
+static inline void putLengthPrefixedSlice(std::string * dst, const Slice & value)
+{
+    putVarint32(dst, (std::uint32_t)value.size());
+    dst->append(value.data(), value.size());
+}
+
+static inline bool getLengthPrefixedSlice(Slice * input, Slice * result)
+{
+    std::uint32_t len;
+    if (getVarint32(input, &len) && input->size() >= len) {
+        *result = Slice(input->data(), len);
+        input->remove_prefix(len);
+        return true;
+    }
+    return false;
+}
+
+} // namespace TiStore
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "TiStore/basic/cstdint"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(_M_AMD64) \
+ || defined(__i386__) || defined(_M_IX86)
+#define TISTORE_ARCH_X86    1
+#else
+#define TISTORE_ARCH_X86    0
+#endif
+
+#if TISTORE_ARCH_X86
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#include <immintrin.h>
+#endif
+
+//
+// The functions using instructions beyond the baseline of the build are
+// marked with TISTORE_TARGET(...), so they compile without -mavx2 etc.,
+// and are only called after a check of CpuFeatures at run time. MSVC
+// compiles the intrinsics without any flag.
+//
+#if TISTORE_ARCH_X86 && (defined(__GNUC__) || defined(__clang__))
+#define TISTORE_TARGET(isa)     __attribute__((target(isa)))
+#else
+#define TISTORE_TARGET(isa)
+#endif
+
+namespace TiStore {
+
+//
+// The instruction sets of the CPU we run on, detected once by cpuid.
+//
+class CpuFeatures {
+private:
+    bool sse41_;
+    bool sse42_;
+    bool pclmul_;
+    bool avx2_;
+
+    CpuFeatures() : sse41_(false), sse42_(false), pclmul_(false), avx2_(false) {
+#if TISTORE_ARCH_X86
+        std::uint32_t regs[4];
+        cpuid(0, 0, regs);
+        std::uint32_t max_leaf = regs[0];
+        if (max_leaf < 1)
+            return;
+
+        cpuid(1, 0, regs);
+        sse41_ = ((regs[2] & (1U << 19)) != 0);
+        sse42_ = ((regs[2] & (1U << 20)) != 0);
+        pclmul_ = ((regs[2] & (1U << 1)) != 0);
+        bool osxsave = ((regs[2] & (1U << 27)) != 0);
+        bool avx = ((regs[2] & (1U << 28)) != 0);
+
+        // AVX2 needs the OS to save the YMM registers (XCR0 bits 1 and 2).
+        if (max_leaf >= 7 && osxsave && avx && (xgetbv0() & 0x06) == 0x06) {
+            cpuid(7, 0, regs);
+            avx2_ = ((regs[1] & (1U << 5)) != 0);
+        }
+#endif
+    }
+
+#if TISTORE_ARCH_X86
+    static void cpuid(std::uint32_t leaf, std::uint32_t subleaf, std::uint32_t regs[4]) {
+#if defined(_MSC_VER)
+        int info[4];
+        __cpuidex(info, (int)leaf, (int)subleaf);
+        for (int i = 0; i < 4; i++)
+            regs[i] = (std::uint32_t)info[i];
+#else
+        unsigned int a = 0, b = 0, c = 0, d = 0;
+        __cpuid_count(leaf, subleaf, a, b, c, d);
+        regs[0] = a; regs[1] = b; regs[2] = c; regs[3] = d;
+#endif
+    }
+
+    static std::uint64_t xgetbv0() {
+#if defined(_MSC_VER)
+        return (std::uint64_t)_xgetbv(0);
+#else
+        std::uint32_t eax, edx;
+        __asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+        return ((std::uint64_t)edx << 32) | eax;
+#endif
+    }
+#endif // TISTORE_ARCH_X86
+
+    static const CpuFeatures & get() {
+        static const CpuFeatures features;
+        return features;
+    }
+
+public:
+    static bool hasSSE41() { return get().sse41_; }
+    static bool hasSSE42() { return get().sse42_; }
+    static bool hasPCLMUL() { return get().pclmul_; }
+    static bool hasAVX2() { return get().avx2_; }
+};
+
+} // namespace TiStore
@@ -0,0 +1,313 @@
+#pragma once
+
+#include "TiStore/basic/cstdint"
+#include "TiStore/kv/CpuFeatures.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#if TISTORE_ARCH_X86
+#include <nmmintrin.h>
+#endif
+
+//
+// CRC32C (Castagnoli polynomial), as used by iSCSI, ext4 and LevelDB.
+//
+// With SSE4.2 the crc is made by the crc32 instruction, 8 bytes at a time,
+// and the big buffers by 3 independent streams at a time, since the
+// instruction has a latency of 3 cycles and a throughput of 1 per cycle.
+// Without it, by tables, 8 bytes at a time (slicing-by-8). The choice is
+// made at run time by CpuFeatures, the crc is the same.
+//
+// See: https://github.com/google/leveldb/blob/master/util/crc32c.h
+// See: "Fast CRC Computation for iSCSI Polynomial Using CRC32 Instruction", Intel
+// See: https://stackoverflow.com/questions/17645167/implementing-sse-4-2s-crc32c-in-software
+//
+
+namespace TiStore {
+
+namespace detail {
+
+// The reversed Castagnoli polynomial.
+static const std::uint32_t kCrc32cPoly = 0x82F63B78UL;
+
+// The lengths of the blocks of the 3 streams, they must be powers of 2.
+static const size_t kCrc32cLongBlock = 8192;
+static const size_t kCrc32cShortBlock = 256;
+
+//
+// table[0] is the crc of a byte, table[k] the crc of a byte followed by k
+// zero bytes, so 8 bytes are folded by 8 lookups at once.
+//
+struct Crc32cTable {
+    std::uint32_t table[8][256];
+
+    Crc32cTable() {
+        for (std::uint32_t i = 0; i < 256; i++) {
+            std::uint32_t crc = i;
+            for (int j = 0; j < 8; j++) {
+                crc = (crc >> 1) ^ ((crc & 1) ? kCrc32cPoly : 0);
+            }
+            table[0][i] = crc;
+        }
+        for (std::uint32_t i = 0; i < 256; i++) {
+            std::uint32_t crc = table[0][i];
+            for (int k = 1; k < 8; k++) {
+                crc = table[0][crc & 0xFF] ^ (crc >> 8);
+                table[k][i] = crc;
+            }
+        }
+    }
+
+    static const Crc32cTable & get() {
+        static const Crc32cTable s_table;
+        return s_table;
+    }
+};
+
+//
+// The operators to append kCrc32cLongBlock or kCrc32cShortBlock zero bytes
+// to a crc, by 4 lookups, to combine the crcs of the 3 streams:
+// crc(A + B) = shift(crc(A), len(B)) ^ crc(B), B's crc starting from 0.
+//
+struct Crc32cShiftTable {
+    std::uint32_t long_shift[4][256];
+    std::uint32_t short_shift[4][256];
+
+    Crc32cShiftTable() {
+        makeShiftTable(long_shift, kCrc32cLongBlock);
+        makeShiftTable(short_shift, kCrc32cShortBlock);
+    }
+
+    static const Crc32cShiftTable & get() {
+        static const Crc32cShiftTable s_table;
+        return s_table;
+    }
+
+private:
+    // The product of the 32x32 bits matrix and the vector, over GF(2).
+    static std::uint32_t gf2MatrixTimes(const std::uint32_t * matrix, std::uint32_t vec) {
+        std::uint32_t sum = 0;
+        while (vec != 0) {
+            if (vec & 1)
+                sum ^= *matrix;
+            vec >>= 1;
+            matrix++;
+        }
+        return sum;
+    }
+
+    static void gf2MatrixSquare(std::uint32_t * square, const std::uint32_t * matrix) {
+        for (int n = 0; n < 32; n++) {
+            square[n] = gf2MatrixTimes(matrix, matrix[n]);
+        }
+    }
+
+    // The operator of len zero bytes, len is a power of 2.
+    static void makeShiftOperator(std::uint32_t * op, size_t len) {
+        std::uint32_t odd[32];
+        // The operator of one zero bit.
+        odd[0] = kCrc32cPoly;
+        std::uint32_t row = 1;
+        for (int n = 1; n < 32; n++) {
+            odd[n] = row;
+            row <<= 1;
+        }
+        // 2 bits, then 4 bits, then squared up to 8 * len bits.
+        gf2MatrixSquare(op, odd);
+        gf2MatrixSquare(odd, op);
+        for (;;) {
+            gf2MatrixSquare(op, odd);
+            len >>= 1;
+            if (len == 0)
+                return;
+            gf2MatrixSquare(odd, op);
+            len >>= 1;
+            if (len == 0)
+                break;
+        }
+        ::memcpy(op, odd, sizeof(odd));
+    }
+
+    static void makeShiftTable(std::uint32_t shift[4][256], size_t len) {
+        std::uint32_t op[32];
+        makeShiftOperator(op, len);
+        for (std::uint32_t n = 0; n < 256; n++) {
+            shift[0][n] = gf2MatrixTimes(op, n);
+            shift[1][n] = gf2MatrixTimes(op, n << 8);
+            shift[2][n] = gf2MatrixTimes(op, n << 16);
+            shift[3][n] = gf2MatrixTimes(op, n << 24);
+        }
+    }
+};
+
+static inline std::uint32_t crc32c_shift(const std::uint32_t shift[4][256], std::uint32_t crc)
+{
+    return (shift[0][crc & 0xFF] ^ shift[1][(crc >> 8) & 0xFF] ^
+            shift[2][(crc >> 16) & 0xFF] ^ shift[3][crc >> 24]);
+}
+
+// The crc register (not inverted) of the bytes, by the tables.
+static inline std::uint32_t crc32c_portable(std::uint32_t crc, const unsigned char * p, size_t n)
+{
+    const Crc32cTable & tables = Crc32cTable::get();
+    const std::uint32_t (*table)[256] = tables.table;
+    while (n >= 8) {
+        std::uint32_t lo, hi;
+        ::memcpy(&lo, p, sizeof(lo));
+        ::memcpy(&hi, p + 4, sizeof(hi));
+        // Little endian: the first byte is the low byte.
+        lo ^= crc;
+        crc = table[7][lo & 0xFF] ^ table[6][(lo >> 8) & 0xFF] ^
+              table[5][(lo >> 16) & 0xFF] ^ table[4][lo >> 24] ^
+              table[3][hi & 0xFF] ^ table[2][(hi >> 8) & 0xFF] ^
+              table[1][(hi >> 16) & 0xFF] ^ table[0][hi >> 24];
+        p += 8;
+        n -= 8;
+    }
+    while (n > 0) {
+        crc = table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+        n--;
+    }
+    return crc;
+}
+
+#if TISTORE_ARCH_X86
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(_M_AMD64)
+typedef std::uint64_t crc32c_word_t;
+
+TISTORE_TARGET("sse4.2")
+static inline std::uint32_t crc32c_word(std::uint32_t crc, const unsigned char * p)
+{
+    std::uint64_t word;
+    ::memcpy(&word, p, sizeof(word));
+    return (std::uint32_t)_mm_crc32_u64(crc, word);
+}
+#else
+typedef std::uint32_t crc32c_word_t;
+
+TISTORE_TARGET("sse4.2")
+static inline std::uint32_t crc32c_word(std::uint32_t crc, const unsigned char * p)
+{
+    std::uint32_t word;
+    ::memcpy(&word, p, sizeof(word));
+    return _mm_crc32_u32(crc, word);
+}
+#endif
+
+//
+// The 3 streams of block_size bytes each at a time, while there are.
+// Returns the crc of them, and moves p and n past them.
+//
+TISTORE_TARGET("sse4.2")
+static inline std::uint32_t crc32c_sse42_3way(std::uint32_t crc, const unsigned char *& p, size_t & n,
+                                              size_t block_size, const std::uint32_t shift[4][256])
+{
+    while (n >= block_size * 3) {
+        std::uint32_t crc1 = 0, crc2 = 0;
+        const unsigned char * end = p + block_size;
+        do {
+            crc  = crc32c_word(crc,  p);
+            crc1 = crc32c_word(crc1, p + block_size);
+            crc2 = crc32c_word(crc2, p + block_size * 2);
+            p += sizeof(crc32c_word_t);
+        } while (p < end);
+        crc = crc32c_shift(shift, crc) ^ crc1;
+        crc = crc32c_shift(shift, crc) ^ crc2;
+        p += block_size * 2;
+        n -= block_size * 3;
+    }
+    return crc;
+}
+
+// The crc register (not inverted) of the bytes, by the crc32 instruction.
+TISTORE_TARGET("sse4.2")
+static inline std::uint32_t crc32c_sse42(std::uint32_t crc, const unsigned char * p, size_t n)
+{
+    // Up to the first word boundary.
+    while (n > 0 && (reinterpret_cast<size_t>(p) & (sizeof(crc32c_word_t) - 1)) != 0) {
+        crc = _mm_crc32_u8(crc, *p++);
+        n--;
+    }
+    if (n >= kCrc32cShortBlock * 3) {
+        const Crc32cShiftTable & shift = Crc32cShiftTable::get();
+        crc = crc32c_sse42_3way(crc, p, n, kCrc32cLongBlock, shift.long_shift);
+        crc = crc32c_sse42_3way(crc, p, n, kCrc32cShortBlock, shift.short_shift);
+    }
+    while (n >= sizeof(crc32c_word_t)) {
+        crc = crc32c_word(crc, p);
+        p += sizeof(crc32c_word_t);
+        n -= sizeof(crc32c_word_t);
+    }
+    while (n > 0) {
+        crc = _mm_crc32_u8(crc, *p++);
+        n--;
+    }
+    return crc;
+}
+
+#endif // TISTORE_ARCH_X86
+
+static inline bool crc32c_use_sse42()
+{
+    static const bool s_use_sse42 = CpuFeatures::hasSSE42();
+    return s_use_sse42;
+}
+
+} // namespace detail
+
+//
+// Return the crc32c of concat(A, data[0, n-1]) where init_crc is the
+// crc32c of some string A. crc32c_extend() is often used to maintain
+// the crc32c of a stream of data.
+//
+static inline std::uint32_t crc32c_extend(std::uint32_t init_crc, const char * data, size_t n)
+{
+    const unsigned char * p = reinterpret_cast<const unsigned char *>(data);
+    std::uint32_t crc = init_crc ^ 0xFFFFFFFFUL;
+#if TISTORE_ARCH_X86
+    if (detail::crc32c_use_sse42())
+        crc = detail::crc32c_sse42(crc, p, n);
+    else
+#endif
+        crc = detail::crc32c_portable(crc, p, n);
+    return (crc ^ 0xFFFFFFFFUL);
+}
+
+// crc32c_extend() by the tables only, whatever the CPU, e.g. to verify the other one.
+static inline std::uint32_t crc32c_extend_portable(std::uint32_t init_crc, const char * data, size_t n)
+{
+    const unsigned char * p = reinterpret_cast<const unsigned char *>(data);
+    return (detail::crc32c_portable(init_crc ^ 0xFFFFFFFFUL, p, n) ^ 0xFFFFFFFFUL);
+}
+
+// Return the crc32c of data[0, n-1]
+static inline std::uint32_t crc32c_value(const char * data, size_t n)
+{
+    return crc32c_extend(0, data, n);
+}
+
+static const std::uint32_t kCrc32cMaskDelta = 0xA282EAD8UL;
+
+//
+// Return a masked representation of crc.
+//
+// Motivation: it is problematic to compute the CRC of a string that
+// contains embedded CRCs. Therefore we recommend that CRCs stored
+// somewhere (e.g., in files) should be masked before being stored.
+//
+static inline std::uint32_t crc32c_mask(std::uint32_t crc)
+{
+    // Rotate right by 15 bits and add a constant.
+    return ((crc >> 15) | (crc << 17)) + kCrc32cMaskDelta;
+}
+
+// Return the crc whose masked representation is masked_crc.
+static inline std::uint32_t crc32c_unmask(std::uint32_t masked_crc)
+{
+    std::uint32_t rot = masked_crc - kCrc32cMaskDelta;
+    return ((rot >> 17) | (rot << 15));
+}
+
+} // namespace TiStore
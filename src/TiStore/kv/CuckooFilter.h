@@ -0,0 +1,340 @@
+#pragma once
+
+#include "TiStore/basic/cstdint"
+#include "TiStore/fs/Common.h"
+#include "TiStore/kv/Hash.h"
+#include "TiStore/kv/Slice.h"
+
+#include <assert.h>
+#include <string.h>
+#include <stdio.h>
+#include <atomic>
+#include <memory>
+#include <new>
+
+namespace TiStore {
+
+//
+// A cuckoo filter: a filter that can delete keys, for a mutable set such
+// as a memtable, where a bloom filter can't unset the bits of a key that
+// are shared with the other keys.
+//
+// Each key has a 16 bits fingerprint, stored in one of its two buckets of
+// 4 slots, i1 = hash(key) and i2 = i1 ^ hash(fingerprint), so i1 can be
+// found again from i2 and the fingerprint when it's kicked out to make
+// room. A bucket is one 64 bits word, 8 buckets to a cache line, so a
+// lookup reads at most two lines and tests the 4 slots of a bucket at once.
+// The false positive rate is at most 2 * 4 / 2^16 (0.012%), and the
+// buckets can be filled to about 95%.
+//
+// removeKey() must only be called for a key that was added (and not
+// removed yet), else it can remove the fingerprint of another key.
+// A key may be added more than once (then it must be removed as many
+// times), but not more than 8 times.
+//
+// The writes require external synchronization. The reads are lock-free
+// and can run concurrently with the writer: a kick moves fingerprints
+// between buckets, so the writer bumps a sequence number around it, and a
+// reader that misses the key while it changed looks again.
+//
+// See: "Cuckoo Filter: Practically Better Than Bloom", Fan et al.
+//
+class CuckooFilter {
+public:
+    static const std::size_t kSlotsPerBucket = 4;
+    static const std::size_t kBitsPerSlot = 16;
+    static const std::size_t kMaxKicks = 500;
+
+    typedef std::uint16_t fingerprint_type;
+
+private:
+    static const std::uint64_t kLowBits = 0x0001000100010001ULL;
+    static const std::uint64_t kHighBits = 0x8000800080008000ULL;
+    static const std::uint64_t kVictimValid = 1ULL << 63;
+
+    HashUtils<> hashUtils_;
+    std::unique_ptr<char[]> buffer_;
+    // buckets_ is buffer_ aligned to CACHE_LINE_SIZE.
+    std::atomic<std::uint64_t> * buckets_;
+    std::size_t bucket_mask_;
+    std::size_t num_buckets_;
+    std::size_t num_keys_;
+
+    // The fingerprint that found no room in the last kick, and its bucket:
+    // kVictimValid | (index << 16) | fingerprint, 0 if there's none.
+    std::atomic<std::uint64_t> victim_;
+    // Odd while a kick moves the fingerprints.
+    std::atomic<std::uint64_t> sequence_;
+    std::uint32_t rnd_;
+
+    bool verbose_;
+
+public:
+    CuckooFilter() :
+        buckets_(nullptr), bucket_mask_(0), num_buckets_(0), num_keys_(0),
+        victim_(0), sequence_(0), rnd_(2463534242U), verbose_(false) {
+    }
+
+    CuckooFilter(std::size_t max_keys, bool verbose = true)
+        : hashUtils_(), buckets_(nullptr), bucket_mask_(0), num_buckets_(0), num_keys_(0),
+          victim_(0), sequence_(0), rnd_(2463534242U), verbose_(verbose) {
+        initFilter(max_keys);
+    }
+
+    ~CuckooFilter() {}
+
+private:
+    void initFilter(std::size_t max_keys) noexcept {
+        // The buckets are 95% full at most, and the xor of the alternate
+        // bucket needs a power of 2.
+        std::size_t min_buckets = (std::size_t)((double)max_keys / (kSlotsPerBucket * 0.95)) + 1;
+        std::size_t num_buckets = CACHE_LINE_SIZE / sizeof(std::uint64_t);
+        while (num_buckets < min_buckets)
+            num_buckets <<= 1;
+
+        std::size_t bytes = num_buckets * sizeof(std::atomic<std::uint64_t>);
+        char * new_buffer = new (std::nothrow) char[bytes + CACHE_LINE_SIZE - 1];
+        buffer_.reset(new_buffer);
+        if (new_buffer == nullptr) {
+            buckets_ = nullptr;
+            num_buckets_ = bucket_mask_ = 0;
+            return;
+        }
+        buckets_ = reinterpret_cast<std::atomic<std::uint64_t> *>(
+            ((std::size_t)new_buffer + CACHE_LINE_SIZE - 1) & ~(std::size_t)(CACHE_LINE_SIZE - 1));
+        for (std::size_t i = 0; i < num_buckets; i++) {
+            new (&buckets_[i]) std::atomic<std::uint64_t>(0);
+        }
+        num_buckets_ = num_buckets;
+        bucket_mask_ = num_buckets - 1;
+        num_keys_ = 0;
+        victim_.store(0, std::memory_order_relaxed);
+
+        if (getVerbose()) {
+            printf("max_keys            = %zu keys\n"
+                   "num_buckets         = %zu buckets\n"
+                   "slots_per_bucket    = %zu\n"
+                   "size_of_buckets     = %zu bytes\n\n",
+                    max_keys, num_buckets_, kSlotsPerBucket, bytes);
+        }
+    }
+
+    inline void getIndexAndFingerprint(const Slice & key, std::size_t & index,
+                                       fingerprint_type & fingerprint) const {
+        std::uint32_t primary_hash = hashUtils_.primaryHash(key.data(), key.size(), kDefaultHashSeed);
+        std::uint32_t secondary_hash = hashUtils_.secondaryHash(key.data(), key.size());
+        index = (std::size_t)primary_hash & bucket_mask_;
+        // 0 is an empty slot.
+        fingerprint = (fingerprint_type)(secondary_hash ^ (secondary_hash >> 16));
+        fingerprint += (fingerprint == 0);
+    }
+
+    inline std::size_t getAltIndex(std::size_t index, fingerprint_type fingerprint) const {
+        return (index ^ ((std::size_t)fingerprint * 0x5BD1E995U)) & bucket_mask_;
+    }
+
+    // Returns a mask with the high bit of each slot that is equal to fingerprint.
+    static inline std::uint64_t matchSlots(std::uint64_t bucket, fingerprint_type fingerprint) {
+        std::uint64_t x = bucket ^ (kLowBits * fingerprint);
+        return (x - kLowBits) & ~x & kHighBits;
+    }
+
+    static inline int getSlotOf(std::uint64_t mask) {
+        int slot = 0;
+        while ((mask & 0x8000U) == 0) {
+            mask >>= kBitsPerSlot;
+            slot++;
+        }
+        return slot;
+    }
+
+    static inline fingerprint_type getSlot(std::uint64_t bucket, int slot) {
+        return (fingerprint_type)(bucket >> (slot * kBitsPerSlot));
+    }
+
+    static inline std::uint64_t setSlot(std::uint64_t bucket, int slot, fingerprint_type fingerprint) {
+        std::uint64_t shift = slot * kBitsPerSlot;
+        return (bucket & ~(0xFFFFULL << shift)) | ((std::uint64_t)fingerprint << shift);
+    }
+
+    bool tryInsert(std::size_t index, fingerprint_type fingerprint) {
+        std::uint64_t bucket = buckets_[index].load(std::memory_order_relaxed);
+        std::uint64_t empty = matchSlots(bucket, 0);
+        if (empty == 0)
+            return false;
+        buckets_[index].store(setSlot(bucket, getSlotOf(empty), fingerprint), std::memory_order_relaxed);
+        return true;
+    }
+
+    bool tryRemove(std::size_t index, fingerprint_type fingerprint) {
+        std::uint64_t bucket = buckets_[index].load(std::memory_order_relaxed);
+        std::uint64_t match = matchSlots(bucket, fingerprint);
+        if (match == 0)
+            return false;
+        buckets_[index].store(setSlot(bucket, getSlotOf(match), 0), std::memory_order_relaxed);
+        return true;
+    }
+
+    inline bool findInBuckets(std::size_t i1, std::size_t i2, fingerprint_type fingerprint) const {
+        std::uint64_t b1 = buckets_[i1].load(std::memory_order_relaxed);
+        std::uint64_t b2 = buckets_[i2].load(std::memory_order_relaxed);
+        return ((matchSlots(b1, fingerprint) | matchSlots(b2, fingerprint)) != 0);
+    }
+
+    inline bool isVictim(std::size_t i1, std::size_t i2, fingerprint_type fingerprint) const {
+        std::uint64_t victim = victim_.load(std::memory_order_relaxed);
+        if (victim == 0 || (fingerprint_type)victim != fingerprint)
+            return false;
+        std::size_t index = (std::size_t)((victim & ~kVictimValid) >> kBitsPerSlot);
+        return (index == i1 || index == i2);
+    }
+
+    void beginMove() {
+        sequence_.store(sequence_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    void endMove() {
+        sequence_.store(sequence_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // Kicks the fingerprints out of their buckets, to their alternate ones,
+    // until one finds an empty slot. Returns false if it gave up, and the
+    // last one kicked out is the victim. Must be called between beginMove()
+    // and endMove().
+    bool kickInsert(std::size_t index, fingerprint_type fingerprint) {
+        for (std::size_t kick = 0; kick < kMaxKicks; kick++) {
+            rnd_ ^= rnd_ << 13; rnd_ ^= rnd_ >> 17; rnd_ ^= rnd_ << 5;
+            int slot = (int)(rnd_ % kSlotsPerBucket);
+            std::uint64_t bucket = buckets_[index].load(std::memory_order_relaxed);
+            fingerprint_type kicked = getSlot(bucket, slot);
+            buckets_[index].store(setSlot(bucket, slot, fingerprint), std::memory_order_relaxed);
+            fingerprint = kicked;
+            index = getAltIndex(index, fingerprint);
+            if (tryInsert(index, fingerprint))
+                return true;
+        }
+        victim_.store(kVictimValid | ((std::uint64_t)index << kBitsPerSlot) | fingerprint,
+                      std::memory_order_relaxed);
+        return false;
+    }
+
+    // Moves the victim into a bucket, or kicks for a slot again. The victim
+    // is cleared inside the move, else a reader could miss it between the
+    // victim and the buckets.
+    void reinsertVictim(std::uint64_t victim) {
+        std::size_t index = (std::size_t)((victim & ~kVictimValid) >> kBitsPerSlot);
+        fingerprint_type fingerprint = (fingerprint_type)victim;
+        beginMove();
+        victim_.store(0, std::memory_order_relaxed);
+        if (!tryInsert(index, fingerprint)
+            && !tryInsert(getAltIndex(index, fingerprint), fingerprint)) {
+            kickInsert(index, fingerprint);
+        }
+        endMove();
+    }
+
+public:
+    bool getVerbose() const { return verbose_; }
+    void setVerbose(bool verbose) { verbose_ = verbose; }
+
+    std::size_t getFilterSize() const { return num_buckets_ * sizeof(std::uint64_t); }
+    std::size_t getNumBuckets() const { return num_buckets_; }
+    std::size_t getNumKeys() const { return num_keys_; }
+
+    double getLoadFactor() const {
+        return (num_buckets_ != 0) ? ((double)num_keys_ / (num_buckets_ * kSlotsPerBucket)) : 0.0;
+    }
+
+    // The filter is full, a kick has failed and its victim is still waiting
+    // for a slot, addKey() would fail.
+    bool isFull() const { return (victim_.load(std::memory_order_relaxed) != 0); }
+
+    // CuckooFilter
+    void setOption(std::size_t max_keys, bool verbose = true) {
+        setVerbose(verbose);
+        initFilter(max_keys);
+    }
+
+    // CuckooFilter
+    void reset() {
+        for (std::size_t i = 0; i < num_buckets_; i++) {
+            buckets_[i].store(0, std::memory_order_relaxed);
+        }
+        num_keys_ = 0;
+        victim_.store(0, std::memory_order_relaxed);
+    }
+
+    // CuckooFilter: returns false if the filter is full, then the key is
+    // not added.
+    bool addKey(const Slice & key) {
+        if (buckets_ == nullptr || isFull())
+            return false;
+        std::size_t i1;
+        fingerprint_type fingerprint;
+        getIndexAndFingerprint(key, i1, fingerprint);
+        num_keys_++;
+        if (tryInsert(i1, fingerprint))
+            return true;
+        std::size_t i2 = getAltIndex(i1, fingerprint);
+        if (tryInsert(i2, fingerprint))
+            return true;
+        // The victim is in the filter too, only the next addKey() fails.
+        beginMove();
+        kickInsert(i2, fingerprint);
+        endMove();
+        return true;
+    }
+
+    // CuckooFilter: returns false if the key is not found.
+    bool removeKey(const Slice & key) {
+        if (buckets_ == nullptr)
+            return false;
+        std::size_t i1;
+        fingerprint_type fingerprint;
+        getIndexAndFingerprint(key, i1, fingerprint);
+        std::size_t i2 = getAltIndex(i1, fingerprint);
+        if (tryRemove(i1, fingerprint) || tryRemove(i2, fingerprint)) {
+            num_keys_--;
+        }
+        else if (isVictim(i1, i2, fingerprint)) {
+            victim_.store(0, std::memory_order_relaxed);
+            num_keys_--;
+            return true;
+        }
+        else {
+            return false;
+        }
+        // There's a free slot now, find a place for the victim.
+        std::uint64_t victim = victim_.load(std::memory_order_relaxed);
+        if (victim != 0) {
+            reinsertVictim(victim);
+        }
+        return true;
+    }
+
+    // CuckooFilter
+    bool maybeMatch(const Slice & key) const {
+        if (buckets_ == nullptr)
+            return true;
+        std::size_t i1;
+        fingerprint_type fingerprint;
+        getIndexAndFingerprint(key, i1, fingerprint);
+        std::size_t i2 = getAltIndex(i1, fingerprint);
+        while (true) {
+            std::uint64_t sequence = sequence_.load(std::memory_order_acquire);
+            if (findInBuckets(i1, i2, fingerprint) || isVictim(i1, i2, fingerprint))
+                return true;
+            // A miss is only sure if no kick moved the fingerprints meanwhile.
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if ((sequence & 1) == 0 && sequence_.load(std::memory_order_relaxed) == sequence)
+                return false;
+        }
+    }
+
+private:
+    CuckooFilter(const CuckooFilter &) = delete;
+    CuckooFilter & operator = (const CuckooFilter &) = delete;
+};
+
+} // namespace TiStore
@@ -0,0 +1,239 @@
+#pragma once
+
+#include "TiStore/basic/cstdint"
+#include "TiStore/fs/ErrorCode.h"
+#include "TiStore/kv/BloomFilter.h"
+#include "TiStore/kv/BloomFilterFixed.h"
+#include "TiStore/kv/Hash.h"
+#include "TiStore/kv/Slice.h"
+
+#include <assert.h>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace TiStore {
+
+namespace detail {
+
+//
+// Makes the filters of a FilterPolicy: a filter for a number of keys to
+// build, and an empty one to attach to an encoding.
+//
+template <typename FilterType>
+struct FilterFactory {
+    static FilterType * newFilter(std::size_t num_keys, std::size_t bits_per_key) {
+        return new FilterType(num_keys, bits_per_key, false);
+    }
+
+    static FilterType * newEmptyFilter() {
+        return new FilterType();
+    }
+};
+
+// The geometry of a fixed filter is the one of its template arguments.
+template <std::size_t N, std::size_t B, std::size_t K>
+struct FilterFactory<StandardBloomFilterFixed<N, B, K>> {
+    static StandardBloomFilterFixed<N, B, K> * newFilter(std::size_t, std::size_t) {
+        return new StandardBloomFilterFixed<N, B, K>(false);
+    }
+
+    static StandardBloomFilterFixed<N, B, K> * newEmptyFilter() {
+        return new StandardBloomFilterFixed<N, B, K>(false);
+    }
+};
+
+template <std::size_t N, std::size_t B, std::size_t K>
+struct FilterFactory<FullBloomFilterFixed<N, B, K>> {
+    static FullBloomFilterFixed<N, B, K> * newFilter(std::size_t, std::size_t) {
+        return new FullBloomFilterFixed<N, B, K>(false);
+    }
+
+    static FullBloomFilterFixed<N, B, K> * newEmptyFilter() {
+        return new FullBloomFilterFixed<N, B, K>(false);
+    }
+};
+
+// Adds the hashes [first, last) of a Builder to the filter, while the
+// other threads add the other ones.
+template <typename FilterType>
+void add_hashes_concurrently(FilterType * filter, const std::uint64_t * hashes,
+                             std::size_t first, std::size_t last) {
+    for (std::size_t i = first; i < last; i++) {
+        filter->addHashConcurrently((std::uint32_t)(hashes[i] >> 32), (std::uint32_t)hashes[i]);
+    }
+}
+
+} // namespace detail
+
+//
+// The filter of a set of keys, e.g. of a table, by the layout of FilterType
+// (StandardBloomFilter, FullBloomFilter, BlockedBloomFilter, or a fixed
+// one), which is a template argument, so the probes of keyMayMatch() are
+// inlined, without a virtual call.
+//
+// The Builder keeps the 64-bit hash of every key added, not a copy of the
+// key, until finish() sizes the filter by the number of the keys and
+// writes its encoding, see BloomFilterFormat.h. The Reader is a read-only
+// view of an encoding, without a copy.
+//
+// FilterType must have addHash(primary_hash, secondary_hash), encodeTo(),
+// attach() and maybeMatch(), and addHashConcurrently() for
+// Builder::finishParallel().
+//
+template <typename FilterType>
+class FilterPolicy {
+public:
+    typedef FilterType filter_type;
+
+    class Builder {
+    public:
+        static const std::size_t kMinKeysPerThread = 65536;
+
+    private:
+        HashUtils<> hashUtils_;
+        std::size_t bits_per_key_;
+        // (primary_hash << 32) | secondary_hash
+        std::vector<std::uint64_t> hashes_;
+
+    public:
+        explicit Builder(std::size_t bits_per_key = 10) : bits_per_key_(bits_per_key) {}
+        ~Builder() {}
+
+        void addKey(const Slice & key) {
+            std::uint32_t primary_hash = hashUtils_.primaryHash(key.data(), key.size(), kDefaultHashSeed);
+            std::uint32_t secondary_hash = hashUtils_.secondaryHash(key.data(), key.size());
+            addHash(primary_hash, secondary_hash);
+        }
+
+        void addHash(std::uint32_t primary_hash, std::uint32_t secondary_hash) {
+            hashes_.push_back(((std::uint64_t)primary_hash << 32) | secondary_hash);
+        }
+
+        std::size_t numKeys() const { return hashes_.size(); }
+        bool empty() const { return hashes_.empty(); }
+
+        // The bytes of the hashes kept so far.
+        std::size_t memoryUsage() const { return hashes_.capacity() * sizeof(std::uint64_t); }
+
+        //
+        // Appends the encoding of the filter of the keys added since the last
+        // finish(), and drops the keys. Returns out_of_memory if the filter
+        // can't be allocated (or is too big, see FullBloomFilter::kMaxBytesTotal),
+        // then nothing is appended.
+        //
+        int finish(std::string * dst) {
+            std::unique_ptr<filter_type> filter(newFilter());
+            if (!filter)
+                return error_code::out_of_memory;
+            for (std::size_t i = 0; i < hashes_.size(); i++) {
+                filter->addHash((std::uint32_t)(hashes_[i] >> 32), (std::uint32_t)hashes_[i]);
+            }
+            filter->encodeTo(dst);
+            hashes_.clear();
+            return error_code::no_error;
+        }
+
+        //
+        // finish() by num_threads threads, each one adds a range of the
+        // hashes to the shared bitmap by atomic ORs, so the encoding is the
+        // same as the one of finish(). It only pays off for big filters,
+        // the ones smaller than kMinKeysPerThread keys per thread are made
+        // by fewer threads. If a thread can't be started, its hashes are
+        // added by the calling thread.
+        //
+        int finishParallel(std::string * dst, std::size_t num_threads) {
+            std::size_t num_keys = hashes_.size();
+            if (num_threads > num_keys / kMinKeysPerThread)
+                num_threads = num_keys / kMinKeysPerThread;
+            if (num_threads <= 1)
+                return finish(dst);
+
+            std::unique_ptr<filter_type> filter(newFilter());
+            if (!filter)
+                return error_code::out_of_memory;
+
+            const std::uint64_t * hashes = hashes_.data();
+            std::size_t keys_per_thread = (num_keys + num_threads - 1) / num_threads;
+            std::vector<std::thread> threads;
+            threads.reserve(num_threads - 1);
+            // The calling thread adds the first range, after starting the other threads.
+            std::size_t first = keys_per_thread;
+            for (; first < num_keys; first += keys_per_thread) {
+                std::size_t last = (num_keys - first < keys_per_thread) ? num_keys : (first + keys_per_thread);
+                try {
+                    threads.emplace_back(detail::add_hashes_concurrently<filter_type>,
+                                         filter.get(), hashes, first, last);
+                }
+                catch (const std::system_error &) {
+                    break;
+                }
+            }
+            detail::add_hashes_concurrently(filter.get(), hashes, 0, keys_per_thread);
+            detail::add_hashes_concurrently(filter.get(), hashes, first, num_keys);
+            for (std::size_t i = 0; i < threads.size(); i++) {
+                threads[i].join();
+            }
+
+            filter->encodeTo(dst);
+            hashes_.clear();
+            return error_code::no_error;
+        }
+
+        void reset() { hashes_.clear(); }
+
+    private:
+        // A filter for the keys added, nullptr if it can't be allocated.
+        filter_type * newFilter() const {
+            filter_type * filter = detail::FilterFactory<filter_type>::newFilter(hashes_.size(), bits_per_key_);
+            if (filter != nullptr && filter->getBitmap() == nullptr) {
+                delete filter;
+                filter = nullptr;
+            }
+            return filter;
+        }
+
+        Builder(const Builder &) = delete;
+        Builder & operator = (const Builder &) = delete;
+    };
+
+    class Reader {
+    private:
+        std::unique_ptr<filter_type> filter_;
+        bool attached_;
+
+    public:
+        Reader() : filter_(detail::FilterFactory<filter_type>::newEmptyFilter()), attached_(false) {}
+        ~Reader() {}
+
+        // Makes the reader a view of the encoding, which must outlive it.
+        int attach(const Slice & contents, bool verify_checksum = true) {
+            int status = filter_->attach(contents, verify_checksum);
+            attached_ = (status == error_code::no_error);
+            return status;
+        }
+
+        bool isAttached() const { return attached_; }
+
+        // Returns false if the key is surely not one of the filter.
+        // REQUIRES: isAttached()
+        bool keyMayMatch(const Slice & key) const {
+            assert(attached_);
+            return filter_->maybeMatch(key);
+        }
+
+        const filter_type & getFilter() const { return *filter_; }
+
+    private:
+        Reader(const Reader &) = delete;
+        Reader & operator = (const Reader &) = delete;
+    };
+};
+
+typedef FilterPolicy<StandardBloomFilter> StandardFilterPolicy;
+typedef FilterPolicy<FullBloomFilter>     FullFilterPolicy;
+typedef FilterPolicy<BlockedBloomFilter>  BlockedFilterPolicy;
+
+} // namespace TiStore
@@ -4,6 +4,11 @@
 #include "TiStore/basic/cstdssize"
 #include "TiStore/kv/Slice.h"
 
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_AMD64))
+#include <intrin.h>
+#endif
+
+#include <string.h>
 #include <string>
 
 //
@@ -183,6 +188,8 @@ static const std::uint32_t kDefaultHashSeed32 = 0xBC9F1D34UL;
 
 static const std::size_t   kHashInitValue_M   = (std::size_t)0x397A4A6CC6A4A793ULL;
 
+static const std::uint64_t kSecondaryHashSeed64 = 0x9E3779B97F4A7C15ULL;
+
 /**************************************************************************
 
     About hash algorithm
@@ -354,6 +361,109 @@ static std::uint32_t DJBHash(const char * key, std::size_t len)
     return hash;
 }
 
+// The bytes are loaded by memcpy(), it's one unaligned load on x86 and ARM64.
+static inline std::uint64_t Read64(const unsigned char * src)
+{
+    std::uint64_t value;
+    ::memcpy(&value, src, sizeof(value));
+    return value;
+}
+
+static inline std::uint64_t Read32(const unsigned char * src)
+{
+    std::uint32_t value;
+    ::memcpy(&value, src, sizeof(value));
+    return value;
+}
+
+// a * b, a = the low 64 bits, b = the high 64 bits.
+static inline void Mum64(std::uint64_t & a, std::uint64_t & b)
+{
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = (__uint128_t)a * b;
+    a = (std::uint64_t)r;
+    b = (std::uint64_t)(r >> 64);
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_AMD64))
+    a = _umul128(a, b, &b);
+#else
+    std::uint64_t ha = a >> 32, hb = b >> 32, la = (std::uint32_t)a, lb = (std::uint32_t)b;
+    std::uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    std::uint64_t t = rl + (rm0 << 32), carry = (t < rl) ? 1 : 0;
+    std::uint64_t lo = t + (rm1 << 32);
+    carry += (lo < t) ? 1 : 0;
+    a = lo;
+    b = rh + (rm0 >> 32) + (rm1 >> 32) + carry;
+#endif
+}
+
+static inline std::uint64_t Mix64(std::uint64_t a, std::uint64_t b)
+{
+    Mum64(a, b);
+    return (a ^ b);
+}
+
+//
+// A 64-bit hash of the wyhash family: the long keys are read 48 bytes at a
+// time by 3 independent lanes of 16 bytes, each one mixed by a 64x64->128
+// bits multiply, so the throughput of a lane is 16 bytes per multiply. The
+// keys of up to 16 bytes are read by at most 4 overlapping loads, without
+// a loop. The bytes are read in the native order, so the hashes of a big
+// endian host are different.
+//
+// See: https://github.com/wangyi-fudan/wyhash (final version 4)
+//
+static inline std::uint64_t WyHash64(const char * key, std::size_t len, std::uint64_t seed)
+{
+    static const std::uint64_t kSecret[4] = {
+        0x2D358DCCAA6C78A5ULL, 0x8BB84B93962EACC9ULL,
+        0x4B33A62ED433D4A3ULL, 0x4D5A2DA51DE1AA47ULL
+    };
+
+    const unsigned char * src = (const unsigned char *)key;
+    seed ^= Mix64(seed ^ kSecret[0], kSecret[1]);
+    std::uint64_t a, b;
+    if (len <= 16) {
+        if (len >= 4) {
+            std::size_t offset = (len >> 3) << 2;
+            a = (Read32(src) << 32) | Read32(src + offset);
+            b = (Read32(src + len - 4) << 32) | Read32(src + len - 4 - offset);
+        }
+        else if (len > 0) {
+            a = ((std::uint64_t)src[0] << 16) | ((std::uint64_t)src[len >> 1] << 8) | src[len - 1];
+            b = 0;
+        }
+        else {
+            a = b = 0;
+        }
+    }
+    else {
+        std::size_t remain = len;
+        if (remain > 48) {
+            std::uint64_t seed1 = seed, seed2 = seed;
+            do {
+                seed  = Mix64(Read64(src)      ^ kSecret[1], Read64(src +  8) ^ seed);
+                seed1 = Mix64(Read64(src + 16) ^ kSecret[2], Read64(src + 24) ^ seed1);
+                seed2 = Mix64(Read64(src + 32) ^ kSecret[3], Read64(src + 40) ^ seed2);
+                src += 48;
+                remain -= 48;
+            } while (remain > 48);
+            seed ^= seed1 ^ seed2;
+        }
+        while (remain > 16) {
+            seed = Mix64(Read64(src) ^ kSecret[1], Read64(src + 8) ^ seed);
+            src += 16;
+            remain -= 16;
+        }
+        // The last 16 bytes, they may overlap the ones already read.
+        a = Read64(src + remain - 16);
+        b = Read64(src + remain - 8);
+    }
+    a ^= kSecret[1];
+    b ^= seed;
+    Mum64(a, b);
+    return Mix64(a ^ kSecret[0] ^ (std::uint64_t)len, b ^ kSecret[1]);
+}
+
 } // namespace hash
 
 //
@@ -941,46 +1051,36 @@ HashUtils<std::uint32_t>::decodeValue<4U>(const char * data, std::uint32_t missa
     return value;
 }
 
+//
+// class HashUtils<std::uint64_t>
+//
+// The 64-bit hashes, by hash::WyHash64(), for the filters which need more
+// than 32 bits of hash, e.g. the probes of a big filter derived from one
+// hash. The primary and the secondary hashes are of different seeds.
+//
 template <>
-template <>
-inline typename HashUtils<std::uint64_t>::hash_type
-HashUtils<std::uint64_t>::decodeValue<8U>(const char * data, std::uint32_t missalign) const {
-    static const std::size_t N = 8;
-    static const hash_type mask = (hash_type)(-1);
-    hash_type value;
-    assert(missalign < N);
-    assert(data != nullptr);
-#if 1
-    value = ((hash_type)data[0] << 56) | ((hash_type)data[1] << 48) | ((hash_type)data[2] << 40) | ((hash_type)data[3] << 32)
-          | ((hash_type)data[4] << 24) | ((hash_type)data[5] << 16) | ((hash_type)data[6] <<  8) | ((hash_type)data[7]);
-#else
-    if (missalign == 1) {
-        value = ((*(hash_type *)(data - 1) & (mask >> (1 * 8U))) <<  8U) | (*(hash_type *)(data + (N - 1)) & (mask >> ((N - 1) * 8U)));
-    }
-    else if (missalign == 2) {
-        value = ((*(hash_type *)(data - 2) & (mask >> (2 * 8U))) << 16U) | (*(hash_type *)(data + (N - 2)) & (mask >> ((N - 2) * 8U)));
-    }
-    else if (missalign == 3) {
-        value = ((*(hash_type *)(data - 3) & (mask >> (3 * 8U))) << 24U) | (*(hash_type *)(data + (N - 3)) & (mask >> ((N - 3) * 8U)));
-    }
-    else if (missalign == 4) {
-        value = ((*(hash_type *)(data - 4) & (mask >> (4 * 8U))) << 32U) | (*(hash_type *)(data + (N - 4)) & (mask >> ((N - 4) * 8U)));
-    }
-    else if (missalign == 5) {
-        value = ((*(hash_type *)(data - 5) & (mask >> (5 * 8U))) << 40U) | (*(hash_type *)(data + (N - 5)) & (mask >> ((N - 5) * 8U)));
+class HashUtils<std::uint64_t> {
+public:
+    typedef std::uint64_t hash_type;
+
+    HashUtils() {}
+    ~HashUtils() {}
+
+    hash_type primaryHash(const char * key, std::size_t len, std::size_t seed) const {
+        return hash::WyHash64(key, len, (std::uint64_t)seed);
     }
-    else if (missalign == 6) {
-        value = ((*(hash_type *)(data - 6) & (mask >> (6 * 8U))) << 48U) | (*(hash_type *)(data + (N - 6)) & (mask >> ((N - 6) * 8U)));
+
+    hash_type primaryHash(const Slice & key, std::size_t seed) const {
+        return primaryHash(key.data(), key.size(), seed);
     }
-    else if (missalign == 7) {
-        value = ((*(hash_type *)(data - 7) & (mask >> (7 * 8U))) << 56U) | (*(hash_type *)(data + (N - 7)) & (mask >> ((N - 7) * 8U)));
+
+    hash_type secondaryHash(const char * key, std::size_t len) const {
+        return hash::WyHash64(key, len, kSecondaryHashSeed64);
     }
-    else {
-        // TODO: Error?
-        value = 0;
+
+    hash_type secondaryHash(const Slice & key) const {
+        return secondaryHash(key.data(), key.size());
     }
-#endif
-    return value;
-}
+};
 
 } // namespace TiStore
@@ -0,0 +1,393 @@
+#pragma once
+
+#include "TiStore/basic/cstdint"
+#include "TiStore/kv/CpuFeatures.h"
+#include "TiStore/kv/Hash.h"
+#include "TiStore/kv/Slice.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <string.h>
+
+namespace TiStore {
+
+//
+// The hashes of many keys at a time, the same ones as HashUtils<>
+// (primaryHash() and secondaryHash()), for the batch lookups of the
+// filters (maybeMatchBatch()).
+//
+// With AVX2, 8 keys are hashed at a time, one in each 32-bit lane, mixed
+// by vpmulld, so the latency of the multiplies of a key is hidden behind
+// the ones of the other 7 keys. The keys of the same length take a fast
+// path without masks (primaryHashFixed() for the arrays of fixed size
+// keys). The keys of different lengths are sorted by words kGroupSize at a
+// time, so the 8 keys of a lane group have about the same number of words,
+// and the lanes of the keys already done are masked out. The groups of
+// keys shorter than kMinLanesKeyLen, and the fixed size keys shorter than
+// kMinFixedKeyLen, are hashed one by one.
+//
+// Like HashUtils<>::primaryHash(), the last word of a key is read whole,
+// up to 3 bytes past its end.
+//
+class BatchHash {
+public:
+    static const std::size_t kLanes = 8;
+    static const std::size_t kGroupSize = 64;
+    static const std::size_t kSortWords = 32;
+    static const std::size_t kMinLanesKeyLen = 12;
+    static const std::size_t kMinFixedKeyLen = 16;
+
+    enum SimdLevel {
+        kScalar,
+        kAVX2
+    };
+
+    // The best implementation the CPU supports.
+    static SimdLevel getBestSimdLevel() {
+        static const SimdLevel s_level = CpuFeatures::hasAVX2() ? kAVX2 : kScalar;
+        return s_level;
+    }
+
+    static const char * getSimdLevelName(SimdLevel level) {
+        return (level == kAVX2) ? "AVX2" : "Scalar";
+    }
+
+    // primary[i] = primaryHash(keys[i], seed), secondary[i] = secondaryHash(keys[i]).
+    static void hashPair(const Slice * keys, std::size_t n, std::size_t seed,
+                         std::uint32_t * primary, std::uint32_t * secondary) {
+        hashPair(keys, n, seed, primary, secondary, getBestSimdLevel());
+    }
+
+    static void hashPair(const Slice * keys, std::size_t n, std::size_t seed,
+                         std::uint32_t * primary, std::uint32_t * secondary, SimdLevel level) {
+        assert(primary != nullptr && secondary != nullptr);
+#if TISTORE_ARCH_X86
+        if (level == kAVX2) {
+            hashSlicesAVX2(keys, n, (std::uint32_t)seed, primary, secondary);
+            return;
+        }
+#endif
+        hashPairScalar(keys, n, (std::uint32_t)seed, primary, secondary);
+    }
+
+    //
+    // out[i] = primaryHash() of the i-th of the n keys of key_len bytes
+    // each, one after another from data.
+    //
+    static void primaryHashFixed(const char * data, std::size_t key_len, std::size_t n,
+                                 std::size_t seed, std::uint32_t * out) {
+        primaryHashFixed(data, key_len, n, seed, out, getBestSimdLevel());
+    }
+
+    static void primaryHashFixed(const char * data, std::size_t key_len, std::size_t n,
+                                 std::size_t seed, std::uint32_t * out, SimdLevel level) {
+        assert(out != nullptr);
+#if TISTORE_ARCH_X86
+        // Under one block of 4 words, the scalar loop is faster.
+        if (level == kAVX2 && key_len >= kMinFixedKeyLen) {
+            hashFixedAVX2(data, key_len, n, (std::uint32_t)seed, out);
+            return;
+        }
+#endif
+        HashUtils<> hashUtils;
+        for (std::size_t i = 0; i < n; i++) {
+            out[i] = hashUtils.primaryHash(data + i * key_len, key_len, seed);
+        }
+    }
+
+private:
+    static void hashPairScalar(const Slice * keys, std::size_t n, std::uint32_t seed,
+                               std::uint32_t * primary, std::uint32_t * secondary) {
+        HashUtils<> hashUtils;
+        for (std::size_t i = 0; i < n; i++) {
+            primary[i] = hashUtils.primaryHash(keys[i].data(), keys[i].size(), seed);
+            secondary[i] = hashUtils.secondaryHash(keys[i].data(), keys[i].size());
+        }
+    }
+
+#if TISTORE_ARCH_X86
+    // The multiplier of HashUtils<>::primaryHash().
+    static std::uint32_t primaryMultiplier() {
+        return (std::uint32_t)(kHashInitValue_M & 0xFFFFFFFFUL);
+    }
+
+    TISTORE_TARGET("avx2")
+    static std::uint32_t readWord(const char * src) {
+        std::uint32_t word;
+        ::memcpy(&word, src, sizeof(word));
+        return word;
+    }
+
+    // The words [w, w + 3] of the keys at ptrs[0, 7], one word of the 8 keys in each of words[0, 3].
+    TISTORE_TARGET("avx2")
+    static void loadWords4x8(const char * const ptrs[kLanes], std::uint32_t w, __m256i words[4]) {
+        const std::size_t offset = w * 4;
+        __m256i row0 = loadRow(ptrs[0] + offset, ptrs[4] + offset);
+        __m256i row1 = loadRow(ptrs[1] + offset, ptrs[5] + offset);
+        __m256i row2 = loadRow(ptrs[2] + offset, ptrs[6] + offset);
+        __m256i row3 = loadRow(ptrs[3] + offset, ptrs[7] + offset);
+        // The 4x4 transpose of the keys 0-3 in the low halves and of the keys 4-7 in the high ones.
+        __m256i t0 = _mm256_unpacklo_epi32(row0, row1);
+        __m256i t1 = _mm256_unpacklo_epi32(row2, row3);
+        __m256i t2 = _mm256_unpackhi_epi32(row0, row1);
+        __m256i t3 = _mm256_unpackhi_epi32(row2, row3);
+        words[0] = _mm256_unpacklo_epi64(t0, t1);
+        words[1] = _mm256_unpackhi_epi64(t0, t1);
+        words[2] = _mm256_unpacklo_epi64(t2, t3);
+        words[3] = _mm256_unpackhi_epi64(t2, t3);
+    }
+
+    TISTORE_TARGET("avx2")
+    static __m256i loadRow(const char * lo, const char * hi) {
+        return _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(lo))),
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(hi)), 1);
+    }
+
+    // The word at ptrs[i] + offsets[i] of each lane, by vmovd and vpinsrd.
+    TISTORE_TARGET("avx2")
+    static __m256i loadWord8(const char * const ptrs[kLanes], const std::uint32_t offsets[kLanes]) {
+        __m128i lo = _mm_cvtsi32_si128((int)readWord(ptrs[0] + offsets[0]));
+        __m128i hi = _mm_cvtsi32_si128((int)readWord(ptrs[4] + offsets[4]));
+        lo = _mm_insert_epi32(lo, (int)readWord(ptrs[1] + offsets[1]), 1);
+        hi = _mm_insert_epi32(hi, (int)readWord(ptrs[5] + offsets[5]), 1);
+        lo = _mm_insert_epi32(lo, (int)readWord(ptrs[2] + offsets[2]), 2);
+        hi = _mm_insert_epi32(hi, (int)readWord(ptrs[6] + offsets[6]), 2);
+        lo = _mm_insert_epi32(lo, (int)readWord(ptrs[3] + offsets[3]), 3);
+        hi = _mm_insert_epi32(hi, (int)readWord(ptrs[7] + offsets[7]), 3);
+        return _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+    }
+
+    // One word of primaryHash(): hash += word; hash *= m; hash ^= hash >> 16.
+    TISTORE_TARGET("avx2")
+    static __m256i primaryRound(__m256i hash, __m256i word, __m256i m) {
+        hash = _mm256_mullo_epi32(_mm256_add_epi32(hash, word), m);
+        return _mm256_xor_si256(hash, _mm256_srli_epi32(hash, 16));
+    }
+
+    //
+    // One word of secondaryHash() (Times31): hash * 31^4 + b0 * 31^3 + b1 * 31^2 + b2 * 31 + b3,
+    // the bytes by pmaddubsw (b0 * 31 + b1, b2 * 31 + b3) and pmaddwd (* 31^2, * 1).
+    //
+    TISTORE_TARGET("avx2")
+    static __m256i secondaryRound(__m256i hash, __m256i word) {
+        __m256i pairs = _mm256_maddubs_epi16(word, _mm256_set1_epi16((1 << 8) | 31));
+        __m256i bytes = _mm256_madd_epi16(pairs, _mm256_set1_epi32((1 << 16) | (31 * 31)));
+        return _mm256_add_epi32(_mm256_mullo_epi32(hash, _mm256_set1_epi32(31 * 31 * 31 * 31)), bytes);
+    }
+
+    //
+    // The hashes of the 8 keys at ptrs[i] of lens[i] bytes.
+    //
+    // The words all the keys have are loaded 16 bytes of a key at a time and
+    // transposed, the gathers are slower than that on many CPUs. The other
+    // words are blended out of the lanes of the shorter keys, which read
+    // their last word again meanwhile, so nothing past a key is read but
+    // the 3 bytes primaryHash() reads too.
+    //
+    TISTORE_TARGET("avx2")
+    static void hashLanesAVX2(const char * const ptrs[kLanes], const std::uint32_t lens[kLanes],
+                              std::uint32_t seed, std::uint32_t primary[kLanes],
+                              std::uint32_t secondary[kLanes]) {
+        static const char kZeroWord[4] = { 0, 0, 0, 0 };
+        const char * src[kLanes];
+        std::uint32_t last[kLanes], tail[kLanes], offsets[kLanes];
+        std::uint32_t min_words = lens[0] >> 2, max_words = lens[0] >> 2;
+        for (std::size_t i = 0; i < kLanes; i++) {
+            std::uint32_t words = lens[i] >> 2;
+            min_words = (words < min_words) ? words : min_words;
+            max_words = (words > max_words) ? words : max_words;
+            // The empty keys have nothing to read, the other ones at least their first word.
+            src[i] = (lens[i] != 0) ? ptrs[i] : kZeroWord;
+            last[i] = (words != 0) ? ((words - 1) * 4) : 0;
+            tail[i] = ((lens[i] & 3U) != 0) ? (lens[i] & ~3U) : last[i];
+        }
+
+        const __m256i m = _mm256_set1_epi32((int)primaryMultiplier());
+        __m256i len_v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(lens));
+        __m256i words_v = _mm256_srli_epi32(len_v, 2);
+        __m256i hash1 = _mm256_xor_si256(_mm256_set1_epi32((int)seed), _mm256_mullo_epi32(m, len_v));
+        __m256i hash2 = _mm256_setzero_si256();
+
+        std::uint32_t w = 0;
+        for (; (w + 4) <= min_words; w += 4) {
+            __m256i block[4];
+            loadWords4x8(src, w, block);
+            for (int j = 0; j < 4; j++) {
+                hash1 = primaryRound(hash1, block[j], m);
+                hash2 = secondaryRound(hash2, block[j]);
+            }
+        }
+        for (; w < max_words; w++) {
+            for (std::size_t i = 0; i < kLanes; i++)
+                offsets[i] = ((w * 4) < last[i]) ? (w * 4) : last[i];
+            __m256i word = loadWord8(src, offsets);
+            if (w < min_words) {
+                hash1 = primaryRound(hash1, word, m);
+                hash2 = secondaryRound(hash2, word);
+            }
+            else {
+                __m256i active = _mm256_cmpgt_epi32(words_v, _mm256_set1_epi32((int)w));
+                hash1 = _mm256_blendv_epi8(hash1, primaryRound(hash1, word, m), active);
+                hash2 = _mm256_blendv_epi8(hash2, secondaryRound(hash2, word), active);
+            }
+        }
+
+        // The last 1 to 3 bytes: one masked word for primaryHash(), byte by byte for Times31.
+        __m256i remain_v = _mm256_and_si256(len_v, _mm256_set1_epi32(3));
+        __m256i has_tail = _mm256_cmpgt_epi32(remain_v, _mm256_setzero_si256());
+        if (!_mm256_testz_si256(has_tail, has_tail)) {
+            __m256i word = loadWord8(src, tail);
+            __m256i byte_mask = _mm256_srlv_epi32(_mm256_set1_epi32(-1),
+                _mm256_sub_epi32(_mm256_set1_epi32(32), _mm256_slli_epi32(remain_v, 3)));
+            hash1 = _mm256_blendv_epi8(hash1,
+                primaryRound(hash1, _mm256_and_si256(word, byte_mask), m), has_tail);
+            for (int r = 0; r < 3; r++) {
+                __m256i active = _mm256_cmpgt_epi32(remain_v, _mm256_set1_epi32(r));
+                __m256i byte = _mm256_and_si256(_mm256_srli_epi32(word, 8 * r), _mm256_set1_epi32(0xFF));
+                __m256i next = _mm256_add_epi32(_mm256_mullo_epi32(hash2, _mm256_set1_epi32(31)), byte);
+                hash2 = _mm256_blendv_epi8(hash2, next, active);
+            }
+        }
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(primary), hash1);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(secondary), hash2);
+    }
+
+    //
+    // The keys of the indexes order[0, count), up to kLanes of them, or of
+    // [0, count) if order is nullptr, then the 8 hashes are stored at once.
+    //
+    TISTORE_TARGET("avx2")
+    static void hashSliceLanesAVX2(const Slice * keys, const std::uint32_t * order, std::size_t count,
+                                   std::uint32_t seed, std::uint32_t * primary, std::uint32_t * secondary) {
+        const char * ptrs[kLanes];
+        std::uint32_t lens[kLanes];
+        for (std::size_t i = 0; i < kLanes; i++) {
+            // The unused lanes hash the last key again, they keep the lengths close.
+            std::size_t index = (i < count) ? i : (count - 1);
+            const Slice & key = keys[(order != nullptr) ? order[index] : index];
+            ptrs[i] = key.data();
+            lens[i] = (std::uint32_t)key.size();
+        }
+        if (order == nullptr && count == kLanes) {
+            hashLanesAVX2(ptrs, lens, seed, primary, secondary);
+            return;
+        }
+        std::uint32_t hashes1[kLanes], hashes2[kLanes];
+        hashLanesAVX2(ptrs, lens, seed, hashes1, hashes2);
+        for (std::size_t i = 0; i < count; i++) {
+            std::size_t index = (order != nullptr) ? order[i] : i;
+            primary[index] = hashes1[i];
+            secondary[index] = hashes2[i];
+        }
+    }
+
+    //
+    // The indexes of the count keys in order[], by their number of words,
+    // a counting sort: the keys of kSortWords words or more are together.
+    //
+    static void sortByWords(const Slice * keys, std::size_t count, std::uint32_t * order) {
+        std::uint32_t offsets[kSortWords + 1];
+        ::memset(offsets, 0, sizeof(offsets));
+        for (std::size_t i = 0; i < count; i++) {
+            std::size_t words = keys[i].size() >> 2;
+            offsets[((words < kSortWords) ? words : kSortWords - 1) + 1]++;
+        }
+        for (std::size_t w = 1; w <= kSortWords; w++)
+            offsets[w] += offsets[w - 1];
+        for (std::size_t i = 0; i < count; i++) {
+            std::size_t words = keys[i].size() >> 2;
+            order[offsets[(words < kSortWords) ? words : kSortWords - 1]++] = (std::uint32_t)i;
+        }
+    }
+
+    static void hashSlicesAVX2(const Slice * keys, std::size_t n, std::uint32_t seed,
+                               std::uint32_t * primary, std::uint32_t * secondary) {
+        std::uint32_t order[kGroupSize];
+        for (std::size_t start = 0; start < n; start += kGroupSize) {
+            std::size_t count = ((n - start) < kGroupSize) ? (n - start) : kGroupSize;
+            const Slice * group = keys + start;
+            std::size_t max_len = 0;
+            for (std::size_t i = 0; i < count; i++) {
+                max_len = (group[i].size() > max_len) ? group[i].size() : max_len;
+            }
+            if (max_len < kMinLanesKeyLen) {
+                // Up to 2 words, building the vectors costs more than the multiplies saved.
+                hashPairScalar(group, count, seed, primary + start, secondary + start);
+                continue;
+            }
+            bool same_length = true;
+            for (std::size_t i = 1; i < count; i++) {
+                same_length = same_length && (group[i].size() == max_len);
+            }
+            if (!same_length)
+                sortByWords(group, count, order);
+            for (std::size_t i = 0; i < count; i += kLanes) {
+                std::size_t lanes = ((count - i) < kLanes) ? (count - i) : kLanes;
+                if (same_length) {
+                    hashSliceLanesAVX2(group + i, nullptr, lanes, seed,
+                                       primary + start + i, secondary + start + i);
+                }
+                else {
+                    hashSliceLanesAVX2(group, order + i, lanes, seed, primary + start, secondary + start);
+                }
+            }
+        }
+    }
+
+    //
+    // The keys of the same length, 8 of them at a time: the lanes are all
+    // active, the hashes of the full groups are stored at once.
+    //
+    TISTORE_TARGET("avx2")
+    static void hashFixedAVX2(const char * data, std::size_t key_len, std::size_t n,
+                              std::uint32_t seed, std::uint32_t * out) {
+        const __m256i m = _mm256_set1_epi32((int)primaryMultiplier());
+        const __m256i init = _mm256_set1_epi32((int)(seed ^ (primaryMultiplier() * (std::uint32_t)key_len)));
+        const std::uint32_t num_words = (std::uint32_t)(key_len >> 2);
+        const std::uint32_t remain = (std::uint32_t)(key_len & 3);
+        const __m256i byte_mask = _mm256_set1_epi32((remain != 0) ? (int)(0xFFFFFFFFUL >> ((4 - remain) * 8)) : 0);
+        const char * ptrs[kLanes];
+        std::uint32_t lanes[kLanes];
+        for (std::size_t start = 0; start < n; start += kLanes) {
+            std::size_t count = ((n - start) < kLanes) ? (n - start) : kLanes;
+            for (std::size_t i = 0; i < kLanes; i++) {
+                // The unused lanes hash the first key again.
+                ptrs[i] = data + (start + ((i < count) ? i : 0)) * key_len;
+            }
+            __m256i hash = init;
+            std::uint32_t w = 0;
+            for (; (w + 4) <= num_words; w += 4) {
+                __m256i block[4];
+                loadWords4x8(ptrs, w, block);
+                hash = primaryRound(hash, block[0], m);
+                hash = primaryRound(hash, block[1], m);
+                hash = primaryRound(hash, block[2], m);
+                hash = primaryRound(hash, block[3], m);
+            }
+            for (; w < num_words; w++) {
+                for (std::size_t i = 0; i < kLanes; i++)
+                    lanes[i] = readWord(ptrs[i] + w * 4);
+                hash = primaryRound(hash, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(lanes)), m);
+            }
+            if (remain != 0) {
+                for (std::size_t i = 0; i < kLanes; i++)
+                    lanes[i] = readWord(ptrs[i] + num_words * 4);
+                __m256i word = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(lanes));
+                hash = primaryRound(hash, _mm256_and_si256(word, byte_mask), m);
+            }
+            if (count == kLanes) {
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + start), hash);
+            }
+            else {
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes), hash);
+                for (std::size_t i = 0; i < count; i++)
+                    out[start + i] = lanes[i];
+            }
+        }
+    }
+#endif // TISTORE_ARCH_X86
+};
+
+} // namespace TiStore
@@ -0,0 +1,42 @@
+#pragma once
+
+//
+// The format of the write-ahead log.
+//
+// The log is a sequence of 32KB blocks. A record is stored in one or more
+// fragments, a fragment never crosses a block boundary:
+//
+//   fragment :=
+//      checksum: fixed32   // masked crc32c of the type and the data
+//      length: uint16      // little-endian
+//      type: uint8         // One of kFullType, kFirstType, kMiddleType, kLastType
+//      data: uint8[length]
+//
+// A block tail smaller than a fragment header (7 bytes) is filled with zeros
+// and skipped by the readers.
+//
+// See: https://github.com/google/leveldb/blob/master/doc/log_format.md
+//
+
+namespace TiStore {
+
+enum LogRecordType {
+    // Zero is reserved for preallocated files
+    kZeroType = 0,
+
+    kFullType = 1,
+
+    // For fragments
+    kFirstType = 2,
+    kMiddleType = 3,
+    kLastType = 4,
+
+    kMaxRecordType = kLastType
+};
+
+static const int kLogBlockSize = 32768;
+
+// Header is checksum (4 bytes), length (2 bytes), type (1 byte).
+static const int kLogHeaderSize = 4 + 2 + 1;
+
+} // namespace TiStore
@@ -0,0 +1,227 @@
+#pragma once
+
+#include "TiStore/basic/cstdint"
+#include "TiStore/fs/ErrorCode.h"
+#include "TiStore/fs/FileSystem.h"
+#include "TiStore/kv/Coding.h"
+#include "TiStore/kv/Crc32c.h"
+#include "TiStore/kv/LogFormat.h"
+#include "TiStore/kv/Slice.h"
+
+#include <assert.h>
+#include <string>
+
+namespace TiStore {
+
+//
+// Reads the records of a log file written by LogWriter, see LogFormat.h.
+//
+// A fragment with a bad checksum or a bad length drops the rest of its
+// block, and the bytes are counted in droppedBytes(). A truncated record
+// at the end of the file, left by a crash in the middle of a write, is
+// ignored and not reported as a corruption. A read error ends the records
+// too, but status() returns it.
+//
+class LogReader {
+private:
+    enum {
+        // Returned whenever we reached the end of the file
+        kEof = kMaxRecordType + 1,
+        // Returned whenever we find an invalid physical record.
+        kBadRecord = kMaxRecordType + 2
+    };
+
+    fs::File * file_;
+    bool checksum_;
+    char * backing_store_;
+    Slice buffer_;
+    // Last read() indicated EOF by returning < kLogBlockSize
+    bool eof_;
+    int status_;
+    std::size_t dropped_bytes_;
+    std::size_t corruptions_;
+
+public:
+    // Create a reader that will return the records from "*file".
+    // "*file" must remain live while this LogReader is in use.
+    // If "checksum" is true, verify the checksums if available.
+    explicit LogReader(fs::File * file, bool checksum = true)
+        : file_(file), checksum_(checksum), backing_store_(new char[kLogBlockSize]),
+          eof_(false), status_(error_code::no_error), dropped_bytes_(0), corruptions_(0) {
+        assert(file_ != nullptr);
+    }
+
+    ~LogReader() {
+        delete[] backing_store_;
+    }
+
+    // Read the next record into *record. Returns true if read
+    // successfully, false if we hit end of the input. May use
+    // "*scratch" as temporary storage. The contents filled in *record
+    // will only be valid until the next mutating operation on this
+    // reader or the next mutation to *scratch.
+    bool readRecord(Slice * record, std::string * scratch) {
+        scratch->clear();
+        record->clear();
+        bool in_fragmented_record = false;
+
+        Slice fragment;
+        while (true) {
+            const unsigned int record_type = readPhysicalRecord(&fragment);
+            switch (record_type) {
+            case kFullType:
+                if (in_fragmented_record)
+                    reportCorruption(scratch->size());
+                scratch->clear();
+                *record = fragment;
+                return true;
+
+            case kFirstType:
+                if (in_fragmented_record)
+                    reportCorruption(scratch->size());
+                scratch->assign(fragment.data(), fragment.size());
+                in_fragmented_record = true;
+                break;
+
+            case kMiddleType:
+                if (!in_fragmented_record) {
+                    reportCorruption(fragment.size());
+                }
+                else {
+                    scratch->append(fragment.data(), fragment.size());
+                }
+                break;
+
+            case kLastType:
+                if (!in_fragmented_record) {
+                    reportCorruption(fragment.size());
+                }
+                else {
+                    scratch->append(fragment.data(), fragment.size());
+                    *record = Slice(*scratch);
+                    return true;
+                }
+                break;
+
+            case kEof:
+                // This can be caused by the writer dying immediately after
+                // writing a physical record but before completing the next;
+                // don't treat it as a corruption, just ignore the entire
+                // logical record.
+                scratch->clear();
+                return false;
+
+            case kBadRecord:
+                if (in_fragmented_record) {
+                    reportCorruption(scratch->size());
+                    in_fragmented_record = false;
+                    scratch->clear();
+                }
+                break;
+
+            default:
+                reportCorruption(fragment.size() + (in_fragmented_record ? scratch->size() : 0));
+                in_fragmented_record = false;
+                scratch->clear();
+                break;
+            }
+        }
+        return false;
+    }
+
+    std::size_t droppedBytes() const { return dropped_bytes_; }
+    std::size_t corruptions() const { return corruptions_; }
+
+    // err_io_error if readRecord() stopped on a read error, not at the end
+    // of the file.
+    int status() const { return status_; }
+
+private:
+    LogReader(const LogReader &) = delete;
+    LogReader & operator = (const LogReader &) = delete;
+
+    void reportCorruption(std::size_t bytes) {
+        dropped_bytes_ += bytes;
+        corruptions_++;
+    }
+
+    // Return type, or one of the preceding special values
+    unsigned int readPhysicalRecord(Slice * result) {
+        while (true) {
+            if (buffer_.size() < (std::size_t)kLogHeaderSize) {
+                if (!eof_) {
+                    // Last read was a full read, so this is a trailer to skip
+                    buffer_.clear();
+                    std::ssize_t n = file_->read(backing_store_, kLogBlockSize);
+                    if (n < 0) {
+                        buffer_.clear();
+                        reportCorruption(kLogBlockSize);
+                        status_ = error_code::err_io_error;
+                        eof_ = true;
+                        return kEof;
+                    }
+                    buffer_ = Slice(backing_store_, (std::size_t)n);
+                    if (n < kLogBlockSize)
+                        eof_ = true;
+                    continue;
+                }
+                else {
+                    // Note that if buffer_ is non-empty, we have a truncated header at the
+                    // end of the file, which can be caused by the writer crashing in the
+                    // middle of writing the header. Instead of considering this an error,
+                    // just report EOF.
+                    buffer_.clear();
+                    return kEof;
+                }
+            }
+
+            // Parse the header
+            const char * header = buffer_.data();
+            const std::uint32_t a = static_cast<std::uint32_t>(header[4]) & 0xFF;
+            const std::uint32_t b = static_cast<std::uint32_t>(header[5]) & 0xFF;
+            const unsigned int type = (unsigned char)header[6];
+            const std::uint32_t length = a | (b << 8);
+            if (kLogHeaderSize + length > buffer_.size()) {
+                std::size_t drop_size = buffer_.size();
+                buffer_.clear();
+                if (!eof_) {
+                    reportCorruption(drop_size);
+                    return kBadRecord;
+                }
+                // If the end of the file has been reached without reading |length| bytes
+                // of payload, assume the writer died in the middle of writing the record.
+                // Don't report a corruption.
+                return kEof;
+            }
+
+            if (type == kZeroType && length == 0) {
+                // Skip zero length record without reporting any drops since
+                // such records are produced by the preallocation of the file.
+                buffer_.clear();
+                return kBadRecord;
+            }
+
+            // Check crc
+            if (checksum_) {
+                std::uint32_t expected_crc = crc32c_unmask(decodeFixed32(header));
+                std::uint32_t actual_crc = crc32c_value(header + 6, 1 + length);
+                if (actual_crc != expected_crc) {
+                    // Drop the rest of the buffer since "length" itself may have
+                    // been corrupted and if we trust it, we could find some
+                    // fragment of a real log record that just happens to look
+                    // like a valid log record.
+                    std::size_t drop_size = buffer_.size();
+                    buffer_.clear();
+                    reportCorruption(drop_size);
+                    return kBadRecord;
+                }
+            }
+
+            buffer_.remove_prefix(kLogHeaderSize + length);
+            *result = Slice(header + kLogHeaderSize, length);
+            return type;
+        }
+    }
+};
+
+} // namespace TiStore
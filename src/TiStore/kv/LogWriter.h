@@ -0,0 +1,127 @@
+#pragma once
+
+#include "TiStore/basic/cstdint"
+#include "TiStore/fs/ErrorCode.h"
+#include "TiStore/fs/FileSystem.h"
+#include "TiStore/kv/Coding.h"
+#include "TiStore/kv/Crc32c.h"
+#include "TiStore/kv/LogFormat.h"
+#include "TiStore/kv/Slice.h"
+
+#include <assert.h>
+#include <string>
+
+namespace TiStore {
+
+//
+// Appends the records to a log file, see LogFormat.h.
+//
+// A record is framed into fragments in a buffer first and then written
+// with one write() call. sync() makes the records written so far durable.
+//
+// Not thread safe, the owner serializes addRecord() and sync().
+//
+class LogWriter {
+private:
+    fs::File * dest_;
+    // Current offset in block
+    int block_offset_;
+    // crc32c values for all supported record types. These are
+    // pre-computed to reduce the overhead of computing the crc of the
+    // record type stored in the header.
+    std::uint32_t type_crc_[kMaxRecordType + 1];
+    std::string buffer_;
+
+public:
+    // Create a writer that will append data to "*dest".
+    // "*dest" must have initial length "dest_length", and remain live
+    // while this LogWriter is in use.
+    explicit LogWriter(fs::File * dest, std::uint64_t dest_length = 0)
+        : dest_(dest), block_offset_((int)(dest_length % kLogBlockSize)) {
+        assert(dest_ != nullptr);
+        for (int i = 0; i <= kMaxRecordType; i++) {
+            char type = (char)i;
+            type_crc_[i] = crc32c_value(&type, 1);
+        }
+    }
+    ~LogWriter() {}
+
+    int addRecord(const Slice & record) {
+        const char * ptr = record.data();
+        size_t left = record.size();
+
+        // Fragment the record if necessary and emit it. Note that if the record
+        // is empty, we still want to iterate once to emit a single
+        // zero-length record.
+        buffer_.clear();
+        bool begin = true;
+        do {
+            const int leftover = kLogBlockSize - block_offset_;
+            assert(leftover >= 0);
+            if (leftover < kLogHeaderSize) {
+                // Switch to a new block
+                if (leftover > 0) {
+                    // Fill the trailer (literal below relies on kLogHeaderSize being 7)
+                    static_assert(kLogHeaderSize == 7, "LogWriter: kLogHeaderSize must be 7.");
+                    buffer_.append("\x00\x00\x00\x00\x00\x00", leftover);
+                }
+                block_offset_ = 0;
+            }
+
+            // Invariant: we never leave < kLogHeaderSize bytes in a block.
+            assert(kLogBlockSize - block_offset_ - kLogHeaderSize >= 0);
+
+            const size_t avail = kLogBlockSize - block_offset_ - kLogHeaderSize;
+            const size_t fragment_length = (left < avail) ? left : avail;
+
+            LogRecordType type;
+            const bool end = (left == fragment_length);
+            if (begin && end)
+                type = kFullType;
+            else if (begin)
+                type = kFirstType;
+            else if (end)
+                type = kLastType;
+            else
+                type = kMiddleType;
+
+            appendFragment(type, ptr, fragment_length);
+            ptr += fragment_length;
+            left -= fragment_length;
+            begin = false;
+        } while (left > 0);
+
+        if (dest_->write(buffer_.data(), buffer_.size()) != (std::ssize_t)buffer_.size())
+            return error_code::err_io_error;
+        return error_code::no_error;
+    }
+
+    int sync() {
+        return (dest_->sync() ? error_code::no_error : error_code::err_io_error);
+    }
+
+private:
+    LogWriter(const LogWriter &) = delete;
+    LogWriter & operator = (const LogWriter &) = delete;
+
+    void appendFragment(LogRecordType type, const char * ptr, size_t length) {
+        assert(length <= 0xFFFF);  // Must fit in two bytes
+        assert(block_offset_ + kLogHeaderSize + (int)length <= kLogBlockSize);
+
+        // Format the header
+        char header[kLogHeaderSize];
+        header[4] = (char)(length & 0xFF);
+        header[5] = (char)(length >> 8);
+        header[6] = (char)(type);
+
+        // Compute the crc of the record type and the payload.
+        std::uint32_t crc = crc32c_extend(type_crc_[type], ptr, length);
+        encodeFixed32(header, crc32c_mask(crc));
+
+        buffer_.append(header, kLogHeaderSize);
+        buffer_.append(ptr, length);
+        block_offset_ += kLogHeaderSize + (int)length;
+    }
+};
+
+} // namespace TiStore
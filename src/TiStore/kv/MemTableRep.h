@@ -0,0 +1,585 @@
+#pragma once
+
+#include "TiStore/basic/cstdint"
+#include "TiStore/fs/Common.h"
+#include "TiStore/kv/Arena.h"
+#include "TiStore/kv/CuckooFilter.h"
+#include "TiStore/kv/Hash.h"
+#include "TiStore/kv/SkipList.h"
+#include "TiStore/kv/Slice.h"
+
+#include <assert.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <vector>
+
+namespace TiStore {
+
+//
+// The in-memory representation of a memtable.
+//
+// A rep holds the latest value of every key. A delete is written by the layer
+// above as a value (a tombstone), so the interface has no remove(). The key
+// and value bytes are copied into the rep, the Slices it returns stay valid
+// as long as the rep is alive.
+//
+// Writes (insert(), markReadOnly()) require external synchronization. If the
+// reads can run concurrently with the writer depends on the rep, see
+// isConcurrentRead().
+//
+// See: https://github.com/facebook/rocksdb/blob/master/include/rocksdb/memtablerep.h
+//
+class MemTableRep {
+public:
+    class Iterator {
+    public:
+        Iterator() {}
+        virtual ~Iterator() {}
+
+        // Returns true iff the iterator is positioned at a valid entry.
+        virtual bool isValid() const = 0;
+
+        // Returns the key and the value at the current position.
+        // REQUIRES: isValid()
+        virtual Slice key() const = 0;
+        virtual Slice value() const = 0;
+
+        // REQUIRES: isValid()
+        virtual void next() = 0;
+        virtual void prev() = 0;
+
+        // Advance to the first entry with a key >= target
+        virtual void seek(const Slice & target) = 0;
+        virtual void seekToFirst() = 0;
+        virtual void seekToLast() = 0;
+
+    private:
+        Iterator(const Iterator &) = delete;
+        Iterator & operator = (const Iterator &) = delete;
+    };
+
+    MemTableRep() {}
+    virtual ~MemTableRep() {}
+
+    virtual const char * name() const = 0;
+
+    // Returns true if the key is new, false if the value of an existing key
+    // is replaced (or if the rep can't tell, see VectorRep).
+    virtual bool insert(const Slice & key, const Slice & value) = 0;
+
+    // Returns true and the latest value of the key if the key exists.
+    virtual bool get(const Slice & key, Slice * value) const = 0;
+
+    // The memtable is full and about to be flushed, no more insert() after this.
+    virtual void markReadOnly() {}
+
+    // Returns true if the reads can run concurrently with the writer.
+    virtual bool isConcurrentRead() const { return true; }
+
+    // The number of entries that insert() added.
+    virtual std::size_t sizes() const = 0;
+
+    virtual std::size_t memoryUsage() const = 0;
+
+    // Returns an iterator over the keys in Slice::compare() order,
+    // the caller owns it and must delete it.
+    virtual Iterator * newIterator() const = 0;
+
+private:
+    MemTableRep(const MemTableRep &) = delete;
+    MemTableRep & operator = (const MemTableRep &) = delete;
+};
+
+//
+// The default rep. A SkipList: O(log n) inserts and lookups, and ordered
+// iteration for free. The reads are lock-free.
+//
+class SkipListRep : public MemTableRep {
+public:
+    typedef SkipList<Key, Value, 16> list_type;
+
+private:
+    list_type list_;
+
+    class SkipListIterator : public MemTableRep::Iterator {
+    private:
+        list_type::iterator iter_;
+
+    public:
+        explicit SkipListIterator(const list_type * list) : iter_(list) {}
+        ~SkipListIterator() {}
+
+        bool isValid() const override { return iter_.is_valid(); }
+        Slice key() const override { return iter_.key(); }
+        Slice value() const override { return iter_.value(); }
+        void next() override { iter_.next(); }
+        void prev() override { iter_.prev(); }
+        void seek(const Slice & target) override { iter_.seek(Key(target.data(), target.size())); }
+        void seekToFirst() override { iter_.seek_to_first(); }
+        void seekToLast() override { iter_.seek_to_last(); }
+    };
+
+public:
+    explicit SkipListRep(std::size_t arena_block_size = list_type::kDefaultArenaBlockSize,
+                         std::size_t hash_index_buckets = 0)
+        : list_(arena_block_size, hash_index_buckets) {}
+    ~SkipListRep() {}
+
+    const char * name() const override { return "SkipListRep"; }
+
+    bool insert(const Slice & key, const Slice & value) override {
+        return list_.insert(Key(key.data(), key.size()), Value(value.data(), value.size()));
+    }
+
+    bool get(const Slice & key, Slice * value) const override {
+        list_type::iterator iter = list_.find(Key(key.data(), key.size()));
+        if (iter.is_valid()) {
+            if (value != nullptr)
+                *value = iter.value();
+            return true;
+        }
+        return false;
+    }
+
+    std::size_t sizes() const override { return list_.sizes(); }
+    std::size_t memoryUsage() const override { return list_.memory_usage(); }
+
+    Iterator * newIterator() const override { return new SkipListIterator(&list_); }
+};
+
+//
+// A std::map (MapSet), as a reference to compare with.
+//
+class MapSetRep : public MemTableRep {
+public:
+    typedef MapSet<Key, Value> map_type;
+
+private:
+    map_type map_;
+
+    class MapSetIterator : public MemTableRep::Iterator {
+    private:
+        const map_type * map_;
+        map_type::iterator iter_;
+
+    public:
+        explicit MapSetIterator(const map_type * map) : map_(map), iter_(map->end()) {}
+        ~MapSetIterator() {}
+
+        bool isValid() const override { return (iter_ != map_->end()); }
+        Slice key() const override { return iter_->first; }
+        Slice value() const override { return iter_->second; }
+        void next() override { ++iter_; }
+        void prev() override {
+            if (iter_ == map_->begin())
+                iter_ = map_->end();
+            else
+                --iter_;
+        }
+        void seek(const Slice & target) override {
+            iter_ = map_->lower_bound(Key(target.data(), target.size()));
+        }
+        void seekToFirst() override { iter_ = map_->begin(); }
+        void seekToLast() override {
+            iter_ = map_->end();
+            if (iter_ != map_->begin())
+                --iter_;
+        }
+    };
+
+public:
+    explicit MapSetRep(std::size_t arena_block_size = map_type::kDefaultArenaBlockSize)
+        : map_(arena_block_size) {}
+    ~MapSetRep() {}
+
+    const char * name() const override { return "MapSetRep"; }
+
+    bool insert(const Slice & key, const Slice & value) override {
+        return map_.insert(Key(key.data(), key.size()), Value(value.data(), value.size()));
+    }
+
+    bool get(const Slice & key, Slice * value) const override {
+        map_type::iterator iter = map_.find(Key(key.data(), key.size()));
+        if (iter != map_.end()) {
+            if (value != nullptr)
+                *value = iter->second;
+            return true;
+        }
+        return false;
+    }
+
+    bool isConcurrentRead() const override { return false; }
+
+    std::size_t sizes() const override { return map_.sizes(); }
+    std::size_t memoryUsage() const override { return map_.memory_usage(); }
+
+    Iterator * newIterator() const override { return new MapSetIterator(&map_); }
+};
+
+//
+// A hash table of sorted singly linked lists, for point lookup heavy
+// workloads: get() costs one hash and a short walk in one bucket.
+// An ordered iteration is expensive, the iterator sorts a snapshot of all
+// the entries when it's created, fine for a flush but not for range reads.
+//
+// The reads are lock-free, the links and the values are published with
+// release stores, as in the SkipList.
+//
+class HashLinkListRep : public MemTableRep {
+public:
+    static const std::size_t kDefaultBuckets = 1024 * 1024;
+    static const std::size_t kDefaultArenaBlockSize = 64 * 1024;
+
+private:
+    struct Node {
+        Slice key;
+        std::atomic<const Slice *> value;
+        std::atomic<Node *> next;
+
+        Node(const Slice & _key, const Slice * _value) : key(_key), value(_value), next(nullptr) {}
+    };
+
+    // An entry of the snapshot of the iterator.
+    struct Entry {
+        Slice key;
+        Slice value;
+
+        bool operator < (const Entry & rhs) const { return (key.compare(rhs.key) < 0); }
+    };
+
+    mutable Arena arena_;
+    std::atomic<Node *> * buckets_;
+    std::size_t bucket_mask_;
+    std::atomic<std::size_t> size_;
+    HashUtils<> hashUtils_;
+
+    class HashLinkListIterator : public MemTableRep::Iterator {
+    private:
+        std::vector<Entry> entries_;
+        std::size_t index_;
+
+    public:
+        explicit HashLinkListIterator(const HashLinkListRep * rep) : index_(0) {
+            entries_.reserve(rep->sizes());
+            for (std::size_t i = 0; i <= rep->bucket_mask_; i++) {
+                Node * node = rep->buckets_[i].load(std::memory_order_acquire);
+                while (node != nullptr) {
+                    Entry entry;
+                    entry.key = node->key;
+                    entry.value = *node->value.load(std::memory_order_acquire);
+                    entries_.push_back(entry);
+                    node = node->next.load(std::memory_order_acquire);
+                }
+            }
+            std::sort(entries_.begin(), entries_.end());
+            index_ = entries_.size();
+        }
+        ~HashLinkListIterator() {}
+
+        bool isValid() const override { return (index_ < entries_.size()); }
+        Slice key() const override { return entries_[index_].key; }
+        Slice value() const override { return entries_[index_].value; }
+        void next() override { index_++; }
+        void prev() override { index_ = (index_ > 0) ? (index_ - 1) : entries_.size(); }
+        void seek(const Slice & target) override {
+            Entry entry;
+            entry.key = target;
+            index_ = std::lower_bound(entries_.begin(), entries_.end(), entry) - entries_.begin();
+        }
+        void seekToFirst() override { index_ = 0; }
+        void seekToLast() override { index_ = entries_.empty() ? 0 : (entries_.size() - 1); }
+    };
+
+public:
+    explicit HashLinkListRep(std::size_t buckets = kDefaultBuckets,
+                             std::size_t arena_block_size = kDefaultArenaBlockSize)
+        : arena_(arena_block_size), buckets_(nullptr), bucket_mask_(0), size_(0) {
+        // Round up the buckets to a power of 2.
+        std::size_t num_buckets = 1;
+        while (num_buckets < buckets)
+            num_buckets <<= 1;
+        char * mem = arena_.allocateAligned(num_buckets * sizeof(std::atomic<Node *>), CACHE_LINE_SIZE);
+        buckets_ = reinterpret_cast<std::atomic<Node *> *>(mem);
+        for (std::size_t i = 0; i < num_buckets; i++) {
+            new (&buckets_[i]) std::atomic<Node *>(nullptr);
+        }
+        bucket_mask_ = num_buckets - 1;
+    }
+    ~HashLinkListRep() {}
+
+    const char * name() const override { return "HashLinkListRep"; }
+
+    bool insert(const Slice & key, const Slice & value) override {
+        std::atomic<Node *> * link = &buckets_[get_hash(key) & bucket_mask_];
+        Node * node = link->load(std::memory_order_relaxed);
+        // The list of a bucket is sorted, stop at the first key >= key.
+        while (node != nullptr) {
+            int cmp = node->key.compare(key);
+            if (cmp == 0) {
+                node->value.store(new_value(value), std::memory_order_release);
+                return false;
+            }
+            else if (cmp > 0) {
+                break;
+            }
+            link = &node->next;
+            node = link->load(std::memory_order_relaxed);
+        }
+        char * mem = arena_.allocateAligned(sizeof(Node), alignof(Node));
+        Node * new_node = new (mem) Node(copy_slice(key), new_value(value));
+        new_node->next.store(node, std::memory_order_relaxed);
+        link->store(new_node, std::memory_order_release);
+        size_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    bool get(const Slice & key, Slice * value) const override {
+        Node * node = buckets_[get_hash(key) & bucket_mask_].load(std::memory_order_acquire);
+        while (node != nullptr) {
+            int cmp = node->key.compare(key);
+            if (cmp == 0) {
+                if (value != nullptr)
+                    *value = *node->value.load(std::memory_order_acquire);
+                return true;
+            }
+            else if (cmp > 0) {
+                break;
+            }
+            node = node->next.load(std::memory_order_acquire);
+        }
+        return false;
+    }
+
+    std::size_t sizes() const override { return size_.load(std::memory_order_relaxed); }
+    std::size_t memoryUsage() const override { return arena_.memoryUsage(); }
+
+    Iterator * newIterator() const override { return new HashLinkListIterator(this); }
+
+private:
+    std::uint32_t get_hash(const Slice & key) const {
+        return hashUtils_.primaryHash(key.data(), key.size(), kDefaultHashSeed);
+    }
+
+    Slice copy_slice(const Slice & slice) {
+        if (slice.size() == 0)
+            return Slice();
+        char * mem = arena_.allocate(slice.size());
+        ::memcpy(mem, slice.data(), slice.size());
+        return Slice(mem, slice.size());
+    }
+
+    const Slice * new_value(const Slice & value) {
+        char * mem = arena_.allocateAligned(sizeof(Slice), alignof(Slice));
+        return new (mem) Slice(copy_slice(value));
+    }
+};
+
+//
+// An append-only vector, for bulk loads: insert() is a push_back(), and
+// the entries are sorted only once, by markReadOnly() before the flush.
+// If a key is inserted more than once, the last value wins.
+//
+// Until markReadOnly(), get() is a linear scan and newIterator() sorts
+// a copy of the entries. The reads need external synchronization with
+// the writer, the vector can be reallocated by insert().
+//
+class VectorRep : public MemTableRep {
+public:
+    static const std::size_t kDefaultArenaBlockSize = 64 * 1024;
+
+private:
+    struct Entry {
+        Slice key;
+        Slice value;
+    };
+
+    struct EntryLess {
+        bool operator () (const Entry & lhs, const Entry & rhs) const {
+            return (lhs.key.compare(rhs.key) < 0);
+        }
+    };
+
+    Arena arena_;
+    std::vector<Entry> entries_;
+    bool sorted_;
+
+    class VectorIterator : public MemTableRep::Iterator {
+    private:
+        std::vector<Entry> sorted_copy_;
+        const std::vector<Entry> * entries_;
+        std::size_t index_;
+
+    public:
+        explicit VectorIterator(const VectorRep * rep) : entries_(&rep->entries_), index_(0) {
+            if (!rep->sorted_) {
+                sorted_copy_ = rep->entries_;
+                sort_entries(sorted_copy_);
+                entries_ = &sorted_copy_;
+            }
+            index_ = entries_->size();
+        }
+        ~VectorIterator() {}
+
+        bool isValid() const override { return (index_ < entries_->size()); }
+        Slice key() const override { return (*entries_)[index_].key; }
+        Slice value() const override { return (*entries_)[index_].value; }
+        void next() override { index_++; }
+        void prev() override { index_ = (index_ > 0) ? (index_ - 1) : entries_->size(); }
+        void seek(const Slice & target) override {
+            Entry entry;
+            entry.key = target;
+            index_ = std::lower_bound(entries_->begin(), entries_->end(), entry, EntryLess())
+                     - entries_->begin();
+        }
+        void seekToFirst() override { index_ = 0; }
+        void seekToLast() override { index_ = entries_->empty() ? 0 : (entries_->size() - 1); }
+    };
+
+public:
+    explicit VectorRep(std::size_t reserve_entries = 0,
+                       std::size_t arena_block_size = kDefaultArenaBlockSize)
+        : arena_(arena_block_size), sorted_(true) {
+        entries_.reserve(reserve_entries);
+    }
+    ~VectorRep() {}
+
+    const char * name() const override { return "VectorRep"; }
+
+    // Always returns true, a duplicate key is only found by the sort.
+    bool insert(const Slice & key, const Slice & value) override {
+        Entry entry;
+        entry.key = copy_slice(key);
+        entry.value = copy_slice(value);
+        // Still sorted if the keys come in order, then there's nothing to do later.
+        if (sorted_ && !entries_.empty() && entries_.back().key.compare(key) >= 0)
+            sorted_ = false;
+        entries_.push_back(entry);
+        return true;
+    }
+
+    bool get(const Slice & key, Slice * value) const override {
+        if (sorted_) {
+            Entry entry;
+            entry.key = key;
+            std::vector<Entry>::const_iterator iter =
+                std::lower_bound(entries_.begin(), entries_.end(), entry, EntryLess());
+            if (iter != entries_.end() && iter->key.compare(key) == 0) {
+                if (value != nullptr)
+                    *value = iter->value;
+                return true;
+            }
+            return false;
+        }
+        // The last one is the latest value.
+        for (std::size_t i = entries_.size(); i > 0; i--) {
+            if (entries_[i - 1].key.compare(key) == 0) {
+                if (value != nullptr)
+                    *value = entries_[i - 1].value;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void markReadOnly() override {
+        if (!sorted_) {
+            sort_entries(entries_);
+            sorted_ = true;
+        }
+    }
+
+    bool isConcurrentRead() const override { return false; }
+
+    std::size_t sizes() const override { return entries_.size(); }
+    std::size_t memoryUsage() const override {
+        return arena_.memoryUsage() + entries_.capacity() * sizeof(Entry);
+    }
+
+    Iterator * newIterator() const override { return new VectorIterator(this); }
+
+private:
+    Slice copy_slice(const Slice & slice) {
+        if (slice.size() == 0)
+            return Slice();
+        char * mem = arena_.allocate(slice.size());
+        ::memcpy(mem, slice.data(), slice.size());
+        return Slice(mem, slice.size());
+    }
+
+    // Sorts by key, and keeps only the last inserted value of every key.
+    static void sort_entries(std::vector<Entry> & entries) {
+        std::stable_sort(entries.begin(), entries.end(), EntryLess());
+        std::size_t count = 0;
+        for (std::size_t i = 0; i < entries.size(); i++) {
+            if (count > 0 && entries[count - 1].key.compare(entries[i].key) == 0)
+                entries[count - 1] = entries[i];
+            else
+                entries[count++] = entries[i];
+        }
+        entries.resize(count);
+    }
+};
+
+//
+// A rep with a CuckooFilter of its keys in front of it, so get() of a key
+// that isn't in the memtable, the common case of a read that goes on to
+// the tables, usually costs one or two cache lines of the filter instead
+// of a walk of the rep (e.g. the SkipList).
+//
+// The filter is sized for max_keys keys, the expected entries of the
+// memtable. If more keys come (or a rep that can't tell the new keys,
+// such as VectorRep, gets many duplicates), the filter gets full and is
+// bypassed from then on.
+//
+class CuckooFilterRep : public MemTableRep {
+private:
+    std::unique_ptr<MemTableRep> rep_;
+    CuckooFilter filter_;
+    std::atomic<bool> bypass_;
+
+public:
+    // Takes the ownership of rep.
+    CuckooFilterRep(MemTableRep * rep, std::size_t max_keys)
+        : rep_(rep), filter_(max_keys, false), bypass_(false) {
+        assert(rep != nullptr);
+    }
+    ~CuckooFilterRep() {}
+
+    const char * name() const override { return "CuckooFilterRep"; }
+
+    bool insert(const Slice & key, const Slice & value) override {
+        bool is_new = rep_->insert(key, value);
+        if (is_new && !bypass_.load(std::memory_order_relaxed)) {
+            if (!filter_.addKey(key))
+                bypass_.store(true, std::memory_order_release);
+        }
+        return is_new;
+    }
+
+    bool get(const Slice & key, Slice * value) const override {
+        if (!bypass_.load(std::memory_order_acquire) && !filter_.maybeMatch(key))
+            return false;
+        return rep_->get(key, value);
+    }
+
+    void markReadOnly() override { rep_->markReadOnly(); }
+
+    bool isConcurrentRead() const override { return rep_->isConcurrentRead(); }
+
+    // Returns true if the filter is full and get() goes to the rep.
+    bool isBypassed() const { return bypass_.load(std::memory_order_relaxed); }
+
+    const CuckooFilter & getFilter() const { return filter_; }
+
+    std::size_t sizes() const override { return rep_->sizes(); }
+    std::size_t memoryUsage() const override {
+        return rep_->memoryUsage() + filter_.getFilterSize();
+    }
+
+    Iterator * newIterator() const override { return rep_->newIterator(); }
+};
+
+} // namespace TiStore
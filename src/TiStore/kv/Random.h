@@ -0,0 +1,100 @@
+#pragma once
+
+#include "TiStore/basic/cstdint"
+
+#include <assert.h>
+#include <atomic>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace TiStore {
+
+//
+// The number of trailing zero bits, value must be non-zero.
+//
+static inline std::uint32_t count_trailing_zeros64(std::uint64_t value)
+{
+    assert(value != 0);
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_AMD64) || defined(_M_ARM64))
+    unsigned long index;
+    ::_BitScanForward64(&index, value);
+    return (std::uint32_t)index;
+#elif defined(_MSC_VER)
+    unsigned long index;
+    if (::_BitScanForward(&index, (unsigned long)(value & 0xFFFFFFFFULL)) != 0)
+        return (std::uint32_t)index;
+    ::_BitScanForward(&index, (unsigned long)(value >> 32));
+    return (std::uint32_t)index + 32;
+#else
+    return (std::uint32_t)__builtin_ctzll(value);
+#endif
+}
+
+//
+// A small and fast pseudo random generator (xorshift64*), it's not
+// thread safe, use one per thread, see getThreadLocal().
+//
+// See: http://vigna.di.unimi.it/ftp/papers/xorshift.pdf
+//
+class Random {
+private:
+    std::uint64_t state_;
+
+    static std::uint64_t splitmix64(std::uint64_t x) {
+        x += 0x9E3779B97F4A7C15ULL;
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+        return x ^ (x >> 31);
+    }
+
+public:
+    explicit Random(std::uint64_t seed) : state_(0) {
+        setSeed(seed);
+    }
+    ~Random() {}
+
+    void setSeed(std::uint64_t seed) {
+        // The state of xorshift must be non-zero.
+        state_ = splitmix64(seed);
+        if (state_ == 0)
+            state_ = 0x2545F4914F6CDD1DULL;
+    }
+
+    std::uint64_t next() {
+        std::uint64_t x = state_;
+        x ^= x >> 12;
+        x ^= x << 25;
+        x ^= x >> 27;
+        state_ = x;
+        return x * 0x2545F4914F6CDD1DULL;
+    }
+
+    std::uint32_t next32() {
+        return static_cast<std::uint32_t>(next() >> 32);
+    }
+
+    // Returns a uniformly distributed value in the range [0..n-1]
+    // REQUIRES: n > 0
+    std::uint32_t uniform(std::uint32_t n) {
+        assert(n > 0);
+        return static_cast<std::uint32_t>((static_cast<std::uint64_t>(next32()) * n) >> 32);
+    }
+
+    // Randomly returns true ~"1/n" of the time, and false otherwise.
+    // REQUIRES: n > 0
+    bool oneIn(std::uint32_t n) { return (uniform(n) == 0); }
+
+    // The generator of the current thread, no lock is taken. Every thread
+    // gets a different seed.
+    static Random & getThreadLocal() {
+        static std::atomic<std::uint64_t> s_thread_seq(0);
+        static thread_local Random s_random(
+            s_thread_seq.fetch_add(1, std::memory_order_relaxed) ^
+            reinterpret_cast<std::uintptr_t>(&s_thread_seq));
+        return s_random;
+    }
+};
+
+} // namespace TiStore
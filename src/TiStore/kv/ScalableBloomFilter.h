@@ -0,0 +1,236 @@
+#pragma once
+
+#include "TiStore/basic/cstdint"
+#include "TiStore/kv/BloomFilter.h"
+#include "TiStore/kv/Hash.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace TiStore {
+
+//
+// A scalable bloom filter, for a key set of an unknown size, e.g. of a
+// memtable: a chain of FullBloomFilters, the first one for initial_keys
+// keys, and each next one, made when the last one is full, for growth
+// times the keys of the previous one, with a false positive rate of
+// tightening times the previous one.
+//
+// A key is added to the last filter only, and looked up in all of them.
+// The false positive rate of the i-th filter is p0 * r^i, so the false
+// positive rate of the whole chain is at most p0 / (1 - r) = fpr.
+//
+// It costs more than a single filter sized for the final keys: the later
+// filters need more bits per key for their lower rates, and just after a
+// new filter is made, it's still empty. With the defaults and fpr 1 %, the
+// chain takes 13-18 bits/key when its last filter is full, and up to 37
+// just after a new one is made, vs 10 for a single filter: 1.3-3.7x the
+// memory. A missing key costs one probe per filter, log2(keys /
+// initial_keys) + 1 of them. The defaults start at 64K keys (104 KB), so
+// a memtable of 10M keys needs 8 filters, not 14 from 1K keys. A growth of
+// 4 needs fewer filters, but up to about 6.5x the memory.
+//
+// A FullBloomFilter has less than 2^32 bits, so a new filter is made for
+// at most that, and if it can't be allocated, the last filter takes the
+// next keys beyond its capacity (then its false positive rate, and the one
+// of the chain, exceed their bounds). If the first filter is too big, or
+// can't be allocated, no key can be added, and every key may match.
+//
+// The key is hashed once, and the hashes are remixed for each filter.
+// Not thread safe.
+//
+// See: "Scalable Bloom Filters", Almeida et al.
+//
+class ScalableBloomFilter {
+public:
+    static const std::size_t kDefaultInitialKeys = 64 * 1024;
+    static const std::size_t kDefaultGrowth = 2;
+    static const std::size_t kMaxBitsPerKey = 30;
+
+private:
+    HashUtils<> hashUtils_;
+    std::vector<std::unique_ptr<FullBloomFilter>> filters_;
+
+    std::size_t initial_keys_;
+    double fpr_;
+    std::size_t growth_;
+    double tightening_;
+
+    // The keys of the last filter, and the keys it's made for.
+    std::size_t last_keys_;
+    std::size_t last_capacity_;
+    std::size_t num_keys_;
+    // False after a new filter couldn't be made.
+    bool can_grow_;
+
+    bool verbose_;
+
+public:
+    ScalableBloomFilter(std::size_t initial_keys = kDefaultInitialKeys, double fpr = 0.01,
+                        std::size_t growth = kDefaultGrowth, double tightening = 0.8, bool verbose = true)
+        : initial_keys_(initial_keys), fpr_(fpr), growth_(growth), tightening_(tightening),
+          last_keys_(0), last_capacity_(0), num_keys_(0), can_grow_(true), verbose_(verbose) {
+        assert(fpr > 0.0 && fpr < 1.0);
+        assert(growth >= 1);
+        assert(tightening > 0.0 && tightening < 1.0);
+        if (initial_keys_ < 1)
+            initial_keys_ = 1;
+        addFilter();
+    }
+
+    ~ScalableBloomFilter() {}
+
+private:
+    // The false positive rate of the i-th filter.
+    double getFilterFPR(std::size_t index) const {
+        return fpr_ * (1.0 - tightening_) * ::pow(tightening_, (double)index);
+    }
+
+    // The bits per key for the false positive rate, (1/2)^(ln 2 * bits).
+    static std::size_t getBitsPerKey(double fpr) {
+        std::size_t bits_per_key = (std::size_t)::ceil(::log(fpr) / ::log(0.6185));
+        if (bits_per_key < 1)
+            bits_per_key = 1;
+        if (bits_per_key > kMaxBitsPerKey)
+            bits_per_key = kMaxBitsPerKey;
+        return bits_per_key;
+    }
+
+    // The most keys of a filter of bits_per_key, under FullBloomFilter::kMaxBytesTotal.
+    static std::size_t getMaxCapacity(std::size_t bits_per_key) {
+        return ((FullBloomFilter::kMaxBytesTotal - 32) * 8) / bits_per_key;
+    }
+
+    // Returns false if the filter is too big, or can't be allocated.
+    bool addFilter() {
+        std::size_t index = filters_.size();
+        std::size_t bits_per_key = getBitsPerKey(getFilterFPR(index));
+        std::size_t capacity = initial_keys_;
+        if (index != 0) {
+            std::size_t max_capacity = getMaxCapacity(bits_per_key);
+            capacity = (last_capacity_ < max_capacity / growth_) ? (last_capacity_ * growth_) : max_capacity;
+        }
+        std::unique_ptr<FullBloomFilter> filter(new FullBloomFilter(capacity, bits_per_key, false));
+        if (filter->getBitmap() == nullptr) {
+            if (getVerbose()) {
+                printf("ScalableBloomFilter: filter %zu, keys = %zu, bits_per_key = %zu, "
+                       "can't be allocated\n", index, capacity, bits_per_key);
+            }
+            return false;
+        }
+        filters_.push_back(std::move(filter));
+        last_capacity_ = capacity;
+        last_keys_ = 0;
+
+        if (getVerbose()) {
+            printf("ScalableBloomFilter: filter %zu, keys = %zu, bits_per_key = %zu, "
+                   "fpr = %0.6f, bytes = %zu\n",
+                   index, capacity, bits_per_key, getFilterFPR(index),
+                   filters_.back()->getFilterSize());
+        }
+        return true;
+    }
+
+    // A different pair of hashes of the key for every filter.
+    static inline void remixHash(std::size_t index, std::uint32_t & primary_hash,
+                                 std::uint32_t & secondary_hash) {
+        std::uint32_t salt = (std::uint32_t)index * 0x9E3779B9U;
+        primary_hash = mix32(primary_hash ^ salt);
+        secondary_hash = mix32(secondary_hash + salt) | 1;
+    }
+
+    static inline std::uint32_t mix32(std::uint32_t h) {
+        h ^= h >> 16;
+        h *= 0x85EBCA6BU;
+        h ^= h >> 13;
+        h *= 0xC2B2AE35U;
+        h ^= h >> 16;
+        return h;
+    }
+
+public:
+    bool getVerbose() const { return verbose_; }
+    void setVerbose(bool verbose) { verbose_ = verbose; }
+
+    std::size_t getNumKeys() const { return num_keys_; }
+    std::size_t getNumFilters() const { return filters_.size(); }
+
+    // The bytes of all the filters.
+    std::size_t getFilterSize() const {
+        std::size_t bytes = 0;
+        for (std::size_t i = 0; i < filters_.size(); i++) {
+            bytes += filters_[i]->getFilterSize();
+        }
+        return bytes;
+    }
+
+    std::size_t getUsedBits() const {
+        std::size_t used_bits = 0;
+        for (std::size_t i = 0; i < filters_.size(); i++) {
+            used_bits += filters_[i]->getUsedBits();
+        }
+        return used_bits;
+    }
+
+    // The bound of the false positive rate of the filters made so far.
+    double getExpectedFPR() const {
+        double no_match = 1.0;
+        for (std::size_t i = 0; i < filters_.size(); i++) {
+            no_match *= (1.0 - getFilterFPR(i));
+        }
+        return (1.0 - no_match);
+    }
+
+    // ScalableBloomFilter: drops all the keys and the filters but the first one.
+    void reset() {
+        if (filters_.empty())
+            return;
+        filters_.resize(1);
+        filters_[0]->reset();
+        last_capacity_ = initial_keys_;
+        last_keys_ = 0;
+        num_keys_ = 0;
+        can_grow_ = true;
+    }
+
+    // ScalableBloomFilter: returns false if there's no filter, the first one
+    // was too big or couldn't be allocated, then the key is not added.
+    bool addKey(const Slice & key) {
+        if (filters_.empty())
+            return false;
+        if (last_keys_ >= last_capacity_ && can_grow_)
+            can_grow_ = addFilter();
+        std::uint32_t primary_hash = hashUtils_.primaryHash(key.data(), key.size(), kDefaultHashSeed);
+        std::uint32_t secondary_hash = hashUtils_.secondaryHash(key.data(), key.size());
+        remixHash(filters_.size() - 1, primary_hash, secondary_hash);
+        filters_.back()->addHash(primary_hash, secondary_hash);
+        last_keys_++;
+        num_keys_++;
+        return true;
+    }
+
+    // ScalableBloomFilter: the newest filter first, it's the biggest one.
+    bool maybeMatch(const Slice & key) const {
+        if (filters_.empty())
+            return true;
+        std::uint32_t primary_hash = hashUtils_.primaryHash(key.data(), key.size(), kDefaultHashSeed);
+        std::uint32_t secondary_hash = hashUtils_.secondaryHash(key.data(), key.size());
+        for (std::size_t i = filters_.size(); i > 0; i--) {
+            std::uint32_t primary = primary_hash, secondary = secondary_hash;
+            remixHash(i - 1, primary, secondary);
+            if (filters_[i - 1]->matchHash(primary, secondary))
+                return true;
+        }
+        return false;
+    }
+
+private:
+    ScalableBloomFilter(const ScalableBloomFilter &) = delete;
+    ScalableBloomFilter & operator = (const ScalableBloomFilter &) = delete;
+};
+
+} // namespace TiStore
@@ -2,7 +2,9 @@
 
 #include "TiStore/basic/cstdint"
 #include "TiStore/fs/Common.h"
+#include "TiStore/kv/Arena.h"
 #include "TiStore/kv/Hash.h"
+#include "TiStore/kv/Random.h"
 #include "TiStore/traits.h"
 
 #include <string.h>
@@ -10,6 +12,8 @@
 #include <string>
 #include <memory>
 #include <map>
+#include <atomic>
+#include <new>
 
 //
 // See: https://github.com/Winnerhust/Code-of-Book/blob/master/Large-Scale-Distributed-Storage-System/skiplist/src/skiplist.h
@@ -22,6 +26,7 @@ class Key : public Slice {
 public:
     Key() {}
     Key(const char * key) : Slice(key) {}
+    Key(const char * key, size_t size) : Slice(key, size) {}
     Key(const std::string & key) : Slice(key) {}
     ~Key() {}
 
@@ -36,6 +41,7 @@ class Value: public Slice {
 public:
     Value() {}
     Value(const char * value) : Slice(value) {}
+    Value(const char * value, size_t size) : Slice(value, size) {}
     Value(const std::string & value) : Slice(value) {}
     ~Value() {}
 
@@ -82,6 +88,12 @@ public:
     const value_type const_value() const { return value_; }
 };
 
+//
+// A std::map with the same basic interface as the SkipList, as a reference
+// to compare with. The key and value bytes are copied into an Arena.
+//
+// REQUIRES: External synchronization for all the operations.
+//
 template <typename KeyT, typename ValueT>
 class MapSet {
 public:
@@ -90,41 +102,64 @@ public:
     typedef typename traits::remove_const<ValueT>::type         value_type;
     typedef typename traits::const_type<ValueT>::type           const_value_type;
 
-    typedef std::map<key_type, value_type>                      node_type;
-    typedef typename std::map<key_type, value_type>::iterator   node_iterator;
-    typedef typename std::map<key_type, value_type>::const_iterator const_node_iterator;
+    // Slice::compare() order, the operator < of Slice isn't a strict weak order.
+    struct key_compare {
+        bool operator () (const key_type & lhs, const key_type & rhs) const {
+            return (lhs.compare(rhs) < 0);
+        }
+    };
+
+    typedef std::map<key_type, value_type, key_compare>         node_type;
+    typedef typename node_type::iterator                        node_iterator;
+    typedef typename node_type::const_iterator                  const_node_iterator;
     typedef std::pair<key_type, value_type>                     node_pair_type;
+    typedef const_node_iterator                                 iterator;
 
-    static const std::size_t kMaxLevel = MaxLevel;
+    static const size_t kDefaultArenaBlockSize = 64 * 1024;
 
 private:
+    Arena arena_;
     std::size_t size_;
     std::size_t capacity_;
     node_type nodes_;
 
+    // A rough size of a red-black tree node of std::map, besides the pair.
+    static const size_t kMapNodeOverhead = 4 * sizeof(void *);
+
 public:
-    MapSet() : size_(0), capacity_(0) {}
+    explicit MapSet(size_t arena_block_size = kDefaultArenaBlockSize)
+        : arena_(arena_block_size), size_(0), capacity_(0) {}
     ~MapSet() {}
 
     size_t sizes() const { return size_; }
     size_t capacity() const { return capacity_; }
 
-    bool insert(const node_type & node) {
-        node_iterator it = nodes_.find(node.key());
+    size_t memory_usage() const {
+        return arena_.memoryUsage() + size_ * (sizeof(node_pair_type) + kMapNodeOverhead);
+    }
+
+    iterator begin() const { return nodes_.begin(); }
+    iterator end() const { return nodes_.end(); }
+
+    iterator find(const key_type & key) const { return nodes_.find(key); }
+    iterator lower_bound(const key_type & key) const { return nodes_.lower_bound(key); }
+
+    // Returns true if the key is new, false if the value of an existing key is replaced.
+    bool insert(const key_type & key, const value_type & value) {
+        node_iterator it = nodes_.find(key);
         if (it != nodes_.end()) {
-            std::string & value = *(new std::string(node.value().data()));
-            it->second = value;
+            it->second = copy_value(value);
             return false;
         }
         else {
-            nodes_.insert(std::make_pair<key_type, value_type>(node.key(), node.value()));
+            nodes_.insert(it, node_pair_type(copy_key(key), copy_value(value)));
             size_++;
             return true;
         }
     }
 
-    bool remove(const node_type & node) {       
-        node_iterator it = nodes_.find(node.key());
+    bool remove(const key_type & key) {
+        node_iterator it = nodes_.find(key);
         if (it != nodes_.end()) {
             nodes_.erase(it);
             size_--;
@@ -134,98 +169,100 @@ public:
     }
 
     bool remove(const char * key) {
-        return false;
+        return remove(key_type(key));
     }
-};
 
-template <typename Key, typename Value>
-struct SkipListNode {
-    typedef SkipListNode<Key, Value>    node_type;
-    typedef typename node_type *        iterator;
-    typedef typename const node_type *  const_iterator;
+private:
+    MapSet(const MapSet &) = delete;
+    MapSet & operator = (const MapSet &) = delete;
+
+    const char * copy_bytes(const char * data, size_t size) {
+        if (size == 0)
+            return "";
+        char * mem = arena_.allocate(size);
+        ::memcpy(mem, data, size);
+        return mem;
+    }
 
-    struct SkipListNodeItem {
-        SkipListNode<Key, Value> * next;
-        SkipListNode<Key, Value> * prev;
-    };
+    key_type copy_key(const key_type & key) {
+        return key_type(copy_bytes(key.data(), key.size()), key.size());
+    }
 
-    Value *     value;
-    Key *       key;
-    size_t      level;
-    SkipListNodeItem * items[1];
+    value_type copy_value(const value_type & value) {
+        return value_type(copy_bytes(value.data(), value.size()), value.size());
+    }
 };
 
-template <typename Key, typename Value, size_t MaxLevel>
-class SkipLinkedList {
-public:
-    typedef Key     key_type;
-    typedef Value   value_type;
-
-    typedef SkipListNode<Key, Value>            node_type;
-    typedef typename node_type::iterator        iteration;
-    typedef typename node_type::const_iterator  const_iterator;
-
-    static const std::size_t max_level = MaxLevel;
-
-private:
-    node_type * head_first_;
-    node_type * head_;
-
-public:
-    SkipLinkedList() : head_first_(nullptr), head_(nullptr) {}
-    ~SkipLinkedList() {}
-
-    node_type * find(const key_type & key, int & find_type, unsigned int & out_level) {
-        node_type * node = head_first_;
-        unsigned int level = (unsigned int)max_level - 1;
-        while (node != nullptr) {
-            int cmp_result;
-            key_type cmp_key = node->key;            
-            if (key.size() > cmp_key.size())
-                cmp_result = 1;
-            else if (key.size() > cmp_key.size())
-                cmp_result = -1;
-            else
-                cmp_result = ::memcmp(key.data(), cmp_key.data(), key.size());
+namespace detail {
 
-            if (cmp_result > 0) {
-                // Bigger than current node
-            }
-            else if (cmp_result < 0) {
-                // Smaller than current node
-                node = node->next[0];
-            }
-            else {
-                // Have found the key name
-                find_type = kFoundTheKey;
-                return node;
-            }
-            level--;
-        }
-        find_type = kNotFound;
-        return nullptr;
-    }
+// The floor of log2(N) at compile time.
+template <size_t N>
+struct static_log2 {
+    static const size_t value = 1 + static_log2<(N >> 1)>::value;
+};
 
-    bool insert(const key_type & key, const value_type & value) {
-        int find_type;
-        node_type * node = find(key, find_type);
-        if (node != nullptr) {
-            // Update the key
-            return false;
-        }
-        else {
-            // Insert a new key
-            return true;
-        }
-    }
+template <>
+struct static_log2<1> {
+    static const size_t value = 0;
 };
 
+} // namespace detail
+
 //
 // See: http://dsqiu.iteye.com/blog/1705530 (original version)
 // See: http://www.cppblog.com/mysileng/archive/2013/04/06/199159.html
 //
+// Thread safety
+// -------------
+//
+// Writes (insert(), update(), remove()) require external synchronization,
+// most likely a mutex, so only one writer touches the list at a time.
+// Reads (find(), iterator) require no lock at all: they can run concurrently
+// with the writer and with each other.
+//
+// The writer fills a new node completely and then publishes it with release
+// stores on Node::next_[], from the lowest level to the highest. Readers walk
+// the towers with acquire loads, so a reader that sees a node also sees its
+// key, value and lower level links. Values are replaced the same way, through
+// a release store on Node::value_. Removed nodes and replaced values are never
+// freed while the list is alive, a reader that is standing on them can still
+// move forward safely.
+//
+// Memory
+// ------
+//
+// All the nodes, their towers and the copied key and value bytes come out of
+// the list's Arena, a new record costs one contiguous bump-pointer allocation.
+// The memory is released all together when the list is destroyed, see
+// memory_usage() for the size of the list.
+//
+// Hash index
+// ----------
+//
+// All the keys are in one tower, in lexicographic order (Slice::compare()).
+// For point lookup heavy workloads, the list can also keep an optional hash
+// index (hash_index_buckets != 0 in the constructor): find() then costs one
+// hash and a short chain walk instead of a O(log n) search. The chains are
+// published with the same release/acquire protocol as the towers.
+//
+// Sorted ingest
+// -------------
+//
+// insert_with_hint() remembers the insert position (the prev and next node
+// of every level, a "splice") of the last insert in a caller owned Splice.
+// When the keys arrive in order, the next insert only walks one or two nodes
+// per level from there, instead of searching from the head again.
+// insert_batch() links a sorted run of records in one pass with a splice.
+//
+// Random levels
+// -------------
+//
+// A node has one more level with probability 1 / Branching (a power of 2).
+// The height is drawn from a thread local xorshift generator (Random), so
+// the writers of different lists never share a lock or a cache line.
+//
 
-template <typename KeyT, typename ValueT, size_t MaxLevel = 10U>
+template <typename KeyT, typename ValueT, size_t MaxLevel = 10U, size_t Branching = 4U>
 class SkipList {
 public:
     class Node;
@@ -235,24 +272,22 @@ public:
     typedef typename traits::remove_const<ValueT>::type     value_type;
     typedef typename traits::const_type<ValueT>::type       const_value_type;
 
-    typedef SkipList<KeyT, ValueT, MaxLevel>        this_type;
-    //typedef SkipListNode<key_type, value_type>      node_type;
+    typedef SkipList<KeyT, ValueT, MaxLevel, Branching> this_type;
     typedef Node                                    node_type;
-    //typedef typename node_type::iterator            node_iterator;
-    //typedef typename node_type::const_iterator      const_node_iterator;
     typedef std::pair<key_type, value_type>         node_pair_type;
 
-    //typedef node_type *                             iterator;
-    //typedef const node_type *                       const_iterator;
     typedef const iterator                          const_iterator;
     typedef std::nullptr_t                          end_iterator_t;
 
     static const size_t kMaxLevel = MaxLevel;
-    static const size_t kMaxKeySize = 1024;
-    // Notes: kSeparateSize must be multiply of 16.
-    static const size_t kSeparateSize = 128;
-    static const size_t kAdditiveIndex = (kSeparateSize / 16) - (kSeparateSize / 32);
-    static const size_t kMaxKeyIndex = (kMaxKeySize / 32) + kAdditiveIndex + 1;
+    // The probability of a node to have one more level is 1 / kBranching.
+    static const size_t kBranching = Branching;
+    static const size_t kBranchingBits = detail::static_log2<Branching>::value;
+    static const size_t kDefaultArenaBlockSize = 64 * 1024;
+
+    static_assert((kMaxLevel > 0), "SkipList: MaxLevel must be greater than 0.");
+    static_assert((kBranching >= 2 && (kBranching & (kBranching - 1)) == 0),
+                  "SkipList: Branching must be a power of 2 and greater than 1.");
 
     enum {
         kFoundTheKey,
@@ -263,35 +298,108 @@ public:
 public:
     class Node {
     public:
-        Node * next;
-        Node * prev;
-        key_type * key;
-        value_type * value;
+        key_type key;
     private:
-        Node * next_[1];
+        std::atomic<value_type *> value_;
+        std::uint32_t height_;
+        // The tower of the node, it's over-allocated to height_ elements.
+        // next_[0] is the lowest level link.
+        std::atomic<Node *> next_[1];
 
     public:
-        explicit Node(const key_type & k, const value_type & v)
-            : key(&k), value(&v) { }
+        Node(const key_type & k, value_type * v, size_t height)
+            : key(k), value_(v), height_(static_cast<std::uint32_t>(height)) {
+            for (size_t n = 0; n < height; n++)
+                next_[n].store(nullptr, std::memory_order_relaxed);
+        }
         ~Node() { }
 
-        Node * getNext(int n) {
-            assert(n >= 0);
-            return next_[n];
+        size_t height() const { return height_; }
+
+        value_type * getValue() const {
+            return value_.load(std::memory_order_acquire);
         }
 
-        void setNext(int n, Node * node) {
-            assert(n >= 0);
-            next_[n] = node;
+        void setValue(value_type * value) {
+            value_.store(value, std::memory_order_release);
         }
+
+        // Use an 'acquire load' so that we observe a fully initialized
+        // version of the returned Node.
+        Node * getNext(size_t n) const {
+            assert(n < height_);
+            return next_[n].load(std::memory_order_acquire);
+        }
+
+        // Use a 'release store' so that anybody who reads through this
+        // pointer observes a fully initialized version of the inserted node.
+        void setNext(size_t n, Node * node) {
+            assert(n < height_);
+            next_[n].store(node, std::memory_order_release);
+        }
+
+        // No-barrier variants, only safe for the writer or for a node
+        // which hasn't been published yet.
+        Node * getNext_relaxed(size_t n) const {
+            assert(n < height_);
+            return next_[n].load(std::memory_order_relaxed);
+        }
+
+        void setNext_relaxed(size_t n, Node * node) {
+            assert(n < height_);
+            next_[n].store(node, std::memory_order_relaxed);
+        }
+
+        static size_t getAllocSize(size_t height) {
+            assert(height >= 1);
+            return (sizeof(Node) + sizeof(std::atomic<Node *>) * (height - 1));
+        }
+    };
+
+    // The insert position of the last insert_with_hint(), per level.
+    // A Splice must only be used by the writer.
+    class Splice {
+    public:
+        Splice() : height_(0), remove_seq_(0) { }
+        ~Splice() { }
+
+        // Forget the position, the next insert searches from the head.
+        void reset() { height_ = 0; }
+
+    private:
+        friend class SkipList;
+
+        // The levels [0..height_ - 1] are valid.
+        std::size_t height_;
+        // The SkipList::remove_seq_ when the splice was made.
+        std::size_t remove_seq_;
+        // prev_[level] < key <= next_[level], next_[level] may be nullptr.
+        node_type * prev_[kMaxLevel];
+        node_type * next_[kMaxLevel];
+    };
+
+    // The entry of the optional hash index.
+    struct HashEntry {
+        node_type * node;
+        std::uint32_t hash;
+        std::atomic<HashEntry *> next;
+
+        HashEntry(node_type * _node, std::uint32_t _hash)
+            : node(_node), hash(_hash), next(nullptr) { }
     };
 
 private:
+    Arena arena_;
     std::size_t max_level_;
-    std::size_t size_;
+    std::atomic<std::size_t> max_height_;
+    std::atomic<std::size_t> size_;
     std::size_t capacity_;
-    node_type * head_[kMaxKeyIndex + 1][kMaxLevel];
-    SkipLinkedList<key_type, value_type, kMaxLevel> linked_list_;
+    std::size_t remove_seq_;
+    node_type * head_;
+
+    HashUtils<> hashUtils_;
+    std::atomic<HashEntry *> * hash_buckets_;
+    std::size_t hash_bucket_mask_;
 
 public:
     // Iteration over the contents of a skip list
@@ -322,26 +430,48 @@ public:
         // REQUIRES: is_valid()
         const key_type & key() const { return node_->key; }
 
+        // Returns the value at the current position.
+        // REQUIRES: is_valid()
+        const value_type & value() const { return *node_->getValue(); }
+
         node_type & node() const { return (*node_); }
 
         // Advances to the next position.
         // REQUIRES: is_valid()
-        void next() { }
+        void next() {
+            assert(is_valid());
+            node_ = node_->getNext(0);
+        }
 
         // Advances to the previous position.
         // REQUIRES: is_valid()
-        void prev() { }
+        void prev() {
+            assert(is_valid());
+            // Instead of using explicit "prev" links, we just search for the
+            // last node that falls before key.
+            node_ = list_->find_less_than(list_->head_, node_->key);
+            if (node_ == list_->head_)
+                node_ = nullptr;
+        }
 
         // Advance to the first entry with a key >= target
-        void seek(const key_type & target) { }
+        void seek(const key_type & target) {
+            node_ = list_->find_greater_or_equal(list_->head_, target, nullptr);
+        }
 
         // Position at the first entry in list.
         // Final state of iterator is is_valid() if list is not empty.
-        void seek_to_first() { }
+        void seek_to_first() {
+            node_ = list_->head_->getNext(0);
+        }
 
         // Position at the last entry in list.
         // Final state of iterator is is_valid() if list is not empty.
-        void seek_to_last() { }
+        void seek_to_last() {
+            node_ = list_->find_last(list_->head_);
+            if (node_ == list_->head_)
+                node_ = nullptr;
+        }
 
         node_type & operator * () const {
             return (node_type &)(*node_);
@@ -354,7 +484,7 @@ public:
         // preincrement: ++i;
         iterator & operator ++ ()
         {
-            ++*(iterator *)this;
+            next();
             return (*this);
         }
 
@@ -369,7 +499,7 @@ public:
         // predecrement: --i;
         iterator & operator -- ()
         {
-            --*(iterator *)this;
+            prev();
             return (*this);
         }
 
@@ -381,25 +511,33 @@ public:
             return (tmp);
         }
 
-        bool operator == (node_type * node) {
+        bool operator == (const iterator & iter) const {
+            return (node_ == iter.node_);
+        }
+
+        bool operator != (const iterator & iter) const {
+            return (node_ != iter.node_);
+        }
+
+        bool operator == (node_type * node) const {
             return (node_ == node);
         }
 
-        bool operator != (node_type * node) {
+        bool operator != (node_type * node) const {
             return (node_ != node);
         }
 
-        bool operator > (node_type * node) {
+        bool operator > (node_type * node) const {
             return (node_ > node);
         }
 
-        bool operator < (node_type * node) {
+        bool operator < (node_type * node) const {
             return (node_ < node);
         }
 
         iterator & operator = (const iterator & iter) {
             if ((iterator *)&iter != this)
-                init(iter->list_, iter->node_);
+                init(iter.list_, iter.node_);
             return (*this);
         }
 
@@ -410,51 +548,202 @@ public:
     };
 
 public:
-    SkipList() : max_level_(kMaxLevel), size_(0), capacity_(0) {
-        init();
+    SkipList(size_t arena_block_size = kDefaultArenaBlockSize, size_t hash_index_buckets = 0)
+        : arena_(arena_block_size), max_level_(kMaxLevel), max_height_(1), size_(0), capacity_(0),
+          remove_seq_(0), head_(nullptr), hash_buckets_(nullptr), hash_bucket_mask_(0) {
+        init(hash_index_buckets);
+    }
+    ~SkipList() {
+        // The nodes are never destroyed one by one, the arena frees them.
     }
-    ~SkipList() {}
 
-    size_t sizes() const { return size_; }
+    size_t sizes() const { return size_.load(std::memory_order_relaxed); }
     size_t capacity() const { return capacity_; }
     size_t max_level() const { return max_level_; }
 
+    bool has_hash_index() const { return (hash_buckets_ != nullptr); }
+
+    // The memory used by the nodes, keys and values, it's safe to call
+    // from any thread.
+    size_t memory_usage() const { return arena_.memoryUsage(); }
+
     bool is_valid() const {
         return true;
     }
 
-    node_type * begin() const {
-        return nullptr();
+    iterator begin() const {
+        iterator iter(this);
+        iter.seek_to_first();
+        return iter;
     }
 
-    node_type * end() const {
-        return nullptr();
+    iterator end() const {
+        return iterator(this);
     }
 
 private:
-    size_t get_random_num() const {
-#if (RAND_MAX == 0x7FFF)
-        size_t rnd = (rand() << 15) | (rand() & 0x7FFFU);
-#else
-        size_t rnd = rand();
-#endif
+    SkipList(const SkipList &) = delete;
+    SkipList & operator = (const SkipList &) = delete;
+
+    void init(size_t hash_index_buckets) {
+        // The head is the hottest node, give it its own cache line.
+        char * mem = arena_.allocateAligned(node_type::getAllocSize(kMaxLevel), CACHE_LINE_SIZE);
+        head_ = new (mem) node_type(key_type(), nullptr, kMaxLevel);
+
+        if (hash_index_buckets != 0) {
+            // Round up to a power of 2
+            size_t buckets = 1;
+            while (buckets < hash_index_buckets)
+                buckets <<= 1;
+            mem = arena_.allocateAligned(sizeof(std::atomic<HashEntry *>) * buckets, CACHE_LINE_SIZE);
+            hash_buckets_ = reinterpret_cast<std::atomic<HashEntry *> *>(mem);
+            for (size_t i = 0; i < buckets; i++) {
+                new (&hash_buckets_[i]) std::atomic<HashEntry *>(nullptr);
+            }
+            hash_bucket_mask_ = buckets - 1;
+        }
     }
 
-    int get_length_index(size_t length) const {
-        if (length < kSeparateSize)
-            return (int)(length / 16);   // If length < 128, interval is small.
-        else {
-            if (length < kMaxKeySize)
-                return (int)((length / 32) + kAdditiveIndex);
-            else
-                return (int)((kMaxKeySize / 32) + kAdditiveIndex);     // If length >= 1024, then index = 36.
+    std::uint32_t get_hash(const key_type & key) const {
+        return hashUtils_.primaryHash(key.data(), key.size(), kDefaultHashSeed);
+    }
+
+    node_type * hash_index_find(const key_type & key) const {
+        assert(hash_buckets_ != nullptr);
+        std::uint32_t hash = get_hash(key);
+        HashEntry * entry = hash_buckets_[hash & hash_bucket_mask_].load(std::memory_order_acquire);
+        while (entry != nullptr) {
+            if (entry->hash == hash && entry->node->key.compare(key) == 0)
+                return entry->node;
+            entry = entry->next.load(std::memory_order_acquire);
+        }
+        return nullptr;
+    }
+
+    // REQUIRES: External synchronization
+    void hash_index_insert(node_type * node) {
+        assert(hash_buckets_ != nullptr);
+        std::uint32_t hash = get_hash(node->key);
+        std::atomic<HashEntry *> & bucket = hash_buckets_[hash & hash_bucket_mask_];
+        char * mem = arena_.allocateAligned(sizeof(HashEntry), alignof(HashEntry));
+        HashEntry * entry = new (mem) HashEntry(node, hash);
+        entry->next.store(bucket.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        bucket.store(entry, std::memory_order_release);
+    }
+
+    // REQUIRES: External synchronization
+    void hash_index_remove(node_type * node) {
+        assert(hash_buckets_ != nullptr);
+        std::uint32_t hash = get_hash(node->key);
+        std::atomic<HashEntry *> * link = &hash_buckets_[hash & hash_bucket_mask_];
+        HashEntry * entry = link->load(std::memory_order_relaxed);
+        while (entry != nullptr) {
+            if (entry->node == node) {
+                // The entry stays in the arena, a concurrent reader may still use it.
+                link->store(entry->next.load(std::memory_order_relaxed), std::memory_order_release);
+                return;
+            }
+            link = &entry->next;
+            entry = link->load(std::memory_order_relaxed);
+        }
+    }
+
+    // The node, its tower, the copied key bytes, the value object and
+    // the copied value bytes are in one allocation:
+    //
+    //   | Node | next_[1 .. height - 1] | value_type | key bytes | value bytes |
+    //
+    node_type * new_node(const key_type & key, const value_type & value, size_t height) {
+        size_t node_size = node_type::getAllocSize(height);
+        static_assert(((sizeof(node_type) % alignof(value_type)) == 0),
+                      "SkipList: the value_type must be placed right after the tower.");
+        char * mem = arena_.allocateAligned(node_size + sizeof(value_type) + key.size() + value.size(),
+                                            alignof(node_type));
+        char * value_obj = mem + node_size;
+        char * key_data = value_obj + sizeof(value_type);
+        char * value_data = key_data + key.size();
+        if (key.size() != 0)
+            ::memcpy(key_data, key.data(), key.size());
+        if (value.size() != 0)
+            ::memcpy(value_data, value.data(), value.size());
+        value_type * new_val = new (value_obj) value_type(value_data, value.size());
+        return new (mem) node_type(key_type(key_data, key.size()), new_val, height);
+    }
+
+    // The value object and the copied value bytes are in one allocation.
+    value_type * new_value(const value_type & value) {
+        char * mem = arena_.allocateAligned(sizeof(value_type) + value.size(), alignof(value_type));
+        char * value_data = mem + sizeof(value_type);
+        if (value.size() != 0)
+            ::memcpy(value_data, value.data(), value.size());
+        return new (mem) value_type(value_data, value.size());
+    }
+
+    size_t get_max_height() const {
+        return max_height_.load(std::memory_order_relaxed);
+    }
+
+    // Return the earliest node that comes at or after key in the list
+    // which head is head, return nullptr if there is no such node.
+    //
+    // If prev is non-null, fills prev[level] with pointer to previous
+    // node at "level" for every level in [0..max_height_ - 1].
+    node_type * find_greater_or_equal(node_type * head, const key_type & key,
+                                      node_type ** prev) const {
+        node_type * node = head;
+        size_t level = get_max_height() - 1;
+        while (true) {
+            node_type * next = node->getNext(level);
+            if (next != nullptr && next->key.compare(key) < 0) {
+                // Keep searching in this list
+                node = next;
+            }
+            else {
+                if (prev != nullptr)
+                    prev[level] = node;
+                if (level == 0)
+                    return next;
+                // Switch to next list
+                level--;
+            }
+        }
+    }
+
+    // Return the latest node with a key < key in the list which head is head.
+    // Return head if there is no such node.
+    node_type * find_less_than(node_type * head, const key_type & key) const {
+        node_type * node = head;
+        size_t level = get_max_height() - 1;
+        while (true) {
+            assert(node == head || node->key.compare(key) < 0);
+            node_type * next = node->getNext(level);
+            if (next == nullptr || next->key.compare(key) >= 0) {
+                if (level == 0)
+                    return node;
+                // Switch to next list
+                level--;
+            }
+            else {
+                node = next;
+            }
         }
     }
 
-    void init() {
-        for (int i = 0; i < kMaxKeyIndex; i++) {
-            for (int j = 0; j < kMaxLevel; j++) {
-                head_[i][j] = nullptr;
+    // Return the last node in the list which head is head.
+    // Return head if list is empty.
+    node_type * find_last(node_type * head) const {
+        node_type * node = head;
+        size_t level = get_max_height() - 1;
+        while (true) {
+            node_type * next = node->getNext(level);
+            if (next == nullptr) {
+                if (level == 0)
+                    return node;
+                // Switch to next list
+                level--;
+            }
+            else {
+                node = next;
             }
         }
     }
@@ -465,10 +754,106 @@ private:
         return true;
     }
 
+    // Walk forward from before at level, until the next node is >= key.
+    // before must be in the list at level, and before < key.
+    void find_splice_for_level(const key_type & key, node_type * before, size_t level,
+                               node_type ** out_prev, node_type ** out_next) const {
+        while (true) {
+            node_type * next = before->getNext_relaxed(level);
+            if (next == nullptr || next->key.compare(key) >= 0) {
+                *out_prev = before;
+                *out_next = next;
+                return;
+            }
+            before = next;
+        }
+    }
+
+    //
+    // Fix up the splice so that it brackets key on all levels of the list,
+    // like RecomputeSpliceLevels() of RocksDB: find the lowest level whose
+    // prev_ < key <= (the next node of prev_) still holds, the levels below
+    // it are searched again from its prev, so a jump of the hint costs a
+    // search from that level, not a walk of level 0.
+    //
+    void find_splice(const key_type & key, Splice * splice) const {
+        size_t max_height = get_max_height();
+        size_t level = max_height;
+        if (splice->height_ >= max_height && splice->remove_seq_ == remove_seq_) {
+            // The nodes of a splice are never removed (remove_seq_ is the same),
+            // so every prev_[level] is still linked.
+            for (level = 0; level < max_height; level++) {
+                node_type * prev = splice->prev_[level];
+                if (prev != head_ && prev->key.compare(key) >= 0)
+                    continue;
+                node_type * next = prev->getNext_relaxed(level);
+                if (next == nullptr || next->key.compare(key) >= 0)
+                    break;
+            }
+        }
+        // The levels >= level walk forward from their old prev, which is
+        // before key (the higher levels have the smaller prevs), only past
+        // the nodes inserted there by insert() since, if any. The levels
+        // below start from the new prev of the level above.
+        for (size_t n = max_height; n > 0; n--) {
+            node_type * before;
+            if (n - 1 >= level)
+                before = (n - 1 < splice->height_) ? splice->prev_[n - 1] : head_;
+            else if (n < max_height)
+                before = splice->prev_[n];
+            else
+                before = head_;
+            find_splice_for_level(key, before, n - 1, &splice->prev_[n - 1], &splice->next_[n - 1]);
+        }
+        splice->height_ = max_height;
+        splice->remove_seq_ = remove_seq_;
+    }
+
+    // Insert a new node right after prev[level] on every level.
+    // REQUIRES: prev[0..max_height_ - 1] are the last nodes before key.
+    node_type * link_new_node(const key_type & key, const value_type & value, node_type ** prev) {
+        size_t height = get_random_level();
+        size_t max_height = get_max_height();
+        if (height > max_height) {
+            for (size_t level = max_height; level < height; level++) {
+                prev[level] = head_;
+            }
+            // It is ok to mutate max_height_ without any synchronization
+            // with concurrent readers. A concurrent reader that observes
+            // the new value of max_height_ will see either the old value of
+            // new level pointers from head (nullptr), or a new value set in
+            // the loop below. In the former case the reader will
+            // immediately drop to the next level since nullptr sorts after all
+            // keys. In the latter case the reader will use the new node.
+            max_height_.store(height, std::memory_order_relaxed);
+        }
+
+        node_type * node = new_node(key, value, height);
+        for (size_t level = 0; level < height; level++) {
+            // setNext_relaxed() suffices since we will add a barrier when
+            // we publish a pointer to "node" in prev[level].
+            node->setNext_relaxed(level, prev[level]->getNext_relaxed(level));
+            prev[level]->setNext(level, node);
+        }
+        if (hash_buckets_ != nullptr)
+            hash_index_insert(node);
+        size_.fetch_add(1, std::memory_order_relaxed);
+        return node;
+    }
+
 public:
     size_t get_random_level() const {
-        size_t rnd_level = get_random_num() % kMaxLevel;
-        return rnd_level;
+        // Increase height with probability 1 in kBranching: every group of
+        // kBranchingBits low zero bits of the random number is one more level.
+        std::uint64_t rnd = Random::getThreadLocal().next();
+        // Sets the top bit, so that rnd is never zero.
+        rnd |= (std::uint64_t)1 << 63;
+        size_t height = 1 + (size_t)count_trailing_zeros64(rnd) / kBranchingBits;
+        if (height > kMaxLevel)
+            height = kMaxLevel;
+        assert(height > 0);
+        assert(height <= kMaxLevel);
+        return height;
     }
 
     void prev(int i) {
@@ -479,141 +864,149 @@ public:
         //
     }
 
-    iterator find(const key_type & key, int & find_type, int & out_level) {
+    iterator find(const key_type & key, int & find_type, int & out_level) const {
         iterator iter(this);
-
         node_type * node;
-        size_t key_size = key.size();
-        int key_index = get_length_index(key_size);
-        assert(key_index <= kMaxKeyIndex);
-        // Get the first node of the specified level by key_index.
-        node_type ** head_base = &head_[key_index][0];
-        int level = 0;
-        // Find the first validate linkedlist.
-        while (level < kMaxLevel) {
-            node = *head_base;
-            if (node != nullptr)
-                break;
-            head_base++;
-            level++;
-        }
-        bool is_first_node = true;
-        while (node != nullptr) {
-            int cmp_result;
-            key_type * cmp_key = node->key;
-            size_t cmp_size = cmp_key->size();
-            size_t min_size = (key_size >= cmp_size) ? key_size : cmp_size;
-            cmp_result = ::memcmp(key.data(), cmp_key->data(), min_size);
-            if (cmp_result == 0) {
-                if (key.size() > cmp_key->size())
-                    cmp_result = +1;
-                else if (key.size() > cmp_key->size())
-                    cmp_result = -1;
-            }
-            if (cmp_result > 0) {
-                // Bigger than current node
-                node = node->getNext(0)->prev;
-            }
-            else if (cmp_result < 0) {
-                // Smaller than current node
-                if (!is_first_node) {
-                    node = node->getNext(0)->next;
-                }
-                else {
-                    // It's smaller than first node in linkedlist.
-                    goto NotFoundKey;
-                }
-            }
-            else {
-                // Have found the key name
-                find_type = kFoundTheKey;
-                return iter;
-            }
-            level++;
-            if (level >= max_level_) {
-                //
-                return iter;
-            }
+        if (hash_buckets_ == nullptr) {
+            node = find_greater_or_equal(head_, key, nullptr);
+            if (node != nullptr && node->key.compare(key) != 0)
+                node = nullptr;
+        }
+        else {
+            node = hash_index_find(key);
+        }
+        if (node != nullptr) {
+            // Have found the key name
+            iter.init(this, node);
+            find_type = kFoundTheKey;
+            out_level = (int)node->height() - 1;
+        }
+        else {
+            find_type = kNotFound;
+            out_level = -1;
         }
-NotFoundKey:
-        find_type = kNotFound;
         return iter;
     }
 
+    iterator find(const key_type & key) const {
+        int find_type = kNotFound, out_level = -1;
+        return find(key, find_type, out_level);
+    }
+
+    // REQUIRES: External synchronization
     void update(iterator & iter, std::string && value) {
-        std::string * new_str = new std::string(value);
-        value_type * new_value = new value_type(new_str);
-        iter.node().value = new_value;
+        update(iter, value_type(value));
     }
 
+    // REQUIRES: External synchronization
     void update(iterator & iter, const value_type & value) {
         assert(iter != nullptr);
-        value_type * new_value = new value_type(value);
-        iter.node().value = new_value;
+        // The old value stays in the arena, a concurrent reader may still use it.
+        value_type * new_val = new_value(value);
+        iter.node().setValue(new_val);
     }
 
+    // REQUIRES: External synchronization
     bool insert(const key_type & key, const value_type & value) {
-        int find_type = kNotFound, out_level = -1;
-        iterator iter = find(key, find_type, out_level);
-        if (iter != nullptr) {
+        node_type * prev[kMaxLevel];
+        node_type * head = head_;
+        node_type * node = find_greater_or_equal(head, key, prev);
+        if (node != nullptr && node->key.compare(key) == 0) {
             // Update the record
+            iterator iter(this);
+            iter.init(this, node);
             update(iter, value);
             return false;
         }
-        else {
-            // Insert the record
-            insert_by_iter(iter, key, value);
-            return true;
+
+        // Insert the record
+        link_new_node(key, value, prev);
+        return true;
+    }
+
+    // Insert with the position of the last insert as a hint, it costs close
+    // to O(1) when the keys are inserted in order. A new Splice (or reset())
+    // starts from the head.
+    // REQUIRES: External synchronization
+    bool insert_with_hint(const key_type & key, const value_type & value, Splice * splice) {
+        assert(splice != nullptr);
+        find_splice(key, splice);
+        node_type * node = splice->next_[0];
+        if (node != nullptr && node->key.compare(key) == 0) {
+            // Update the record
+            iterator iter(this);
+            iter.init(this, node);
+            update(iter, value);
+            return false;
+        }
+
+        // Insert the record
+        node = link_new_node(key, value, splice->prev_);
+        for (size_t level = 0; level < node->height(); level++) {
+            // The next key is likely to be right after this one. If the list
+            // became higher, the new levels are all below the node's height.
+            splice->prev_[level] = node;
+            splice->next_[level] = node->getNext_relaxed(level);
+        }
+        splice->height_ = get_max_height();
+        return true;
+    }
+
+    // Insert a run of records, each one has key() and value(). A sorted run
+    // is linked in one pass, about O(1) per key. An unsorted run is still
+    // inserted correctly, but each key out of order costs a search from
+    // the level of the splice which brackets it, up to O(log n) like insert().
+    // Return the number of new keys.
+    // REQUIRES: External synchronization
+    template <typename RecordT>
+    size_t insert_batch(const RecordT * records, size_t count) {
+        Splice splice;
+        size_t inserted = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (insert_with_hint(records[i].key(), records[i].value(), &splice))
+                inserted++;
         }
+        return inserted;
     }
-    
+
     template <typename U>
     bool insert(U && record) {
         return insert(record.key(), record.value());
     }
 
-    bool insert(const node_type & node) {
-        return insert(node.key(), node.value());
-    }
-
+    // REQUIRES: External synchronization
     bool remove(const key_type & key) {
-        int find_type = kNotFound, out_level = -1;
-        iterator iter = find(key, find_type, out_level);
-        if (iter != nullptr) {
-            // Erase the record
-            //erase(iter);
-            size_--;
+        node_type * prev[kMaxLevel];
+        node_type * node = find_greater_or_equal(head_, key, prev);
+        if (node != nullptr && node->key.compare(key) == 0) {
+            if (hash_buckets_ != nullptr)
+                hash_index_remove(node);
+            // Erase the record, unlink from the highest level to the lowest,
+            // the node is still readable by the concurrent readers.
+            for (size_t level = node->height(); level > 0; level--) {
+                if (prev[level - 1]->getNext_relaxed(level - 1) == node)
+                    prev[level - 1]->setNext(level - 1, node->getNext_relaxed(level - 1));
+            }
+            remove_seq_++;
+            size_.fetch_sub(1, std::memory_order_relaxed);
             return true;
         }
         return false;
     }
 
     bool remove(key_type && key) {
-        return remove(key);
+        const key_type & _key = key;
+        return remove(_key);
     }
 
     bool remove(const char * key) {
-        return false;
+        return remove(key_type(key));
     }
 
     template <typename U>
     bool remove_by_record(U && record) {
         return remove(record.const_key());
     }
-
-    bool remove(const node_type & node) {
-        return remove(node.key());
-    }
 };
 
-template <typename KeyT, typename ValueT, size_t MaxLevel>
-inline bool operator == (const typename SkipList<KeyT, ValueT, MaxLevel>::iterator & iter, const std::nullptr_t & null_ptr) {
-    return (iter.node_ == null_ptr);
-}
-
-template <typename KeyT, typename ValueT, size_t MaxLevel>
-inline bool operator != (const typename SkipList<KeyT, ValueT, MaxLevel>::iterator & iter, const std::nullptr_t & null_ptr) {
-    return (iter.node_ != null_ptr);
-}
-
 } // namespace TiStore
@@ -0,0 +1,138 @@
+#pragma once
+
+#include "TiStore/basic/cstdint"
+#include "TiStore/kv/Slice.h"
+
+#include <stdio.h>
+#include <string>
+
+namespace TiStore {
+
+//
+// Extracts a prefix from a key, e.g. "tenant|table|" from the keys
+// "tenant|table|rowkey", so the filters can index the prefixes of the keys
+// and a prefix seek can skip the tables without the prefix.
+//
+// A transform must be the same for the writer and the readers of a table,
+// it's identified by its name(), which is stored in the table. The keys
+// with the same prefix must be contiguous in the key order, which holds
+// for any prefix of the key bytes.
+//
+// See: https://github.com/facebook/rocksdb/blob/master/include/rocksdb/slice_transform.h
+//
+class SliceTransform {
+public:
+    SliceTransform() {}
+    virtual ~SliceTransform() {}
+
+    // The name of the transform with its parameters, e.g. "TiStore.FixedPrefix.8".
+    virtual const char * name() const = 0;
+
+    // Returns true if the key has a prefix, only then transform() is defined.
+    virtual bool inDomain(const Slice & key) const = 0;
+
+    // Returns the prefix of the key, a part of it.
+    // REQUIRES: inDomain(key)
+    virtual Slice transform(const Slice & key) const = 0;
+
+private:
+    SliceTransform(const SliceTransform &) = delete;
+    SliceTransform & operator = (const SliceTransform &) = delete;
+};
+
+//
+// The first prefix_length bytes, the shorter keys have no prefix.
+//
+class FixedPrefixTransform : public SliceTransform {
+private:
+    std::size_t prefix_length_;
+    std::string name_;
+
+public:
+    explicit FixedPrefixTransform(std::size_t prefix_length) : prefix_length_(prefix_length) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "TiStore.FixedPrefix.%zu", prefix_length);
+        name_ = buf;
+    }
+    ~FixedPrefixTransform() {}
+
+    const char * name() const override { return name_.c_str(); }
+
+    bool inDomain(const Slice & key) const override {
+        return (key.size() >= prefix_length_);
+    }
+
+    Slice transform(const Slice & key) const override {
+        return Slice(key.data(), prefix_length_);
+    }
+};
+
+//
+// The first cap_length bytes, or the whole key if it's shorter.
+//
+class CappedPrefixTransform : public SliceTransform {
+private:
+    std::size_t cap_length_;
+    std::string name_;
+
+public:
+    explicit CappedPrefixTransform(std::size_t cap_length) : cap_length_(cap_length) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "TiStore.CappedPrefix.%zu", cap_length);
+        name_ = buf;
+    }
+    ~CappedPrefixTransform() {}
+
+    const char * name() const override { return name_.c_str(); }
+
+    bool inDomain(const Slice &) const override { return true; }
+
+    Slice transform(const Slice & key) const override {
+        return Slice(key.data(), (key.size() < cap_length_) ? key.size() : cap_length_);
+    }
+};
+
+//
+// The key up to and including the num_delimiters-th delimiter, e.g. with
+// '|' and 2, "tenant|table|" of "tenant|table|rowkey". The keys with fewer
+// delimiters have no prefix.
+//
+class DelimiterPrefixTransform : public SliceTransform {
+private:
+    char delimiter_;
+    std::size_t num_delimiters_;
+    std::string name_;
+
+public:
+    DelimiterPrefixTransform(char delimiter, std::size_t num_delimiters = 1)
+        : delimiter_(delimiter), num_delimiters_(num_delimiters) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "TiStore.DelimiterPrefix.%02X.%zu",
+                 (unsigned int)(unsigned char)delimiter, num_delimiters);
+        name_ = buf;
+    }
+    ~DelimiterPrefixTransform() {}
+
+    const char * name() const override { return name_.c_str(); }
+
+    bool inDomain(const Slice & key) const override {
+        return (prefixLength(key) != 0);
+    }
+
+    Slice transform(const Slice & key) const override {
+        return Slice(key.data(), prefixLength(key));
+    }
+
+private:
+    // The length of the prefix, 0 if the key has no prefix.
+    std::size_t prefixLength(const Slice & key) const {
+        std::size_t count = 0;
+        for (std::size_t i = 0; i < key.size(); i++) {
+            if (key[i] == delimiter_ && ++count == num_delimiters_)
+                return (i + 1);
+        }
+        return 0;
+    }
+};
+
+} // namespace TiStore
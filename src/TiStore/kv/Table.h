@@ -0,0 +1,387 @@
+#pragma once
+
+#include "TiStore/basic/cstdint"
+#include "TiStore/fs/ErrorCode.h"
+#include "TiStore/fs/FileSystem.h"
+#include "TiStore/kv/Block.h"
+#include "TiStore/kv/Cache.h"
+#include "TiStore/kv/Coding.h"
+#include "TiStore/kv/FilterPolicy.h"
+#include "TiStore/kv/Slice.h"
+#include "TiStore/kv/SliceTransform.h"
+#include "TiStore/kv/TableFormat.h"
+
+#include <assert.h>
+#include <memory>
+#include <string>
+
+namespace TiStore {
+
+//
+// A reader of a table file built by TableBuilder, see TableFormat.h.
+//
+// The index block and the filter are loaded by open() and stay in memory,
+// a point lookup costs one filter probe, one binary search in the index
+// and one block read. get() is thread safe.
+//
+// If a BlockCache is given to open(), the data blocks are looked up in it
+// before they are read, and inserted into it after; a cache can be shared
+// by many tables.
+//
+// If the filter has the prefixes of the keys, by the same prefix extractor
+// as the one given to open(), prefixMayMatch() tells if a prefix seek can
+// skip the table.
+//
+// If the filter is partitioned, only its partition index is loaded by
+// open(), a probe reads the partition of the key like a data block, from
+// the BlockCache if there's one, so only the partitions of the hot keys
+// take memory.
+//
+class Table {
+private:
+    const fs::File * file_;
+    std::string index_contents_;
+    Block * index_block_;
+    // The filter is a view of its block, it's not copied.
+    std::string filter_contents_;
+    FullFilterPolicy::Reader filter_;
+    // The partition index of a partitioned filter, a view of filter_contents_.
+    Block * filter_index_block_;
+    bool has_filter_;
+    std::uint8_t filter_flags_;
+    // The prefix extractor of the reader, if it's the one of the filter.
+    const SliceTransform * prefix_extractor_;
+    BlockCache * cache_;
+    std::uint64_t cache_id_;
+
+    Table(const fs::File * file, BlockCache * cache)
+        : file_(file), index_block_(nullptr), filter_index_block_(nullptr),
+          has_filter_(false), filter_flags_(0),
+          prefix_extractor_(nullptr), cache_(cache),
+          cache_id_((cache != nullptr) ? cache->newId() : 0) {}
+
+public:
+    ~Table() {
+        delete index_block_;
+        delete filter_index_block_;
+    }
+
+    //
+    // Opens the table stored in the file, the file must stay open while the
+    // table is in use. On success, stores a pointer to the newly opened
+    // table in *table, the caller must delete it. The cache and the prefix
+    // extractor are optional and must outlive the table.
+    //
+    static int open(const fs::File * file, Table ** table, BlockCache * cache = nullptr,
+                    const SliceTransform * prefix_extractor = nullptr) {
+        assert(file != nullptr);
+        assert(table != nullptr);
+        *table = nullptr;
+
+        std::uint64_t size = file->size();
+        if (size < Footer::kEncodedLength)
+            return error_code::err_corruption;
+
+        char footer_space[Footer::kEncodedLength];
+        std::ssize_t n = file->read_at(size - Footer::kEncodedLength, footer_space,
+                                       Footer::kEncodedLength);
+        if (n != (std::ssize_t)Footer::kEncodedLength)
+            return error_code::err_io_error;
+
+        Footer footer;
+        int status = footer.decodeFrom(Slice(footer_space, Footer::kEncodedLength));
+        if (status != error_code::no_error)
+            return status;
+
+        Table * new_table = new Table(file, cache);
+        status = readTableBlock(file, footer.index_handle(), &new_table->index_contents_);
+        if (status == error_code::no_error) {
+            new_table->index_block_ = new Block(Slice(new_table->index_contents_));
+            if (!new_table->index_block_->isValid())
+                status = error_code::err_corruption;
+        }
+        if (status == error_code::no_error) {
+            status = new_table->readFilter(footer.filter_handle(), prefix_extractor);
+        }
+        if (status != error_code::no_error) {
+            delete new_table;
+            return status;
+        }
+        *table = new_table;
+        return error_code::no_error;
+    }
+
+    //
+    // Looks up the key, returns no_error and the value if the key is found,
+    // err_not_found if it's not.
+    //
+    int get(const Slice & key, std::string * value) const {
+        if (!keyMayMatch(key))
+            return error_code::err_not_found;
+
+        Block::Iterator index_iter(index_block_);
+        index_iter.seek(key);
+        if (!index_iter.isValid()) {
+            return (index_iter.isCorrupted() ? error_code::err_corruption
+                                             : error_code::err_not_found);
+        }
+
+        BlockHandle handle;
+        Slice handle_value = index_iter.value();
+        if (!handle.decodeFrom(&handle_value))
+            return error_code::err_corruption;
+
+        BlockCache::value_type contents;
+        int status = readDataBlock(handle, &contents);
+        if (status != error_code::no_error)
+            return status;
+
+        Block block((Slice(*contents)));
+        Block::Iterator block_iter(&block);
+        block_iter.seek(key);
+        if (block_iter.isValid() && block_iter.key() == key) {
+            if (value != nullptr)
+                value->assign(block_iter.value().data(), block_iter.value().size());
+            return error_code::no_error;
+        }
+        return (block_iter.isCorrupted() ? error_code::err_corruption
+                                         : error_code::err_not_found);
+    }
+
+    // Returns false if the key is surely not in the table.
+    bool keyMayMatch(const Slice & key) const {
+        if (!has_filter_ || (filter_flags_ & kFilterWholeKeys) == 0)
+            return true;
+        if (filter_index_block_ != nullptr)
+            return partitionMayMatch(key, key);
+        return filter_.keyMayMatch(key);
+    }
+
+    //
+    // Returns false if no key of the table starts with the prefix of the
+    // target, then a prefix seek to the target can skip the table. The
+    // target is a key or a prefix, its prefix is the one of the prefix
+    // extractor.
+    //
+    bool prefixMayMatch(const Slice & target) const {
+        if (prefix_extractor_ == nullptr || !prefix_extractor_->inDomain(target))
+            return true;
+        if (filter_index_block_ != nullptr)
+            return partitionMayMatch(target, prefix_extractor_->transform(target));
+        return filter_.keyMayMatch(prefix_extractor_->transform(target));
+    }
+
+    //
+    // An iterator over the entries of the table in key order: a seek in the
+    // index block, then in the data block it points to. The data blocks are
+    // read (or found in the cache) as the iterator gets to them.
+    //
+    class Iterator {
+    private:
+        const Table * table_;
+        Block::Iterator index_iter_;
+        BlockCache::value_type data_contents_;
+        std::unique_ptr<Block> data_block_;
+        std::unique_ptr<Block::Iterator> data_iter_;
+        int status_;
+
+    public:
+        explicit Iterator(const Table * table)
+            : table_(table), index_iter_(table->index_block_), status_(error_code::no_error) {}
+        ~Iterator() {}
+
+        bool isValid() const { return (data_iter_ && data_iter_->isValid()); }
+
+        // no_error, or the error that stopped the iterator.
+        int status() const { return status_; }
+
+        Slice key() const {
+            assert(isValid());
+            return data_iter_->key();
+        }
+
+        Slice value() const {
+            assert(isValid());
+            return data_iter_->value();
+        }
+
+        void next() {
+            assert(isValid());
+            data_iter_->next();
+            skipEmptyDataBlocks();
+        }
+
+        // Advance to the first entry with a key >= target
+        void seek(const Slice & target) {
+            index_iter_.seek(target);
+            initDataBlock();
+            if (data_iter_)
+                data_iter_->seek(target);
+            skipEmptyDataBlocks();
+        }
+
+        void seekToFirst() {
+            index_iter_.seekToFirst();
+            initDataBlock();
+            if (data_iter_)
+                data_iter_->seekToFirst();
+            skipEmptyDataBlocks();
+        }
+
+    private:
+        Iterator(const Iterator &) = delete;
+        Iterator & operator = (const Iterator &) = delete;
+
+        void initDataBlock() {
+            data_iter_.reset();
+            data_block_.reset();
+            data_contents_.reset();
+            if (!index_iter_.isValid()) {
+                if (index_iter_.isCorrupted())
+                    status_ = error_code::err_corruption;
+                return;
+            }
+            BlockHandle handle;
+            Slice handle_value = index_iter_.value();
+            if (!handle.decodeFrom(&handle_value)) {
+                status_ = error_code::err_corruption;
+                return;
+            }
+            int status = table_->readDataBlock(handle, &data_contents_);
+            if (status != error_code::no_error) {
+                status_ = status;
+                return;
+            }
+            data_block_.reset(new Block(Slice(*data_contents_)));
+            data_iter_.reset(new Block::Iterator(data_block_.get()));
+        }
+
+        // Moves to the next data block while the current one is at its end.
+        void skipEmptyDataBlocks() {
+            while (data_iter_ && !data_iter_->isValid()) {
+                if (data_iter_->isCorrupted()) {
+                    status_ = error_code::err_corruption;
+                    data_iter_.reset();
+                    return;
+                }
+                index_iter_.next();
+                initDataBlock();
+                if (data_iter_)
+                    data_iter_->seekToFirst();
+            }
+        }
+    };
+
+    // Returns a new iterator of the table, the caller must delete it.
+    Iterator * newIterator() const { return new Iterator(this); }
+
+    bool hasFilter() const { return has_filter_; }
+    bool hasPrefixFilter() const { return (prefix_extractor_ != nullptr); }
+    bool hasPartitionedFilter() const { return (filter_index_block_ != nullptr); }
+    std::size_t indexSize() const { return index_contents_.size(); }
+    // The bytes of the filter kept in memory, the partition index of a
+    // partitioned filter.
+    std::size_t filterSize() const {
+        if (filter_index_block_ != nullptr)
+            return filter_contents_.size();
+        return (has_filter_ ? filter_.getFilter().getFilterSize() : 0);
+    }
+
+private:
+    Table(const Table &) = delete;
+    Table & operator = (const Table &) = delete;
+
+    int readDataBlock(const BlockHandle & handle, BlockCache::value_type * contents) const {
+        BlockCacheKey cache_key(cache_id_, handle.offset());
+        if (cache_ != nullptr) {
+            *contents = cache_->lookup(cache_key);
+            if (*contents)
+                return error_code::no_error;
+        }
+
+        std::shared_ptr<std::string> block(new std::string());
+        int status = readTableBlock(file_, handle, block.get());
+        if (status != error_code::no_error)
+            return status;
+        if (cache_ != nullptr)
+            cache_->insert(cache_key, block);
+        *contents = block;
+        return error_code::no_error;
+    }
+
+    //
+    // Probes the partition of the filter that may have the seek key, the
+    // filter key is the key or the prefix to look for. If the partition
+    // can't be read, it's a match.
+    //
+    bool partitionMayMatch(const Slice & seek_key, const Slice & filter_key) const {
+        Block::Iterator index_iter(filter_index_block_);
+        index_iter.seek(seek_key);
+        if (!index_iter.isValid()) {
+            // After the last key of the filter.
+            return index_iter.isCorrupted();
+        }
+
+        BlockHandle handle;
+        Slice handle_value = index_iter.value();
+        if (!handle.decodeFrom(&handle_value))
+            return true;
+        BlockCache::value_type contents;
+        if (readDataBlock(handle, &contents) != error_code::no_error)
+            return true;
+        // The crc of the partition is checked when it's read.
+        FullFilterPolicy::Reader partition;
+        if (partition.attach(Slice(*contents), false) != error_code::no_error)
+            return true;
+        return partition.keyMayMatch(filter_key);
+    }
+
+    int readFilter(const BlockHandle & handle, const SliceTransform * prefix_extractor) {
+        if (handle.size() == 0)
+            return error_code::no_error;
+        int status = readTableBlock(file_, handle, &filter_contents_);
+        if (status != error_code::no_error)
+            return status;
+
+        Slice input;
+        if (filter_contents_.size() >= 4
+            && decodeFixed32(filter_contents_.data()) == kFilterPartitionMagic) {
+            input = Slice(filter_contents_.data() + 4, filter_contents_.size() - 4);
+            Slice index_contents;
+            if (!getLengthPrefixedSlice(&input, &index_contents))
+                return error_code::err_corruption;
+            filter_index_block_ = new Block(index_contents);
+            if (!filter_index_block_->isValid())
+                return error_code::err_corruption;
+        }
+        else {
+            // The crc of the block is checked by readTableBlock().
+            status = filter_.attach(Slice(filter_contents_), false);
+            if (status != error_code::no_error)
+                return status;
+            std::size_t filter_size = BloomFilterHeader::kHeaderSize
+                                      + BloomFilterHeader::paddedSize(filter_.getFilter().getFilterSize());
+            if (filter_size > filter_contents_.size())
+                return error_code::err_corruption;
+            input = Slice(filter_contents_.data() + filter_size, filter_contents_.size() - filter_size);
+        }
+
+        // What the filter indexes follows the filter.
+        if (input.empty())
+            return error_code::err_corruption;
+        filter_flags_ = (std::uint8_t)input[0];
+        if (((filter_flags_ & kFilterPartitioned) != 0) != (filter_index_block_ != nullptr))
+            return error_code::err_corruption;
+        input.remove_prefix(1);
+        Slice extractor_name;
+        if (!getLengthPrefixedSlice(&input, &extractor_name))
+            return error_code::err_corruption;
+        if ((filter_flags_ & kFilterPrefixes) != 0 && prefix_extractor != nullptr
+            && extractor_name == Slice(prefix_extractor->name()))
+            prefix_extractor_ = prefix_extractor;
+        has_filter_ = true;
+        return error_code::no_error;
+    }
+};
+
+} // namespace TiStore
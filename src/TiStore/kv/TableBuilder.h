@@ -0,0 +1,317 @@
+#pragma once
+
+#include "TiStore/basic/cstdint"
+#include "TiStore/fs/ErrorCode.h"
+#include "TiStore/fs/FileSystem.h"
+#include "TiStore/kv/Block.h"
+#include "TiStore/kv/Coding.h"
+#include "TiStore/kv/Crc32c.h"
+#include "TiStore/kv/FilterPolicy.h"
+#include "TiStore/kv/Slice.h"
+#include "TiStore/kv/TableFormat.h"
+
+#include <assert.h>
+#include <string>
+
+namespace TiStore {
+
+//
+// Builds a table file, see TableFormat.h, e.g. from the iterator of a
+// memtable when it's flushed. The keys must be added in increasing order
+// (Slice::compare()).
+//
+// Not thread safe.
+//
+class TableBuilder {
+private:
+    TableOptions options_;
+    fs::File * file_;
+    std::uint64_t offset_;
+    int status_;
+    BlockBuilder data_block_;
+    BlockBuilder index_block_;
+    std::string last_key_;
+    std::size_t num_entries_;
+    bool closed_;           // Either finish() or abandon() has been called.
+
+    // The hashes of the keys (and prefixes) of the filter, or of the current
+    // partition of it, all of them are needed to size the filter.
+    FullFilterPolicy::Builder filter_builder_;
+    std::string last_prefix_;
+    bool has_last_prefix_;
+    // The partition index of a partitioned filter, see TableFormat.h.
+    BlockBuilder filter_index_block_;
+    std::size_t num_filter_partitions_;
+
+    // We do not emit the index entry for a block until we have seen the
+    // first key for the next data block. This allows us to use shorter
+    // keys in the index block. For example, consider a block boundary
+    // between the keys "the quick brown fox" and "the who". We can use
+    // "the r" as the key for the index block entry since it is >= all
+    // entries in the first block and < all entries in subsequent
+    // blocks.
+    //
+    // Invariant: pending_index_entry_ is true only if data_block_ is empty.
+    bool pending_index_entry_;
+    BlockHandle pending_handle_;    // Handle to add to index block
+
+public:
+    // Create a builder that will store the contents of the table it is
+    // building in *file. Does not close the file. It is up to the
+    // caller to close the file after calling finish().
+    TableBuilder(fs::File * file, const TableOptions & options = TableOptions())
+        : options_(options), file_(file), offset_(0), status_(error_code::no_error),
+          data_block_(options.block_restart_interval),
+          // The index block is searched by a binary search on every entry.
+          index_block_(1),
+          num_entries_(0), closed_(false), filter_builder_(options.bits_per_key), has_last_prefix_(false),
+          filter_index_block_(1), num_filter_partitions_(0), pending_index_entry_(false) {
+        assert(file_ != nullptr);
+    }
+
+    ~TableBuilder() {
+        // Catch errors where caller forgot to call finish()
+        assert(closed_);
+    }
+
+    // Add key, value to the table being constructed.
+    // REQUIRES: key is after any previously added key.
+    // REQUIRES: finish(), abandon() have not been called
+    int add(const Slice & key, const Slice & value) {
+        assert(!closed_);
+        if (status_ != error_code::no_error)
+            return status_;
+        if (num_entries_ > 0) {
+            assert(key.compare(Slice(last_key_)) > 0);
+        }
+
+        if (pending_index_entry_) {
+            assert(data_block_.empty());
+            findShortestSeparator(&last_key_, key);
+            std::string handle_encoding;
+            pending_handle_.encodeTo(&handle_encoding);
+            index_block_.add(Slice(last_key_), Slice(handle_encoding));
+            pending_index_entry_ = false;
+        }
+
+        if (options_.bits_per_key != 0) {
+            addFilterKeys(key);
+        }
+
+        last_key_.assign(key.data(), key.size());
+        num_entries_++;
+        data_block_.add(key, value);
+
+        const std::size_t estimated_block_size = data_block_.currentSizeEstimate();
+        if (estimated_block_size >= options_.block_size) {
+            flush();
+        }
+        return status_;
+    }
+
+    // Finish building the table. Stops using the file passed to the
+    // constructor after this function returns.
+    // REQUIRES: finish(), abandon() have not been called
+    int finish() {
+        flush();
+        assert(!closed_);
+        closed_ = true;
+
+        BlockHandle filter_block_handle, index_block_handle;
+
+        // Write filter block
+        if (status_ == error_code::no_error) {
+            std::string filter_block;
+            buildFilterBlock(&filter_block);
+            writeRawBlock(Slice(filter_block), &filter_block_handle);
+        }
+
+        // Write index block
+        if (status_ == error_code::no_error) {
+            if (pending_index_entry_) {
+                std::string handle_encoding;
+                pending_handle_.encodeTo(&handle_encoding);
+                index_block_.add(Slice(last_key_), Slice(handle_encoding));
+                pending_index_entry_ = false;
+            }
+            writeBlock(&index_block_, &index_block_handle);
+        }
+
+        // Write footer
+        if (status_ == error_code::no_error) {
+            Footer footer;
+            footer.set_filter_handle(filter_block_handle);
+            footer.set_index_handle(index_block_handle);
+            std::string footer_encoding;
+            footer.encodeTo(&footer_encoding);
+            appendToFile(footer_encoding.data(), footer_encoding.size());
+        }
+        return status_;
+    }
+
+    // Indicate that the contents of this builder should be abandoned. Stops
+    // using the file passed to the constructor after this function returns.
+    void abandon() {
+        assert(!closed_);
+        closed_ = true;
+    }
+
+    int status() const { return status_; }
+
+    // Number of calls to add() so far.
+    std::size_t numEntries() const { return num_entries_; }
+
+    // Size of the file generated so far. If invoked after a successful
+    // finish() call, returns the size of the final generated file.
+    std::uint64_t fileSize() const { return offset_; }
+
+private:
+    TableBuilder(const TableBuilder &) = delete;
+    TableBuilder & operator = (const TableBuilder &) = delete;
+
+    // If *start < limit, changes *start to a short string in [start, limit).
+    static void findShortestSeparator(std::string * start, const Slice & limit) {
+        // Find length of common prefix
+        std::size_t min_length = (start->size() < limit.size()) ? start->size() : limit.size();
+        std::size_t diff_index = 0;
+        while ((diff_index < min_length) && ((*start)[diff_index] == limit[diff_index])) {
+            diff_index++;
+        }
+
+        if (diff_index >= min_length) {
+            // Do not shorten if one string is a prefix of the other
+        }
+        else {
+            unsigned char diff_byte = static_cast<unsigned char>((*start)[diff_index]);
+            if (diff_byte < 0xFF && diff_byte + 1 < static_cast<unsigned char>(limit[diff_index])) {
+                (*start)[diff_index]++;
+                start->resize(diff_index + 1);
+                assert(Slice(*start).compare(limit) < 0);
+            }
+        }
+    }
+
+    void flush() {
+        assert(!closed_);
+        if (status_ != error_code::no_error)
+            return;
+        if (data_block_.empty())
+            return;
+        assert(!pending_index_entry_);
+        writeBlock(&data_block_, &pending_handle_);
+        if (status_ == error_code::no_error) {
+            pending_index_entry_ = true;
+        }
+        // A filter partition ends at a data block boundary.
+        if (isFilterPartitioned() && (filter_builder_.numKeys() * options_.bits_per_key / 8
+                                      >= options_.filter_partition_size)) {
+            writeFilterPartition();
+        }
+    }
+
+    void writeBlock(BlockBuilder * block, BlockHandle * handle) {
+        Slice raw = block->finish();
+        writeRawBlock(raw, handle);
+        block->reset();
+    }
+
+    void writeRawBlock(const Slice & block_contents, BlockHandle * handle) {
+        handle->set_offset(offset_);
+        handle->set_size(block_contents.size());
+        appendToFile(block_contents.data(), block_contents.size());
+        if (status_ == error_code::no_error) {
+            char trailer[kBlockTrailerSize];
+            trailer[0] = (char)kNoCompression;
+            std::uint32_t crc = crc32c_value(block_contents.data(), block_contents.size());
+            crc = crc32c_extend(crc, trailer, 1);  // Extend crc to cover block type
+            encodeFixed32(trailer + 1, crc32c_mask(crc));
+            appendToFile(trailer, kBlockTrailerSize);
+        }
+    }
+
+    void appendToFile(const char * data, std::size_t size) {
+        if (status_ != error_code::no_error)
+            return;
+        if (size != 0 && file_->write(data, size) != (std::ssize_t)size) {
+            status_ = error_code::err_io_error;
+            return;
+        }
+        offset_ += size;
+    }
+
+    void addFilterKeys(const Slice & key) {
+        if (options_.whole_key_filtering)
+            filter_builder_.addKey(key);
+        const SliceTransform * extractor = options_.prefix_extractor;
+        if (extractor != nullptr && extractor->inDomain(key)) {
+            // The keys come in order, so the same prefixes are next to each other.
+            Slice prefix = extractor->transform(key);
+            if (!has_last_prefix_ || prefix != Slice(last_prefix_)) {
+                filter_builder_.addKey(prefix);
+                last_prefix_.assign(prefix.data(), prefix.size());
+                has_last_prefix_ = true;
+            }
+        }
+    }
+
+    bool isFilterPartitioned() const {
+        return (options_.bits_per_key != 0 && options_.filter_partition_size != 0);
+    }
+
+    // Writes the filter of the keys since the last partition, and adds it
+    // to the partition index under the last key of the table so far.
+    void writeFilterPartition() {
+        if (filter_builder_.empty())
+            return;
+        std::string partition;
+        int status = filter_builder_.finish(&partition);
+        if (status != error_code::no_error) {
+            status_ = status;
+            return;
+        }
+        BlockHandle handle;
+        writeRawBlock(Slice(partition), &handle);
+        if (status_ != error_code::no_error)
+            return;
+        std::string handle_encoding;
+        handle.encodeTo(&handle_encoding);
+        filter_index_block_.add(Slice(last_key_), Slice(handle_encoding));
+        num_filter_partitions_++;
+        // The next partition must have the prefix of its first key too.
+        has_last_prefix_ = false;
+    }
+
+    // An empty filter block means no filter.
+    void buildFilterBlock(std::string * filter_block) {
+        filter_block->clear();
+        if (isFilterPartitioned()) {
+            writeFilterPartition();
+            if (status_ != error_code::no_error || num_filter_partitions_ == 0)
+                return;
+            putFixed32(filter_block, kFilterPartitionMagic);
+            putLengthPrefixedSlice(filter_block, filter_index_block_.finish());
+        }
+        else {
+            if (options_.bits_per_key == 0 || filter_builder_.empty())
+                return;
+            int status = filter_builder_.finish(filter_block);
+            if (status != error_code::no_error) {
+                status_ = status;
+                return;
+            }
+        }
+
+        std::uint8_t flags = 0;
+        if (options_.whole_key_filtering)
+            flags |= kFilterWholeKeys;
+        if (options_.prefix_extractor != nullptr)
+            flags |= kFilterPrefixes;
+        if (isFilterPartitioned())
+            flags |= kFilterPartitioned;
+        filter_block->push_back((char)flags);
+        putLengthPrefixedSlice(filter_block, (options_.prefix_extractor != nullptr)
+                                             ? Slice(options_.prefix_extractor->name()) : Slice());
+    }
+};
+
+} // namespace TiStore
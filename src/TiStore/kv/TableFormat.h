@@ -0,0 +1,208 @@
+#pragma once
+
+#include "TiStore/basic/cstdint"
+#include "TiStore/fs/ErrorCode.h"
+#include "TiStore/fs/FileSystem.h"
+#include "TiStore/kv/Coding.h"
+#include "TiStore/kv/Crc32c.h"
+#include "TiStore/kv/SliceTransform.h"
+#include "TiStore/kv/Slice.h"
+
+#include <string>
+
+//
+// The format of an immutable sorted table (SSTable):
+//
+//   <beginning_of_file>
+//   [data block 1]
+//   [data block 2]
+//   ...
+//   [data block N]
+//   [filter block]
+//   [index block]
+//   [footer]           (fixed size, Footer::kEncodedLength bytes)
+//   <end_of_file>
+//
+// Every block is followed by a trailer: a type byte (kNoCompression) and
+// the masked crc32c of the block contents and the type.
+//
+// The data and the index blocks are prefix-compressed, see Block.h. The
+// index block has one entry per data block: a key >= the last key of the
+// block and < the first key of the next block, and the BlockHandle of the
+// block. The filter block is the encoding of a FullBloomFilter, see
+// BloomFilterFormat.h, followed by what the filter indexes:
+//
+//   flags:            uint8    (kFilterWholeKeys | kFilterPrefixes)
+//   prefix extractor: varint32 length + bytes (SliceTransform::name())
+//
+// With kFilterPrefixes the filter also has the prefix of every key with
+// one, by the prefix extractor of the table.
+//
+// With kFilterPartitioned (TableOptions::filter_partition_size != 0) the
+// filter is cut into partitions, at data block boundaries, each one a
+// block of its own written after the last data block it covers, with the
+// encoding of a FullBloomFilter of the keys (and prefixes) of its data
+// blocks. The filter block then starts with the partition index instead
+// of a filter:
+//
+//   magic:            fixed32  (kFilterPartitionMagic)
+//   partition index:  varint32 length + an index block, one entry per
+//                     partition: the last key of the partition, and the
+//                     BlockHandle of the partition
+//
+// followed by the flags and the prefix extractor as above. Only the index
+// has to stay in memory, the partitions are read (and cached) on demand.
+// The index has the last keys, not shorter separators, so the partition
+// found by a seek to a target always has a key >= the target.
+//
+// See: https://github.com/google/leveldb/blob/master/doc/table_format.md
+//
+
+namespace TiStore {
+
+struct TableOptions {
+    // Approximate size of the user data packed per block.
+    std::size_t block_size;
+    // Number of keys between restart points for delta encoding of keys.
+    int block_restart_interval;
+    // The bits per key of the bloom filter, 0 for no filter.
+    std::size_t bits_per_key;
+    // Add the whole keys to the filter, for get().
+    bool whole_key_filtering;
+    // If not null, add the prefixes of the keys to the filter too, for a
+    // prefix seek, see Table::prefixMayMatch(). Must outlive the builder.
+    const SliceTransform * prefix_extractor;
+    // If not 0, cut the filter into partitions of about this many bytes,
+    // see the filter block above, 0 for one filter for the whole table.
+    std::size_t filter_partition_size;
+
+    TableOptions() : block_size(4096), block_restart_interval(16), bits_per_key(10),
+                     whole_key_filtering(true), prefix_extractor(nullptr),
+                     filter_partition_size(0) {}
+};
+
+// What the filter of a table indexes, see the filter block above.
+enum FilterContentFlags {
+    kFilterWholeKeys = 0x01,
+    kFilterPrefixes = 0x02,
+    kFilterPartitioned = 0x04
+};
+
+// The first 4 bytes of a partitioned filter block, "TiFP".
+static const std::uint32_t kFilterPartitionMagic = 0x50466954U;
+
+// 1-byte type + 32-bit crc
+static const std::size_t kBlockTrailerSize = 5;
+
+enum BlockCompressionType {
+    kNoCompression = 0x0
+};
+
+//
+// BlockHandle is a pointer to the extent of a file that stores a data
+// block or a meta block.
+//
+class BlockHandle {
+private:
+    std::uint64_t offset_;
+    std::uint64_t size_;
+
+public:
+    // Maximum encoding length of a BlockHandle
+    static const std::size_t kMaxEncodedLength = 10 + 10;
+
+    BlockHandle() : offset_(~(std::uint64_t)0), size_(~(std::uint64_t)0) {}
+    BlockHandle(std::uint64_t offset, std::uint64_t size) : offset_(offset), size_(size) {}
+
+    // The offset of the block in the file.
+    std::uint64_t offset() const { return offset_; }
+    void set_offset(std::uint64_t offset) { offset_ = offset; }
+
+    // The size of the stored block, without the trailer.
+    std::uint64_t size() const { return size_; }
+    void set_size(std::uint64_t size) { size_ = size; }
+
+    void encodeTo(std::string * dst) const {
+        putVarint64(dst, offset_);
+        putVarint64(dst, size_);
+    }
+
+    bool decodeFrom(Slice * input) {
+        return (getVarint64(input, &offset_) && getVarint64(input, &size_));
+    }
+};
+
+//
+// Footer encapsulates the fixed information stored at the tail
+// end of every table file.
+//
+//   filter handle: fixed64 offset, fixed64 size
+//   index handle:  fixed64 offset, fixed64 size
+//   magic:         fixed64
+//
+class Footer {
+private:
+    BlockHandle filter_handle_;
+    BlockHandle index_handle_;
+
+public:
+    static const std::size_t kEncodedLength = 8 * 5;
+    static const std::uint64_t kTableMagicNumber = 0x54695354424C4531ULL;   // "TiSTBLE1"
+
+    Footer() {}
+
+    const BlockHandle & filter_handle() const { return filter_handle_; }
+    void set_filter_handle(const BlockHandle & handle) { filter_handle_ = handle; }
+
+    const BlockHandle & index_handle() const { return index_handle_; }
+    void set_index_handle(const BlockHandle & handle) { index_handle_ = handle; }
+
+    void encodeTo(std::string * dst) const {
+        putFixed64(dst, filter_handle_.offset());
+        putFixed64(dst, filter_handle_.size());
+        putFixed64(dst, index_handle_.offset());
+        putFixed64(dst, index_handle_.size());
+        putFixed64(dst, kTableMagicNumber);
+    }
+
+    int decodeFrom(const Slice & input) {
+        if (input.size() < kEncodedLength)
+            return error_code::err_corruption;
+        const char * p = input.data();
+        if (decodeFixed64(p + 32) != kTableMagicNumber)
+            return error_code::err_corruption;
+        filter_handle_ = BlockHandle(decodeFixed64(p), decodeFixed64(p + 8));
+        index_handle_ = BlockHandle(decodeFixed64(p + 16), decodeFixed64(p + 24));
+        return error_code::no_error;
+    }
+};
+
+//
+// Read the block identified by "handle" from "file" into *contents,
+// and verify its checksum.
+//
+static inline int readTableBlock(const fs::File * file, const BlockHandle & handle,
+                                 std::string * contents)
+{
+    std::size_t n = static_cast<std::size_t>(handle.size());
+    contents->resize(n + kBlockTrailerSize);
+    char * buf = &(*contents)[0];
+    std::ssize_t bytes_read = file->read_at(handle.offset(), buf, n + kBlockTrailerSize);
+    if (bytes_read < 0)
+        return error_code::err_io_error;
+    if ((std::size_t)bytes_read != n + kBlockTrailerSize)
+        return error_code::err_corruption;
+
+    // Check the crc of the type and the block contents
+    std::uint32_t crc = crc32c_unmask(decodeFixed32(buf + n + 1));
+    std::uint32_t actual = crc32c_value(buf, n + 1);
+    if (actual != crc)
+        return error_code::err_corruption;
+    if (buf[n] != kNoCompression)
+        return error_code::err_corruption;
+
+    contents->resize(n);
+    return error_code::no_error;
+}
+
+} // namespace TiStore
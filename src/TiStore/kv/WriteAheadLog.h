@@ -0,0 +1,295 @@
+#pragma once
+
+#include "TiStore/basic/cstdint"
+#include "TiStore/fs/ErrorCode.h"
+#include "TiStore/fs/FileSystem.h"
+#include "TiStore/kv/LogReader.h"
+#include "TiStore/kv/LogWriter.h"
+#include "TiStore/kv/Slice.h"
+#include "TiStore/kv/WriteBatch.h"
+
+#include <assert.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+
+namespace TiStore {
+
+//
+// The write-ahead log of the KV layer: a WriteBatch is made durable in the
+// log before it's applied to the memtable (SkipList), and recover() replays
+// the log into a fresh memtable after a crash.
+//
+// Group commit
+// ------------
+//
+// write() can be called by many threads. The writers line up in a queue;
+// the one at the front (the leader) takes the batches of the writers behind
+// it, writes them as one log record, with one write() and one fdatasync(),
+// and then wakes them up with the result. While the leader is doing the I/O,
+// the new writers queue up for the next group, so the more writers are
+// waiting, the fewer syncs per write.
+//
+// See: https://github.com/google/leveldb/blob/master/db/db_impl.cc (DBImpl::Write)
+//
+class WriteAheadLog {
+public:
+    // The maximum bytes of the batches of a group, a small write isn't
+    // slowed down by too much by a group of big ones.
+    static const std::size_t kMaxGroupSize = 1024 * 1024;
+    static const std::size_t kSmallBatchSize = 128 * 1024;
+
+private:
+    struct Writer {
+        const WriteBatch * batch;
+        bool sync;
+        bool done;
+        int status;
+        std::condition_variable cv;
+
+        Writer(const WriteBatch * _batch, bool _sync)
+            : batch(_batch), sync(_sync), done(false), status(error_code::no_error) {}
+    };
+
+    std::mutex mutex_;
+    std::deque<Writer *> writers_;
+    fs::File file_;
+    LogWriter * log_;
+    WriteBatch group_batch_;
+    int status_;
+
+    std::atomic<std::size_t> records_;
+    std::atomic<std::size_t> batches_;
+    std::atomic<std::size_t> syncs_;
+
+public:
+    WriteAheadLog() : log_(nullptr), status_(error_code::no_error),
+        records_(0), batches_(0), syncs_(0) {}
+
+    ~WriteAheadLog() {
+        close();
+    }
+
+    // Creates a new empty log file, or truncates the existing one.
+    int open(const char * filename) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        assert(writers_.empty());
+        if (log_ != nullptr)
+            return error_code::err_failed;
+        if (!file_.open(filename, fs::FS_MARK_WRITE | fs::FS_MARK_TRUNC |
+                                  fs::FS_MARK_APPENDTOEND | fs::FS_MARK_BINARY))
+            return error_code::err_io_error;
+        log_ = new LogWriter(&file_);
+        status_ = error_code::no_error;
+        return error_code::no_error;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        assert(writers_.empty());
+        if (log_ != nullptr) {
+            delete log_;
+            log_ = nullptr;
+        }
+        file_.close();
+    }
+
+    bool is_open() const { return (log_ != nullptr); }
+
+    //
+    // Appends the batch to the log, and returns after it's durable if sync
+    // is true. After an I/O error all the following writes fail, the log
+    // must be recovered.
+    //
+    int write(const WriteBatch * batch, bool sync = true) {
+        assert(batch != nullptr);
+        Writer w(batch, sync);
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        writers_.push_back(&w);
+        while (!w.done && &w != writers_.front()) {
+            w.cv.wait(lock);
+        }
+        if (w.done) {
+            return w.status;
+        }
+
+        // I'm the leader of a group.
+        if (log_ == nullptr)
+            status_ = error_code::err_failed;
+
+        Writer * last_writer = &w;
+        int status = status_;
+        if (status == error_code::no_error) {
+            bool need_sync = false;
+            const WriteBatch * group = buildBatchGroup(&last_writer, need_sync);
+
+            // Unlock while writing the log, the new writers can line up
+            // for the next group meanwhile. The log is only touched by the
+            // leader, the front of writers_.
+            lock.unlock();
+            status = log_->addRecord(group->contents());
+            if (status == error_code::no_error && need_sync) {
+                status = log_->sync();
+                syncs_.fetch_add(1, std::memory_order_relaxed);
+            }
+            lock.lock();
+
+            if (group == &group_batch_)
+                group_batch_.clear();
+            records_.fetch_add(1, std::memory_order_relaxed);
+            if (status != error_code::no_error) {
+                // The state of the log file is unknown, no more writes.
+                status_ = status;
+            }
+        }
+
+        while (true) {
+            Writer * ready = writers_.front();
+            writers_.pop_front();
+            batches_.fetch_add(1, std::memory_order_relaxed);
+            if (ready != &w) {
+                ready->status = status;
+                ready->done = true;
+                ready->cv.notify_one();
+            }
+            if (ready == last_writer)
+                break;
+        }
+
+        // Notify new head of write queue
+        if (!writers_.empty()) {
+            writers_.front()->cv.notify_one();
+        }
+        return status;
+    }
+
+    // The number of log records (groups) written.
+    std::size_t records() const { return records_.load(std::memory_order_relaxed); }
+    // The number of batches written, by all the groups.
+    std::size_t batches() const { return batches_.load(std::memory_order_relaxed); }
+    std::size_t syncs() const { return syncs_.load(std::memory_order_relaxed); }
+
+    //
+    // Replays the log into the memtable, e.g. a SkipList, with insert() and
+    // remove(). A corrupted record is skipped, the number of the corrupted
+    // bytes is returned in dropped_bytes, and the number of the replayed
+    // operations in operations. A batch is checked whole before it's
+    // applied, so a malformed one leaves nothing in the memtable.
+    //
+    // Returns err_io_error if the log couldn't be read to its end, then
+    // only the records before the error are replayed.
+    //
+    template <typename MemTableT>
+    static int recover(const char * filename, MemTableT * memtable,
+                       std::size_t * operations = nullptr, std::size_t * dropped_bytes = nullptr) {
+        assert(memtable != nullptr);
+        fs::File file;
+        if (!file.open(filename, fs::FS_MARK_READ | fs::FS_MARK_BINARY))
+            return error_code::err_io_error;
+
+        BatchChecker checker;
+        MemTableInserter<MemTableT> inserter(memtable);
+        LogReader reader(&file);
+        WriteBatch batch;
+        std::string scratch;
+        Slice record;
+        std::size_t count = 0;
+        std::size_t dropped = 0;
+        while (reader.readRecord(&record, &scratch)) {
+            if (!batch.setContents(record) || !batch.iterate(&checker)) {
+                // The checksum is right, but the contents are not a batch.
+                dropped += record.size();
+                continue;
+            }
+            batch.iterate(&inserter);
+            count += batch.count();
+        }
+        if (operations != nullptr)
+            *operations = count;
+        if (dropped_bytes != nullptr)
+            *dropped_bytes = dropped + reader.droppedBytes();
+        return reader.status();
+    }
+
+private:
+    WriteAheadLog(const WriteAheadLog &) = delete;
+    WriteAheadLog & operator = (const WriteAheadLog &) = delete;
+
+    // Only parses a batch, a dry run before it's applied.
+    class BatchChecker : public WriteBatch::Handler {
+    public:
+        void put(const Slice & key, const Slice & value) override {}
+        void remove(const Slice & key) override {}
+    };
+
+    template <typename MemTableT>
+    class MemTableInserter : public WriteBatch::Handler {
+    private:
+        MemTableT * memtable_;
+
+    public:
+        explicit MemTableInserter(MemTableT * memtable) : memtable_(memtable) {}
+
+        void put(const Slice & key, const Slice & value) override {
+            typedef typename MemTableT::key_type key_type;
+            typedef typename MemTableT::value_type value_type;
+            memtable_->insert(key_type(key.data(), key.size()), value_type(value.data(), value.size()));
+        }
+
+        void remove(const Slice & key) override {
+            typedef typename MemTableT::key_type key_type;
+            memtable_->remove(key_type(key.data(), key.size()));
+        }
+    };
+
+    //
+    // Merges the batches of the writers from the front of the queue into
+    // one batch. REQUIRES: mutex_ is held, and the front writer has a batch.
+    //
+    const WriteBatch * buildBatchGroup(Writer ** last_writer, bool & need_sync) {
+        assert(!writers_.empty());
+        Writer * first = writers_.front();
+        const WriteBatch * result = first->batch;
+        assert(result != nullptr);
+
+        std::size_t size = first->batch->approximateSize();
+
+        // Allow the group to grow up to a maximum size, but if the
+        // original write is small, limit the growth so we do not slow
+        // down the small write too much.
+        std::size_t max_size = kMaxGroupSize;
+        if (size <= kSmallBatchSize) {
+            max_size = size + kSmallBatchSize;
+        }
+
+        need_sync = first->sync;
+        *last_writer = first;
+        std::deque<Writer *>::iterator iter = writers_.begin();
+        ++iter;  // Advance past "first"
+        for (; iter != writers_.end(); ++iter) {
+            Writer * w = *iter;
+            size += w->batch->approximateSize();
+            if (size > max_size) {
+                // Do not make batch too big
+                break;
+            }
+
+            // Append to *result
+            if (result == first->batch) {
+                // Switch to temporary batch instead of disturbing caller's batch
+                result = &group_batch_;
+                assert(group_batch_.count() == 0);
+                group_batch_.append(*first->batch);
+            }
+            group_batch_.append(*w->batch);
+            need_sync = (need_sync || w->sync);
+            *last_writer = w;
+        }
+        return result;
+    }
+};
+
+} // namespace TiStore
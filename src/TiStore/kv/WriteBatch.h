@@ -0,0 +1,143 @@
+#pragma once
+
+#include "TiStore/basic/cstdint"
+#include "TiStore/kv/Coding.h"
+#include "TiStore/kv/Slice.h"
+
+#include <assert.h>
+#include <string>
+
+namespace TiStore {
+
+//
+// A batch of updates that are applied atomically, and the payload of
+// a record of the write-ahead log.
+//
+// The format of the contents:
+//
+//   count: fixed32
+//   records: record[count]
+//
+//   record :=
+//      kTypeValue    key: varstring value: varstring |
+//      kTypeDeletion key: varstring
+//
+//   varstring :=
+//      len: varint32
+//      data: uint8[len]
+//
+// See: https://github.com/google/leveldb/blob/master/db/write_batch.cc
+//
+class WriteBatch {
+public:
+    enum ValueType {
+        kTypeDeletion = 0x0,
+        kTypeValue = 0x1
+    };
+
+    // The size of the header of the contents.
+    static const size_t kHeaderSize = 4;
+
+    // The callbacks of iterate().
+    class Handler {
+    public:
+        virtual ~Handler() {}
+        virtual void put(const Slice & key, const Slice & value) = 0;
+        virtual void remove(const Slice & key) = 0;
+    };
+
+private:
+    std::string contents_;
+
+public:
+    WriteBatch() { clear(); }
+    ~WriteBatch() {}
+
+    void put(const Slice & key, const Slice & value) {
+        setCount(count() + 1);
+        contents_.push_back((char)kTypeValue);
+        putLengthPrefixedSlice(&contents_, key);
+        putLengthPrefixedSlice(&contents_, value);
+    }
+
+    void remove(const Slice & key) {
+        setCount(count() + 1);
+        contents_.push_back((char)kTypeDeletion);
+        putLengthPrefixedSlice(&contents_, key);
+    }
+
+    void clear() {
+        contents_.clear();
+        contents_.resize(kHeaderSize);
+    }
+
+    // Copies the operations of "source" to the end of this batch.
+    void append(const WriteBatch & source) {
+        assert(source.contents_.size() >= kHeaderSize);
+        setCount(count() + source.count());
+        contents_.append(source.contents_.data() + kHeaderSize,
+                         source.contents_.size() - kHeaderSize);
+    }
+
+    std::uint32_t count() const { return decodeFixed32(contents_.data()); }
+
+    // The size of the contents, an estimate of the cost of the batch.
+    size_t approximateSize() const { return contents_.size(); }
+
+    Slice contents() const { return Slice(contents_); }
+
+    // Replace the contents, e.g. with a record read from the log.
+    bool setContents(const Slice & contents) {
+        if (contents.size() < kHeaderSize)
+            return false;
+        contents_.assign(contents.data(), contents.size());
+        return true;
+    }
+
+    // Calls the handler for every operation, in order. Returns false
+    // if the contents are malformed.
+    bool iterate(Handler * handler) const {
+        assert(handler != nullptr);
+        Slice input(contents_);
+        if (input.size() < kHeaderSize)
+            return false;
+
+        input.remove_prefix(kHeaderSize);
+        Slice key, value;
+        std::uint32_t found = 0;
+        while (!input.empty()) {
+            found++;
+            char tag = input[0];
+            input.remove_prefix(1);
+            switch (tag) {
+            case kTypeValue:
+                if (getLengthPrefixedSlice(&input, &key) &&
+                    getLengthPrefixedSlice(&input, &value)) {
+                    handler->put(key, value);
+                }
+                else {
+                    return false;
+                }
+                break;
+            case kTypeDeletion:
+                if (getLengthPrefixedSlice(&input, &key)) {
+                    handler->remove(key);
+                }
+                else {
+                    return false;
+                }
+                break;
+            default:
+                return false;
+            }
+        }
+        return (found == count());
+    }
+
+private:
+    void setCount(std::uint32_t n) {
+        encodeFixed32(&contents_[0], n);
+    }
+};
+
+} // namespace TiStore
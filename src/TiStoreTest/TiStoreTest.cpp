@@ -6,12 +6,19 @@
 #include <cstdio>
 #include <iostream>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include "TiStore/TiFS.h"
 #include "TiStore/TiStore.h"
 #include "TiStore/fs/Initor.h"
 #include "TiStore/traits.h"
+#include "TiStore/kv/BinaryFuseFilter.h"
 #include "TiStore/kv/BloomFilter.h"
+#include "TiStore/kv/BloomFilterFixed.h"
+#include "TiStore/kv/BloomFilterSimd.h"
+#include "TiStore/kv/FilterPolicy.h"
+#include "TiStore/kv/ScalableBloomFilter.h"
 #include "TiStore/kv/SkipList.h"
 #include "TiStore/lang/TypeInfo.h"
 
@@ -75,10 +82,68 @@ void test_bloomfilter_hash_impl(const char key[])
     printf("sbf.maybe_match_openssl() time spent: %8.3f ms, hash: 0x%08X\n\n", sw.getElapsedMillisec(), hash);
 }
 
+//
+// The throughput of the hashes for a key length, the first byte of the key
+// changes each time, so the hash can't be hoisted out of the loop.
+//
+void test_bloomfilter_hash_speed_impl(std::size_t key_len)
+{
+    static const std::size_t kTotalBytes = 256 * 1024 * 1024;
+    std::size_t iterations = kTotalBytes / key_len;
+    std::string key(key_len, '\0');
+    for (std::size_t i = 0; i < key_len; i++) {
+        key[i] = (char)('a' + (i * 7) % 26);
+    }
+    char * data = &key[0];
+
+    HashUtils<std::uint32_t> hashUtils32;
+    HashUtils<std::uint64_t> hashUtils64;
+    StopWatch sw;
+
+    volatile std::uint32_t hash32 = 0;
+    sw.start();
+    for (std::size_t i = 0; i < iterations; ++i) {
+        data[0] = (char)i;
+        hash32 += hashUtils32.primaryHash(data, key_len, kDefaultHashSeed);
+    }
+    sw.stop();
+    double primary32_time = sw.getElapsedMillisec();
+
+    hash32 = 0;
+    sw.start();
+    for (std::size_t i = 0; i < iterations; ++i) {
+        data[0] = (char)i;
+        hash32 += hashUtils32.secondaryHash(data, key_len);
+    }
+    sw.stop();
+    double secondary32_time = sw.getElapsedMillisec();
+
+    volatile std::uint64_t hash64 = 0;
+    sw.start();
+    for (std::size_t i = 0; i < iterations; ++i) {
+        data[0] = (char)i;
+        hash64 += hashUtils64.primaryHash(data, key_len, kDefaultHashSeed);
+    }
+    sw.stop();
+    double primary64_time = sw.getElapsedMillisec();
+
+    double bytes = (double)iterations * key_len;
+    printf("key_len = %4zu: HashUtils<uint32_t>::primaryHash %6.2f GB/s, secondaryHash %6.2f GB/s, "
+           "HashUtils<uint64_t>::primaryHash %6.2f GB/s (%5.2f ns/hash)\n",
+           key_len, bytes / primary32_time / 1000000.0, bytes / secondary32_time / 1000000.0,
+           bytes / primary64_time / 1000000.0, primary64_time * 1000000.0 / iterations);
+}
+
 void test_bloomfilter_hash()
 {
     test_bloomfilter_hash_impl("This is a hash test.");
     test_bloomfilter_hash_impl("This is a hash test...");
+
+    static const std::size_t kKeyLengths[] = { 8, 16, 64, 256, 4096 };
+    for (std::size_t i = 0; i < sizeof(kKeyLengths) / sizeof(kKeyLengths[0]); i++) {
+        test_bloomfilter_hash_speed_impl(kKeyLengths[i]);
+    }
+    printf("\n");
 }
 
 void test_bloomfilter_impl()
@@ -140,6 +205,16 @@ static int NextLength(int length) {
     return length;
 }
 
+// The static filters are made after all the keys are added.
+template <typename BloomFilterT>
+static inline void buildFilter(BloomFilterT &) {}
+
+static inline void buildFilter(BinaryFuseFilter & filter) {
+    int status = filter.build();
+    if (status != error_code::no_error)
+        printf("BinaryFuseFilter::build() failed, status = %d\n", status);
+}
+
 template <typename T>
 double getFalsePositiveRate(T const & bloom_filter, int length) {
     char buffer[sizeof(int)];
@@ -206,7 +281,8 @@ void test_bloomfilter_standard_false_positive_rate()
     fprintf(stderr, "\n");
 }
 
-void test_bloomfilter_full_false_positive_rate()
+template <typename BloomFilterT>
+void test_bloomfilter_full_false_positive_rate_impl(const char * name)
 {
     char buffer[sizeof(int)];
 
@@ -216,11 +292,11 @@ void test_bloomfilter_full_false_positive_rate()
     bool isMatch;
 
     std::cout << "----------------------------------" << std::endl;
-    std::cout << "FullBloomFilter Test" << std::endl;
+    std::cout << name << " Test" << std::endl;
     std::cout << "----------------------------------" << std::endl;
     std::cout << std::endl;
 
-    FullBloomFilter bloomfilter(10000, 10, true);
+    BloomFilterT bloomfilter(10000, 10, true);
 
     for (int length = 1; length <= 10000; length = NextLength(length)) {
         bloomfilter.setOption(length, 10, false);
@@ -228,6 +304,7 @@ void test_bloomfilter_full_false_positive_rate()
         for (int i = 0; i < length; i++) {
             bloomfilter.addKey(MemIntegerKey(i, buffer));
         }
+        buildFilter(bloomfilter);
 
         // All added keys must match
         for (int i = 0; i < length; ++i) {
@@ -258,6 +335,611 @@ void test_bloomfilter_full_false_positive_rate()
     fprintf(stderr, "\n");
 }
 
+//
+// The measured false positive rate and the cost of a lookup of a filter
+// much bigger than the caches, where the blocked filter takes one cache
+// miss per lookup and the full filter up to num_probes.
+//
+template <typename BloomFilterT>
+void test_bloomfilter_lookup_speed_impl(const char * name, int num_keys, int bits_per_key)
+{
+    static const int kLookups = 2000000;
+    char buffer[sizeof(int)];
+
+    BloomFilterT bloomfilter(num_keys, bits_per_key, false);
+    for (int i = 0; i < num_keys; i++) {
+        bloomfilter.addKey(MemIntegerKey(i, buffer));
+    }
+    buildFilter(bloomfilter);
+
+    // Look up the keys in a random order, so the lines are not in the caches.
+    std::uint32_t rnd = 2463534242U;
+    int false_positives = 0;
+    StopWatch sw;
+    sw.start();
+    for (int i = 0; i < kLookups; ++i) {
+        rnd ^= rnd << 13; rnd ^= rnd >> 17; rnd ^= rnd << 5;
+        if (bloomfilter.maybeMatch(MemIntegerKey((int)(rnd & 0x3FFFFFFF) + 1073741824, buffer)))
+            false_positives++;
+    }
+    sw.stop();
+    double missing_ns = sw.getElapsedMillisec() * 1000000.0 / kLookups;
+
+    int found = 0;
+    sw.start();
+    for (int i = 0; i < kLookups; ++i) {
+        rnd ^= rnd << 13; rnd ^= rnd >> 17; rnd ^= rnd << 5;
+        if (bloomfilter.maybeMatch(MemIntegerKey((int)(rnd % (std::uint32_t)num_keys), buffer)))
+            found++;
+    }
+    sw.stop();
+    double existing_ns = sw.getElapsedMillisec() * 1000000.0 / kLookups;
+
+    printf("%-18s keys = %9d, bytes = %10zu, bits/key = %5.2f, probes = %2zu, FPR = %6.3f %%, "
+           "missing: %7.2f ns/lookup, existing: %7.2f ns/lookup%s\n",
+           name, num_keys, bloomfilter.getFilterSize(),
+           (double)bloomfilter.getFilterSize() * 8.0 / num_keys, bloomfilter.getNumProbes(),
+           (double)false_positives * 100.0 / kLookups, missing_ns, existing_ns,
+           (found == kLookups) ? "" : " [Not Match]");
+}
+
+void test_bloomfilter_full_false_positive_rate()
+{
+    test_bloomfilter_full_false_positive_rate_impl<FullBloomFilter>("FullBloomFilter");
+    test_bloomfilter_full_false_positive_rate_impl<BlockedBloomFilter>("BlockedBloomFilter");
+    test_bloomfilter_full_false_positive_rate_impl<BinaryFuseFilter>("BinaryFuseFilter");
+
+#if TISTORE_FULL_BENCHMARK
+    static const int kLargeKeys[] = { 100000, 1000000, 10000000, 100000000 };
+#else
+    static const int kLargeKeys[] = { 100000, 1000000, 10000000 };
+#endif
+    for (std::size_t i = 0; i < sizeof(kLargeKeys) / sizeof(kLargeKeys[0]); i++) {
+        test_bloomfilter_lookup_speed_impl<FullBloomFilter>("FullBloomFilter", kLargeKeys[i], 10);
+        test_bloomfilter_lookup_speed_impl<BlockedBloomFilter>("BlockedBloomFilter", kLargeKeys[i], 10);
+        test_bloomfilter_lookup_speed_impl<BinaryFuseFilter>("BinaryFuseFilter", kLargeKeys[i], 10);
+    }
+    printf("\n");
+}
+
+template <typename BloomFilterT>
+double bloomfilter_probe_speed(const BloomFilterT & bloomfilter, int num_keys, int lookups,
+                               int & found)
+{
+    char buffer[sizeof(int)];
+    std::uint32_t rnd = 2463534242U;
+    found = 0;
+    StopWatch sw;
+    sw.start();
+    for (int i = 0; i < lookups; ++i) {
+        rnd ^= rnd << 13; rnd ^= rnd >> 17; rnd ^= rnd << 5;
+        // Half of the keys exist.
+        int key = (i & 1) ? (int)(rnd % (std::uint32_t)num_keys) : (int)(rnd & 0x3FFFFFFF) + 1073741824;
+        if (bloomfilter.maybeMatch(MemIntegerKey(key, buffer)))
+            found++;
+    }
+    sw.stop();
+    return sw.getElapsedMillisec() * 1000000.0 / lookups;
+}
+
+template <typename BloomFilterT>
+void test_bloomfilter_simd_probe_impl(const char * name, BloomFilterT & bloomfilter, int num_keys)
+{
+    static const int kLookups = 4000000;
+    char buffer[sizeof(int)];
+    for (int i = 0; i < num_keys; i++) {
+        bloomfilter.addKey(MemIntegerKey(i, buffer));
+    }
+    int found;
+    double ns = bloomfilter_probe_speed(bloomfilter, num_keys, kLookups, found);
+    printf("%-32s bytes = %9zu, probes = %2zu, %7.2f ns/lookup, match = %5.2f %%\n",
+           name, bloomfilter.getFilterSize(), bloomfilter.getNumProbes(), ns,
+           (double)found * 100.0 / kLookups);
+}
+
+//
+// The probes of the SplitBlockBloomFilter made by SIMD (AVX2, SSE4.1) or
+// one by one, against the insideBitmap() loop of the other filters.
+//
+void test_bloomfilter_simd_probe()
+{
+    std::cout << "----------------------------------" << std::endl;
+    std::cout << "SplitBlockBloomFilter SIMD Test" << std::endl;
+    std::cout << "----------------------------------" << std::endl;
+    std::cout << std::endl;
+
+    static const int kNumKeys = 1000000;
+    char buffer[sizeof(int)];
+
+    printf("best simd level: %s\n\n",
+           SplitBlockBloomFilter::getSimdLevelName(SplitBlockBloomFilter::getBestSimdLevel()));
+
+    static const SplitBlockBloomFilter::SimdLevel levels[] = {
+        SplitBlockBloomFilter::kScalar, SplitBlockBloomFilter::kSSE41, SplitBlockBloomFilter::kAVX2
+    };
+
+    // All the implementations must make the same bitmap.
+    SplitBlockBloomFilter scalar(kNumKeys, 10, false);
+    scalar.setSimdLevel(SplitBlockBloomFilter::kScalar);
+    for (int i = 0; i < kNumKeys; i++) {
+        scalar.addKey(MemIntegerKey(i, buffer));
+    }
+    for (std::size_t n = 1; n < sizeof(levels) / sizeof(levels[0]); n++) {
+        if (levels[n] > SplitBlockBloomFilter::getBestSimdLevel())
+            continue;
+        SplitBlockBloomFilter simd(kNumKeys, 10, false);
+        simd.setSimdLevel(levels[n]);
+        for (int i = 0; i < kNumKeys; i++) {
+            simd.addKey(MemIntegerKey(i, buffer));
+        }
+        bool same = (::memcmp(scalar.getBitmap(), simd.getBitmap(), scalar.getFilterSize()) == 0);
+        printf("Scalar and %s bitmaps: %s\n",
+               SplitBlockBloomFilter::getSimdLevelName(levels[n]), same ? "same" : "different");
+    }
+    printf("\n");
+
+    StandardBloomFilter standard(kNumKeys, 10, false);
+    test_bloomfilter_simd_probe_impl("StandardBloomFilter", standard, kNumKeys);
+    FullBloomFilter full(kNumKeys, 10, false);
+    test_bloomfilter_simd_probe_impl("FullBloomFilter", full, kNumKeys);
+    BlockedBloomFilter blocked(kNumKeys, 10, false);
+    test_bloomfilter_simd_probe_impl("BlockedBloomFilter", blocked, kNumKeys);
+
+    for (std::size_t i = 0; i < sizeof(levels) / sizeof(levels[0]); i++) {
+        if (levels[i] > SplitBlockBloomFilter::getBestSimdLevel())
+            continue;
+        SplitBlockBloomFilter split_block(kNumKeys, 10, false);
+        split_block.setSimdLevel(levels[i]);
+        std::string name = std::string("SplitBlockBloomFilter (") +
+                           SplitBlockBloomFilter::getSimdLevelName(levels[i]) + ")";
+        test_bloomfilter_simd_probe_impl(name.c_str(), split_block, kNumKeys);
+    }
+    printf("\n");
+}
+
+//
+// maybeMatch() one key at a time against maybeMatchBatch(), which hashes a
+// batch of keys and prefetches their lines before testing them.
+//
+template <typename BloomFilterT>
+void test_bloomfilter_batch_lookup_impl(const char * name, std::size_t filter_bytes)
+{
+    static const int kLookups = 4000000;
+    static const std::size_t kBatchKeys = 64;
+    char buffer[sizeof(int)];
+
+    int num_keys = (int)(filter_bytes * 8 / 10);
+    BloomFilterT bloomfilter(num_keys, 10, false);
+    for (int i = 0; i < num_keys; i++) {
+        bloomfilter.addKey(MemIntegerKey(i, buffer));
+    }
+
+    // Half of the keys exist, in a random order.
+    std::vector<int> key_values(kLookups);
+    std::vector<Slice> keys(kLookups);
+    std::uint32_t rnd = 2463534242U;
+    for (int i = 0; i < kLookups; ++i) {
+        rnd ^= rnd << 13; rnd ^= rnd >> 17; rnd ^= rnd << 5;
+        key_values[i] = (i & 1) ? (int)(rnd % (std::uint32_t)num_keys) : (int)(rnd & 0x3FFFFFFF) + 1073741824;
+    }
+    for (int i = 0; i < kLookups; ++i) {
+        keys[i] = Slice(reinterpret_cast<const char *>(&key_values[i]), sizeof(int));
+    }
+
+    int found = 0;
+    StopWatch sw;
+    sw.start();
+    for (int i = 0; i < kLookups; ++i) {
+        if (bloomfilter.maybeMatch(keys[i]))
+            found++;
+    }
+    sw.stop();
+    double single_ns = sw.getElapsedMillisec() * 1000000.0 / kLookups;
+
+    bool results[kBatchKeys];
+    int batch_found = 0;
+    sw.start();
+    for (int i = 0; i < kLookups; i += (int)kBatchKeys) {
+        std::size_t n = ((std::size_t)(kLookups - i) < kBatchKeys) ? (std::size_t)(kLookups - i) : kBatchKeys;
+        bloomfilter.maybeMatchBatch(&keys[i], n, results);
+        for (std::size_t j = 0; j < n; j++) {
+            batch_found += results[j];
+        }
+    }
+    sw.stop();
+    double batch_ns = sw.getElapsedMillisec() * 1000000.0 / kLookups;
+
+    printf("%-22s filter = %5zu MB, single: %7.2f ns/key, batch: %7.2f ns/key, speedup = %5.2fx%s\n",
+           name, bloomfilter.getFilterSize() / (1024 * 1024), single_ns, batch_ns,
+           single_ns / batch_ns, (found == batch_found) ? "" : " [Not Same]");
+}
+
+void test_bloomfilter_batch_lookup()
+{
+    std::cout << "----------------------------------" << std::endl;
+    std::cout << "BloomFilter Batch Lookup Test" << std::endl;
+    std::cout << "----------------------------------" << std::endl;
+    std::cout << std::endl;
+
+#if TISTORE_FULL_BENCHMARK
+    static const std::size_t kFilterBytes[] = { 1 << 20, 64 << 20, 1024 << 20 };
+#else
+    static const std::size_t kFilterBytes[] = { 1 << 20, 64 << 20, 256 << 20 };
+#endif
+    for (std::size_t i = 0; i < sizeof(kFilterBytes) / sizeof(kFilterBytes[0]); i++) {
+        // A FullBloomFilter has less than 2^32 bits, 256 MB at most here.
+        if (kFilterBytes[i] <= (256 << 20))
+            test_bloomfilter_batch_lookup_impl<FullBloomFilter>("FullBloomFilter", kFilterBytes[i]);
+        test_bloomfilter_batch_lookup_impl<BlockedBloomFilter>("BlockedBloomFilter", kFilterBytes[i]);
+        test_bloomfilter_batch_lookup_impl<SplitBlockBloomFilter>("SplitBlockBloomFilter", kFilterBytes[i]);
+    }
+    printf("\n");
+}
+
+//
+// Encodes a filter, decodes it (a copy) and attaches to it (a view), both
+// must match the same keys as the filter, and a corrupted encoding must
+// be refused.
+//
+template <typename BloomFilterT>
+void test_bloomfilter_serialization_impl(const char * name, BloomFilterT & bloomfilter,
+                                         BloomFilterT & copy, BloomFilterT & view, int num_keys)
+{
+    char buffer[sizeof(int)];
+    for (int i = 0; i < num_keys; i++) {
+        bloomfilter.addKey(MemIntegerKey(i, buffer));
+    }
+    buildFilter(bloomfilter);
+    std::string encoding;
+    bloomfilter.encodeTo(&encoding);
+
+    int copy_status = copy.decodeFrom(Slice(encoding));
+    int view_status = view.attach(Slice(encoding));
+
+    int mismatches = 0;
+    for (int i = 0; i < num_keys * 2; i++) {
+        bool isMatch = bloomfilter.maybeMatch(MemIntegerKey(i, buffer));
+        if (copy.maybeMatch(MemIntegerKey(i, buffer)) != isMatch)
+            mismatches++;
+        if (view.maybeMatch(MemIntegerKey(i, buffer)) != isMatch)
+            mismatches++;
+    }
+
+    std::string corrupted = encoding;
+    corrupted[corrupted.size() / 2] ^= 0x10;
+    int corrupted_status = copy.decodeFrom(Slice(corrupted));
+
+    printf("%-26s encoding = %8zu bytes, decodeFrom() = %d, attach() = %d, read only = %-5s, "
+           "mismatches = %d, corrupted decodeFrom() = %d\n",
+           name, encoding.size(), copy_status, view_status,
+           bool_to_string(view.isReadOnly()).c_str(), mismatches, corrupted_status);
+}
+
+//
+// Loads kNumFilters filters from one buffer (as from a mmapped file), by
+// copies and by views.
+//
+void test_bloomfilter_attach_speed()
+{
+    static const int kNumFilters = 2000;
+    static const int kKeysPerFilter = 20000;
+    char buffer[sizeof(int)];
+
+    std::string file;
+    std::vector<std::size_t> offsets;
+    for (int n = 0; n < kNumFilters; n++) {
+        FullBloomFilter bloomfilter(kKeysPerFilter, 10, false);
+        for (int i = 0; i < 100; i++) {
+            bloomfilter.addKey(MemIntegerKey(n * kKeysPerFilter + i, buffer));
+        }
+        // Keep the bitmaps 8 bytes aligned.
+        file.resize((file.size() + 7) / 8 * 8);
+        offsets.push_back(file.size());
+        bloomfilter.encodeTo(&file);
+    }
+    offsets.push_back(file.size());
+
+    StopWatch sw;
+    std::vector<FullBloomFilter> filters(kNumFilters);
+    int failed = 0;
+    sw.start();
+    for (int n = 0; n < kNumFilters; n++) {
+        Slice input(file.data() + offsets[n], offsets[n + 1] - offsets[n]);
+        if (filters[n].decodeFrom(input) != error_code::no_error)
+            failed++;
+    }
+    sw.stop();
+    printf("%d filters, %zu MB: decodeFrom()        time spent: %9.3f ms, failed = %d\n",
+           kNumFilters, file.size() / (1024 * 1024), sw.getElapsedMillisec(), failed);
+
+    std::vector<FullBloomFilter> views(kNumFilters);
+    failed = 0;
+    sw.start();
+    for (int n = 0; n < kNumFilters; n++) {
+        Slice input(file.data() + offsets[n], offsets[n + 1] - offsets[n]);
+        if (views[n].attach(input) != error_code::no_error)
+            failed++;
+    }
+    sw.stop();
+    printf("%d filters, %zu MB: attach()            time spent: %9.3f ms, failed = %d\n",
+           kNumFilters, file.size() / (1024 * 1024), sw.getElapsedMillisec(), failed);
+
+    failed = 0;
+    sw.start();
+    for (int n = 0; n < kNumFilters; n++) {
+        Slice input(file.data() + offsets[n], offsets[n + 1] - offsets[n]);
+        if (views[n].attach(input, false) != error_code::no_error)
+            failed++;
+    }
+    sw.stop();
+    printf("%d filters, %zu MB: attach(no checksum) time spent: %9.3f ms, failed = %d\n\n",
+           kNumFilters, file.size() / (1024 * 1024), sw.getElapsedMillisec(), failed);
+}
+
+void test_bloomfilter_serialization()
+{
+    std::cout << "----------------------------------" << std::endl;
+    std::cout << "BloomFilter Serialization Test" << std::endl;
+    std::cout << "----------------------------------" << std::endl;
+    std::cout << std::endl;
+
+    {
+        StandardBloomFilter bloomfilter(10000, 10, false), copy, view;
+        test_bloomfilter_serialization_impl("StandardBloomFilter", bloomfilter, copy, view, 10000);
+    }
+    {
+        FullBloomFilter bloomfilter(10000, 10, false), copy, view;
+        test_bloomfilter_serialization_impl("FullBloomFilter", bloomfilter, copy, view, 10000);
+    }
+    {
+        BlockedBloomFilter bloomfilter(10000, 10, false), copy, view;
+        test_bloomfilter_serialization_impl("BlockedBloomFilter", bloomfilter, copy, view, 10000);
+    }
+    {
+        SplitBlockBloomFilter bloomfilter(10000, 10, false), copy, view;
+        test_bloomfilter_serialization_impl("SplitBlockBloomFilter", bloomfilter, copy, view, 10000);
+    }
+    {
+        BinaryFuseFilter bloomfilter(10000, 10, false), copy, view;
+        test_bloomfilter_serialization_impl("BinaryFuseFilter", bloomfilter, copy, view, 10000);
+    }
+    {
+        typedef StandardBloomFilterFixed<65536, 10, 6> filter_type;
+        filter_type bloomfilter(false), copy(false), view(false);
+        test_bloomfilter_serialization_impl("StandardBloomFilterFixed", bloomfilter, copy, view, 10000);
+    }
+    {
+        typedef FullBloomFilterFixed<65536, 10, 6> filter_type;
+        filter_type bloomfilter(false), copy(false), view(false);
+        test_bloomfilter_serialization_impl("FullBloomFilterFixed", bloomfilter, copy, view, 10000);
+    }
+    printf("\n");
+
+    test_bloomfilter_attach_speed();
+}
+
+//
+// The memory and the false positive rate of a ScalableBloomFilter as the
+// keys grow, it's made for 64K keys (the default), and a FullBloomFilter
+// made for the final number of keys up front.
+//
+void test_bloomfilter_scalable()
+{
+    std::cout << "----------------------------------" << std::endl;
+    std::cout << "ScalableBloomFilter Test" << std::endl;
+    std::cout << "----------------------------------" << std::endl;
+    std::cout << std::endl;
+
+#if TISTORE_FULL_BENCHMARK
+    static const int kMaxKeys = 100000000;
+#else
+    static const int kMaxKeys = 10000000;
+#endif
+    static const int kLookups = 1000000;
+    char buffer[sizeof(int)];
+
+    ScalableBloomFilter bloomfilter(ScalableBloomFilter::kDefaultInitialKeys, 0.01,
+                                    ScalableBloomFilter::kDefaultGrowth, 0.8, false);
+    FullBloomFilter full(kMaxKeys, 10, false);
+    printf("FullBloomFilter for %d keys: bytes = %zu\n\n", kMaxKeys, full.getFilterSize());
+
+    int num_keys = 0;
+    for (int checkpoint = 1000; checkpoint <= kMaxKeys; checkpoint *= 10) {
+        for (; num_keys < checkpoint; num_keys++) {
+            bloomfilter.addKey(MemIntegerKey(num_keys, buffer));
+        }
+
+        int not_found = 0;
+        for (int i = 0; i < num_keys; i += (num_keys / 1000)) {
+            if (!bloomfilter.maybeMatch(MemIntegerKey(i, buffer)))
+                not_found++;
+        }
+
+        std::uint32_t rnd = 2463534242U;
+        int false_positives = 0;
+        StopWatch sw;
+        sw.start();
+        for (int i = 0; i < kLookups; ++i) {
+            rnd ^= rnd << 13; rnd ^= rnd >> 17; rnd ^= rnd << 5;
+            if (bloomfilter.maybeMatch(MemIntegerKey((int)(rnd & 0x3FFFFFFF) + 1073741824, buffer)))
+                false_positives++;
+        }
+        sw.stop();
+
+        printf("keys = %9d, filters = %2zu, bytes = %10zu, bits/key = %5.2f, FPR = %6.3f %% "
+               "(bound = %6.3f %%), missing: %7.2f ns/lookup, not found = %d\n",
+               num_keys, bloomfilter.getNumFilters(), bloomfilter.getFilterSize(),
+               (double)bloomfilter.getFilterSize() * 8.0 / num_keys,
+               (double)false_positives * 100.0 / kLookups, bloomfilter.getExpectedFPR() * 100.0,
+               sw.getElapsedMillisec() * 1000000.0 / kLookups, not_found);
+    }
+    printf("\n");
+
+    // The first filter needs more than 2^32 bits: no key is added, but
+    // every key may match, no false negatives.
+    ScalableBloomFilter too_big(400000000, 0.01, 2, 0.8, false);
+    bool added = too_big.addKey(MemIntegerKey(1, buffer));
+    bool matched = too_big.maybeMatch(MemIntegerKey(1, buffer)) && too_big.maybeMatch(MemIntegerKey(2, buffer));
+    printf("ScalableBloomFilter for 400M keys: filters = %zu, added = %d, matched = %d (expected 0, 0, 1)\n\n",
+           too_big.getNumFilters(), (int)added, (int)matched);
+}
+
+//
+// A filter built by a FilterPolicy: the memory of the builder, which keeps
+// the hashes of the keys, versus copies of the keys, and the lookups of
+// its reader, which must be as fast as the ones of the filter itself.
+//
+template <typename FilterPolicyT>
+void test_bloomfilter_policy_impl(const char * name, int num_keys)
+{
+    static const int kLookups = 2000000;
+    char buffer[32];
+
+    typename FilterPolicyT::Builder builder(10);
+    std::size_t key_bytes = 0;
+    for (int i = 0; i < num_keys; i++) {
+        int length = snprintf(buffer, sizeof(buffer), "user_key_%016d", i * 2);
+        builder.addKey(Slice(buffer, length));
+        key_bytes += length + sizeof(std::size_t);
+    }
+    std::size_t builder_bytes = builder.memoryUsage();
+
+    std::string encoding;
+    int status = builder.finish(&encoding);
+    typename FilterPolicyT::Reader reader;
+    if (status == error_code::no_error)
+        status = reader.attach(Slice(encoding));
+    if (status != error_code::no_error) {
+        printf("%-22s finish() or attach() failed, status = %d\n", name, status);
+        return;
+    }
+
+    std::uint32_t rnd = 2463534242U;
+    int false_positives = 0;
+    StopWatch sw;
+    sw.start();
+    for (int i = 0; i < kLookups; ++i) {
+        rnd ^= rnd << 13; rnd ^= rnd >> 17; rnd ^= rnd << 5;
+        int length = snprintf(buffer, sizeof(buffer), "user_key_%016d",
+                              (int)(rnd % (std::uint32_t)num_keys) * 2 + 1);
+        if (reader.keyMayMatch(Slice(buffer, length)))
+            false_positives++;
+    }
+    sw.stop();
+    double missing_ns = sw.getElapsedMillisec() * 1000000.0 / kLookups;
+
+    int found = 0;
+    for (int i = 0; i < num_keys; i++) {
+        int length = snprintf(buffer, sizeof(buffer), "user_key_%016d", i * 2);
+        if (reader.keyMayMatch(Slice(buffer, length)))
+            found++;
+    }
+
+    printf("%-22s keys = %8d, builder = %9zu bytes (keys: %9zu bytes), encoding = %9zu bytes, "
+           "FPR = %6.3f %%, missing: %7.2f ns/lookup%s\n",
+           name, num_keys, builder_bytes, key_bytes, encoding.size(),
+           (double)false_positives * 100.0 / kLookups, missing_ns,
+           (found == num_keys) ? "" : " [Not Match]");
+}
+
+void test_bloomfilter_policy()
+{
+    std::cout << "----------------------------------" << std::endl;
+    std::cout << "FilterPolicy Test" << std::endl;
+    std::cout << "----------------------------------" << std::endl;
+    std::cout << std::endl;
+
+    static const int kNumKeys = 1000000;
+    test_bloomfilter_policy_impl<StandardFilterPolicy>("StandardFilterPolicy", kNumKeys);
+    test_bloomfilter_policy_impl<FullFilterPolicy>("FullFilterPolicy", kNumKeys);
+    test_bloomfilter_policy_impl<BlockedFilterPolicy>("BlockedFilterPolicy", kNumKeys);
+    test_bloomfilter_policy_impl<FilterPolicy<FullBloomFilterFixed<1441792, 10, 6>>>(
+        "FullFixedFilterPolicy", kNumKeys / 10);
+    printf("\n");
+}
+
+//
+// The build time of a big filter from the hashes kept by a Builder, by 1
+// thread and by many ones, the encodings must be the same.
+//
+template <typename FilterPolicyT>
+void test_bloomfilter_parallel_build_impl(const char * name, const std::vector<std::uint64_t> & hashes,
+                                          const std::vector<std::size_t> & thread_counts)
+{
+    std::string base_encoding;
+    double base_time = 0.0;
+    for (std::size_t n = 0; n < thread_counts.size(); n++) {
+        typename FilterPolicyT::Builder builder(10);
+        for (std::size_t i = 0; i < hashes.size(); i++) {
+            builder.addHash((std::uint32_t)(hashes[i] >> 32), (std::uint32_t)hashes[i]);
+        }
+
+        std::string encoding;
+        StopWatch sw;
+        sw.start();
+        int status = builder.finishParallel(&encoding, thread_counts[n]);
+        sw.stop();
+        if (status != error_code::no_error) {
+            printf("%-20s threads = %2zu, finishParallel() failed, status = %d\n",
+                   name, thread_counts[n], status);
+            return;
+        }
+
+        double elapsed_time = sw.getElapsedMillisec();
+        if (n == 0) {
+            base_encoding.swap(encoding);
+            base_time = elapsed_time;
+        }
+        printf("%-20s threads = %2zu, keys = %9zu, build: %10.3f ms, %7.2f ns/key, speedup = %5.2fx%s\n",
+               name, thread_counts[n], hashes.size(), elapsed_time,
+               elapsed_time * 1000000.0 / hashes.size(), base_time / elapsed_time,
+               (n == 0 || encoding == base_encoding) ? "" : " [Not Match]");
+    }
+}
+
+void test_bloomfilter_parallel_build()
+{
+    std::cout << "----------------------------------" << std::endl;
+    std::cout << "Parallel Filter Build Test" << std::endl;
+    std::cout << "----------------------------------" << std::endl;
+    std::cout << std::endl;
+
+#if TISTORE_FULL_BENCHMARK
+    static const int kNumKeys = 100000000;
+#else
+    static const int kNumKeys = 10000000;
+#endif
+    char buffer[sizeof(int)];
+
+    // The keys are hashed once, as a TableBuilder does while adding them.
+    HashUtils<> hashUtils;
+    std::vector<std::uint64_t> hashes;
+    hashes.reserve(kNumKeys);
+    StopWatch sw;
+    sw.start();
+    for (int i = 0; i < kNumKeys; i++) {
+        Slice key = MemIntegerKey(i, buffer);
+        std::uint32_t primary_hash = hashUtils.primaryHash(key.data(), key.size(), kDefaultHashSeed);
+        std::uint32_t secondary_hash = hashUtils.secondaryHash(key.data(), key.size());
+        hashes.push_back(((std::uint64_t)primary_hash << 32) | secondary_hash);
+    }
+    sw.stop();
+    printf("hash: keys = %d, %0.3f ms, %0.2f ns/key\n\n", kNumKeys,
+           sw.getElapsedMillisec(), sw.getElapsedMillisec() * 1000000.0 / kNumKeys);
+
+    std::size_t max_threads = std::thread::hardware_concurrency();
+    std::vector<std::size_t> thread_counts;
+    thread_counts.push_back(1);
+    thread_counts.push_back(16);
+    if (max_threads > 1 && max_threads != 16)
+        thread_counts.push_back(max_threads);
+
+    test_bloomfilter_parallel_build_impl<StandardFilterPolicy>("StandardFilterPolicy", hashes, thread_counts);
+    test_bloomfilter_parallel_build_impl<FullFilterPolicy>("FullFilterPolicy", hashes, thread_counts);
+    test_bloomfilter_parallel_build_impl<BlockedFilterPolicy>("BlockedFilterPolicy", hashes, thread_counts);
+    printf("\n");
+}
+
 void test_bloomfilter()
 {
     test_bloomfilter_impl();
@@ -275,6 +957,13 @@ void test_bloomfilter()
     sw.stop();
 
     printf("time spent: %0.3f ms.\n\n", sw.getElapsedMillisec());
+
+    test_bloomfilter_simd_probe();
+    test_bloomfilter_batch_lookup();
+    test_bloomfilter_serialization();
+    test_bloomfilter_scalable();
+    test_bloomfilter_policy();
+    test_bloomfilter_parallel_build();
 }
 
 int main(int argc, char * argv[])
@@ -291,8 +980,24 @@ int main(int argc, char * argv[])
 
     TiStore::fs::File file1("C:\\test.bin");
     file1.close();
+    TiStore::fs::File::remove("C:\\test.bin");
 
     test_skiplist();
+    test_skiplist_concurrent_read();
+    test_skiplist_scan();
+    test_skiplist_point_lookup();
+    test_skiplist_sorted_ingest();
+    test_skiplist_random_level();
+    test_memtable_rep();
+    test_memtable_cuckoo_filter();
+    test_wal_group_commit();
+    test_table_point_read();
+    test_table_prefix_seek();
+    test_table_partitioned_filter();
+    test_block_cache_sharding();
+    test_crc32c();
+    test_hash_quality();
+    test_hash_batch();
     test_property();
     test_traist();
     test_stl_iterator();
@@ -29,7 +29,12 @@ private:
 	double total_elapsed_time_;
     bool running_;
 
-    static std::chrono::time_point<high_resolution_clock> base_time_;
+    // Use a function-local static, so this header can be included
+    // by more than one translation unit.
+    static std::chrono::time_point<high_resolution_clock> & base_time() {
+        static std::chrono::time_point<high_resolution_clock> base_time_ = std::chrono::high_resolution_clock::now();
+        return base_time_;
+    }
 
 public:
     StopWatch() : interval_time_{0}, total_elapsed_time_(0.0), running_(false) {
@@ -87,7 +92,7 @@ public:
     static double now() {
         COMPILER_BARRIER();
         std::chrono::duration<double> _now = std::chrono::duration_cast< std::chrono::duration<double> >
-                                            (std::chrono::high_resolution_clock::now() - base_time_);
+                                            (std::chrono::high_resolution_clock::now() - base_time());
         COMPILER_BARRIER();
         return _now.count();
     }
@@ -137,8 +142,6 @@ public:
     }
 };
 
-std::chrono::time_point<high_resolution_clock> StopWatch::base_time_ = std::chrono::high_resolution_clock::now();
-
 #if defined(_WIN32) || defined(WIN32) || defined(OS_WINDOWS) || defined(__WINDOWS__)
 class StopWatch_v2 {
 private:
@@ -1,7 +1,28 @@
 #pragma once
 
+// The benchmarks with the sizes of the requirements (e.g. 1 GB tables) take
+// minutes and a lot of disk and memory, by default they run scaled down.
+#ifndef TISTORE_FULL_BENCHMARK
+#define TISTORE_FULL_BENCHMARK  0
+#endif
+
 void test_typeinfo_module();
 void test_property();
 void test_traist();
 void test_skiplist();
 void test_stl_iterator();
+void test_skiplist_concurrent_read();
+void test_skiplist_scan();
+void test_skiplist_point_lookup();
+void test_skiplist_sorted_ingest();
+void test_skiplist_random_level();
+void test_memtable_rep();
+void test_memtable_cuckoo_filter();
+void test_wal_group_commit();
+void test_table_point_read();
+void test_table_prefix_seek();
+void test_table_partitioned_filter();
+void test_block_cache_sharding();
+void test_crc32c();
+void test_hash_quality();
+void test_hash_batch();
@@ -0,0 +1,87 @@
+
+#include "test.h"
+
+#include "TiStore/kv/Cache.h"
+
+#include "stop_watch.h"
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace TiStore;
+
+static const std::size_t kCacheThreads = 16;
+static const std::size_t kCacheBlockSize = 4096;
+static const std::size_t kCacheCapacity = 64 * 1024 * 1024;
+#if TISTORE_FULL_BENCHMARK
+static const std::size_t kCacheOpsPerThread = 1000000;
+#else
+static const std::size_t kCacheOpsPerThread = 100000;
+#endif
+
+// 80% of the lookups go to the hot 20% of the blocks, all the blocks are
+// twice the capacity of the cache. A miss inserts the block.
+static void block_cache_sharding_impl(int num_shard_bits, CachePolicy policy)
+{
+    BlockCache cache(kCacheCapacity, num_shard_bits, policy);
+    const std::size_t num_blocks = kCacheCapacity / kCacheBlockSize * 2;
+    const std::size_t num_hot_blocks = num_blocks / 5;
+    BlockCache::value_type block(new std::string(kCacheBlockSize, 'b'));
+    std::vector<std::uint64_t> file_ids;
+    for (std::size_t i = 0; i < 4; i++) {
+        file_ids.push_back(cache.newId());
+    }
+
+    std::vector<std::thread> threads;
+    stop_watch sw;
+    sw.start();
+    for (std::size_t t = 0; t < kCacheThreads; t++) {
+        threads.push_back(std::thread([&, t]() {
+            std::uint64_t rnd = 0x9E3779B97F4A7C15ULL * (t + 1);
+            for (std::size_t i = 0; i < kCacheOpsPerThread; i++) {
+                rnd = rnd * 6364136223846793005ULL + 1442695040888963407ULL;
+                std::size_t r = (std::size_t)(rnd >> 33);
+                std::size_t n = ((r % 10) < 8) ? (r / 10 % num_hot_blocks) : (r / 10 % num_blocks);
+                BlockCacheKey key(file_ids[n & 3], (std::uint64_t)(n >> 2) * kCacheBlockSize);
+                if (!cache.lookup(key))
+                    cache.insert(key, block);
+            }
+        }));
+    }
+    for (std::size_t t = 0; t < threads.size(); t++) {
+        threads[t].join();
+    }
+    sw.stop();
+
+    double elapsed = sw.getElapsedMillisec();
+    std::size_t ops = kCacheThreads * kCacheOpsPerThread;
+    CacheStats stats = cache.getStats();
+    printf("%-5s shards = %3zu, time spent: %9.3f ms, %11.1f ops/sec, hit rate = %5.2f %%, "
+           "evictions = %llu, charge = %zu KB\n",
+           (policy == kCacheLRU) ? "LRU" : "CLOCK", cache.numShards(), elapsed,
+           (double)ops / (elapsed / 1000.0),
+           (double)stats.hits * 100.0 / (double)(stats.hits + stats.misses),
+           (unsigned long long)stats.evictions, stats.charge / 1024);
+}
+
+void test_block_cache_sharding()
+{
+    printf("test_block_cache_sharding()\n\n");
+    printf("threads = %zu, capacity = %zu MB, block size = %zu bytes, lookups = %zu per thread\n\n",
+           kCacheThreads, kCacheCapacity / (1024 * 1024), kCacheBlockSize, kCacheOpsPerThread);
+
+    static const int shard_bits[] = { 0, 1, 2, 4, 6 };
+    for (std::size_t i = 0; i < sizeof(shard_bits) / sizeof(shard_bits[0]); i++) {
+        block_cache_sharding_impl(shard_bits[i], kCacheLRU);
+    }
+    printf("\n");
+    for (std::size_t i = 0; i < sizeof(shard_bits) / sizeof(shard_bits[0]); i++) {
+        block_cache_sharding_impl(shard_bits[i], kCacheCLOCK);
+    }
+    printf("\n");
+}
@@ -0,0 +1,109 @@
+
+#include "test.h"
+
+#include "TiStore/kv/CpuFeatures.h"
+#include "TiStore/kv/Crc32c.h"
+
+#include "stop_watch.h"
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+using namespace TiStore;
+
+static const std::size_t kCrcTotalBytes = 256 * 1024 * 1024;
+
+// The crc32c of a bit at a time, the reference of the other ones.
+static std::uint32_t crc32c_bitwise(std::uint32_t init_crc, const char * data, std::size_t n)
+{
+    std::uint32_t crc = init_crc ^ 0xFFFFFFFFUL;
+    for (std::size_t i = 0; i < n; i++) {
+        crc ^= (unsigned char)data[i];
+        for (int j = 0; j < 8; j++) {
+            crc = (crc >> 1) ^ ((crc & 1) ? 0x82F63B78UL : 0);
+        }
+    }
+    return (crc ^ 0xFFFFFFFFUL);
+}
+
+// The crc of every length around the block sizes of the 3 streams, at every
+// offset of a word, by both implementations, and of a stream by pieces.
+static std::size_t crc32c_verify(const std::string & data)
+{
+    static const std::size_t kLengths[] = {
+        0, 1, 3, 7, 8, 9, 63, 255, 767, 768, 769, 1000, 4096,
+        24575, 24576, 24577, 30000, 65536 + 13
+    };
+    std::size_t errors = 0;
+    for (std::size_t i = 0; i < sizeof(kLengths) / sizeof(kLengths[0]); i++) {
+        for (std::size_t offset = 0; offset < 8; offset++) {
+            const char * p = data.data() + offset;
+            std::uint32_t expected = crc32c_bitwise(0x12345678U, p, kLengths[i]);
+            if (crc32c_extend(0x12345678U, p, kLengths[i]) != expected)
+                errors++;
+            if (crc32c_extend_portable(0x12345678U, p, kLengths[i]) != expected)
+                errors++;
+        }
+    }
+
+    std::uint32_t crc = 0;
+    for (std::size_t start = 0; start < data.size(); start += 10007) {
+        std::size_t n = (data.size() - start < 10007) ? (data.size() - start) : 10007;
+        crc = crc32c_extend(crc, data.data() + start, n);
+    }
+    if (crc != crc32c_value(data.data(), data.size()))
+        errors++;
+
+    // The check value of CRC-32C, and the one of 32 zero bytes (RFC 3720).
+    if (crc32c_value("123456789", 9) != 0xE3069283U)
+        errors++;
+    if (crc32c_value(std::string(32, '\0').data(), 32) != 0x8A9136AAU)
+        errors++;
+    if (crc32c_unmask(crc32c_mask(0xE3069283U)) != 0xE3069283U)
+        errors++;
+    return errors;
+}
+
+static double crc32c_speed(const std::string & data, std::size_t len, bool portable)
+{
+    std::size_t iterations = kCrcTotalBytes / len;
+    volatile std::uint32_t crc = 0;
+    StopWatch sw;
+    sw.start();
+    for (std::size_t i = 0; i < iterations; i++) {
+        if (portable)
+            crc += crc32c_extend_portable((std::uint32_t)i, data.data(), len);
+        else
+            crc += crc32c_extend((std::uint32_t)i, data.data(), len);
+    }
+    sw.stop();
+    return ((double)iterations * len / sw.getElapsedMillisec() / 1000000.0);
+}
+
+void test_crc32c()
+{
+    printf("----------------------------------\n");
+    printf("CRC32C Test\n");
+    printf("----------------------------------\n\n");
+
+    std::string data(1024 * 1024 + 8, '\0');
+    std::uint32_t rnd = 2463534242U;
+    for (std::size_t i = 0; i < data.size(); i++) {
+        rnd ^= rnd << 13; rnd ^= rnd >> 17; rnd ^= rnd << 5;
+        data[i] = (char)rnd;
+    }
+
+    printf("SSE4.2 = %s, errors = %zu\n\n",
+           CpuFeatures::hasSSE42() ? "true" : "false", crc32c_verify(data));
+
+    static const std::size_t kLengths[] = { 64, 256, 4096, 65536, 1024 * 1024 };
+    for (std::size_t i = 0; i < sizeof(kLengths) / sizeof(kLengths[0]); i++) {
+        printf("len = %7zu: crc32c_extend() %6.2f GB/s, tables %6.2f GB/s\n",
+               kLengths[i], crc32c_speed(data, kLengths[i], false),
+               crc32c_speed(data, kLengths[i], true));
+    }
+    printf("\n");
+}
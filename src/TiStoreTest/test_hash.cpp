@@ -0,0 +1,685 @@
+
+#include "test.h"
+
+#include "TiStore/kv/Cache.h"
+#include "TiStore/kv/Hash.h"
+#include "TiStore/kv/HashBatch.h"
+
+#include "stop_watch.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+using namespace TiStore;
+
+//
+// An SMHasher-style test of the hashes of Hash.h: the quality (avalanche,
+// bit independence, sparse keys, cyclic keys), the distribution of the
+// keys we really hash into the buckets they are used for, and the speed.
+// The report tells which hash can be used for the probes of the bloom
+// filters (all the bits, taken modulo the bits of the filter), and which
+// one for the sharding of the block cache (the low bits of the keys of
+// the blocks).
+//
+// See: https://github.com/aappleby/smhasher
+//
+
+#if TISTORE_FULL_BENCHMARK
+static const std::size_t kAvalancheKeys = 1000000;
+static const std::size_t kBicKeys = 100000;
+static const std::size_t kBucketKeys = 10000000;
+#else
+static const std::size_t kAvalancheKeys = 100000;
+static const std::size_t kBicKeys = 20000;
+static const std::size_t kBucketKeys = 1000000;
+#endif
+static const std::size_t kCyclicKeys = 200000;
+static const std::size_t kSpeedBytes = 64 * 1024 * 1024;
+
+// A bias or a correlation is an error beyond kMaxSigmas standard deviations
+// of the one of an ideal hash, with the number of keys of the test.
+static const double kMaxSigmas = 5.0;
+
+// Some of the hashes read a word at the end of the key.
+static const std::size_t kKeyPadding = 8;
+
+typedef std::uint64_t (*hash_func_t)(const char * key, std::size_t len);
+
+struct HashCandidate {
+    const char * name;
+    hash_func_t func;
+    int bits;
+};
+
+struct HashReport {
+    double avalanche;
+    double bic;
+    std::size_t sparse_collisions;
+    double sparse_expected;
+    std::size_t cyclic_collisions;
+    double cyclic_expected;
+    // The worst z-score of the chi-square of the buckets.
+    double shard_z;
+    double modulo_z;
+    double gbps[5];
+};
+
+static std::uint64_t hash_openssl(const char * key, std::size_t len)
+{
+    return hash::OpenSSL_Hash(key, len);
+}
+
+static std::uint64_t hash_bkdr(const char * key, std::size_t len)
+{
+    return hash::BKDRHash(key, len);
+}
+
+static std::uint64_t hash_times31(const char * key, std::size_t len)
+{
+    return hash::Times31(key, len);
+}
+
+static std::uint64_t hash_ap(const char * key, std::size_t len)
+{
+    return hash::APHash(key, len);
+}
+
+static std::uint64_t hash_djb(const char * key, std::size_t len)
+{
+    return hash::DJBHash(key, len);
+}
+
+static std::uint64_t hash_rocksdb(const char * key, std::size_t len)
+{
+    return rocksdb::hash::Hash(key, len, 0xBC9F1D34U);
+}
+
+static std::uint64_t hash_primary32(const char * key, std::size_t len)
+{
+    static const HashUtils<std::uint32_t> hashUtils;
+    return hashUtils.primaryHash(key, len, kDefaultHashSeed);
+}
+
+static std::uint64_t hash_primary64(const char * key, std::size_t len)
+{
+    static const HashUtils<std::uint64_t> hashUtils;
+    return hashUtils.primaryHash(key, len, kDefaultHashSeed);
+}
+
+// BKDRHash_31() is Times31(), and HashUtils<uint32_t>::secondaryHash() too.
+static const HashCandidate kHashCandidates[] = {
+    { "OpenSSL_Hash",                   hash_openssl,   32 },
+    { "BKDRHash",                       hash_bkdr,      32 },
+    { "Times31 (secondaryHash)",        hash_times31,   32 },
+    { "APHash",                         hash_ap,        32 },
+    { "DJBHash",                        hash_djb,       32 },
+    { "rocksdb::hash::Hash",            hash_rocksdb,   32 },
+    { "HashUtils<uint32_t>::primary",   hash_primary32, 32 },
+    { "HashUtils<uint64_t>::primary",   hash_primary64, 64 },
+};
+
+static const std::size_t kNumHashCandidates = sizeof(kHashCandidates) / sizeof(kHashCandidates[0]);
+
+static inline std::uint64_t next_random(std::uint64_t & state)
+{
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+static void fill_random(char * key, std::size_t len, std::uint64_t & state)
+{
+    for (std::size_t i = 0; i < len; i++) {
+        key[i] = (char)next_random(state);
+    }
+}
+
+//
+// Avalanche: flipping any bit of the key flips each bit of the hash with a
+// probability of 1/2. Returns the worst bias, |2 * p - 1|, of all the
+// pairs of an input bit and an output bit.
+//
+static double avalanche_test(const HashCandidate & candidate, std::size_t key_len, std::size_t num_keys)
+{
+    const std::size_t in_bits = key_len * 8;
+    const int out_bits = candidate.bits;
+    std::vector<std::uint32_t> counts(in_bits * 64, 0);
+    std::vector<char> key(key_len + kKeyPadding, 0);
+    std::uint64_t rnd = 0x2545F4914F6CDD1DULL + key_len;
+
+    for (std::size_t n = 0; n < num_keys; n++) {
+        fill_random(&key[0], key_len, rnd);
+        std::uint64_t base = candidate.func(&key[0], key_len);
+        for (std::size_t i = 0; i < in_bits; i++) {
+            key[i >> 3] ^= (char)(1 << (i & 7));
+            std::uint64_t diff = base ^ candidate.func(&key[0], key_len);
+            key[i >> 3] ^= (char)(1 << (i & 7));
+            std::uint32_t * count = &counts[i * 64];
+            for (int j = 0; j < out_bits; j++) {
+                count[j] += (std::uint32_t)((diff >> j) & 1);
+            }
+        }
+    }
+
+    double worst = 0.0;
+    for (std::size_t i = 0; i < in_bits; i++) {
+        for (int j = 0; j < out_bits; j++) {
+            double bias = fabs(2.0 * counts[i * 64 + j] / num_keys - 1.0);
+            worst = std::max(worst, bias);
+        }
+    }
+    return worst;
+}
+
+//
+// Bit independence: the flips of two bits of the hash, by the flip of a
+// bit of the key, are independent. Returns the worst correlation of the
+// flips of a pair of the low 32 bits of the hash, for any input bit.
+//
+static double bit_independence_test(const HashCandidate & candidate, std::size_t key_len, std::size_t num_keys)
+{
+    static const int kOutBits = 32;
+    const std::size_t in_bits = key_len * 8;
+    std::vector<std::uint32_t> single(in_bits * kOutBits, 0);
+    std::vector<std::uint32_t> pairs(in_bits * kOutBits * kOutBits, 0);
+    std::vector<char> key(key_len + kKeyPadding, 0);
+    std::uint64_t rnd = 0x9E3779B97F4A7C15ULL + key_len;
+
+    for (std::size_t n = 0; n < num_keys; n++) {
+        fill_random(&key[0], key_len, rnd);
+        std::uint32_t base = (std::uint32_t)candidate.func(&key[0], key_len);
+        for (std::size_t i = 0; i < in_bits; i++) {
+            key[i >> 3] ^= (char)(1 << (i & 7));
+            std::uint32_t diff = base ^ (std::uint32_t)candidate.func(&key[0], key_len);
+            key[i >> 3] ^= (char)(1 << (i & 7));
+            std::uint32_t * one = &single[i * kOutBits];
+            std::uint32_t * two = &pairs[i * kOutBits * kOutBits];
+            for (int j = 0; j < kOutBits; j++) {
+                if ((diff >> j) & 1) {
+                    one[j]++;
+                    for (int k = j + 1; k < kOutBits; k++) {
+                        two[j * kOutBits + k] += (diff >> k) & 1;
+                    }
+                }
+            }
+        }
+    }
+
+    double worst = 0.0;
+    for (std::size_t i = 0; i < in_bits; i++) {
+        for (int j = 0; j < kOutBits; j++) {
+            double pj = (double)single[i * kOutBits + j] / num_keys;
+            for (int k = j + 1; k < kOutBits; k++) {
+                double pk = (double)single[i * kOutBits + k] / num_keys;
+                double pjk = (double)pairs[(i * kOutBits + j) * kOutBits + k] / num_keys;
+                double variance = pj * (1.0 - pj) * pk * (1.0 - pk);
+                // A bit which never (or always) flips is as bad as it gets.
+                double correlation = (variance > 0.0) ? fabs(pjk - pj * pk) / sqrt(variance) : 1.0;
+                worst = std::max(worst, correlation);
+            }
+        }
+    }
+    return worst;
+}
+
+// The number of the pairs of the keys with the same hash.
+static std::size_t count_collisions(std::vector<std::uint64_t> & hashes)
+{
+    std::sort(hashes.begin(), hashes.end());
+    std::size_t collisions = 0;
+    for (std::size_t i = 1; i < hashes.size(); i++) {
+        if (hashes[i] == hashes[i - 1])
+            collisions++;
+    }
+    return collisions;
+}
+
+static double expected_collisions(std::size_t num_keys, int bits)
+{
+    double n = (double)num_keys;
+    return n * (n - 1.0) / 2.0 / pow(2.0, (double)bits);
+}
+
+static bool collisions_ok(std::size_t collisions, double expected)
+{
+    return ((double)collisions <= expected * 2.0 + 3.0);
+}
+
+static void add_sparse_keys(const HashCandidate & candidate, std::vector<char> & key, std::size_t key_len,
+                            std::size_t first_bit, int bits_left, std::vector<std::uint64_t> & hashes)
+{
+    hashes.push_back(candidate.func(&key[0], key_len));
+    if (bits_left == 0)
+        return;
+    for (std::size_t i = first_bit; i < key_len * 8; i++) {
+        key[i >> 3] ^= (char)(1 << (i & 7));
+        add_sparse_keys(candidate, key, key_len, i + 1, bits_left - 1, hashes);
+        key[i >> 3] ^= (char)(1 << (i & 7));
+    }
+}
+
+//
+// Sparse keys: the keys of 16 bytes with at most 3 bits set, and of 64
+// bytes with at most 2 bits set, mostly zero bytes, like the keys of
+// integers. Returns the collisions of all the bits of the hash.
+//
+static std::size_t sparse_key_test(const HashCandidate & candidate, double * expected)
+{
+    static const std::size_t kKeyLengths[] = { 16, 64 };
+    static const int kMaxBitsSet[] = { 3, 2 };
+    std::size_t collisions = 0;
+    *expected = 0.0;
+    for (std::size_t n = 0; n < 2; n++) {
+        std::vector<char> key(kKeyLengths[n] + kKeyPadding, 0);
+        std::vector<std::uint64_t> hashes;
+        add_sparse_keys(candidate, key, kKeyLengths[n], 0, kMaxBitsSet[n], hashes);
+        *expected += expected_collisions(hashes.size(), candidate.bits);
+        collisions += count_collisions(hashes);
+    }
+    return collisions;
+}
+
+//
+// Cyclic keys: a block of 4 or 8 bytes repeated up to 32 bytes, which the
+// hashes adding words with a weak mix cancel out. The blocks are distinct,
+// they are a bijection of the index of the key.
+//
+static std::size_t cyclic_key_test(const HashCandidate & candidate, double * expected)
+{
+    static const std::size_t kCycleLengths[] = { 4, 8 };
+    static const std::size_t kKeyLen = 32;
+    std::size_t collisions = 0;
+    *expected = 0.0;
+    for (std::size_t n = 0; n < 2; n++) {
+        std::vector<char> key(kKeyLen + kKeyPadding, 0);
+        std::vector<std::uint64_t> hashes;
+        hashes.reserve(kCyclicKeys);
+        for (std::size_t i = 0; i < kCyclicKeys; i++) {
+            if (kCycleLengths[n] == 4) {
+                std::uint32_t block = (std::uint32_t)(i + 1) * 0x9E3779B1U;
+                block ^= block >> 16;
+                ::memcpy(&key[0], &block, sizeof(block));
+            }
+            else {
+                std::uint64_t block = (std::uint64_t)(i + 1) * 0x9E3779B97F4A7C15ULL;
+                block ^= block >> 29;
+                ::memcpy(&key[0], &block, sizeof(block));
+            }
+            for (std::size_t j = kCycleLengths[n]; j < kKeyLen; j++) {
+                key[j] = key[j % kCycleLengths[n]];
+            }
+            hashes.push_back(candidate.func(&key[0], kKeyLen));
+        }
+        *expected += expected_collisions(hashes.size(), candidate.bits);
+        collisions += count_collisions(hashes);
+    }
+    return collisions;
+}
+
+// The z-score of the chi-square of the buckets, 0 is ideal, 5 is bad.
+static double chi_square_z(const std::vector<std::uint32_t> & buckets, std::size_t num_keys)
+{
+    double expected = (double)num_keys / buckets.size();
+    double chi_square = 0.0;
+    for (std::size_t i = 0; i < buckets.size(); i++) {
+        double diff = (double)buckets[i] - expected;
+        chi_square += diff * diff / expected;
+    }
+    double df = (double)(buckets.size() - 1);
+    return (chi_square - df) / sqrt(2.0 * df);
+}
+
+//
+// The keys we hash: the user keys of a table, "user_key_%016d" in order,
+// and the keys of the block cache, a file id and a block offset. The
+// shards are the low 4 and 10 bits (hash & mask), the probes the hash
+// modulo a prime. Returns the worst z-scores.
+//
+static void bucket_test(const HashCandidate & candidate, double * shard_z, double * modulo_z)
+{
+    static const std::uint32_t kModulo = 65521;
+    static const std::size_t kShardBits[] = { 4, 10 };
+    std::vector<std::uint32_t> shards4(1 << kShardBits[0]), shards10(1 << kShardBits[1]);
+    std::vector<std::uint32_t> probes(kModulo);
+    *shard_z = 0.0;
+    *modulo_z = 0.0;
+
+    for (int key_set = 0; key_set < 2; key_set++) {
+        std::fill(shards4.begin(), shards4.end(), 0);
+        std::fill(shards10.begin(), shards10.end(), 0);
+        std::fill(probes.begin(), probes.end(), 0);
+        char key[32 + kKeyPadding];
+        for (std::size_t i = 0; i < kBucketKeys; i++) {
+            std::size_t len;
+            if (key_set == 0) {
+                len = (std::size_t)snprintf(key, sizeof(key), "user_key_%016zu", i);
+            }
+            else {
+                std::uint64_t block_key[2] = { 1 + (i & 3), (i >> 2) * 4096 };
+                ::memcpy(key, block_key, sizeof(block_key));
+                len = sizeof(block_key);
+            }
+            std::uint64_t hash = candidate.func(key, len);
+            shards4[hash & (shards4.size() - 1)]++;
+            shards10[hash & (shards10.size() - 1)]++;
+            probes[(std::uint32_t)(hash % kModulo)]++;
+        }
+        *shard_z = std::max(*shard_z, chi_square_z(shards4, kBucketKeys));
+        *shard_z = std::max(*shard_z, chi_square_z(shards10, kBucketKeys));
+        *modulo_z = std::max(*modulo_z, chi_square_z(probes, kBucketKeys));
+    }
+}
+
+static double speed_test(const HashCandidate & candidate, std::size_t key_len)
+{
+    std::vector<char> key(key_len + kKeyPadding, 0);
+    for (std::size_t i = 0; i < key_len; i++) {
+        // No zero bytes, DJBHash() stops at the first one.
+        key[i] = (char)('a' + (i * 7) % 26);
+    }
+    std::size_t iterations = kSpeedBytes / key_len;
+    volatile std::uint64_t sum = 0;
+    StopWatch sw;
+    sw.start();
+    for (std::size_t i = 0; i < iterations; i++) {
+        key[0] = (char)('a' + (i & 15));
+        sum += candidate.func(&key[0], key_len);
+    }
+    sw.stop();
+    return ((double)iterations * key_len / sw.getElapsedMillisec() / 1000000.0);
+}
+
+static const char * pass_or_fail(bool pass)
+{
+    return (pass ? "pass" : "FAIL");
+}
+
+void test_hash_quality()
+{
+    printf("----------------------------------\n");
+    printf("Hash Quality Test\n");
+    printf("----------------------------------\n\n");
+
+    static const std::size_t kSpeedKeyLengths[] = { 8, 16, 64, 256, 4096 };
+    const double max_avalanche = kMaxSigmas / sqrt((double)kAvalancheKeys);
+    const double max_bic = kMaxSigmas / sqrt((double)kBicKeys);
+
+    std::vector<HashReport> reports(kNumHashCandidates);
+    for (std::size_t n = 0; n < kNumHashCandidates; n++) {
+        const HashCandidate & candidate = kHashCandidates[n];
+        HashReport & report = reports[n];
+        report.avalanche = std::max(avalanche_test(candidate, 4, kAvalancheKeys),
+                                    avalanche_test(candidate, 16, kAvalancheKeys));
+        report.bic = bit_independence_test(candidate, 8, kBicKeys);
+        report.sparse_collisions = sparse_key_test(candidate, &report.sparse_expected);
+        report.cyclic_collisions = cyclic_key_test(candidate, &report.cyclic_expected);
+        bucket_test(candidate, &report.shard_z, &report.modulo_z);
+        for (std::size_t i = 0; i < 5; i++) {
+            report.gbps[i] = speed_test(candidate, kSpeedKeyLengths[i]);
+        }
+    }
+
+    printf("avalanche: worst bias of 4 and 16 byte keys, pass < %0.2f %%\n"
+           "BIC:       worst correlation of the low 32 bits, 8 byte keys, pass < %0.2f %%\n"
+           "sparse:    collisions (expected) of 16/64 byte keys with <= 3/2 bits set\n"
+           "cyclic:    collisions (expected) of 32 byte keys of 4/8 byte cycles\n"
+           "shards:    worst chi-square z of the low 4 and 10 bits, table and block cache keys, pass < %0.0f\n"
+           "modulo:    worst chi-square z of the hash %% 65521, same keys, pass < %0.0f\n\n",
+           max_avalanche * 100.0, max_bic * 100.0, kMaxSigmas, kMaxSigmas);
+
+    printf("%-30s %4s %10s %10s %16s %16s %9s %9s\n",
+           "hash", "bits", "avalanche", "BIC", "sparse", "cyclic", "shards", "modulo");
+    for (std::size_t n = 0; n < kNumHashCandidates; n++) {
+        const HashReport & report = reports[n];
+        printf("%-30s %4d %9.2f%% %9.2f%% %7zu (%6.1f) %7zu (%6.1f) %9.1f %9.1f\n",
+               kHashCandidates[n].name, kHashCandidates[n].bits,
+               report.avalanche * 100.0, report.bic * 100.0,
+               report.sparse_collisions, report.sparse_expected,
+               report.cyclic_collisions, report.cyclic_expected,
+               report.shard_z, report.modulo_z);
+    }
+    printf("\n");
+
+    printf("%-30s", "GB/s, key length =");
+    for (std::size_t i = 0; i < 5; i++) {
+        printf(" %8zu", kSpeedKeyLengths[i]);
+    }
+    printf("\n");
+    for (std::size_t n = 0; n < kNumHashCandidates; n++) {
+        printf("%-30s", kHashCandidates[n].name);
+        for (std::size_t i = 0; i < 5; i++) {
+            printf(" %8.2f", reports[n].gbps[i]);
+        }
+        printf("\n");
+    }
+    printf("\n");
+
+    //
+    // The bloom probes need all of it: any weakness is a false positive
+    // rate above the bound. The sharding of the cache only needs the low
+    // bits of the keys of the blocks to be balanced, and no collisions of
+    // the keys which differ by a few bits (block offsets).
+    //
+    printf("%-30s %10s %10s %10s %10s %10s %10s   %-14s %-14s\n",
+           "hash", "avalanche", "BIC", "sparse", "cyclic", "shards", "modulo",
+           "bloom probes", "cache shards");
+    for (std::size_t n = 0; n < kNumHashCandidates; n++) {
+        const HashReport & report = reports[n];
+        bool avalanche = (report.avalanche < max_avalanche);
+        bool bic = (report.bic < max_bic);
+        bool sparse = collisions_ok(report.sparse_collisions, report.sparse_expected);
+        bool cyclic = collisions_ok(report.cyclic_collisions, report.cyclic_expected);
+        bool shards = (report.shard_z < kMaxSigmas);
+        bool modulo = (report.modulo_z < kMaxSigmas);
+        bool bloom = (avalanche && bic && sparse && cyclic && shards && modulo);
+        bool cache = (sparse && shards);
+        printf("%-30s %10s %10s %10s %10s %10s %10s   %-14s %-14s\n",
+               kHashCandidates[n].name, pass_or_fail(avalanche), pass_or_fail(bic),
+               pass_or_fail(sparse), pass_or_fail(cyclic), pass_or_fail(shards),
+               pass_or_fail(modulo), bloom ? "trust" : "don't use",
+               cache ? "trust" : "don't use");
+    }
+    printf("\n");
+}
+
+//
+// BatchHash must make the same hashes as HashUtils<>, key by key: the keys
+// of mixed lengths up to kMaxKeyLen and any offset, in batches of any size,
+// and the keys of each length. Returns the number of errors.
+//
+static std::size_t batch_hash_verify(BatchHash::SimdLevel level)
+{
+    static const std::size_t kNumKeys = 1000;
+    static const std::size_t kMaxKeyLen = 64;
+    static const std::size_t kBatchSizes[] = { 1, 7, 8, 9, 16, 63, 64, 65, kNumKeys };
+
+    std::uint64_t state = 88172645463325252ULL;
+    std::vector<char> data(kNumKeys * (kMaxKeyLen + 4) + kKeyPadding, 0);
+    fill_random(&data[0], data.size() - kKeyPadding, state);
+
+    HashUtils<> hashUtils;
+    std::vector<Slice> keys(kNumKeys);
+    std::vector<std::uint32_t> primary(kNumKeys), secondary(kNumKeys);
+    std::size_t errors = 0;
+
+    std::size_t offset = 0;
+    for (std::size_t i = 0; i < kNumKeys; i++) {
+        std::size_t len = (std::size_t)(next_random(state) % (kMaxKeyLen + 1));
+        keys[i] = Slice(&data[offset], len);
+        offset += len + (std::size_t)(next_random(state) % 4);
+    }
+    for (std::size_t b = 0; b < sizeof(kBatchSizes) / sizeof(kBatchSizes[0]); b++) {
+        std::size_t n = kBatchSizes[b];
+        BatchHash::hashPair(&keys[0], n, kDefaultHashSeed, &primary[0], &secondary[0], level);
+        for (std::size_t i = 0; i < n; i++) {
+            if (primary[i] != hashUtils.primaryHash(keys[i].data(), keys[i].size(), kDefaultHashSeed))
+                errors++;
+            if (secondary[i] != hashUtils.secondaryHash(keys[i].data(), keys[i].size()))
+                errors++;
+        }
+    }
+
+    for (std::size_t len = 0; len <= kMaxKeyLen; len++) {
+        for (std::size_t i = 0; i < kNumKeys; i++) {
+            keys[i] = Slice(&data[1 + i * len], len);
+        }
+        BatchHash::hashPair(&keys[0], kNumKeys, kDefaultHashSeed, &primary[0], &secondary[0], level);
+        for (std::size_t i = 0; i < kNumKeys; i++) {
+            if (primary[i] != hashUtils.primaryHash(keys[i].data(), len, kDefaultHashSeed))
+                errors++;
+            if (secondary[i] != hashUtils.secondaryHash(keys[i].data(), len))
+                errors++;
+        }
+        BatchHash::primaryHashFixed(&data[1], len, kNumKeys, 0, &primary[0], level);
+        for (std::size_t i = 0; i < kNumKeys; i++) {
+            if (primary[i] != hashUtils.primaryHash(keys[i].data(), len, 0))
+                errors++;
+        }
+    }
+    return errors;
+}
+
+// BlockCache::lookupBatch() finds the same blocks as lookup().
+static std::size_t block_cache_batch_verify()
+{
+    static const std::size_t kNumKeys = 1000;
+    BlockCache cache(1024 * 1024, 4);
+    BlockCache::value_type block(new std::string(100, 'b'));
+    std::vector<BlockCacheKey> keys;
+    for (std::size_t i = 0; i < kNumKeys; i++) {
+        keys.push_back(BlockCacheKey(i / 10 + 1, (i % 10) * 4096));
+        if ((i % 3) != 0)
+            cache.insert(keys[i], block);
+    }
+    std::vector<BlockCache::value_type> values(kNumKeys);
+    cache.lookupBatch(&keys[0], kNumKeys, &values[0]);
+    std::size_t errors = 0;
+    for (std::size_t i = 0; i < kNumKeys; i++) {
+        if ((values[i] != nullptr) != ((i % 3) != 0) || values[i] != cache.lookup(keys[i]))
+            errors++;
+    }
+    return errors;
+}
+
+// The keys of min_len to max_len bytes, one after another in data.
+static void make_batch_keys(std::vector<char> & data, std::vector<Slice> & keys,
+                            std::size_t min_len, std::size_t max_len, std::uint64_t & state)
+{
+    data.assign(keys.size() * max_len + kKeyPadding, 0);
+    fill_random(&data[0], data.size() - kKeyPadding, state);
+    std::size_t offset = 0;
+    for (std::size_t i = 0; i < keys.size(); i++) {
+        std::size_t len = min_len + (std::size_t)(next_random(state) % (max_len - min_len + 1));
+        keys[i] = Slice(&data[offset], len);
+        offset += len;
+    }
+}
+
+// Millions of keys per second, both hashes, kBatchSize keys at a time like maybeMatchBatch().
+static double batch_hash_speed(const std::vector<Slice> & keys, int level)
+{
+    static const std::size_t kBatchSize = 16;
+    HashUtils<> hashUtils;
+    std::uint32_t primary[kBatchSize], secondary[kBatchSize];
+    std::size_t rounds = kSpeedBytes / 16 / keys.size();
+    volatile std::uint32_t sum = 0;
+    StopWatch sw;
+    sw.start();
+    for (std::size_t r = 0; r < rounds; r++) {
+        for (std::size_t start = 0; start < keys.size(); start += kBatchSize) {
+            if (level < 0) {
+                for (std::size_t i = 0; i < kBatchSize; i++) {
+                    const Slice & key = keys[start + i];
+                    primary[i] = hashUtils.primaryHash(key.data(), key.size(), kDefaultHashSeed);
+                    secondary[i] = hashUtils.secondaryHash(key.data(), key.size());
+                }
+            }
+            else {
+                BatchHash::hashPair(&keys[start], kBatchSize, kDefaultHashSeed, primary, secondary,
+                                    (BatchHash::SimdLevel)level);
+            }
+            sum += primary[0] + secondary[kBatchSize - 1];
+        }
+    }
+    sw.stop();
+    return ((double)rounds * keys.size() / sw.getElapsedMillisec() / 1000.0);
+}
+
+// Millions of keys per second, the shards of the keys of the block cache,
+// by BlockCache::shardIndex().
+static double cache_shard_speed(const BlockCache & cache, const std::vector<BlockCacheKey> & keys)
+{
+    std::size_t rounds = kSpeedBytes / 16 / keys.size();
+    volatile std::size_t sum = 0;
+    StopWatch sw;
+    sw.start();
+    for (std::size_t r = 0; r < rounds; r++) {
+        for (std::size_t i = 0; i < keys.size(); i++) {
+            sum += cache.shardIndex(keys[i]);
+        }
+    }
+    sw.stop();
+    return ((double)rounds * keys.size() / sw.getElapsedMillisec() / 1000.0);
+}
+
+// The chi-square z of the keys of the block cache in the shards, pass < kMaxSigmas.
+static double cache_shard_z(const BlockCache & cache, const std::vector<BlockCacheKey> & keys)
+{
+    std::vector<std::uint32_t> shards(cache.numShards(), 0);
+    for (std::size_t i = 0; i < keys.size(); i++) {
+        shards[cache.shardIndex(keys[i])]++;
+    }
+    return chi_square_z(shards, keys.size());
+}
+
+void test_hash_batch()
+{
+    printf("----------------------------------\n");
+    printf("Batch Hash Test\n");
+    printf("----------------------------------\n\n");
+
+    static const std::size_t kSpeedKeys = 64 * 1024;
+    static const std::size_t kKeyLengths[][2] = { { 8, 8 }, { 16, 16 }, { 8, 40 }, { 32, 64 } };
+    BatchHash::SimdLevel best = BatchHash::getBestSimdLevel();
+
+    printf("BatchHash: %s, errors = %zu (Scalar), %zu (%s), lookupBatch() errors = %zu\n\n",
+           BatchHash::getSimdLevelName(best), batch_hash_verify(BatchHash::kScalar),
+           batch_hash_verify(best), BatchHash::getSimdLevelName(best), block_cache_batch_verify());
+
+    std::uint64_t state = 2463534242ULL;
+    std::vector<char> data;
+    std::vector<Slice> keys(kSpeedKeys);
+    printf("%-22s %12s %12s (Mkeys/s)\n", "keys", "HashUtils", BatchHash::getSimdLevelName(best));
+    for (std::size_t n = 0; n < sizeof(kKeyLengths) / sizeof(kKeyLengths[0]); n++) {
+        make_batch_keys(data, keys, kKeyLengths[n][0], kKeyLengths[n][1], state);
+        char name[32];
+        snprintf(name, sizeof(name), "%zu - %zu bytes", kKeyLengths[n][0], kKeyLengths[n][1]);
+        printf("%-22s %12.1f %12.1f\n", name, batch_hash_speed(keys, -1), batch_hash_speed(keys, best));
+    }
+
+    printf("\n");
+
+    // The blocks of a few big files, and of many small ones.
+    std::vector<BlockCacheKey> cache_keys;
+    for (std::size_t i = 0; i < kSpeedKeys; i++) {
+        cache_keys.push_back(BlockCacheKey(i / 4096 + 1, (i % 4096) * 4096));
+    }
+    for (std::size_t i = 0; i < kSpeedKeys; i++) {
+        cache_keys.push_back(BlockCacheKey(i / 4 + 1, (i % 4) * 4096));
+    }
+    static const int kShardBits[] = { 4, 10 };
+    for (std::size_t n = 0; n < sizeof(kShardBits) / sizeof(kShardBits[0]); n++) {
+        BlockCache cache(1024 * 1024, kShardBits[n]);
+        printf("BlockCacheKey shards:  %4zu shards, %8.1f Mkeys/s, chi-square z = %5.2f (pass < %0.0f)\n",
+               cache.numShards(), cache_shard_speed(cache, cache_keys), cache_shard_z(cache, cache_keys),
+               kMaxSigmas);
+    }
+    printf("\n");
+}
@@ -0,0 +1,280 @@
+
+#include "test.h"
+
+#include "TiStore/kv/MemTableRep.h"
+
+#include "stop_watch.h"
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace TiStore;
+
+static const std::size_t kMemTableKeys = 1000000;
+static const std::size_t kMemTableReads = 1000000;
+static const std::size_t kMemTableValueSize = 100;
+
+enum MemTableRepType {
+    kSkipListRep,
+    kMapSetRep,
+    kHashLinkListRep,
+    kVectorRep,
+    kMaxMemTableRepType
+};
+
+static MemTableRep * new_memtable_rep(int type)
+{
+    switch (type) {
+    case kSkipListRep:
+        return new SkipListRep();
+    case kMapSetRep:
+        return new MapSetRep();
+    case kHashLinkListRep:
+        return new HashLinkListRep(kMemTableKeys);
+    case kVectorRep:
+        return new VectorRep(kMemTableKeys);
+    default:
+        return nullptr;
+    }
+}
+
+static std::string make_memtable_key(std::size_t i)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%016zu", i);
+    return std::string(buf);
+}
+
+// Fill the rep, then flush it in order: returns the fill time in millisec.
+static double memtable_fill(MemTableRep * rep, const std::vector<std::string> & keys,
+                            const std::string & value, double & flush_time,
+                            std::size_t & flushed, std::size_t & out_of_order)
+{
+    stop_watch sw;
+    sw.start();
+    for (std::size_t i = 0; i < keys.size(); i++) {
+        rep->insert(keys[i], value);
+    }
+    sw.stop();
+    double elapsed = sw.getElapsedMillisec();
+
+    flushed = 0;
+    out_of_order = 0;
+    sw.start();
+    rep->markReadOnly();
+    std::unique_ptr<MemTableRep::Iterator> iter(rep->newIterator());
+    Slice last_key;
+    for (iter->seekToFirst(); iter->isValid(); iter->next()) {
+        if (flushed > 0 && last_key.compare(iter->key()) >= 0)
+            out_of_order++;
+        last_key = iter->key();
+        flushed++;
+    }
+    sw.stop();
+    flush_time = sw.getElapsedMillisec();
+    return elapsed;
+}
+
+void test_memtable_rep()
+{
+    printf("test_memtable_rep()\n\n");
+
+    std::vector<std::string> seq_keys, random_keys;
+    seq_keys.reserve(kMemTableKeys);
+    random_keys.reserve(kMemTableKeys);
+    for (std::size_t i = 0; i < kMemTableKeys; i++) {
+        seq_keys.push_back(make_memtable_key(i));
+        random_keys.push_back(make_memtable_key((i * 2654435761ULL) % kMemTableKeys));
+    }
+    std::vector<std::size_t> read_index(kMemTableReads);
+    std::uint64_t rnd = 0x2545F4914F6CDD1DULL;
+    for (std::size_t i = 0; i < kMemTableReads; i++) {
+        rnd = rnd * 6364136223846793005ULL + 1442695040888963407ULL;
+        read_index[i] = (std::size_t)(rnd >> 33) % kMemTableKeys;
+    }
+    std::string value(kMemTableValueSize, 'v');
+
+    printf("keys = %zu, key size = %zu, value size = %zu\n\n",
+           kMemTableKeys, seq_keys[0].size(), kMemTableValueSize);
+
+    for (int type = 0; type < kMaxMemTableRepType; type++) {
+        double flush_time;
+        std::size_t flushed, out_of_order;
+
+        // fill-seq
+        std::unique_ptr<MemTableRep> rep(new_memtable_rep(type));
+        double fill_seq = memtable_fill(rep.get(), seq_keys, value, flush_time, flushed, out_of_order);
+        printf("%-16s fill-seq:    %9.3f ms, %7.1f ns/key, flush = %9.3f ms, flushed = %zu, out of order = %zu\n",
+               rep->name(), fill_seq, fill_seq * 1000000.0 / kMemTableKeys,
+               flush_time, flushed, out_of_order);
+
+        // fill-random
+        rep.reset(new_memtable_rep(type));
+        double fill_random = memtable_fill(rep.get(), random_keys, value, flush_time, flushed, out_of_order);
+        printf("%-16s fill-random: %9.3f ms, %7.1f ns/key, flush = %9.3f ms, flushed = %zu, out of order = %zu\n",
+               rep->name(), fill_random, fill_random * 1000000.0 / kMemTableKeys,
+               flush_time, flushed, out_of_order);
+
+        // read-random, on the memtable of fill-random
+        stop_watch sw;
+        std::size_t found = 0;
+        Slice result;
+        sw.start();
+        for (std::size_t i = 0; i < kMemTableReads; i++) {
+            if (rep->get(seq_keys[read_index[i]], &result))
+                found++;
+        }
+        sw.stop();
+        double read_random = sw.getElapsedMillisec();
+        printf("%-16s read-random: %9.3f ms, %7.1f ns/key, found = %zu, memory usage = %zu bytes\n\n",
+               rep->name(), read_random, read_random * 1000000.0 / kMemTableReads,
+               found, rep->memoryUsage());
+    }
+}
+
+// Fills a filter to the end, removes half of the keys, and checks that the
+// others are all found, and the false positives of the removed keys.
+static void cuckoo_filter_insert_remove()
+{
+    CuckooFilter filter(kMemTableKeys, false);
+    std::size_t added = 0;
+    stop_watch sw;
+    sw.start();
+    while (filter.addKey(make_memtable_key(added)))
+        added++;
+    sw.stop();
+    printf("CuckooFilter     fill:   keys = %zu, bytes = %zu, load factor = %5.2f %%, "
+           "bits/key = %5.2f, %7.1f ns/key\n",
+           added, filter.getFilterSize(), filter.getLoadFactor() * 100.0,
+           (double)filter.getFilterSize() * 8.0 / added, sw.getElapsedMillisec() * 1000000.0 / added);
+
+    std::size_t removed = 0;
+    sw.start();
+    for (std::size_t i = 0; i < added; i += 2) {
+        if (filter.removeKey(make_memtable_key(i)))
+            removed++;
+    }
+    sw.stop();
+    double remove_time = sw.getElapsedMillisec();
+
+    std::size_t not_found = 0, false_positives = 0;
+    for (std::size_t i = 0; i < added; i++) {
+        bool found = filter.maybeMatch(make_memtable_key(i));
+        if ((i & 1) != 0 && !found)
+            not_found++;
+        else if ((i & 1) == 0 && found)
+            false_positives++;
+    }
+    printf("CuckooFilter     remove: keys = %zu, %7.1f ns/key, load factor = %5.2f %%, "
+           "not found = %zu, FPR of the removed = %6.3f %%\n\n",
+           removed, remove_time * 1000000.0 / removed, filter.getLoadFactor() * 100.0,
+           not_found, (double)false_positives * 100.0 / removed);
+}
+
+// One writer adds and removes keys, and kicks fingerprints around, while a
+// reader looks up the keys that are known to be in the filter.
+static void cuckoo_filter_concurrent_read()
+{
+    CuckooFilter filter(kMemTableKeys, false);
+    std::atomic<std::size_t> published(0);
+    std::atomic<bool> done(false);
+    std::size_t reads = 0, not_found = 0;
+
+    std::thread reader([&]() {
+        std::uint64_t rnd = 0x9E3779B97F4A7C15ULL;
+        while (!done.load(std::memory_order_acquire)) {
+            std::size_t count = published.load(std::memory_order_acquire);
+            if (count == 0)
+                continue;
+            rnd = rnd * 6364136223846793005ULL + 1442695040888963407ULL;
+            // The even keys stay, the odd keys are removed again.
+            std::size_t i = ((std::size_t)(rnd >> 33) % count) & ~(std::size_t)1;
+            if (!filter.maybeMatch(make_memtable_key(i)))
+                not_found++;
+            reads++;
+        }
+    });
+
+    std::size_t max_keys = kMemTableKeys * 95 / 100;
+    for (std::size_t i = 0; i < max_keys; i++) {
+        filter.addKey(make_memtable_key(i));
+        if ((i & 1) != 0 && (i & 7) != 7)
+            filter.removeKey(make_memtable_key(i));
+        published.store(i + 1, std::memory_order_release);
+    }
+    done.store(true, std::memory_order_release);
+    reader.join();
+
+    printf("CuckooFilter     concurrent read: reads = %zu, not found = %zu, load factor = %5.2f %%\n\n",
+           reads, not_found, filter.getLoadFactor() * 100.0);
+}
+
+// get() of the missing and the existing keys, with and without the filter.
+static void cuckoo_filter_rep_lookup(MemTableRep * rep, const std::vector<std::string> & keys,
+                                     const std::vector<std::string> & missing_keys,
+                                     const std::string & value)
+{
+    for (std::size_t i = 0; i < keys.size(); i++) {
+        rep->insert(keys[i], value);
+    }
+
+    stop_watch sw;
+    std::size_t found = 0;
+    Slice result;
+    sw.start();
+    for (std::size_t i = 0; i < missing_keys.size(); i++) {
+        if (rep->get(missing_keys[i], &result))
+            found++;
+    }
+    sw.stop();
+    double missing_time = sw.getElapsedMillisec();
+
+    std::size_t existing_found = 0;
+    sw.start();
+    for (std::size_t i = 0; i < keys.size(); i++) {
+        if (rep->get(keys[i], &result))
+            existing_found++;
+    }
+    sw.stop();
+    double existing_time = sw.getElapsedMillisec();
+
+    printf("%-16s missing: %7.1f ns/key, found = %zu, existing: %7.1f ns/key, found = %zu, "
+           "memory usage = %zu bytes\n",
+           rep->name(), missing_time * 1000000.0 / missing_keys.size(), found,
+           existing_time * 1000000.0 / keys.size(), existing_found, rep->memoryUsage());
+}
+
+void test_memtable_cuckoo_filter()
+{
+    printf("test_memtable_cuckoo_filter()\n\n");
+
+    cuckoo_filter_insert_remove();
+    cuckoo_filter_concurrent_read();
+
+    std::vector<std::string> keys, missing_keys;
+    keys.reserve(kMemTableKeys);
+    missing_keys.reserve(kMemTableReads);
+    for (std::size_t i = 0; i < kMemTableKeys; i++) {
+        keys.push_back(make_memtable_key((i * 2654435761ULL) % kMemTableKeys * 2));
+    }
+    // The missing keys are between the existing ones.
+    for (std::size_t i = 0; i < kMemTableReads; i++) {
+        missing_keys.push_back(make_memtable_key((i * 2654435761ULL) % kMemTableReads * 2 + 1));
+    }
+    std::string value(kMemTableValueSize, 'v');
+
+    static const int rep_types[] = { kSkipListRep, kHashLinkListRep };
+    for (std::size_t i = 0; i < sizeof(rep_types) / sizeof(rep_types[0]); i++) {
+        std::unique_ptr<MemTableRep> rep(new_memtable_rep(rep_types[i]));
+        cuckoo_filter_rep_lookup(rep.get(), keys, missing_keys, value);
+        rep.reset(new CuckooFilterRep(new_memtable_rep(rep_types[i]), kMemTableKeys));
+        cuckoo_filter_rep_lookup(rep.get(), keys, missing_keys, value);
+    }
+    printf("\n");
+}
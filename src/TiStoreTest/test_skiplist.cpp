@@ -0,0 +1,449 @@
+
+#include "test.h"
+
+#include "TiStore/kv/SkipList.h"
+
+#include "stop_watch.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace TiStore;
+
+typedef SkipList<Key, Value, 16> skiplist_type;
+
+static const std::size_t kSkipListPrefillKeys = 200000;
+static const std::size_t kSkipListReadsPerThread = 1000000;
+static const std::size_t kSkipListMaxWritesPerRound = 1000000;
+
+static std::string make_skiplist_key(const char * prefix, std::size_t i)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%s%016zu", prefix, i);
+    return std::string(buf);
+}
+
+// The keys have different lengths, from 2 to 8 bytes.
+static std::string make_skiplist_var_key(const char * prefix, std::size_t i)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%s%zu", prefix, i);
+    return std::string(buf);
+}
+
+//
+// One writer keeps inserting new keys (behind a mutex, as the SkipList
+// requires for writers), while 1 to N reader threads do random lookups
+// of the prefilled keys without any lock.
+//
+static double skiplist_concurrent_read_impl(skiplist_type & skiplist,
+                                            const std::vector<std::string> & keys,
+                                            std::size_t num_readers, std::size_t & write_seq,
+                                            std::size_t & writes, std::size_t & misses)
+{
+    std::mutex write_mutex;
+    std::atomic<bool> readers_done(false);
+    std::atomic<std::size_t> total_misses(0);
+    std::size_t total_writes = 0;
+
+    std::thread writer([&]() {
+        std::size_t i = 0;
+        while (!readers_done.load(std::memory_order_acquire) && i < kSkipListMaxWritesPerRound) {
+            std::string key = make_skiplist_key("w", write_seq + i);
+            std::lock_guard<std::mutex> lock(write_mutex);
+            skiplist.insert(Key(key), Value(key));
+            i++;
+        }
+        write_seq += i;
+        total_writes = i;
+    });
+
+    std::vector<std::thread> readers;
+    stop_watch sw;
+    sw.start();
+    for (std::size_t t = 0; t < num_readers; t++) {
+        readers.push_back(std::thread([&, t]() {
+            std::uint64_t rnd = 0x9E3779B97F4A7C15ULL * (t + 1);
+            std::size_t not_found = 0;
+            for (std::size_t i = 0; i < kSkipListReadsPerThread; i++) {
+                rnd = rnd * 6364136223846793005ULL + 1442695040888963407ULL;
+                const std::string & key = keys[(std::size_t)(rnd >> 33) % keys.size()];
+                skiplist_type::iterator iter = skiplist.find(Key(key));
+                if (!iter.is_valid() || iter.value().size() != key.size())
+                    not_found++;
+            }
+            total_misses.fetch_add(not_found);
+        }));
+    }
+    for (std::size_t t = 0; t < readers.size(); t++) {
+        readers[t].join();
+    }
+    sw.stop();
+
+    readers_done.store(true, std::memory_order_release);
+    writer.join();
+
+    writes = total_writes;
+    misses = total_misses.load();
+    return sw.getElapsedMillisec();
+}
+
+void test_skiplist_concurrent_read()
+{
+    printf("test_skiplist_concurrent_read()\n\n");
+
+    skiplist_type skiplist;
+    std::vector<std::string> keys;
+    keys.reserve(kSkipListPrefillKeys);
+    for (std::size_t i = 0; i < kSkipListPrefillKeys; i++) {
+        keys.push_back(make_skiplist_key("r", i * 7919));
+        skiplist.insert(Key(keys.back()), Value(keys.back()));
+    }
+    printf("prefill keys = %zu, reads per thread = %zu\n\n",
+           skiplist.sizes(), kSkipListReadsPerThread);
+
+    std::size_t max_threads = std::thread::hardware_concurrency();
+    if (max_threads < 2)
+        max_threads = 2;
+    std::vector<std::size_t> thread_counts;
+    for (std::size_t threads = 1; threads < max_threads; threads *= 2) {
+        thread_counts.push_back(threads);
+    }
+    thread_counts.push_back(max_threads);
+
+    double base_throughput = 0.0;
+    std::size_t write_seq = 0;
+    for (std::size_t n = 0; n < thread_counts.size(); n++) {
+        std::size_t threads = thread_counts[n];
+        std::size_t writes = 0, misses = 0;
+        double elapsed = skiplist_concurrent_read_impl(skiplist, keys, threads, write_seq, writes, misses);
+        double throughput = (double)(kSkipListReadsPerThread * threads) / (elapsed / 1000.0);
+        if (threads == 1)
+            base_throughput = throughput;
+        printf("readers = %2zu, time spent: %9.3f ms, reads: %8.3f M/s, scaling: %5.2fx, "
+               "concurrent writes: %zu, misses: %zu\n",
+               threads, elapsed, throughput / 1000000.0, throughput / base_throughput,
+               writes, misses);
+    }
+    printf("\nskiplist.size() = %zu, memory_usage() = %zu bytes (%0.1f bytes/key)\n\n",
+           skiplist.sizes(), skiplist.memory_usage(),
+           (double)skiplist.memory_usage() / (double)skiplist.sizes());
+}
+
+static const std::size_t kSkipListScanKeys = 1000000;
+static const std::size_t kSkipListRangeScans = 100000;
+static const std::size_t kSkipListRangeScanLength = 100;
+
+void test_skiplist_scan()
+{
+    printf("test_skiplist_scan()\n\n");
+
+    skiplist_type skiplist;
+    for (std::size_t i = 0; i < kSkipListScanKeys; i++) {
+        std::string key = make_skiplist_var_key("s", (i * 2654435761ULL) % kSkipListScanKeys);
+        skiplist.insert(Key(key), Value(key));
+    }
+
+    // Verify the order and the reverse order
+    std::size_t count = 0, out_of_order = 0;
+    skiplist_type::iterator iter(&skiplist);
+    Key last_key;
+    for (iter.seek_to_first(); iter.is_valid(); iter.next()) {
+        if (count > 0 && last_key.compare(iter.key()) >= 0)
+            out_of_order++;
+        last_key = iter.key();
+        count++;
+    }
+    std::size_t reverse_count = 0;
+    for (iter.seek_to_last(); iter.is_valid(); iter.prev()) {
+        reverse_count++;
+    }
+    printf("keys = %zu, forward = %zu, backward = %zu, out of order = %zu\n\n",
+           skiplist.sizes(), count, reverse_count, out_of_order);
+
+    // Sequential scan
+    stop_watch sw;
+    std::size_t scanned = 0, bytes = 0;
+    sw.start();
+    for (skiplist_type::iterator it = skiplist.begin(); it != skiplist.end(); ++it) {
+        bytes += it.value().size();
+        scanned++;
+    }
+    sw.stop();
+    double elapsed = sw.getElapsedMillisec();
+    printf("sequential scan:        time spent: %9.3f ms, keys: %9zu, %8.3f M keys/s, bytes: %zu\n",
+           elapsed, scanned, (double)scanned / (elapsed * 1000.0), bytes);
+
+    // Short range scans: seek() to a random key, then read 100 keys
+    std::uint64_t rnd = 0x2545F4914F6CDD1DULL;
+    scanned = 0;
+    bytes = 0;
+    sw.start();
+    for (std::size_t n = 0; n < kSkipListRangeScans; n++) {
+        rnd = rnd * 6364136223846793005ULL + 1442695040888963407ULL;
+        std::string start_key = make_skiplist_var_key("s", (std::size_t)(rnd >> 33) % kSkipListScanKeys);
+        iter.seek(Key(start_key));
+        for (std::size_t i = 0; i < kSkipListRangeScanLength && iter.is_valid(); i++) {
+            bytes += iter.value().size();
+            scanned++;
+            iter.next();
+        }
+    }
+    sw.stop();
+    elapsed = sw.getElapsedMillisec();
+    printf("range scan (%zu keys):  time spent: %9.3f ms, keys: %9zu, %8.3f M keys/s, %8.3f K scans/s\n\n",
+           kSkipListRangeScanLength, elapsed, scanned, (double)scanned / (elapsed * 1000.0),
+           (double)kSkipListRangeScans / elapsed);
+}
+
+static const std::size_t kSkipListLookupKeys = 1000000;
+static const std::size_t kSkipListLookups = 2000000;
+
+static double skiplist_point_lookup_impl(skiplist_type & skiplist,
+                                         const std::vector<std::string> & keys,
+                                         std::size_t & found)
+{
+    std::uint64_t rnd = 0x9E3779B97F4A7C15ULL;
+    found = 0;
+    stop_watch sw;
+    sw.start();
+    for (std::size_t i = 0; i < kSkipListLookups; i++) {
+        rnd = rnd * 6364136223846793005ULL + 1442695040888963407ULL;
+        // Half of the lookups are for keys that don't exist.
+        std::size_t n = (std::size_t)(rnd >> 33) % (keys.size() * 2);
+        skiplist_type::iterator iter = skiplist.find(Key(keys[n % keys.size()].data(),
+                                                         keys[n % keys.size()].size() - (n / keys.size())));
+        if (iter.is_valid())
+            found++;
+    }
+    sw.stop();
+    return sw.getElapsedMillisec();
+}
+
+void test_skiplist_point_lookup()
+{
+    printf("test_skiplist_point_lookup()\n\n");
+
+    std::vector<std::string> keys;
+    keys.reserve(kSkipListLookupKeys);
+    for (std::size_t i = 0; i < kSkipListLookupKeys; i++) {
+        keys.push_back(make_skiplist_var_key("p", i * 7919));
+    }
+
+    skiplist_type skiplist;
+    skiplist_type skiplist_hashed(skiplist_type::kDefaultArenaBlockSize, kSkipListLookupKeys);
+    for (std::size_t i = 0; i < keys.size(); i++) {
+        skiplist.insert(Key(keys[i]), Value(keys[i]));
+        skiplist_hashed.insert(Key(keys[i]), Value(keys[i]));
+    }
+
+    std::size_t found;
+    double elapsed = skiplist_point_lookup_impl(skiplist, keys, found);
+    printf("ordered index only:  time spent: %9.3f ms, %7.1f ns/lookup, found: %zu, memory_usage() = %zu bytes\n",
+           elapsed, elapsed * 1000000.0 / kSkipListLookups, found, skiplist.memory_usage());
+
+    elapsed = skiplist_point_lookup_impl(skiplist_hashed, keys, found);
+    printf("with hash index:     time spent: %9.3f ms, %7.1f ns/lookup, found: %zu, memory_usage() = %zu bytes\n\n",
+           elapsed, elapsed * 1000000.0 / kSkipListLookups, found, skiplist_hashed.memory_usage());
+}
+
+static const std::size_t kSkipListIngestKeys = 1000000;
+
+void test_skiplist_sorted_ingest()
+{
+    printf("test_skiplist_sorted_ingest()\n\n");
+
+    std::vector<std::string> keys;
+    keys.reserve(kSkipListIngestKeys);
+    for (std::size_t i = 0; i < kSkipListIngestKeys; i++) {
+        keys.push_back(make_skiplist_key("i", i));
+    }
+    std::vector<Record<Key, Value>> records(keys.size());
+    for (std::size_t i = 0; i < keys.size(); i++) {
+        records[i].write(Key(keys[i]), Value(keys[i]));
+    }
+
+    stop_watch sw;
+    double elapsed;
+    {
+        skiplist_type skiplist;
+        sw.start();
+        for (std::size_t i = 0; i < keys.size(); i++) {
+            skiplist.insert(Key(keys[i]), Value(keys[i]));
+        }
+        sw.stop();
+        elapsed = sw.getElapsedMillisec();
+        printf("insert():           time spent: %9.3f ms, %7.1f ns/key, size = %zu\n",
+               elapsed, elapsed * 1000000.0 / keys.size(), skiplist.sizes());
+    }
+    {
+        skiplist_type skiplist;
+        skiplist_type::Splice splice;
+        sw.start();
+        for (std::size_t i = 0; i < keys.size(); i++) {
+            skiplist.insert_with_hint(Key(keys[i]), Value(keys[i]), &splice);
+        }
+        sw.stop();
+        elapsed = sw.getElapsedMillisec();
+        printf("insert_with_hint(): time spent: %9.3f ms, %7.1f ns/key, size = %zu\n",
+               elapsed, elapsed * 1000000.0 / keys.size(), skiplist.sizes());
+    }
+    {
+        skiplist_type skiplist;
+        sw.start();
+        std::size_t inserted = skiplist.insert_batch(records.data(), records.size());
+        sw.stop();
+        elapsed = sw.getElapsedMillisec();
+
+        // Verify the order, and that a hint in the middle of the list still works.
+        std::size_t count = 0, out_of_order = 0;
+        Key last_key;
+        for (skiplist_type::iterator it = skiplist.begin(); it != skiplist.end(); ++it) {
+            if (count > 0 && last_key.compare(it.key()) >= 0)
+                out_of_order++;
+            last_key = it.key();
+            count++;
+        }
+        skiplist_type::Splice splice;
+        std::size_t updated = 0;
+        for (std::size_t i = 0; i < keys.size(); i += 1000) {
+            if (!skiplist.insert_with_hint(Key(keys[i]), Value(keys[keys.size() - 1 - i]), &splice))
+                updated++;
+        }
+        printf("insert_batch():     time spent: %9.3f ms, %7.1f ns/key, size = %zu, inserted = %zu\n"
+               "                    forward = %zu, out of order = %zu, updated = %zu\n\n",
+               elapsed, elapsed * 1000000.0 / keys.size(), skiplist.sizes(), inserted,
+               count, out_of_order, updated);
+    }
+    {
+        // The hint jumps between the two halves of the keys every time, and
+        // a third of the keys are inserted by insert(), behind the splice.
+        skiplist_type skiplist;
+        skiplist_type::Splice splice;
+        std::size_t half = keys.size() / 2;
+        sw.start();
+        for (std::size_t i = 0; i < half; i++) {
+            for (std::size_t j = i; j < keys.size(); j += half) {
+                if ((j % 3) == 0)
+                    skiplist.insert(Key(keys[j]), Value(keys[j]));
+                else
+                    skiplist.insert_with_hint(Key(keys[j]), Value(keys[j]), &splice);
+            }
+        }
+        sw.stop();
+        elapsed = sw.getElapsedMillisec();
+
+        std::size_t count = 0, out_of_order = 0;
+        Key last_key;
+        for (skiplist_type::iterator it = skiplist.begin(); it != skiplist.end(); ++it) {
+            if (count > 0 && last_key.compare(it.key()) >= 0)
+                out_of_order++;
+            last_key = it.key();
+            count++;
+        }
+        printf("hint, jumps:        time spent: %9.3f ms, %7.1f ns/key, size = %zu\n"
+               "                    forward = %zu, out of order = %zu\n\n",
+               elapsed, elapsed * 1000000.0 / keys.size(), skiplist.sizes(),
+               count, out_of_order);
+    }
+}
+
+static const std::size_t kSkipListWriterThreads = 8;
+static const std::size_t kSkipListLevelsPerThread = 10000000;
+static const std::size_t kSkipListKeysPerWriter = 200000;
+
+// The random level of the SkipList before the thread local generator.
+static std::size_t skiplist_rand_level()
+{
+    std::size_t height = 1;
+    while (height < skiplist_type::kMaxLevel && ((rand() % skiplist_type::kBranching) == 0)) {
+        height++;
+    }
+    return height;
+}
+
+template <typename Function>
+static double skiplist_run_writers(std::size_t threads, Function func)
+{
+    std::vector<std::thread> workers;
+    stop_watch sw;
+    sw.start();
+    for (std::size_t t = 0; t < threads; t++) {
+        workers.push_back(std::thread(func, t));
+    }
+    for (std::size_t t = 0; t < workers.size(); t++) {
+        workers[t].join();
+    }
+    sw.stop();
+    return sw.getElapsedMillisec();
+}
+
+void test_skiplist_random_level()
+{
+    printf("test_skiplist_random_level()\n\n");
+
+    static const std::size_t kLevelSamples = 1000000;
+    std::size_t histogram[skiplist_type::kMaxLevel + 1] = { 0 };
+    skiplist_type skiplist;
+    for (std::size_t i = 0; i < kLevelSamples; i++) {
+        histogram[skiplist.get_random_level()]++;
+    }
+    printf("level distribution (branching = %zu, %zu samples):\n\n",
+           skiplist_type::kBranching, kLevelSamples);
+    for (std::size_t level = 1; level <= skiplist_type::kMaxLevel; level++) {
+        if (histogram[level] != 0)
+            printf("  level %2zu: %8zu (%8.5f %%)\n", level, histogram[level],
+                   histogram[level] * 100.0 / kLevelSamples);
+    }
+    printf("\n");
+
+    // Generate the levels only, kSkipListWriterThreads threads at a time.
+    std::atomic<std::size_t> checksum(0);
+    double elapsed_rand = skiplist_run_writers(kSkipListWriterThreads, [&](std::size_t) {
+        std::size_t sum = 0;
+        for (std::size_t i = 0; i < kSkipListLevelsPerThread; i++) {
+            sum += skiplist_rand_level();
+        }
+        checksum.fetch_add(sum, std::memory_order_relaxed);
+    });
+    double elapsed_local = skiplist_run_writers(kSkipListWriterThreads, [&](std::size_t) {
+        skiplist_type list;
+        std::size_t sum = 0;
+        for (std::size_t i = 0; i < kSkipListLevelsPerThread; i++) {
+            sum += list.get_random_level();
+        }
+        checksum.fetch_add(sum, std::memory_order_relaxed);
+    });
+    std::size_t total_levels = kSkipListLevelsPerThread * kSkipListWriterThreads;
+    printf("levels, %zu threads: rand() = %7.3f ns/level, thread local = %7.3f ns/level, checksum = %zu\n",
+           kSkipListWriterThreads, elapsed_rand * 1000000.0 / total_levels,
+           elapsed_local * 1000000.0 / total_levels, checksum.load());
+
+    // Every writer owns a list (a SkipList has one writer at a time),
+    // so the only state the writers can share is the random generator.
+    std::vector<std::vector<std::string>> keys(kSkipListWriterThreads);
+    for (std::size_t t = 0; t < kSkipListWriterThreads; t++) {
+        keys[t].reserve(kSkipListKeysPerWriter);
+        for (std::size_t i = 0; i < kSkipListKeysPerWriter; i++) {
+            keys[t].push_back(make_skiplist_key("w", (i * 2654435761ULL) % kSkipListKeysPerWriter));
+        }
+    }
+    std::atomic<std::size_t> inserted(0);
+    double elapsed = skiplist_run_writers(kSkipListWriterThreads, [&](std::size_t t) {
+        skiplist_type list;
+        for (std::size_t i = 0; i < keys[t].size(); i++) {
+            list.insert(Key(keys[t][i]), Value(keys[t][i]));
+        }
+        inserted.fetch_add(list.sizes(), std::memory_order_relaxed);
+    });
+    printf("insert, %zu writers: time spent: %9.3f ms, %7.3f M inserts/sec, inserted = %zu\n\n",
+           kSkipListWriterThreads, elapsed, (double)inserted.load() / (elapsed * 1000.0),
+           inserted.load());
+}
@@ -0,0 +1,466 @@
+
+#include "test.h"
+
+#include "TiStore/kv/Cache.h"
+#include "TiStore/kv/Random.h"
+#include "TiStore/kv/SliceTransform.h"
+#include "TiStore/kv/Table.h"
+#include "TiStore/kv/TableBuilder.h"
+
+#include "stop_watch.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace TiStore;
+
+static const char * kTableFilename = "tistore_test_table.sst";
+static const std::size_t kTableValueSize = 100;
+#if TISTORE_FULL_BENCHMARK
+static const std::uint64_t kTableSize = 1024ULL * 1024 * 1024;
+#else
+static const std::uint64_t kTableSize = 64ULL * 1024 * 1024;
+#endif
+static const std::size_t kTableReads = 200000;
+
+static std::string make_table_key(std::size_t i)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%016zu", i);
+    return std::string(buf);
+}
+
+// Random point reads of the keys i * 2, the odd keys are not in the table.
+static double table_point_read_impl(const Table * table, std::size_t num_keys, bool existing,
+                                    std::size_t & found, std::size_t & errors)
+{
+    std::uint64_t rnd = existing ? 0x2545F4914F6CDD1DULL : 0x9E3779B97F4A7C15ULL;
+    std::string value;
+    found = 0;
+    errors = 0;
+
+    stop_watch sw;
+    sw.start();
+    for (std::size_t i = 0; i < kTableReads; i++) {
+        rnd = rnd * 6364136223846793005ULL + 1442695040888963407ULL;
+        std::size_t n = (std::size_t)(rnd >> 33) % num_keys;
+        std::string key = make_table_key(existing ? (n * 2) : (n * 2 + 1));
+        int status = table->get(key, &value);
+        if (status == error_code::no_error)
+            found++;
+        else if (status != error_code::err_not_found)
+            errors++;
+    }
+    sw.stop();
+    return sw.getElapsedMillisec();
+}
+
+void test_table_point_read()
+{
+    printf("test_table_point_read()\n\n");
+
+    // Build the table, about kTableSize bytes.
+    std::size_t num_keys = (std::size_t)(kTableSize / (16 + kTableValueSize + 3));
+    std::string value(kTableValueSize, 'v');
+    stop_watch sw;
+    {
+        fs::File file(kTableFilename, fs::FS_MARK_WRITE | fs::FS_MARK_TRUNC | fs::FS_MARK_BINARY);
+        if (!file.is_open()) {
+            printf("open(\"%s\") failed.\n\n", kTableFilename);
+            return;
+        }
+        TableBuilder builder(&file);
+        sw.start();
+        for (std::size_t i = 0; i < num_keys; i++) {
+            // Make every value different, to check what we read.
+            std::string key = make_table_key(i * 2);
+            ::memcpy(&value[0], key.data(), key.size());
+            builder.add(key, value);
+        }
+        int status = builder.finish();
+        file.sync();
+        sw.stop();
+        printf("build: keys = %zu, file size = %llu bytes, status = %d, time spent: %9.3f ms\n",
+               num_keys, (unsigned long long)builder.fileSize(), status, sw.getElapsedMillisec());
+    }
+
+    fs::File file(kTableFilename, fs::FS_MARK_READ | fs::FS_MARK_BINARY);
+    Table * table = nullptr;
+    int status = Table::open(&file, &table);
+    if (status != error_code::no_error) {
+        printf("Table::open() failed, status = %d\n\n", status);
+        return;
+    }
+    printf("open:  index block = %zu bytes, filter = %zu bytes\n\n",
+           table->indexSize(), table->filterSize());
+
+    std::size_t found, errors;
+    double elapsed = table_point_read_impl(table, num_keys, true, found, errors);
+    printf("existing keys: reads = %zu, time spent: %9.3f ms, %7.3f us/read, %9.1f reads/sec, found = %zu, errors = %zu\n",
+           kTableReads, elapsed, elapsed * 1000.0 / kTableReads,
+           (double)kTableReads / (elapsed / 1000.0), found, errors);
+
+    // Check a value.
+    std::string read_value;
+    std::string key = make_table_key(num_keys / 2 * 2);
+    status = table->get(key, &read_value);
+    bool value_ok = (status == error_code::no_error && read_value.compare(0, key.size(), key) == 0);
+
+    elapsed = table_point_read_impl(table, num_keys, false, found, errors);
+    printf("missing keys:  reads = %zu, time spent: %9.3f ms, %7.3f us/read, %9.1f reads/sec, found = %zu, errors = %zu\n",
+           kTableReads, elapsed, elapsed * 1000.0 / kTableReads,
+           (double)kTableReads / (elapsed / 1000.0), found, errors);
+    printf("value check: %s\n\n", value_ok ? "ok" : "failed");
+
+    // The hot keys, 1/64 of the table, without and with a block cache.
+    std::size_t num_hot_keys = num_keys / 64;
+    elapsed = table_point_read_impl(table, num_hot_keys, true, found, errors);
+    printf("hot keys, no cache:    reads = %zu, time spent: %9.3f ms, %7.3f us/read, %9.1f reads/sec\n",
+           kTableReads, elapsed, elapsed * 1000.0 / kTableReads, (double)kTableReads / (elapsed / 1000.0));
+    delete table;
+
+    BlockCache cache((std::size_t)(kTableSize / 32), 4);
+    table = nullptr;
+    status = Table::open(&file, &table, &cache);
+    if (status != error_code::no_error) {
+        printf("Table::open() failed, status = %d\n\n", status);
+        return;
+    }
+    elapsed = table_point_read_impl(table, num_hot_keys, true, found, errors);
+    CacheStats stats = cache.getStats();
+    printf("hot keys, block cache: reads = %zu, time spent: %9.3f ms, %7.3f us/read, %9.1f reads/sec, "
+           "found = %zu, hits = %llu, misses = %llu\n\n",
+           kTableReads, elapsed, elapsed * 1000.0 / kTableReads, (double)kTableReads / (elapsed / 1000.0),
+           found, (unsigned long long)stats.hits, (unsigned long long)stats.misses);
+
+    delete table;
+    file.close();
+    fs::File::remove(kTableFilename);
+}
+
+static const std::size_t kPrefixTables = 16;
+static const std::size_t kPrefixTenants = 256;
+static const std::size_t kPrefixTablesPerTenant = 4;
+static const std::size_t kPrefixRows = 200;
+static const std::size_t kPrefixSeeks = 2000;
+
+// "tenant|table|rowkey"
+static std::string make_prefix_key(std::size_t tenant, std::size_t table, std::size_t row)
+{
+    char buf[64];
+    snprintf(buf, sizeof(buf), "t%04zu|tb%02zu|%08zu", tenant, table, row);
+    return std::string(buf);
+}
+
+static std::string make_prefix_table_filename(std::size_t n)
+{
+    char buf[64];
+    snprintf(buf, sizeof(buf), "tistore_test_prefix_%02zu.sst", n);
+    return std::string(buf);
+}
+
+// Scans the rows of random "tenant|table|" prefixes in all the tables,
+// the tables whose filter doesn't have the prefix are skipped if
+// use_filter. A quarter of the prefixes are not in any table.
+static double table_prefix_seek_impl(const std::vector<Table *> & tables, bool use_filter,
+                                     std::size_t & rows, std::size_t & seeks)
+{
+    std::uint64_t rnd = 0x2545F4914F6CDD1DULL;
+    rows = 0;
+    seeks = 0;
+
+    stop_watch sw;
+    sw.start();
+    for (std::size_t i = 0; i < kPrefixSeeks; i++) {
+        rnd = rnd * 6364136223846793005ULL + 1442695040888963407ULL;
+        std::size_t r = (std::size_t)(rnd >> 33);
+        std::string prefix = make_prefix_key(r % kPrefixTenants,
+                                             r / kPrefixTenants % (kPrefixTablesPerTenant + 1), 0);
+        prefix.resize(prefix.size() - 8);
+        for (std::size_t n = 0; n < tables.size(); n++) {
+            if (use_filter && !tables[n]->prefixMayMatch(prefix))
+                continue;
+            seeks++;
+            std::unique_ptr<Table::Iterator> iter(tables[n]->newIterator());
+            for (iter->seek(prefix); iter->isValid() && iter->key().starts_with(prefix); iter->next()) {
+                rows++;
+            }
+        }
+    }
+    sw.stop();
+    return sw.getElapsedMillisec();
+}
+
+void test_table_prefix_seek()
+{
+    printf("test_table_prefix_seek()\n\n");
+
+    // The tenants are spread over the tables, so the key ranges of all the
+    // tables overlap, as in the newest level of an LSM tree.
+    DelimiterPrefixTransform prefix_extractor('|', 2);
+    TableOptions options;
+    options.prefix_extractor = &prefix_extractor;
+    std::string value(kTableValueSize, 'v');
+    std::uint64_t total_size = 0;
+    for (std::size_t n = 0; n < kPrefixTables; n++) {
+        std::string filename = make_prefix_table_filename(n);
+        fs::File file(filename.c_str(), fs::FS_MARK_WRITE | fs::FS_MARK_TRUNC | fs::FS_MARK_BINARY);
+        if (!file.is_open()) {
+            printf("open(\"%s\") failed.\n\n", filename.c_str());
+            return;
+        }
+        TableBuilder builder(&file, options);
+        for (std::size_t tenant = n; tenant < kPrefixTenants; tenant += kPrefixTables) {
+            for (std::size_t table = 0; table < kPrefixTablesPerTenant; table++) {
+                for (std::size_t row = 0; row < kPrefixRows; row++) {
+                    builder.add(make_prefix_key(tenant, table, row), value);
+                }
+            }
+        }
+        builder.finish();
+        total_size += builder.fileSize();
+    }
+    printf("tables = %zu, tenants = %zu, rows per prefix = %zu, total size = %llu bytes, "
+           "prefix extractor = %s\n\n",
+           kPrefixTables, kPrefixTenants, kPrefixRows, (unsigned long long)total_size,
+           prefix_extractor.name());
+
+    std::vector<std::unique_ptr<fs::File>> files;
+    std::vector<Table *> tables;
+    for (std::size_t n = 0; n < kPrefixTables; n++) {
+        std::string filename = make_prefix_table_filename(n);
+        files.push_back(std::unique_ptr<fs::File>(
+            new fs::File(filename.c_str(), fs::FS_MARK_READ | fs::FS_MARK_BINARY)));
+        Table * table = nullptr;
+        int status = Table::open(files.back().get(), &table, nullptr, &prefix_extractor);
+        if (status != error_code::no_error) {
+            printf("Table::open() failed, status = %d\n\n", status);
+            break;
+        }
+        tables.push_back(table);
+    }
+
+    if (tables.size() == kPrefixTables) {
+        std::size_t rows, seeks;
+        double elapsed = table_prefix_seek_impl(tables, false, rows, seeks);
+        printf("no prefix filter: prefixes = %zu, time spent: %9.3f ms, %8.3f us/prefix, "
+               "table seeks = %zu, rows = %zu\n",
+               kPrefixSeeks, elapsed, elapsed * 1000.0 / kPrefixSeeks, seeks, rows);
+        elapsed = table_prefix_seek_impl(tables, true, rows, seeks);
+        printf("prefix filter:    prefixes = %zu, time spent: %9.3f ms, %8.3f us/prefix, "
+               "table seeks = %zu, rows = %zu, has prefix filter = %s\n",
+               kPrefixSeeks, elapsed, elapsed * 1000.0 / kPrefixSeeks, seeks, rows,
+               tables[0]->hasPrefixFilter() ? "true" : "false");
+
+        // A whole key is still in the filter.
+        std::size_t found = 0;
+        std::string read_value;
+        for (std::size_t tenant = 0; tenant < kPrefixTenants; tenant++) {
+            if (tables[tenant % kPrefixTables]->get(make_prefix_key(tenant, 1, 7), &read_value)
+                == error_code::no_error)
+                found++;
+        }
+        printf("point reads: found = %zu of %zu\n\n", found, kPrefixTenants);
+    }
+
+    for (std::size_t n = 0; n < tables.size(); n++) {
+        delete tables[n];
+    }
+    for (std::size_t n = 0; n < files.size(); n++) {
+        files[n]->close();
+        fs::File::remove(make_prefix_table_filename(n).c_str());
+    }
+}
+
+static const char * kPartitionedTableFilename = "tistore_test_table_partitioned.sst";
+static const std::size_t kFilterPartitionSize = 4096;
+
+//
+// The zipfian generator of YCSB: next() returns a rank in [0, n), rank 0
+// is the most frequent one, with a frequency of 1 / (i + 1)^theta.
+//
+// See: "Quickly Generating Billion-Record Synthetic Databases", Gray et al.
+//
+class ZipfianGenerator {
+private:
+    Random random_;
+    std::size_t n_;
+    double theta_;
+    double alpha_;
+    double zetan_;
+    double eta_;
+
+    static double zeta(std::size_t n, double theta) {
+        double sum = 0.0;
+        for (std::size_t i = 1; i <= n; i++) {
+            sum += 1.0 / ::pow((double)i, theta);
+        }
+        return sum;
+    }
+
+public:
+    ZipfianGenerator(std::size_t n, double theta, std::uint64_t seed)
+        : random_(seed), n_(n), theta_(theta) {
+        alpha_ = 1.0 / (1.0 - theta);
+        zetan_ = zeta(n, theta);
+        double zeta2 = zeta(2, theta);
+        eta_ = (1.0 - ::pow(2.0 / (double)n, 1.0 - theta)) / (1.0 - zeta2 / zetan_);
+    }
+
+    std::size_t next() {
+        double u = (double)(random_.next() >> 11) * (1.0 / 9007199254740992.0);
+        double uz = u * zetan_;
+        if (uz < 1.0)
+            return 0;
+        if (uz < 1.0 + ::pow(0.5, theta_))
+            return 1;
+        std::size_t rank = (std::size_t)((double)n_ * ::pow(eta_ * u - eta_ + 1.0, alpha_));
+        return ((rank < n_) ? rank : (n_ - 1));
+    }
+};
+
+static bool build_table(const char * filename, std::size_t num_keys, const TableOptions & options)
+{
+    fs::File file(filename, fs::FS_MARK_WRITE | fs::FS_MARK_TRUNC | fs::FS_MARK_BINARY);
+    if (!file.is_open()) {
+        printf("open(\"%s\") failed.\n\n", filename);
+        return false;
+    }
+    std::string value(kTableValueSize, 'v');
+    TableBuilder builder(&file, options);
+    for (std::size_t i = 0; i < num_keys; i++) {
+        builder.add(make_table_key(i * 2), value);
+    }
+    int status = builder.finish();
+    file.sync();
+    return (status == error_code::no_error);
+}
+
+//
+// Zipfian point reads of the keys i * 2 (existing), or filter probes of the
+// keys i * 2 + 1 (missing), by the rank i, or by a hash of the rank
+// (scrambled), which spreads the hot keys over all the table instead of
+// its beginning. found is the number of keys found, or of false positives.
+//
+static double table_zipfian_read_impl(const Table * table, std::size_t num_keys, bool existing,
+                                      bool scrambled, std::size_t & found)
+{
+    ZipfianGenerator zipf(num_keys, 0.99, existing ? 1 : 2);
+    std::string value;
+    found = 0;
+
+    stop_watch sw;
+    sw.start();
+    for (std::size_t i = 0; i < kTableReads; i++) {
+        std::size_t n = zipf.next();
+        if (scrambled)
+            n = (std::size_t)((n * 0x9E3779B97F4A7C15ULL) >> 17) % num_keys;
+        if (existing) {
+            if (table->get(make_table_key(n * 2), &value) == error_code::no_error)
+                found++;
+        }
+        else if (table->keyMayMatch(make_table_key(n * 2 + 1))) {
+            found++;
+        }
+    }
+    sw.stop();
+    return sw.getElapsedMillisec();
+}
+
+//
+// The resident memory of the filter versus the latency of the filter
+// probes of missing keys, by zipfian keys, of a table with one filter,
+// always in memory, and of one with a partitioned filter, with block
+// caches of different sizes. The resident memory of the partitioned filter
+// is its partition index and the charge of the cache.
+//
+void test_table_partitioned_filter()
+{
+    printf("test_table_partitioned_filter()\n\n");
+
+    std::size_t num_keys = (std::size_t)(kTableSize / (16 + kTableValueSize + 3));
+    TableOptions options;
+    TableOptions partitioned_options;
+    partitioned_options.filter_partition_size = kFilterPartitionSize;
+    if (!build_table(kTableFilename, num_keys, options)
+        || !build_table(kPartitionedTableFilename, num_keys, partitioned_options)) {
+        printf("build_table() failed.\n\n");
+        return;
+    }
+
+    fs::File file(kTableFilename, fs::FS_MARK_READ | fs::FS_MARK_BINARY);
+    fs::File partitioned_file(kPartitionedTableFilename, fs::FS_MARK_READ | fs::FS_MARK_BINARY);
+    Table * table = nullptr;
+    int status = Table::open(&file, &table);
+    if (status != error_code::no_error) {
+        printf("Table::open() failed, status = %d\n\n", status);
+        return;
+    }
+    std::size_t filter_size = table->filterSize();
+
+    std::size_t found;
+    for (int scrambled = 0; scrambled <= 1; scrambled++) {
+        const char * distribution = scrambled ? "scrambled zipfian" : "zipfian";
+        table_zipfian_read_impl(table, num_keys, false, (scrambled != 0), found);
+        double elapsed = table_zipfian_read_impl(table, num_keys, false, (scrambled != 0), found);
+        printf("%-17s one filter:                     resident = %8zu bytes, "
+               "%7.3f us/probe, false positives = %zu\n",
+               distribution, filter_size, elapsed * 1000.0 / kTableReads, found);
+    }
+    printf("\n");
+    delete table;
+
+    // The cache sizes, in 1/8 of the filter size.
+    static const std::size_t kCacheSizes[] = { 0, 1, 2, 4, 8, 16 };
+    for (int scrambled = 0; scrambled <= 1; scrambled++) {
+        const char * distribution = scrambled ? "scrambled zipfian" : "zipfian";
+        for (std::size_t i = 0; i < sizeof(kCacheSizes) / sizeof(kCacheSizes[0]); i++) {
+            std::size_t cache_size = filter_size * kCacheSizes[i] / 8;
+            std::unique_ptr<BlockCache> cache;
+            if (cache_size != 0)
+                cache.reset(new BlockCache(cache_size, 0));
+            table = nullptr;
+            status = Table::open(&partitioned_file, &table, cache.get());
+            if (status != error_code::no_error) {
+                printf("Table::open() failed, status = %d\n\n", status);
+                break;
+            }
+            table_zipfian_read_impl(table, num_keys, false, (scrambled != 0), found);
+            std::size_t resident = table->filterSize();
+            if (cache) {
+                cache->resetStats();
+                resident += cache->getStats().charge;
+            }
+            double elapsed = table_zipfian_read_impl(table, num_keys, false, (scrambled != 0), found);
+            CacheStats stats;
+            if (cache)
+                stats = cache->getStats();
+            printf("%-17s partitioned, cache = %8zu: resident = %8zu bytes, "
+                   "%7.3f us/probe, false positives = %zu, hits = %llu, misses = %llu\n",
+                   distribution, cache_size, resident, elapsed * 1000.0 / kTableReads, found,
+                   (unsigned long long)stats.hits, (unsigned long long)stats.misses);
+            delete table;
+        }
+        printf("\n");
+    }
+
+    // Every existing key is still found.
+    table = nullptr;
+    status = Table::open(&partitioned_file, &table);
+    if (status == error_code::no_error) {
+        table_zipfian_read_impl(table, num_keys, true, true, found);
+        printf("partitioned, existing keys: found = %zu of %zu, partitioned = %s\n\n",
+               found, kTableReads, table->hasPartitionedFilter() ? "true" : "false");
+        delete table;
+    }
+
+    file.close();
+    partitioned_file.close();
+    fs::File::remove(kTableFilename);
+    fs::File::remove(kPartitionedTableFilename);
+}
@@ -0,0 +1,172 @@
+
+#include "test.h"
+
+#include "TiStore/kv/SkipList.h"
+#include "TiStore/kv/WriteAheadLog.h"
+
+#include "stop_watch.h"
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace TiStore;
+
+static const char * kWalFilename = "tistore_test_wal.log";
+static const std::size_t kWalWrites = 4000;
+static const std::size_t kWalValueSize = 100;
+
+static std::string make_wal_key(std::size_t writer, std::size_t i)
+{
+    char buf[48];
+    snprintf(buf, sizeof(buf), "w%03zu-%08zu", writer, i);
+    return std::string(buf);
+}
+
+// kWalWrites fsync'd writes of one put() each, by "threads" writers.
+static void wal_group_commit_impl(std::size_t threads)
+{
+    WriteAheadLog wal;
+    int status = wal.open(kWalFilename);
+    if (status != error_code::no_error) {
+        printf("WriteAheadLog::open(\"%s\") failed, status = %d\n\n", kWalFilename, status);
+        return;
+    }
+
+    std::size_t writes_per_thread = kWalWrites / threads;
+    std::atomic<std::size_t> failed(0);
+    std::string value(kWalValueSize, 'v');
+    std::vector<std::thread> writers;
+
+    stop_watch sw;
+    sw.start();
+    for (std::size_t t = 0; t < threads; t++) {
+        writers.push_back(std::thread([&, t]() {
+            WriteBatch batch;
+            for (std::size_t i = 0; i < writes_per_thread; i++) {
+                batch.clear();
+                batch.put(make_wal_key(t, i), value);
+                if (wal.write(&batch, true) != error_code::no_error)
+                    failed.fetch_add(1, std::memory_order_relaxed);
+            }
+        }));
+    }
+    for (std::size_t t = 0; t < writers.size(); t++) {
+        writers[t].join();
+    }
+    sw.stop();
+    wal.close();
+
+    double elapsed = sw.getElapsedMillisec();
+    std::size_t writes = writes_per_thread * threads;
+    printf("writers = %2zu, writes = %zu, time spent: %9.3f ms, %9.1f writes/sec, "
+           "syncs = %zu, %5.2f writes/sync, failed = %zu\n",
+           threads, writes, elapsed, (double)writes / (elapsed / 1000.0),
+           wal.syncs(), (double)wal.batches() / (wal.syncs() > 0 ? wal.syncs() : 1),
+           failed.load());
+
+    // Replay the log into a fresh SkipList.
+    typedef SkipList<Key, Value, 16> skiplist_type;
+    skiplist_type skiplist;
+    std::size_t operations = 0, dropped_bytes = 0;
+    sw.start();
+    status = WriteAheadLog::recover(kWalFilename, &skiplist, &operations, &dropped_bytes);
+    sw.stop();
+    std::size_t missing = 0;
+    for (std::size_t t = 0; t < threads; t++) {
+        for (std::size_t i = 0; i < writes_per_thread; i += 97) {
+            std::string key = make_wal_key(t, i);
+            if (!skiplist.find(Key(key)).is_valid())
+                missing++;
+        }
+    }
+    printf("             recover: status = %d, %9.3f ms, operations = %zu, size = %zu, "
+           "dropped bytes = %zu, missing = %zu\n",
+           status, sw.getElapsedMillisec(), operations, skiplist.sizes(), dropped_bytes, missing);
+}
+
+// Corrupt one byte of a log in the middle, the rest must still be replayed.
+static void wal_recover_corruption()
+{
+    static const std::size_t kRecords = 1000;
+    {
+        WriteAheadLog wal;
+        wal.open(kWalFilename);
+        WriteBatch batch;
+        // Some records span more than one log block.
+        std::string big_value(40000, 'b');
+        for (std::size_t i = 0; i < kRecords; i++) {
+            batch.clear();
+            batch.put(make_wal_key(0, i), (i % 100 == 0) ? big_value : std::string(kWalValueSize, 'v'));
+            if (i % 10 == 9)
+                batch.remove(make_wal_key(0, i - 1));
+            wal.write(&batch, false);
+        }
+    }
+
+    std::string contents;
+    {
+        fs::File file(kWalFilename, fs::FS_MARK_READ | fs::FS_MARK_BINARY);
+        char buf[4096];
+        std::ssize_t n;
+        while ((n = file.read(buf, sizeof(buf))) > 0) {
+            contents.append(buf, (std::size_t)n);
+        }
+    }
+    std::size_t pos = contents.size() / 2;
+    contents[pos] = (char)(contents[pos] ^ 0x5A);
+    {
+        fs::File file(kWalFilename, fs::FS_MARK_WRITE | fs::FS_MARK_TRUNC | fs::FS_MARK_BINARY);
+        file.write(contents.data(), contents.size());
+    }
+
+    typedef SkipList<Key, Value, 16> skiplist_type;
+    skiplist_type skiplist;
+    std::size_t operations = 0, dropped_bytes = 0;
+    int status = WriteAheadLog::recover(kWalFilename, &skiplist, &operations, &dropped_bytes);
+    printf("corrupt 1 byte at %zu of %zu: status = %d, operations = %zu of %zu, size = %zu, dropped bytes = %zu\n\n",
+           pos, contents.size(), status, operations, kRecords + kRecords / 10, skiplist.sizes(), dropped_bytes);
+}
+
+// A record with a right checksum, but a batch cut in its second put():
+// nothing of it may be replayed.
+static void wal_recover_malformed_batch()
+{
+    WriteBatch batch;
+    batch.put(make_wal_key(0, 0), std::string(kWalValueSize, 'v'));
+    batch.put(make_wal_key(0, 1), std::string(kWalValueSize, 'v'));
+    Slice contents = batch.contents();
+    std::string record(contents.data(), contents.size() - kWalValueSize / 2);
+    {
+        fs::File file(kWalFilename, fs::FS_MARK_WRITE | fs::FS_MARK_TRUNC | fs::FS_MARK_BINARY);
+        LogWriter log(&file);
+        log.addRecord(Slice(record));
+    }
+
+    typedef SkipList<Key, Value, 16> skiplist_type;
+    skiplist_type skiplist;
+    std::size_t operations = 0, dropped_bytes = 0;
+    int status = WriteAheadLog::recover(kWalFilename, &skiplist, &operations, &dropped_bytes);
+    printf("malformed batch: status = %d, operations = %zu, size = %zu (expected 0), dropped bytes = %zu of %zu\n\n",
+           status, operations, skiplist.sizes(), dropped_bytes, record.size());
+}
+
+void test_wal_group_commit()
+{
+    printf("test_wal_group_commit()\n\n");
+
+    static const std::size_t kWalWriters[] = { 1, 8, 64 };
+    for (std::size_t i = 0; i < sizeof(kWalWriters) / sizeof(kWalWriters[0]); i++) {
+        wal_group_commit_impl(kWalWriters[i]);
+    }
+    printf("\n");
+
+    wal_recover_corruption();
+    wal_recover_malformed_batch();
+
+    fs::File::remove(kWalFilename);
+}